@@ -16,5 +16,20 @@ CONFIG( tests ) {
         lib/lastfm/core/tests/test_libcore.pro \
         lib/lastfm/types/tests/test_libtypes.pro \
         lib/lastfm/scrobble/tests/test_libscrobble.pro \
-        lib/listener/tests/test_liblistener.pro
+        lib/listener/tests/test_liblistener.pro \
+        app/fingerprinter/tests/test_fingerprinter.pro \
+        app/boffin/tests/test_collection_index.pro \
+        app/boffin/tests/test_fenwick_sampler.pro \
+        app/boffin/tests/test_shuffler.pro \
+        app/boffin/tests/test_prefetcher.pro \
+        app/boffin/tests/test_tagcloud_view.pro \
+        app/twiddly/tests/test_itunes_library_xml.pro \
+        app/twiddly/tests/test_playcounts_snapshot.pro
+}
+
+CONFIG( benchmarks ) {
+    SUBDIRS += app/fingerprinter/tests/bench_sources.pro \
+               app/boffin/tests/bench_levenshtein.pro
+
+    mac:SUBDIRS += app/twiddly/tests/bench_playcounts.pro
 }
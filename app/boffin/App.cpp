@@ -24,6 +24,8 @@
 #include <QTimer>
 #include <QShortcut>
 #include <QComboBox>
+#include <QDesktopServices>
+#include <QDir>
 #include <QStatusBar>
 #include <QVBoxLayout>
 #include <phonon/audiooutput.h>
@@ -39,6 +41,7 @@
 #include "ScrobSocket.h"
 #include "TrackSource.h"
 #include "Shuffler.h"
+#include "LocalCollectionIndex.h"
 #include "LocalCollectionScanner.h"
 #include "playdar/PlaydarConnection.h"
 #include "PlaydarTagCloudModel.h"
@@ -49,6 +52,7 @@
 #define OUTPUT_DEVICE_KEY "OutputDevice"
 #define PLAYDAR_AUTHTOKEN_KEY "PlaydarAuth"
 #define PLAYDAR_URLBASE_KEY "PlaydarUrlBase"
+#define PREFETCH_DEPTH_KEY "PrefetchDepth"
 
 App::App( int& argc, char** argv )
    : unicorn::Application( argc, argv )
@@ -66,6 +70,11 @@ App::App( int& argc, char** argv )
 {
     m_wam = new lastfm::NetworkAccessManager( this );
     m_playdar = new PlaydarConnection(m_wam, m_api);
+    const QString data = QDesktopServices::storageLocation(QDesktopServices::DataLocation);
+    QDir().mkpath(data);
+    m_index = new LocalCollectionIndex(QDir(data).filePath("collection.index"));
+    m_index->open();
+    m_playdar->setLocalIndex(m_index);
     connect(m_playdar, SIGNAL(authed(QString)), SLOT(onPlaydarAuth(QString)));
 
     m_shuffler = new Shuffler(this);
@@ -76,6 +85,9 @@ App::App( int& argc, char** argv )
 App::~App()
 {
     cleanup();
+    // waits for the scanner's index writer, which is still using m_index
+    delete m_scanner;
+    delete m_index;
     if (m_audioOutput) QSettings().setValue( OUTPUT_DEVICE_KEY, m_audioOutput->outputDevice().name() );
     delete m_pipe;
 }
@@ -120,6 +132,8 @@ App::init( MainWindow* window ) throw( int /*exitcode*/ )
     connect( actiongroup, SIGNAL(triggered( QAction* )), SLOT(onOutputDeviceActionTriggered( QAction* )) );
 
 	m_pipe = new MediaPipeline( m_audioOutput, this );
+    // how many upcoming tracks are downloaded ahead of time
+    m_pipe->setLookahead( QSettings().value( PREFETCH_DEPTH_KEY, m_pipe->lookahead() ).toInt() );
     connect( m_pipe, SIGNAL(preparing()), SLOT(onPreparing()) );
     connect( m_pipe, SIGNAL(started( Track )), SLOT(onStarted( Track )) );
     connect( m_pipe, SIGNAL(paused()), SLOT(onPaused()) );
@@ -161,6 +175,10 @@ App::init( MainWindow* window ) throw( int /*exitcode*/ )
     connect(m_playdar, SIGNAL(changed(QString)), m_mainwindow->ui.playdarStatus, SLOT(setText(QString)));
     connect(m_playdar, SIGNAL(connected()), SLOT(newTagcloud()));
     m_playdar->start();
+
+    // no need to wait for playdar to see what's on this machine
+    if (m_index->isOpen())
+        newTagcloud();
 }
 
 
@@ -382,14 +400,19 @@ App::onRescan()
     if (QDialog::Accepted == dlg->exec()) {
         QStringList directories = dlg->dirs();
         if (directories.size()) {
+            // only one scan writes the index at a time
+            delete m_scanner;
             LocalCollectionScanner *scanner = new LocalCollectionScanner(this);
+            m_scanner = scanner;
             m_scanWidget = new ScanProgressWidget();
-            connect(scanner, SIGNAL(track(Track)), m_scanWidget, SLOT(onNewTrack(Track)));
+            connect(scanner, SIGNAL(tracks(QList<Track>)), m_scanWidget, SLOT(onNewTracks(QList<Track>)));
             connect(scanner, SIGNAL(directory(QString)), m_scanWidget, SLOT(onNewDirectory(QString)));
             connect(scanner, SIGNAL(finished()), m_scanWidget, SLOT(onFinished()));
             connect(scanner, SIGNAL(finished()), SLOT(newTagcloud()));
             connect(m_scanWidget, SIGNAL(statusMessage(QString)), m_mainwindow->statusBar(), SLOT(showMessage(QString)));
 
+            scanner->setIndex(m_index);
+
             // TODO: fix hard coded paths here!
             scanner->run(
                 QDir("c:\\cygwin\\home\\doug\\src\\playdar\\win32\\debug\\bin\\"), 
@@ -36,6 +36,7 @@ class PlaydarTagCloudModel;
 class Shuffler;
 class TrackSource;
 class ScanProgressWidget;
+class LocalCollectionScanner;
 
 namespace lastfm{ class Track; }
 
@@ -86,6 +87,8 @@ private:
     class TrackSource* m_tracksource;   // tracksource pulls from shuffler
     class Shuffler* m_shuffler;         // shuffler is fed from 
     class PlaydarConnection* m_playdar;
+    class LocalCollectionIndex* m_index;
+    QPointer<LocalCollectionScanner> m_scanner;  // its writer thread uses m_index
     class Playlist* m_playlist;
     class BoffinRqlRequest* m_req;      // current boffin rql request
 
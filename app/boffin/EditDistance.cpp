@@ -0,0 +1,231 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "EditDistance.h"
+
+#include <cstring>
+
+#include <QVarLengthArray>
+#include <QtGlobal>
+
+
+namespace
+{
+    /** For each character, a mask of the positions it occurs at in the
+      * pattern. Patterns are at most 64 characters, so a small open
+      * addressed table on the stack does for any UTF-16 unit. Only as much
+      * of it as the pattern needs is cleared, which matters for short names. */
+    class PatternMasks
+    {
+        enum { MaxSize = 128 }; // a power of two, and twice the longest pattern
+
+        int m_keys[MaxSize];
+        quint64 m_masks[MaxSize];
+        int m_mask;
+
+        int find( ushort c ) const
+        {
+            int i = c & m_mask;
+            while ( m_keys[i] != -1 && m_keys[i] != c )
+                i = ( i + 1 ) & m_mask;
+            return i;
+        }
+
+    public:
+        PatternMasks( const QChar* pattern, int length )
+        {
+            int size = 16;
+            while ( size < 2 * length )
+                size *= 2;
+
+            m_mask = size - 1;
+            memset( m_keys, 0xff, size * sizeof( int ) );
+
+            for ( int i = 0; i < length; ++i )
+            {
+                const ushort c = pattern[i].unicode();
+                const int slot = find( c );
+                if ( m_keys[slot] == -1 )
+                {
+                    m_keys[slot] = c;
+                    m_masks[slot] = 0;
+                }
+                m_masks[slot] |= quint64( 1 ) << i;
+            }
+        }
+
+        quint64 operator[]( ushort c ) const
+        {
+            const int slot = find( c );
+            return m_keys[slot] == -1 ? 0 : m_masks[slot];
+        }
+    };
+
+
+    /** Hyyrö's bit-vector algorithm, with his extension for transpositions.
+      * Column j of the DP matrix is held as vertical deltas in vp and vn
+      * (bit i set if row i + 1 is one more, or one less, than row i) and d0
+      * marks the cells that are equal to their diagonal neighbour.
+      *
+      * Needs 0 < m <= 64 and m <= n. */
+    int
+    bitParallel( const QChar* pattern, int m, const QChar* text, int n, int max )
+    {
+        const PatternMasks peq( pattern, m );
+        const quint64 last = quint64( 1 ) << ( m - 1 );
+
+        quint64 vp = ~quint64( 0 );
+        quint64 vn = 0;
+        quint64 d0 = 0;
+        quint64 pmPrev = 0;
+        int score = m;
+
+        for ( int j = 0; j < n; ++j )
+        {
+            const quint64 pm = peq[text[j].unicode()];
+
+            // pattern[i - 1] == text[j] and pattern[i] == text[j - 1], and
+            // the cell diagonally before the swap wasn't free. Like playdar
+            // we don't look at the first two rows or columns for these
+            quint64 tr = 0;
+            if ( j >= 2 )
+                tr = ( ( ( ~d0 ) & pm ) << 1 ) & pmPrev & ~quint64( 3 );
+
+            d0 = ( ( ( pm & vp ) + vp ) ^ vp ) | pm | vn | tr;
+
+            quint64 hp = vn | ~( d0 | vp );
+            quint64 hn = d0 & vp;
+
+            if ( hp & last )
+                ++score;
+            else if ( hn & last )
+                --score;
+
+            // the bottom row drops by at most one per column left
+            if ( score - ( n - j - 1 ) > max )
+                return max + 1;
+
+            hp = ( hp << 1 ) | 1;
+            hn <<= 1;
+            vp = hn | ~( d0 | hp );
+            vn = hp & d0;
+            pmPrev = pm;
+        }
+
+        return score <= max ? score : max + 1;
+    }
+
+
+    /** The usual DP, keeping three rows (transpositions look two back) and
+      * only working out the cells that could be on a path costing no more
+      * than max. A cell on diagonal k = j - i costs at least |k| to reach
+      * and at least |( m - n ) - k| to get from to the end, so only the
+      * diagonals where those add up to max or less are worked out. Every
+      * other cell is treated as costing max + 1.
+      *
+      * Needs qAbs( n - m ) <= max. */
+    int
+    banded( const QChar* s, int n, const QChar* t, int m, int max )
+    {
+        const int big = max + 1;
+        const int delta = m - n;
+        const int slack = ( max - qAbs( delta ) ) / 2;
+        const int kmin = qMin( 0, delta ) - slack;
+        const int kmax = qMax( 0, delta ) + slack;
+
+        QVarLengthArray<int, 3 * 256> buffer( 3 * ( m + 1 ) );
+        int* rows[3] = { buffer.data(), buffer.data() + m + 1, buffer.data() + 2 * ( m + 1 ) };
+
+        for ( int j = 0; j <= m; ++j )
+            rows[0][j] = j <= kmax ? j : big;
+
+        for ( int i = 1; i <= n; ++i )
+        {
+            int* cur = rows[i % 3];
+            const int* above = rows[( i - 1 ) % 3];
+            const int* above2 = rows[( i + 1 ) % 3]; // i - 2, only read when i > 2
+
+            const int lo = qMax( 1, i + kmin );
+            const int hi = qMin( m, i + kmax );
+
+            // the edges of the band, for this row and the next one to read
+            cur[lo - 1] = lo == 1 && i <= -kmin ? i : big;
+            if ( hi < m )
+                cur[hi + 1] = big;
+
+            const QChar s_i = s[i - 1];
+            bool reachable = cur[lo - 1] + qAbs( delta - ( lo - 1 - i ) ) <= max;
+
+            for ( int j = lo; j <= hi; ++j )
+            {
+                const QChar t_j = t[j - 1];
+
+                int cell = qMin( above[j], cur[j - 1] ) + 1;
+                cell = qMin( cell, above[j - 1] + ( s_i == t_j ? 0 : 1 ) );
+
+                // a transposition that isn't an exact swap is never cheaper
+                // than the substitutions, so only exact swaps are looked at
+                if ( i > 2 && j > 2 && s[i - 2] == t_j && s_i == t[j - 2] )
+                    cell = qMin( cell, above2[j - 2] + 1 );
+
+                cur[j] = qMin( cell, big );
+                if ( cur[j] + qAbs( delta - ( j - i ) ) <= max )
+                    reachable = true;
+            }
+
+            // every path to the end goes through this row, or jumps it with
+            // a transposition that costs no less than the cell it jumps
+            if ( !reachable )
+                return big;
+        }
+
+        return rows[n % 3][m];
+    }
+}
+
+
+int
+boundedLevenshtein( const QString& source, const QString& target, int max )
+{
+    Q_ASSERT( max >= 0 );
+
+    // the distance is symmetric, so use the shorter string as the pattern
+    const bool swap = source.length() > target.length();
+    const QString& a = swap ? target : source;
+    const QString& b = swap ? source : target;
+    const int m = a.length();
+    const int n = b.length();
+
+    if ( n - m > max )
+        return max + 1;
+    if ( m == 0 )
+        return n;
+
+    if ( m <= 64 )
+        return bitParallel( a.unicode(), m, b.unicode(), n, max );
+
+    return banded( b.unicode(), n, a.unicode(), m, max );
+}
+
+
+int
+levenshtein( const QString& source, const QString& target )
+{
+    return boundedLevenshtein( source, target, qMax( source.length(), target.length() ) );
+}
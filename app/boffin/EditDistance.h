@@ -0,0 +1,44 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EDIT_DISTANCE_H
+#define EDIT_DISTANCE_H
+
+#include <QString>
+
+/** Edit distances as playdar's resolver works them out: insertions,
+  * deletions, substitutions and transpositions of adjacent characters all
+  * cost one. Like playdar, a transposition isn't recognised if it involves
+  * either string's first character, so "ab" to "ba" costs two but "xab"
+  * to "xba" costs one.
+  *
+  * Neither function allocates for strings of up to 64 UTF-16 units, which
+  * covers nearly every artist and track name.
+  */
+
+/** The edit distance between source and target if it is no more than max,
+  * otherwise max + 1. Gives up as soon as it's clear the distance will be
+  * over max, so the tighter the bound the quicker it is. max must not be
+  * negative. */
+int boundedLevenshtein( const QString& source, const QString& target, int max );
+
+/** The edit distance between source and target. */
+int levenshtein( const QString& source, const QString& target );
+
+#endif // EDIT_DISTANCE_H
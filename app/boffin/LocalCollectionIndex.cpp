@@ -0,0 +1,1009 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "LocalCollectionIndex.h"
+#include "EditDistance.h"
+
+#include <QDebug>
+#include <QFileInfo>
+#include <QHash>
+#include <QMap>
+#include <QUrl>
+
+
+// The file is the header and then arrays of the records below, all of
+// them made of 32 bit fields in the machine's byte order. Strings are
+// UTF-16 and kept together at the end. Postings are lists of track ids in
+// ascending order, and each track's tags are a list of tag ids, all in one
+// array of quint32.
+
+struct LocalCollectionIndex::Header
+{
+    quint32 magic;
+    quint32 version;
+    quint32 fileSize;
+
+    quint32 trackCount;
+    quint32 tracks;         // byte offsets from the start of the file
+    quint32 termCount;
+    quint32 terms;
+    quint32 tagCount;
+    quint32 tags;
+    quint32 postingCount;
+    quint32 postings;
+    quint32 stringSize;     // in UTF-16 units
+    quint32 strings;
+};
+
+struct LocalCollectionIndex::StringRef
+{
+    quint32 offset;
+    quint32 length;
+};
+
+struct LocalCollectionIndex::TrackRecord
+{
+    StringRef artist;
+    StringRef album;
+    StringRef title;
+    StringRef path;
+    qint32 duration;
+    quint32 tags;           // offset and count in the postings
+    quint32 tagCount;
+};
+
+/** strings are written once however many records share them */
+struct LocalCollectionIndex::StringPool
+{
+    QString strings;
+    QHash<QString, StringRef> refs;
+
+    StringRef operator()( const QString& s )
+    {
+        QHash<QString, StringRef>::const_iterator it = refs.constFind( s );
+        if ( it != refs.constEnd() )
+            return *it;
+
+        StringRef ref;
+        ref.offset = strings.length();
+        ref.length = s.length();
+        strings += s;
+        refs.insert( s, ref );
+        return ref;
+    }
+};
+
+/** sorted by field and then term */
+struct LocalCollectionIndex::TermRecord
+{
+    StringRef term;
+    quint32 field;
+    quint32 postings;
+    quint32 count;
+};
+
+/** sorted by name, the id of a tag is its position */
+struct LocalCollectionIndex::TagRecord
+{
+    StringRef name;
+    quint32 postings;
+    quint32 count;
+    quint32 seconds;        // the total duration of the tracks with this tag
+};
+
+
+namespace
+{
+    const quint32 k_magic = 0x58494342; // "BCIX", reads differently on the other endian
+    const quint32 k_version = 1;
+
+    // track resolution gives up on candidates this different
+    const float k_minResolveScore = 0.5f;
+    const int k_maxResolveResults = 10;
+
+    typedef LocalCollectionIndex::Hit Hit;
+    typedef LocalCollectionIndex::Hits Hits;
+
+    Hit
+    hit( quint32 id, float weight )
+    {
+        Hit h;
+        h.id = id;
+        h.weight = weight;
+        return h;
+    }
+
+    /** the tracks in both, their weights added up */
+    Hits
+    intersect( const Hits& a, const Hits& b )
+    {
+        Hits result;
+        int i = 0, j = 0;
+        while ( i < a.size() && j < b.size() )
+        {
+            if ( a[i].id < b[j].id )
+                ++i;
+            else if ( b[j].id < a[i].id )
+                ++j;
+            else
+            {
+                result << hit( a[i].id, a[i].weight + b[j].weight );
+                ++i, ++j;
+            }
+        }
+        return result;
+    }
+
+    /** the tracks in either, tracks in both get their weights added up */
+    Hits
+    unite( const Hits& a, const Hits& b )
+    {
+        Hits result;
+        result.reserve( qMax( a.size(), b.size() ) );
+        int i = 0, j = 0;
+        while ( i < a.size() || j < b.size() )
+        {
+            if ( j == b.size() || ( i < a.size() && a[i].id < b[j].id ) )
+                result << a[i++];
+            else if ( i == a.size() || b[j].id < a[i].id )
+                result << b[j++];
+            else
+            {
+                result << hit( a[i].id, a[i].weight + b[j].weight );
+                ++i, ++j;
+            }
+        }
+        return result;
+    }
+
+    /** the tracks in all that aren't in a */
+    Hits
+    subtract( const Hits& all, const Hits& a )
+    {
+        Hits result;
+        int j = 0;
+        foreach ( const Hit& h, all )
+        {
+            while ( j < a.size() && a[j].id < h.id )
+                ++j;
+            if ( j == a.size() || a[j].id != h.id )
+                result << h;
+        }
+        return result;
+    }
+
+    QString
+    normalisedTag( const QString& tag )
+    {
+        return tag.simplified().toLower();
+    }
+
+    struct TagCounts
+    {
+        TagCounts() : count( 0 ), weight( 0 ), seconds( 0 ) {}
+
+        int count;
+        float weight;
+        int seconds;
+    };
+
+    bool
+    writeAll( QFile& file, const void* data, qint64 size )
+    {
+        return file.write( static_cast<const char*>( data ), size ) == size;
+    }
+
+    bool
+    isBelow( const QString& path, const QString& dir )
+    {
+        if ( path == dir )
+            return true;
+        return path.startsWith( dir.endsWith( '/' ) ? dir : dir + '/' );
+    }
+}
+
+
+/** Parses and evaluates a boffin rql query in one go:
+  *
+  *     query := and ( "or" and )*
+  *     and   := not ( "and"? not )*
+  *     not   := "not" not | atom
+  *     atom  := "(" query ")" | field ":" value | value
+  *     field := "tag" | "artist" | "album" | "track" | "title"
+  *
+  * where a value is a word or a quoted string. */
+class LocalCollectionIndex::Query
+{
+    enum Type { Word, Quoted, Colon, Open, Close, End };
+
+    struct Token
+    {
+        Type type;
+        QString text;
+    };
+
+    const LocalCollectionIndex& m_index;
+    QList<Token> m_tokens;
+    int m_pos;
+    bool m_ok;
+
+    void add( Type type, const QString& text = QString() )
+    {
+        Token t;
+        t.type = type;
+        t.text = text;
+        m_tokens << t;
+    }
+
+    void tokenise( const QString& rql )
+    {
+        int i = 0;
+        while ( i < rql.length() )
+        {
+            const QChar c = rql[i];
+            if ( c.isSpace() )
+                ++i;
+            else if ( c == '(' )
+                add( Open ), ++i;
+            else if ( c == ')' )
+                add( Close ), ++i;
+            else if ( c == ':' )
+                add( Colon ), ++i;
+            else if ( c == '"' )
+            {
+                const int end = rql.indexOf( '"', i + 1 );
+                if ( end == -1 )
+                {
+                    m_ok = false;
+                    return;
+                }
+                add( Quoted, rql.mid( i + 1, end - i - 1 ) );
+                i = end + 1;
+            }
+            else
+            {
+                const int start = i;
+                while ( i < rql.length() && !rql[i].isSpace() && rql[i] != '(' && rql[i] != ')' && rql[i] != ':' && rql[i] != '"' )
+                    ++i;
+                add( Word, rql.mid( start, i - start ) );
+            }
+        }
+        add( End );
+    }
+
+    const Token& peek() const { return m_tokens[m_pos]; }
+
+    bool isKeyword( const char* keyword ) const
+    {
+        return peek().type == Word && peek().text.compare( keyword, Qt::CaseInsensitive ) == 0;
+    }
+
+    Hits fail()
+    {
+        m_ok = false;
+        return Hits();
+    }
+
+    Hits query()
+    {
+        Hits hits = conjunction();
+        while ( m_ok && isKeyword( "or" ) )
+        {
+            ++m_pos;
+            hits = unite( hits, conjunction() );
+        }
+        return hits;
+    }
+
+    Hits conjunction()
+    {
+        Hits hits = negation();
+        while ( m_ok )
+        {
+            if ( isKeyword( "and" ) )
+                ++m_pos;
+            else if ( isKeyword( "or" ) || peek().type == Close || peek().type == End )
+                break;
+            hits = intersect( hits, negation() );
+        }
+        return hits;
+    }
+
+    Hits negation()
+    {
+        if ( !isKeyword( "not" ) )
+            return atom();
+        ++m_pos;
+        return subtract( m_index.allHits(), negation() );
+    }
+
+    Hits atom()
+    {
+        const Token t = peek();
+        if ( t.type == Open )
+        {
+            ++m_pos;
+            Hits hits = query();
+            if ( peek().type != Close )
+                return fail();
+            ++m_pos;
+            return hits;
+        }
+
+        if ( t.type != Word && t.type != Quoted )
+            return fail();
+        ++m_pos;
+
+        if ( t.type == Quoted || peek().type != Colon )
+            return m_index.tagHits( t.text );
+
+        ++m_pos;
+        const Token value = peek();
+        if ( value.type != Word && value.type != Quoted )
+            return fail();
+        ++m_pos;
+
+        const QString field = t.text.toLower();
+        if ( field == "tag" )
+            return m_index.tagHits( value.text );
+        if ( field == "artist" )
+            return m_index.termHits( Artist, value.text );
+        if ( field == "album" )
+            return m_index.termHits( Album, value.text );
+        if ( field == "track" || field == "title" )
+            return m_index.termHits( Title, value.text );
+        return fail();
+    }
+
+public:
+    Query( const LocalCollectionIndex& index, const QString& rql )
+        : m_index( index )
+        , m_pos( 0 )
+        , m_ok( true )
+    {
+        tokenise( rql );
+    }
+
+    Hits evaluate( bool* ok )
+    {
+        Hits hits;
+        if ( m_ok )
+            hits = query();
+        if ( m_ok && peek().type != End )
+            m_ok = false;
+
+        *ok = m_ok;
+        return m_ok ? hits : Hits();
+    }
+};
+
+
+LocalCollectionIndex::LocalCollectionIndex( const QString& path )
+    : m_path( path )
+    , m_data( 0 )
+    , m_header( 0 )
+{
+}
+
+
+LocalCollectionIndex::~LocalCollectionIndex()
+{
+    close();
+}
+
+
+bool
+LocalCollectionIndex::open()
+{
+    close();
+
+    m_file.setFileName( m_path );
+    if ( !m_file.open( QIODevice::ReadOnly ) )
+        return false;
+
+    const qint64 size = m_file.size();
+    if ( size < qint64( sizeof( Header ) ) || size > 0x7fffffff )
+    {
+        m_file.close();
+        return false;
+    }
+
+    const uchar* data = m_file.map( 0, size );
+    if ( !data )
+    {
+        m_file.close();
+        return false;
+    }
+
+    const Header* h = reinterpret_cast<const Header*>( data );
+
+    // everything has to fit in the file, the records are only checked as
+    // they're read
+    struct Region { quint32 offset; quint64 bytes; quint32 align; };
+    const Region regions[] =
+    {
+        { h->tracks, quint64( h->trackCount ) * sizeof( TrackRecord ), 4 },
+        { h->terms, quint64( h->termCount ) * sizeof( TermRecord ), 4 },
+        { h->tags, quint64( h->tagCount ) * sizeof( TagRecord ), 4 },
+        { h->postings, quint64( h->postingCount ) * sizeof( quint32 ), 4 },
+        { h->strings, quint64( h->stringSize ) * sizeof( ushort ), 2 }
+    };
+
+    bool ok = h->magic == k_magic && h->version == k_version && h->fileSize == quint64( size );
+    for ( size_t i = 0; ok && i < sizeof( regions ) / sizeof( regions[0] ); ++i )
+        ok = regions[i].offset % regions[i].align == 0 && regions[i].offset + regions[i].bytes <= quint64( size );
+
+    if ( !ok )
+    {
+        qWarning() << "Ignoring the local collection index" << m_path;
+        m_file.unmap( const_cast<uchar*>( data ) );
+        m_file.close();
+        return false;
+    }
+
+    m_data = data;
+    m_header = h;
+    return true;
+}
+
+
+void
+LocalCollectionIndex::close()
+{
+    if ( m_data )
+        m_file.unmap( const_cast<uchar*>( m_data ) );
+    m_file.close();
+    m_data = 0;
+    m_header = 0;
+}
+
+
+int
+LocalCollectionIndex::trackCount() const
+{
+    return m_header ? int( m_header->trackCount ) : 0;
+}
+
+
+const LocalCollectionIndex::TrackRecord*
+LocalCollectionIndex::trackRecord( int id ) const
+{
+    if ( id < 0 || id >= trackCount() )
+        return 0;
+    return reinterpret_cast<const TrackRecord*>( m_data + m_header->tracks ) + id;
+}
+
+
+QString
+LocalCollectionIndex::string( const StringRef& ref ) const
+{
+    if ( quint64( ref.offset ) + ref.length > m_header->stringSize )
+        return QString();
+    const QChar* strings = reinterpret_cast<const QChar*>( m_data + m_header->strings );
+    return QString( strings + ref.offset, ref.length );
+}
+
+
+const quint32*
+LocalCollectionIndex::postings( quint32 offset, quint32 count ) const
+{
+    if ( quint64( offset ) + count > m_header->postingCount )
+        return 0;
+    return reinterpret_cast<const quint32*>( m_data + m_header->postings ) + offset;
+}
+
+
+LocalCollectionIndex::Entry
+LocalCollectionIndex::track( int id ) const
+{
+    Entry e;
+    const TrackRecord* r = trackRecord( id );
+    if ( !r )
+        return e;
+
+    e.artist = string( r->artist );
+    e.album = string( r->album );
+    e.title = string( r->title );
+    e.path = string( r->path );
+    e.duration = r->duration;
+
+    const TagRecord* tags = reinterpret_cast<const TagRecord*>( m_data + m_header->tags );
+    if ( const quint32* ids = postings( r->tags, r->tagCount ) )
+        for ( quint32 i = 0; i < r->tagCount; ++i )
+            if ( ids[i] < m_header->tagCount )
+                e.tags << string( tags[ids[i]].name );
+
+    return e;
+}
+
+
+//static
+QStringList
+LocalCollectionIndex::terms( const QString& s )
+{
+    QStringList words;
+    QString word;
+
+    const QString lower = s.toLower();
+    for ( int i = 0; i < lower.length(); ++i )
+    {
+        const QChar c = lower[i];
+        if ( c.isLetterOrNumber() || c.isMark() )
+            word += c;
+        else if ( !word.isEmpty() )
+        {
+            words << word;
+            word.clear();
+        }
+    }
+    if ( !word.isEmpty() )
+        words << word;
+
+    return words;
+}
+
+
+const LocalCollectionIndex::TermRecord*
+LocalCollectionIndex::findTerm( Field field, const QString& term ) const
+{
+    if ( !m_header )
+        return 0;
+
+    const TermRecord* terms = reinterpret_cast<const TermRecord*>( m_data + m_header->terms );
+    const QChar* strings = reinterpret_cast<const QChar*>( m_data + m_header->strings );
+
+    int lo = 0;
+    int hi = m_header->termCount;
+    while ( lo < hi )
+    {
+        const int mid = ( lo + hi ) / 2;
+        const TermRecord& r = terms[mid];
+
+        int cmp = int( r.field ) - int( field );
+        if ( cmp == 0 )
+        {
+            if ( quint64( r.term.offset ) + r.term.length > m_header->stringSize )
+                return 0;
+            cmp = QString::fromRawData( strings + r.term.offset, r.term.length ).compare( term );
+        }
+
+        if ( cmp == 0 )
+            return &r;
+        if ( cmp < 0 )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return 0;
+}
+
+
+const LocalCollectionIndex::TagRecord*
+LocalCollectionIndex::findTag( const QString& tag ) const
+{
+    if ( !m_header )
+        return 0;
+
+    const TagRecord* tags = reinterpret_cast<const TagRecord*>( m_data + m_header->tags );
+    const QChar* strings = reinterpret_cast<const QChar*>( m_data + m_header->strings );
+
+    int lo = 0;
+    int hi = m_header->tagCount;
+    while ( lo < hi )
+    {
+        const int mid = ( lo + hi ) / 2;
+        const TagRecord& r = tags[mid];
+        if ( quint64( r.name.offset ) + r.name.length > m_header->stringSize )
+            return 0;
+
+        const int cmp = QString::fromRawData( strings + r.name.offset, r.name.length ).compare( tag );
+        if ( cmp == 0 )
+            return &r;
+        if ( cmp < 0 )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return 0;
+}
+
+
+LocalCollectionIndex::Hits
+LocalCollectionIndex::termHits( Field field, const QString& value ) const
+{
+    const QStringList words = terms( value );
+    if ( words.isEmpty() )
+        return Hits();
+
+    Hits result;
+    for ( int w = 0; w < words.size(); ++w )
+    {
+        const TermRecord* r = findTerm( field, words[w] );
+        const quint32* ids = r ? postings( r->postings, r->count ) : 0;
+        if ( !ids )
+            return Hits();
+
+        Hits hits;
+        hits.reserve( r->count );
+        for ( quint32 i = 0; i < r->count; ++i )
+            hits << hit( ids[i], 1 );
+
+        result = w == 0 ? hits : intersect( result, hits );
+    }
+
+    // every word has to be there, but it's one match
+    for ( int i = 0; i < result.size(); ++i )
+        result[i].weight = 1;
+    return result;
+}
+
+
+LocalCollectionIndex::Hits
+LocalCollectionIndex::tagHits( const QString& tag ) const
+{
+    Hits hits;
+    const TagRecord* r = findTag( normalisedTag( tag ) );
+    const quint32* ids = r ? postings( r->postings, r->count ) : 0;
+    if ( !ids )
+        return hits;
+
+    hits.reserve( r->count );
+    for ( quint32 i = 0; i < r->count; ++i )
+        hits << hit( ids[i], 1 );
+    return hits;
+}
+
+
+LocalCollectionIndex::Hits
+LocalCollectionIndex::allHits() const
+{
+    Hits hits;
+    hits.reserve( trackCount() );
+    for ( int i = 0; i < trackCount(); ++i )
+        hits << hit( i, 1 );
+    return hits;
+}
+
+
+LocalCollectionIndex::Hits
+LocalCollectionIndex::evaluate( const QString& rql, bool* ok ) const
+{
+    if ( rql.trimmed().isEmpty() )
+    {
+        *ok = true;
+        return allHits();
+    }
+
+    Hits hits = Query( *this, rql ).evaluate( ok );
+    if ( !*ok )
+        qWarning() << "Couldn't parse rql" << rql;
+    return hits;
+}
+
+
+BoffinPlayableItem
+LocalCollectionIndex::item( quint32 id, float weight, float score, const QString& source ) const
+{
+    const TrackRecord* r = trackRecord( id );
+    if ( !r )
+        return BoffinPlayableItem();
+
+    const QUrl url = QUrl::fromLocalFile( string( r->path ) );
+    return BoffinPlayableItem::fromLocalTrack( string( r->artist ),
+                                               string( r->album ),
+                                               string( r->title ),
+                                               QString::fromLatin1( url.toEncoded() ),
+                                               r->duration,
+                                               source,
+                                               weight,
+                                               score );
+}
+
+
+QList<BoffinPlayableItem>
+LocalCollectionIndex::rql( const QString& rql, const QString& source ) const
+{
+    QList<BoffinPlayableItem> items;
+    if ( !isOpen() )
+        return items;
+
+    bool ok;
+    foreach ( const Hit& h, evaluate( rql, &ok ) )
+        items << item( h.id, h.weight, 0, source );
+    return items;
+}
+
+
+QList<BoffinTagItem>
+LocalCollectionIndex::tagcloud( const QString& rql, const QString& source ) const
+{
+    QList<BoffinTagItem> items;
+    if ( !isOpen() )
+        return items;
+
+    const TagRecord* tags = reinterpret_cast<const TagRecord*>( m_data + m_header->tags );
+
+    // the whole collection's cloud is worked out when the index is built
+    if ( rql.trimmed().isEmpty() )
+    {
+        for ( quint32 i = 0; i < m_header->tagCount; ++i )
+            items << BoffinTagItem( string( tags[i].name ), source, tags[i].count, tags[i].count, tags[i].seconds );
+        return items;
+    }
+
+    QHash<quint32, TagCounts> counts;
+
+    bool ok;
+    foreach ( const Hit& h, evaluate( rql, &ok ) )
+    {
+        const TrackRecord* r = trackRecord( h.id );
+        const quint32* ids = r ? postings( r->tags, r->tagCount ) : 0;
+        if ( !ids )
+            continue;
+
+        for ( quint32 i = 0; i < r->tagCount; ++i )
+        {
+            QHash<quint32, TagCounts>::iterator it = counts.find( ids[i] );
+            if ( it == counts.end() )
+                it = counts.insert( ids[i], TagCounts() );
+            it->count++;
+            it->weight += h.weight;
+            it->seconds += qMax( 0, r->duration );
+        }
+    }
+
+    for ( QHash<quint32, TagCounts>::const_iterator it = counts.constBegin(); it != counts.constEnd(); ++it )
+        if ( it.key() < m_header->tagCount )
+            items << BoffinTagItem( string( tags[it.key()].name ), source, it->count, it->weight, it->seconds );
+
+    return items;
+}
+
+
+static bool
+scoreGreaterThan( const QPair<float, quint32>& a, const QPair<float, quint32>& b )
+{
+    return a.first > b.first;
+}
+
+
+QList<BoffinPlayableItem>
+LocalCollectionIndex::resolve( const QString& artist, const QString& album, const QString& track, const QString& source ) const
+{
+    QList<BoffinPlayableItem> items;
+    if ( !isOpen() )
+        return items;
+
+    // every word of the artist and title has to be there, how close the
+    // rest of the names are decides the score
+    const Hits candidates = intersect( termHits( Artist, artist ), termHits( Title, track ) );
+    if ( candidates.isEmpty() )
+        return items;
+
+    const QString artistKey = artist.simplified().toLower();
+    const QString trackKey = track.simplified().toLower();
+    const QString albumKey = album.simplified().toLower();
+
+    QList< QPair<float, quint32> > scored;
+    foreach ( const Hit& h, candidates )
+    {
+        const TrackRecord* r = trackRecord( h.id );
+        if ( !r )
+            continue;
+
+        const QString a = string( r->artist ).simplified().toLower();
+        const QString t = string( r->title ).simplified().toLower();
+        const int length = qMax( artistKey.length(), a.length() ) + qMax( trackKey.length(), t.length() );
+        float score = 1 - float( levenshtein( artistKey, a ) + levenshtein( trackKey, t ) ) / qMax( 1, length );
+
+        if ( albumKey.size() && string( r->album ).simplified().toLower() != albumKey )
+            score *= 0.95f;
+
+        if ( score >= k_minResolveScore )
+            scored << qMakePair( score, h.id );
+    }
+
+    qStableSort( scored.begin(), scored.end(), scoreGreaterThan );
+
+    for ( int i = 0; i < scored.size() && i < k_maxResolveResults; ++i )
+        items << item( scored[i].second, 1, scored[i].first, source );
+    return items;
+}
+
+
+bool
+LocalCollectionIndex::update( const QList<Entry>& found, const QStringList& roots, const QSet<QString>& unchanged )
+{
+    return write( found, roots, unchanged ) && replace();
+}
+
+
+bool
+LocalCollectionIndex::write( const QList<Entry>& found, const QStringList& roots, const QSet<QString>& unchanged ) const
+{
+    QList<Entry> entries;
+
+    for ( int id = 0; id < trackCount(); ++id )
+    {
+        const Entry e = track( id );
+        const QString dir = QFileInfo( e.path ).absolutePath();
+
+        bool scanned = false;
+        foreach ( const QString& root, roots )
+            scanned = scanned || isBelow( dir, root );
+
+        if ( !scanned || unchanged.contains( dir ) )
+            entries << e;
+    }
+    entries += found;
+
+    StringPool pool;
+
+    // keyed by the field's number and then the term, to sort as findTerm
+    // expects
+    QMap<QString, QVector<quint32> > termPostings;
+    QMap<QString, QVector<quint32> > tagPostings;
+    QList<QStringList> trackTags;
+
+    for ( int id = 0; id < entries.size(); ++id )
+    {
+        const Entry& e = entries[id];
+        const QString fields[] = { e.artist, e.album, e.title };
+
+        for ( int f = Artist; f <= Title; ++f )
+        {
+            const QChar prefix( ushort( f ) );
+            foreach ( const QString& term, terms( fields[f] ).toSet() )
+                termPostings[prefix + term] << id;
+        }
+
+        QStringList tags;
+        foreach ( const QString& tag, e.tags )
+        {
+            const QString name = normalisedTag( tag );
+            if ( name.size() && !tags.contains( name ) )
+                tags << name;
+        }
+        foreach ( const QString& tag, tags )
+            tagPostings[tag] << id;
+        trackTags << tags;
+    }
+
+    QVector<quint32> postings;
+    QVector<TermRecord> termRecords;
+    QVector<TagRecord> tagRecords;
+    QHash<QString, quint32> tagIds;
+
+    for ( QMap<QString, QVector<quint32> >::const_iterator it = termPostings.constBegin(); it != termPostings.constEnd(); ++it )
+    {
+        TermRecord r;
+        r.term = pool( it.key().mid( 1 ) );
+        r.field = it.key()[0].unicode();
+        r.postings = postings.size();
+        r.count = it->size();
+        termRecords << r;
+        postings += *it;
+    }
+
+    for ( QMap<QString, QVector<quint32> >::const_iterator it = tagPostings.constBegin(); it != tagPostings.constEnd(); ++it )
+    {
+        TagRecord r;
+        r.name = pool( it.key() );
+        r.postings = postings.size();
+        r.count = it->size();
+        r.seconds = 0;
+        foreach ( quint32 id, *it )
+            r.seconds += qMax( 0, entries[id].duration );
+
+        tagIds.insert( it.key(), tagRecords.size() );
+        tagRecords << r;
+        postings += *it;
+    }
+
+    QVector<TrackRecord> trackRecords;
+    trackRecords.reserve( entries.size() );
+    for ( int id = 0; id < entries.size(); ++id )
+    {
+        const Entry& e = entries[id];
+        TrackRecord r;
+        r.artist = pool( e.artist );
+        r.album = pool( e.album );
+        r.title = pool( e.title );
+        r.path = pool( e.path );
+        r.duration = e.duration;
+        r.tags = postings.size();
+        r.tagCount = trackTags[id].size();
+        foreach ( const QString& tag, trackTags[id] )
+            postings << tagIds.value( tag );
+        trackRecords << r;
+    }
+
+    Header h;
+    h.magic = k_magic;
+    h.version = k_version;
+    h.trackCount = trackRecords.size();
+    h.tracks = sizeof( Header );
+    h.termCount = termRecords.size();
+    h.terms = h.tracks + h.trackCount * sizeof( TrackRecord );
+    h.tagCount = tagRecords.size();
+    h.tags = h.terms + h.termCount * sizeof( TermRecord );
+    h.postingCount = postings.size();
+    h.postings = h.tags + h.tagCount * sizeof( TagRecord );
+    h.stringSize = pool.strings.size();
+    h.strings = h.postings + h.postingCount * sizeof( quint32 );
+    h.fileSize = h.strings + h.stringSize * sizeof( ushort );
+
+    // written beside the old one, so that one is still there if we fail
+    QFile file( m_path + ".new" );
+    if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+    {
+        qWarning() << "Couldn't write the local collection index" << file.fileName();
+        return false;
+    }
+
+    bool ok = writeAll( file, &h, sizeof( h ) )
+           && writeAll( file, trackRecords.constData(), trackRecords.size() * sizeof( TrackRecord ) )
+           && writeAll( file, termRecords.constData(), termRecords.size() * sizeof( TermRecord ) )
+           && writeAll( file, tagRecords.constData(), tagRecords.size() * sizeof( TagRecord ) )
+           && writeAll( file, postings.constData(), postings.size() * sizeof( quint32 ) )
+           && writeAll( file, pool.strings.constData(), pool.strings.size() * sizeof( ushort ) );
+    file.close();
+
+    if ( !ok )
+    {
+        qWarning() << "Couldn't write the local collection index" << file.fileName();
+        file.remove();
+        return false;
+    }
+
+    return true;
+}
+
+
+bool
+LocalCollectionIndex::replace()
+{
+    QFile file( m_path + ".new" );
+    if ( !file.exists() )
+        return false;
+
+    // a mapped file can't be replaced on Windows, and rename() won't
+    // overwrite one. The old index is kept until the new one is in place,
+    // so if that fails we go on with what we had
+    close();
+    const QString old = m_path + ".old";
+    QFile::remove( old );
+    if ( QFile::exists( m_path ) && !QFile::rename( m_path, old ) )
+    {
+        qWarning() << "Couldn't replace the local collection index" << m_path;
+        open();
+        return false;
+    }
+
+    if ( !file.rename( m_path ) )
+    {
+        qWarning() << "Couldn't replace the local collection index" << m_path;
+        QFile::rename( old, m_path );
+        open();
+        return false;
+    }
+
+    QFile::remove( old );
+    return open();
+}
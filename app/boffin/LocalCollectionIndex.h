@@ -0,0 +1,140 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOCAL_COLLECTION_INDEX_H
+#define LOCAL_COLLECTION_INDEX_H
+
+#include <QFile>
+#include <QList>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "playdar/BoffinPlayableItem.h"
+#include "playdar/BoffinTagRequest.h"
+
+/** An inverted index of the tracks the LocalCollectionScanner found, so
+  * rql queries, tag clouds and track resolution for this machine can be
+  * answered without asking Playdar.
+  *
+  * The index is a single file that is memory mapped, nothing is read
+  * into memory when it's opened. It holds the tracks, a sorted dictionary
+  * of the words in their artist, album and title with a list of the
+  * tracks each one is in, and the same for tags. The tags are the ones
+  * in the files themselves (their genres), Last.fm's tags for a track are
+  * only known to Playdar.
+  *
+  * The scanner rebuilds the file after a scan that found changes, with
+  * write() on a thread of its own and then replace(). */
+class LocalCollectionIndex
+{
+public:
+    /** a track as the scanner found it */
+    struct Entry
+    {
+        Entry() : duration( 0 ) {}
+
+        QString artist;
+        QString album;
+        QString title;
+        QString path;
+        int duration;       // in seconds
+        QStringList tags;
+    };
+
+    LocalCollectionIndex( const QString& path );
+    ~LocalCollectionIndex();
+
+    /** maps the index file, false if there isn't one we can use */
+    bool open();
+    void close();
+    bool isOpen() const { return m_data != 0; }
+
+    /** Replaces the tracks below roots with found, except for those in the
+      * unchanged directories, which were left out of found because they
+      * weren't read again. Tracks outside roots are kept as they are. The
+      * new index is written beside the old one and then takes its place. */
+    bool update( const QList<Entry>& found, const QStringList& roots, const QSet<QString>& unchanged );
+
+    /** The first half of update(), which only reads this index, so it can
+      * be run on another thread while this one is still being queried. */
+    bool write( const QList<Entry>& found, const QStringList& roots, const QSet<QString>& unchanged ) const;
+
+    /** The second half, the file write() made takes the old one's place.
+      * If it can't, the old one is kept and false is returned. */
+    bool replace();
+
+    int trackCount() const;
+    Entry track( int id ) const;
+
+    /** The tracks matching a boffin rql query like
+      * tag:"rock" and not ( tag:"pop" or artist:"abba" ), the empty query
+      * matches everything. Terms without a field are tags. */
+    QList<BoffinPlayableItem> rql( const QString& rql, const QString& source ) const;
+
+    /** the tags of the tracks matching rql */
+    QList<BoffinTagItem> tagcloud( const QString& rql, const QString& source ) const;
+
+    /** the tracks that could be this one, best first */
+    QList<BoffinPlayableItem> resolve( const QString& artist, const QString& album, const QString& track, const QString& source ) const;
+
+    enum Field { Artist, Album, Title };
+
+    /** the lowercased words of s, as they are indexed */
+    static QStringList terms( const QString& s );
+
+    struct Hit
+    {
+        quint32 id;
+        float weight;
+    };
+    typedef QVector<Hit> Hits;
+
+private:
+    struct Header;
+    struct StringRef;
+    struct StringPool;
+    struct TrackRecord;
+    struct TermRecord;
+    struct TagRecord;
+    class Query;
+
+    QString string( const StringRef& ) const;
+    const TrackRecord* trackRecord( int id ) const;
+    const quint32* postings( quint32 offset, quint32 count ) const;
+
+    const TermRecord* findTerm( Field, const QString& term ) const;
+    const TagRecord* findTag( const QString& tag ) const;
+
+    Hits termHits( Field, const QString& value ) const;
+    Hits tagHits( const QString& tag ) const;
+    Hits allHits() const;
+    Hits evaluate( const QString& rql, bool* ok ) const;
+
+    BoffinPlayableItem item( quint32 id, float weight, float score, const QString& source ) const;
+
+    QString m_path;
+    QFile m_file;
+
+    const uchar* m_data;
+    const Header* m_header;
+};
+
+#endif // LOCAL_COLLECTION_INDEX_H
@@ -19,20 +19,439 @@
 
 #include "LocalCollectionScanner.h"
 
+#include <QDataStream>
+#include <QDateTime>
+#include <QRegExp>
 #include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QQueue>
+#include <QSet>
+#include <QThread>
+#include <QTimer>
+#include <QUrl>
+#include <QWaitCondition>
+
+#include <audioproperties.h>
+#include <fileref.h>
+#include <tag.h>
+#include <tstring.h>
+
+
+namespace
+{
+    // tracks are passed on this often rather than one at a time
+    const int k_batchInterval = 100; // ms
+
+    // past this many changed directories we give playdar the roots instead,
+    // command lines only go so far
+    const int k_maxChangedDirectories = 256;
+
+    const quint32 k_mtimesMagic = 0x4c434453; // "LCDS"
+    const qint32 k_mtimesVersion = 1;
+
+    const char* const k_audioExtensions[] = { "mp3", "m4a", "mp4", "aac", "ogg", "oga", "flac", "wma" };
+
+    bool isAudioFile(const QFileInfo& info)
+    {
+        const QString suffix = info.suffix().toLower();
+        for (size_t i = 0; i < sizeof(k_audioExtensions) / sizeof(k_audioExtensions[0]); ++i)
+            if (suffix == k_audioExtensions[i])
+                return true;
+        return false;
+    }
+
+    bool isBelow(const QString& path, const QString& dir)
+    {
+        if (path == dir)
+            return true;
+        return path.startsWith(dir.endsWith('/') ? dir : dir + '/');
+    }
+}
+
+
+/** The directories still to visit, shared by the workers, and what they
+  * have found so far. */
+class CollectionWalk
+{
+public:
+    typedef LocalCollectionIndex::Entry ScannedTrack;
+
+    CollectionWalk(const QStringList& roots, const QHash<QString, uint>& mtimes)
+        : m_known(mtimes)
+        , m_busy(0)
+        , m_cancelled(false)
+    {
+        foreach (const QString& root, roots)
+            m_pending.enqueue(root);
+    }
+
+    /** blocks until there is a directory to visit, returns false once
+      * there are none left and nobody is visiting one that might have more */
+    bool take(QString& dir)
+    {
+        QMutexLocker locker(&m_mutex);
+        while (m_pending.isEmpty() && m_busy > 0 && !m_cancelled)
+            m_wake.wait(&m_mutex);
+
+        if (m_cancelled || m_pending.isEmpty())
+            return false;
+
+        dir = m_pending.dequeue();
+        ++m_busy;
+        return true;
+    }
+
+    /** a directory from take() has been visited */
+    void done(const QString& dir, uint mtime, bool changed, const QStringList& subdirs, const QList<ScannedTrack>& tracks)
+    {
+        QMutexLocker locker(&m_mutex);
+        --m_busy;
+        m_mtimes[dir] = mtime;
+        if (changed)
+            m_changed << dir;
+        m_tracks += tracks;
+        foreach (const QString& subdir, subdirs)
+            m_pending.enqueue(subdir);
+        m_wake.wakeAll();
+    }
+
+    void cancel()
+    {
+        QMutexLocker locker(&m_mutex);
+        m_cancelled = true;
+        m_wake.wakeAll();
+    }
+
+    // m_known isn't written once we start, so this doesn't need the lock
+    bool isChanged(const QString& dir, uint mtime) const
+    {
+        QHash<QString, uint>::const_iterator it = m_known.constFind(dir);
+        return it == m_known.constEnd() || *it != mtime;
+    }
+
+    /** hands over what has been found since the last call */
+    void takeResults(QStringList& changed, QList<ScannedTrack>& tracks)
+    {
+        QMutexLocker locker(&m_mutex);
+        changed = m_changed;
+        tracks = m_tracks;
+        m_changed.clear();
+        m_tracks.clear();
+    }
+
+    /** of every directory visited */
+    QHash<QString, uint> mtimes()
+    {
+        QMutexLocker locker(&m_mutex);
+        return m_mtimes;
+    }
+
+private:
+    const QHash<QString, uint> m_known;
+
+    QMutex m_mutex;
+    QWaitCondition m_wake;
+    QQueue<QString> m_pending;
+    int m_busy;
+    bool m_cancelled;
+
+    QHash<QString, uint> m_mtimes;
+    QStringList m_changed;
+    QList<ScannedTrack> m_tracks;
+};
+
+
+/** Visits directories from a CollectionWalk until there are none left. */
+class CollectionScanWorker : public QThread
+{
+public:
+    CollectionScanWorker(CollectionWalk& walk)
+        : m_walk(walk)
+    {}
+
+private:
+    void run()
+    {
+        QString dir;
+        while (m_walk.take(dir))
+            visit(dir);
+    }
+
+    void visit(const QString& dir)
+    {
+        const uint mtime = QFileInfo(dir).lastModified().toTime_t();
+        const bool changed = m_walk.isChanged(dir, mtime);
+
+        // unchanged directories still have to be listed, a new album only
+        // changes the modification time of the directory it's added to.
+        // symlinks are skipped so we can't go round in circles
+        QDir::Filters filters = QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks;
+        if (changed)
+            filters |= QDir::Files;
+
+        QStringList subdirs;
+        QList<CollectionWalk::ScannedTrack> tracks;
+
+        foreach (const QFileInfo& entry, QDir(dir).entryInfoList(filters)) {
+            if (entry.isDir()) {
+                subdirs << entry.absoluteFilePath();
+            } else if (isAudioFile(entry)) {
+                CollectionWalk::ScannedTrack track;
+                if (readTags(entry.absoluteFilePath(), track))
+                    tracks << track;
+            }
+        }
+
+        m_walk.done(dir, mtime, changed, subdirs, tracks);
+    }
+
+    static bool readTags(const QString& path, CollectionWalk::ScannedTrack& track)
+    {
+#ifdef Q_OS_WIN
+        TagLib::FileRef file(reinterpret_cast<const wchar_t*>(path.utf16()), true, TagLib::AudioProperties::Fast);
+#else
+        TagLib::FileRef file(QFile::encodeName(path).constData(), true, TagLib::AudioProperties::Fast);
+#endif
+        if (file.isNull() || !file.tag())
+            return false;
+
+        TagLib::Tag* tag = file.tag();
+        track.artist = TStringToQString(tag->artist()).trimmed();
+        track.album = TStringToQString(tag->album()).trimmed();
+        track.title = TStringToQString(tag->title()).trimmed();
+        track.path = path;
+        if (file.audioProperties())
+            track.duration = file.audioProperties()->length();
+
+        // the index keeps genres as tags, and a genre is often several
+        foreach (const QString& genre, TStringToQString(tag->genre()).split(QRegExp("[;,/]"), QString::SkipEmptyParts))
+            if (genre.trimmed().size())
+                track.tags << genre.trimmed();
+
+        // playdar can't resolve anything without these
+        return !track.artist.isEmpty() && !track.title.isEmpty();
+    }
+
+    CollectionWalk& m_walk;
+};
+
+
+/** Writes the new index file while the old one is still in use. */
+class IndexWriter : public QThread
+{
+public:
+    IndexWriter(const LocalCollectionIndex& index, const QList<LocalCollectionIndex::Entry>& found, const QStringList& roots, const QSet<QString>& unchanged)
+        : m_index(index)
+        , m_found(found)
+        , m_roots(roots)
+        , m_unchanged(unchanged)
+        , m_ok(false)
+    {}
+
+    bool ok() const { return m_ok; }
+
+private:
+    void run()
+    {
+        m_ok = m_index.write(m_found, m_roots, m_unchanged);
+    }
+
+    const LocalCollectionIndex& m_index;
+    const QList<LocalCollectionIndex::Entry> m_found;
+    const QStringList m_roots;
+    const QSet<QString> m_unchanged;
+    bool m_ok;
+};
 
-using namespace std;
 
 LocalCollectionScanner::LocalCollectionScanner(QObject* parent)
     : QObject(parent)
+    , m_proc(0)
+    , m_index(0)
+    , m_walk(0)
+    , m_batchTimer(0)
+    , m_indexWriter(0)
+{
+}
+
+LocalCollectionScanner::~LocalCollectionScanner()
+{
+    stopWorkers();
+
+    if (m_indexWriter) {
+        m_indexWriter->wait();
+        delete m_indexWriter;
+    }
+}
+
+void
+LocalCollectionScanner::setIndex(LocalCollectionIndex* index)
 {
+    m_index = index;
 }
 
 void 
 LocalCollectionScanner::run(QDir playdarBinDir, QString collectionDbFilename, QStringList directories)
 {
+    m_playdarBinDir = playdarBinDir;
+    m_collectionDbFilename = collectionDbFilename;
+    m_directories.clear();
+    foreach (const QString& directory, directories)
+        m_directories << QDir(directory).absolutePath();
+
+    m_changed.clear();
+    m_found.clear();
+    m_mtimes = loadMtimes();
+    m_walk = new CollectionWalk(m_directories, m_mtimes);
+
+    // mostly waiting on the disk, or the network, so more threads than cores
+    const int threads = qBound(4, QThread::idealThreadCount() * 2, 16);
+    for (int i = 0; i < threads; ++i) {
+        QThread* worker = new CollectionScanWorker(*m_walk);
+        m_workers << worker;
+        worker->start();
+    }
+
+    m_batchTimer = new QTimer(this);
+    connect(m_batchTimer, SIGNAL(timeout()), SLOT(onBatchTimer()));
+    m_batchTimer->start(k_batchInterval);
+}
+
+void
+LocalCollectionScanner::onBatchTimer()
+{
+    // check before taking the results, so we can't miss the last of them
+    bool done = true;
+    foreach (QThread* worker, m_workers)
+        done = done && worker->isFinished();
+
+    QStringList changed;
+    QList<CollectionWalk::ScannedTrack> found;
+    m_walk->takeResults(changed, found);
+
+    m_changed += changed;
+    m_found += found;
+    foreach (const QString& dir, changed)
+        emit directory(dir);
+
+    if (found.size()) {
+        QList<Track> batch;
+        foreach (const CollectionWalk::ScannedTrack& s, found) {
+            Track t;
+            MutableTrack mt(t);
+            mt.setArtist(s.artist);
+            mt.setAlbum(s.album);
+            mt.setTitle(s.title);
+            mt.setUrl(QUrl::fromLocalFile(s.path));
+            batch << t;
+        }
+        emit tracks(batch);
+    }
+
+    if (!done)
+        return;
+
+    m_batchTimer->stop();
+
+    // what we saw this time, and what we knew about outside the
+    // directories we were asked to scan
+    QHash<QString, uint> mtimes = m_walk->mtimes();
+
+    // the tracks in the directories we didn't read again are still good
+    QSet<QString> unchanged = mtimes.keys().toSet();
+    foreach (const QString& dir, m_changed)
+        unchanged.remove(dir);
+
+    for (QHash<QString, uint>::const_iterator it = m_mtimes.constBegin(); it != m_mtimes.constEnd(); ++it) {
+        bool scanned = false;
+        foreach (const QString& root, m_directories)
+            scanned = scanned || isBelow(it.key(), root);
+        if (!scanned)
+            mtimes.insert(it.key(), it.value());
+    }
+    m_mtimes = mtimes;
+
+    stopWorkers();
+
+    // a directory that's gone changes its parent, so with nothing changed
+    // the index has nothing to lose either
+    if (m_index && (m_changed.size() || m_found.size())) {
+        m_indexWriter = new IndexWriter(*m_index, m_found, m_directories, unchanged);
+        connect(m_indexWriter, SIGNAL(finished()), SLOT(onIndexWritten()));
+        m_indexWriter->start();
+        return;
+    }
+
+    finishScan();
+}
+
+void
+LocalCollectionScanner::onIndexWritten()
+{
+    // finished() can get here before run() has quite returned
+    m_indexWriter->wait();
+
+    // swapped in here, as the index is in use on this thread
+    if (m_indexWriter->ok())
+        m_index->replace();
+
+    delete m_indexWriter;
+    m_indexWriter = 0;
+    m_found.clear();
+
+    finishScan();
+}
+
+void
+LocalCollectionScanner::finishScan()
+{
+    if (m_changed.isEmpty()) {
+        saveMtimes();
+        emit finished();
+        return;
+    }
+
+    runPlaydarScanner();
+}
+
+void
+LocalCollectionScanner::stopWorkers()
+{
+    if (m_walk)
+        m_walk->cancel();
+
+    foreach (QThread* worker, m_workers) {
+        worker->wait();
+        delete worker;
+    }
+    m_workers.clear();
+
+    delete m_walk;
+    m_walk = 0;
+}
+
+void
+LocalCollectionScanner::runPlaydarScanner()
+{
+    // playdar's scanner goes into every directory below the ones it's
+    // given, so leave out the ones below another changed directory
+    const QSet<QString> changed = m_changed.toSet();
+    QStringList directories;
+    foreach (const QString& dir, m_changed) {
+        bool below = false;
+        for (QDir parent(dir); !below && parent.cdUp(); )
+            below = changed.contains(parent.absolutePath());
+        if (!below)
+            directories << dir;
+    }
+
+    if (directories.size() > k_maxChangedDirectories)
+        directories = m_directories;
+
     QStringList args;
-    args << collectionDbFilename;
+    args << m_collectionDbFilename;
     args << directories;
 
     m_proc = new QProcess(this);
@@ -40,64 +459,85 @@ LocalCollectionScanner::run(QDir playdarBinDir, QString collectionDbFilename, QS
     connect(m_proc, SIGNAL(readyReadStandardError()), SLOT(onReadyReadStandardError()));
     connect(m_proc, SIGNAL(finished(int, QProcess::ExitStatus)), SLOT(onFinished(int, QProcess::ExitStatus)));
     connect(m_proc, SIGNAL(error(QProcess::ProcessError)), SLOT(onError(QProcess::ProcessError)));
-    m_proc->start(playdarBinDir.filePath("scanner.exe"), args);
+    m_proc->start(m_playdarBinDir.filePath("scanner.exe"), args);
 }
 
 void
 LocalCollectionScanner::onReadyReadStandardOutput()
 {
-    QByteArray ba = m_proc->readAllStandardOutput();
-    m_buffer.write(ba.constData(), ba.size());
-    while (true) {
-        string line;
-        getline(m_buffer, line);
-        if (m_buffer.fail()) {
-            // the line is incomplete (for now)
-            m_buffer.clear(); // clears the failbit
-            return;
-        } 
-        LocalCollectionScanner::line(line);
-    }
+    // it lists what it finds, but we've read the tags ourselves
+    m_proc->readAllStandardOutput();
 }
 
 void
 LocalCollectionScanner::onReadyReadStandardError()
 {
+    m_proc->readAllStandardError();
 }
 
 void  
-LocalCollectionScanner::onFinished(int /*exitCode*/, QProcess::ExitStatus /*exitStatus*/)
+LocalCollectionScanner::onFinished(int exitCode, QProcess::ExitStatus exitStatus)
 {
+    // only remember the directories once playdar has them, or we'd skip
+    // them next time
+    if (exitStatus == QProcess::NormalExit && exitCode == 0)
+        saveMtimes();
+    else
+        qWarning() << "Playdar's scanner failed with exit code" << exitCode;
+
     emit finished();
 }
 
 void
-LocalCollectionScanner::onError(QProcess::ProcessError)
+LocalCollectionScanner::onError(QProcess::ProcessError error)
 {
-    emit finished();
+    // otherwise finished() follows
+    if (error == QProcess::FailedToStart) {
+        qWarning() << "Couldn't start playdar's scanner:" << m_proc->errorString();
+        emit finished();
+    }
+}
+
+QHash<QString, uint>
+LocalCollectionScanner::loadMtimes() const
+{
+    QHash<QString, uint> mtimes;
+
+    // the times of a database, or an index, that has gone would have us
+    // skip everything
+    if (!QFile::exists(m_collectionDbFilename) || (m_index && !m_index->isOpen()))
+        return mtimes;
+
+    QFile file(m_collectionDbFilename + ".dirs");
+    if (!file.open(QIODevice::ReadOnly))
+        return mtimes;
+
+    QDataStream stream(&file);
+    quint32 magic;
+    qint32 version;
+    stream >> magic >> version;
+    if (magic != k_mtimesMagic || version != k_mtimesVersion)
+        return mtimes;
+
+    stream.setVersion(QDataStream::Qt_4_5);
+    stream >> mtimes;
+    if (stream.status() != QDataStream::Ok)
+        mtimes.clear();
+
+    return mtimes;
 }
 
 void
-LocalCollectionScanner::line(const string& s)
-{
-    QString line = QString::fromUtf8(s.data(), s.length()).trimmed();
-    QStringList fields = line.split(QChar('\t'), QString::KeepEmptyParts, Qt::CaseInsensitive);
-    if (fields.size()) {
-        if (fields[0] == "DIR:") {
-            if (fields.size() > 1) {
-                emit directory(fields[1]);
-            }
-        } else if (fields[0] == "TRACK:") {
-            if (fields.size() > 4) {
-                lastfm::Track t;
-                lastfm::MutableTrack mt(t);
-                mt.setArtist(fields[1]);
-                mt.setAlbum(fields[2]);
-                mt.setTitle(fields[3]);
-                mt.setUrl(fields[4]);
-                emit track(t);
-            }
-        }
+LocalCollectionScanner::saveMtimes() const
+{
+    QFile file(m_collectionDbFilename + ".dirs");
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Couldn't save directory times to" << file.fileName();
+        return;
     }
-}
 
+    QDataStream stream(&file);
+    stream << k_mtimesMagic << k_mtimesVersion;
+    stream.setVersion(QDataStream::Qt_4_5);
+    stream << m_mtimes;
+}
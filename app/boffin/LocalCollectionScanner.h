@@ -20,39 +20,81 @@
 #ifndef LOCAL_COLLECTION_SCANNER_H
 #define LOCAL_COLLECTION_SCANNER_H
 
-#include <sstream>
 #include <QDir>
+#include <QHash>
+#include <QList>
 #include <QProcess>
 #include <QStringList>
 #include <types/Track.h>
+#include "LocalCollectionIndex.h"
 
+class CollectionWalk;
+class IndexWriter;
+class QThread;
+class QTimer;
 
+/** Walks the collection on a pool of threads and reads the tags of the
+  * audio files in every directory that has changed since the last scan,
+  * then has playdar's scanner bring its collection database up to date
+  * with just those directories. Playdar owns that database, so it's still
+  * the one that writes it.
+  *
+  * A directory has changed if its modification time isn't the one we saw
+  * last time, which is what adding, removing or renaming anything in it
+  * does. The times are kept next to the collection database, in
+  * collectionDbFilename + ".dirs", and ignored if the database goes away.
+  *
+  * If there's a LocalCollectionIndex it is brought up to date too, on a
+  * thread of its own, before playdar's scanner is run. If nothing changed
+  * it's left alone.
+  */
 class LocalCollectionScanner : public QObject
 {
     Q_OBJECT;
 
 public:
     LocalCollectionScanner(QObject* parent);
+    ~LocalCollectionScanner();
+
+    /** the index to update, its times are ignored if it isn't open */
+    void setIndex(LocalCollectionIndex* index);
     void run(QDir playdarBinDir, QString collectionDbFilename, QStringList directories);
 
 signals:
-    void track(Track);
+    /** tracks found in changed directories, a batch at a time */
+    void tracks(QList<Track>);
     void directory(QString);
     void finished();
 
 private slots:
+    void onBatchTimer();
+    void onIndexWritten();
     void onReadyReadStandardOutput();
     void onReadyReadStandardError();
     void onFinished(int, QProcess::ExitStatus);
     void onError(QProcess::ProcessError);
 
 private:
-    void line(const std::string& line);
+    void stopWorkers();
+    void finishScan();
+    void runPlaydarScanner();
+    QHash<QString, uint> loadMtimes() const;
+    void saveMtimes() const;
 
     QProcess* m_proc;
+    LocalCollectionIndex* m_index;
     QString m_collectionDbFilename;
     QDir m_playdarBinDir;
-    std::stringstream m_buffer;
+    QStringList m_directories;
+
+    CollectionWalk* m_walk;
+    QList<QThread*> m_workers;
+    QTimer* m_batchTimer;
+    IndexWriter* m_indexWriter;
+
+    QStringList m_changed;          // directories whose tracks playdar needs to hear about
+    QHash<QString, uint> m_mtimes;  // to save once playdar has them
+    QList<LocalCollectionIndex::Entry> m_found;
 };
 
 #endif
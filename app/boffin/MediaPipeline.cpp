@@ -19,12 +19,14 @@
 */
 #include <cmath>
 #include <QEventLoop>
+#include <QDesktopServices>
 #include <QStringList>
 #include <QThread>
 #include <phonon/mediaobject.h>
 #include <phonon/audiooutput.h>
 #include "MediaPipeline.h"
 #include "TrackSource.h"
+#include "TrackPrefetcher.h"
 
 
 MediaPipeline::MediaPipeline( Phonon::AudioOutput* ao, QObject* parent )
@@ -32,6 +34,8 @@ MediaPipeline::MediaPipeline( Phonon::AudioOutput* ao, QObject* parent )
              , mo( 0 )
              , ao( ao )
              , m_source( 0 )
+             , m_lookahead( 1 )
+             , m_taking( false )
              , m_errorRecover( false )
              , m_phonon_sucks( false )
 {
@@ -40,6 +44,9 @@ MediaPipeline::MediaPipeline( Phonon::AudioOutput* ao, QObject* parent )
     connect( mo, SIGNAL(aboutToFinish()), SLOT(enqueue()) ); // fires just before track finishes
     connect( mo, SIGNAL(currentSourceChanged( Phonon::MediaSource )), SLOT(onPhononSourceChanged( Phonon::MediaSource )) ); 
     Phonon::createPath( mo, ao );
+
+    const QString cache = QDesktopServices::storageLocation( QDesktopServices::CacheLocation );
+    m_prefetcher = new TrackPrefetcher( cache + "/prefetch", this );
 }
 
 
@@ -73,8 +80,40 @@ void
 MediaPipeline::play( TrackSource* trackSource )
 {
 //	delete m_source;
+    if (m_source)
+        disconnect( m_source, 0, this, 0 );
+
     m_source = trackSource;
+    if (m_source)
+    {
+        connect( m_source, SIGNAL(changed()), SLOT(onUpcomingChanged()) );
+        m_source->setSize( m_lookahead );
+    }
     enqueue();
+    onUpcomingChanged();
+}
+
+
+void
+MediaPipeline::setLookahead( int depth )
+{
+    m_lookahead = qMax( 1, depth );
+    if (m_source)
+        m_source->setSize( m_lookahead );
+}
+
+
+void
+MediaPipeline::onUpcomingChanged()
+{
+    if (m_taking)
+        return;
+
+    QList<QUrl> urls;
+    if (m_source)
+        for (int i = 0; i < m_source->size(); ++i)
+            urls << QUrl( m_source->peek( i ).url() );
+    m_prefetcher->setUpcoming( urls );
 }
 
 
@@ -221,7 +260,10 @@ MediaPipeline::enqueue()
             break;
         }
 
+        // the prefetcher would drop t if it heard about it before we take it
+        m_taking = true;
         Track t = m_source->takeNextTrack();
+        m_taking = false;
         if (t.isNull()) {
             qDebug() << "tracksource empty";
             break;
@@ -231,19 +273,24 @@ MediaPipeline::enqueue()
         // state changes, so we must prefilter them.
         if (!t.url().isValid()) {
             qDebug() << "invalid url (" << t << ") skipped";
+            onUpcomingChanged();
             continue;
         }
 
-        m_tracks[t.url()] = t;
+        // the cached file, if it's been fetched
+        const QUrl url = m_prefetcher->take( t.url() );
+        onUpcomingChanged();
+
+        m_tracks[url] = t;
 
         // if we are playing a track now, enqueue, otherwise start now!
         if (mo->currentSource().url().isValid()) {
-            qDebug() << "enqueuing " << t;
-            mo->enqueue( Phonon::MediaSource( t.url() ) );
+            qDebug() << "enqueuing " << t << url;
+            mo->enqueue( Phonon::MediaSource( url ) );
         } else {
-            qDebug() << "starting " << t;
+            qDebug() << "starting " << t << url;
             m_phonon_sucks = true; //Phonon is shit and broken
-            mo->setCurrentSource( Phonon::MediaSource( t.url() ) );
+            mo->setCurrentSource( Phonon::MediaSource( url ) );
             mo->play();
         }
         break;
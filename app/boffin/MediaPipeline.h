@@ -25,6 +25,8 @@
 #include <phonon/phononnamespace.h>
 
 
+class TrackPrefetcher;
+
 namespace Phonon
 {
 	class MediaObject;
@@ -46,6 +48,13 @@ public:
 
     void play( class TrackSource* );
 
+    /** how many of the TrackSource's upcoming tracks are fetched ahead of
+      * time, it's the size of the source's buffer. 1 by default */
+    void setLookahead( int depth );
+    int lookahead() const { return m_lookahead; }
+
+    TrackPrefetcher* prefetcher() const { return m_prefetcher; }
+
 public slots:
     void setPaused( bool );
     void stop();
@@ -63,11 +72,15 @@ private slots:
     void onPhononStateChanged( Phonon::State, Phonon::State );
     void onSourceError( lastfm::ws::Error );
     void enqueue();
+    void onUpcomingChanged();
 
 private:
 	Phonon::MediaObject* mo;    
     Phonon::AudioOutput* ao;
     TrackSource* m_source;
+    TrackPrefetcher* m_prefetcher;
+    int m_lookahead;
+    bool m_taking;                  // a track from m_source, ignore its changed()
 
     QMap<QUrl, Track> m_tracks;
 
@@ -21,12 +21,38 @@
 #include <math.h>
 #include "PlaydarTagCloudModel.h"
 #include "playdar/PlaydarConnection.h"
+#include <QElapsedTimer>
 #include <QTimer>
 
+// tags are published this often while they arrive, and for no longer
+// than the budget, so the cloud fills in without stalling the ui
+static const int k_publishInterval = 40; // ms
+static const int k_publishBudget = 10; // ms
+
+// the order of the tag list: most tracks first, then by name, so every
+// tag has one place and binary search finds it
+static bool
+tagOrder( const BoffinTagItem& a, const BoffinTagItem& b )
+{
+    if (a.m_count != b.m_count)
+        return a.m_count > b.m_count;
+    return a.m_name < b.m_name;
+}
+
+
 PlaydarTagCloudModel::PlaydarTagCloudModel(PlaydarConnection* playdar)
 :m_playdar(playdar)
-,m_loadingTimer( 0 )
+,m_req( 0 )
+,m_maxTrackCount( 0 )
+,m_totalTracks( 0 )
+,m_totalDuration( 0 )
+,m_maxWeight( 0 )
+,m_maxLogCount( FLT_MIN )
+,m_minLogCount( FLT_MAX )
 {
+    m_publishTimer = new QTimer( this );
+    m_publishTimer->setSingleShot( true );
+    connect( m_publishTimer, SIGNAL(timeout()), SLOT(publish()) );
 }
 
 PlaydarTagCloudModel::~PlaydarTagCloudModel()
@@ -36,9 +62,19 @@ PlaydarTagCloudModel::~PlaydarTagCloudModel()
 void
 PlaydarTagCloudModel::startGetTags(const QString& rql)
 {
+    if (m_req) {
+        m_req->disconnect( this );
+        m_req->deleteLater();
+        m_req = 0;
+    }
+    m_publishTimer->stop();
+
+    beginResetModel();
     m_hosts.clear();
-    m_tagListBuffer.clear();
     m_tagList.clear();
+    m_counts.clear();
+    m_pending.clear();
+    m_pendingNames.clear();
 
     m_maxWeight = 0;
     m_maxLogCount = FLT_MIN;
@@ -46,72 +82,129 @@ PlaydarTagCloudModel::startGetTags(const QString& rql)
     m_maxTrackCount = 0;
     m_totalTracks = 0;
     m_totalDuration = 0;
-
-    BoffinTagRequest* req = m_playdar->boffinTagcloud(rql);
-    connect(req, SIGNAL(tagItem(BoffinTagItem)), SLOT(onTag(BoffinTagItem)));
-    connect(req, SIGNAL(tagItem(BoffinTagItem)), SIGNAL(tagItem(BoffinTagItem)));
-    connect(req, SIGNAL(error()), this, SLOT(onTagError()));
-    if( m_loadingTimer )
-    {
-    	delete( m_loadingTimer );
-    	m_loadingTimer = 0;
+    endResetModel();
+
+    m_req = m_playdar->boffinTagcloud(rql);
+    if (m_req) {
+        connect(m_req, SIGNAL(tagItem(BoffinTagItem)), SLOT(onTag(BoffinTagItem)));
+        connect(m_req, SIGNAL(tagItem(BoffinTagItem)), SIGNAL(tagItem(BoffinTagItem)));
+        connect(m_req, SIGNAL(error()), this, SLOT(onTagError()));
+        connect(m_req, SIGNAL(destroyed()), this, SLOT(onRequestDestroyed()));
     }
     qDebug() << "Fetching rql: " << rql;
 }
 
 void
-PlaydarTagCloudModel::onTag(BoffinTagItem tag)
+PlaydarTagCloudModel::onRequestDestroyed()
 {
-	if( m_loadingTimer )
-		m_loadingTimer->stop();
+    m_req = 0;
+}
 
+void
+PlaydarTagCloudModel::onTag(BoffinTagItem tag)
+{
     // check if the host is being filtered.
-    if (!m_hostFilter.contains(tag.m_host)) {
-        m_hosts.insert(tag.m_host);
-
-		if( int i = m_tagListBuffer.indexOf( tag ) >= 0 )
-		{
-    		// merge into existing tag
-			m_tagListBuffer[ i ].m_weight += tag.m_weight;
-            m_tagListBuffer[ i ].m_count += tag.m_count;
-			m_tagListBuffer[ i ].m_logCount = log( (float) m_tagListBuffer[i].m_count );
-			m_maxWeight = qMax( m_tagListBuffer[i].m_weight, m_maxWeight);
-			m_maxLogCount = qMax( m_tagListBuffer[i].m_logCount, m_maxLogCount);
-        }
-        else
-        {
-            // new tag
-		    tag.m_logCount = log( (float) tag.m_count );
-		    m_tagListBuffer << tag;
-		    m_maxTrackCount = qMax( tag.m_count, m_maxTrackCount );
-		    m_maxWeight = qMax( tag.m_weight, m_maxWeight );
-		    m_maxLogCount = qMax( m_maxLogCount, tag.m_logCount );
-		    m_minLogCount = qMin( m_minLogCount, tag.m_logCount );
-        }
-	}
-
-    // fire onFetchedTags after 1 second of idle-ness
-	if( !m_loadingTimer )
-	{
-		m_loadingTimer = new QTimer();
-		m_loadingTimer->setSingleShot( true );
-		connect( m_loadingTimer, SIGNAL( timeout()), SLOT(onFetchedTags()));
-	}
-    m_loadingTimer->start( 1000 );
+    if (m_hostFilter.contains(tag.m_host))
+        return;
+
+    m_hosts.insert(tag.m_host);
+
+    // several hosts can send the same tag, merge them before they're published
+    QHash<QString, BoffinTagItem>::iterator i = m_pending.find( tag.m_name );
+    if (i == m_pending.end()) {
+        m_pending.insert( tag.m_name, tag );
+        m_pendingNames << tag.m_name;
+    } else {
+        i->m_weight += tag.m_weight;
+        i->m_count += tag.m_count;
+        i->m_seconds += tag.m_seconds;
+    }
 
+    if (!m_publishTimer->isActive())
+        m_publishTimer->start( k_publishInterval );
 }
 
 void
-PlaydarTagCloudModel::onFetchedTags()
+PlaydarTagCloudModel::publish()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const float maxWeight = m_maxWeight;
+    const float maxLogCount = m_maxLogCount;
+    const float minLogCount = m_minLogCount;
+
+    while (!m_pendingNames.isEmpty() && timer.elapsed() < k_publishBudget)
+        publishTag( m_pending.take( m_pendingNames.takeFirst() ) );
+
+    // every tag is drawn relative to these
+    if (m_tagList.size() && (maxWeight != m_maxWeight || maxLogCount != m_maxLogCount || minLogCount != m_minLogCount))
+        emit dataChanged( index( 0, 0 ), index( m_tagList.size() - 1, 0 ) );
+
+    if (m_pendingNames.size())
+        m_publishTimer->start( k_publishInterval );
+
+    emit fetchedTags();
+}
+
+void
+PlaydarTagCloudModel::publishTag(BoffinTagItem tag)
+{
+    QHash<QString, int>::const_iterator count = m_counts.constFind( tag.m_name );
+
+    if (count == m_counts.constEnd()) {
+        // new tag
+        const int row = qLowerBound( m_tagList.begin(), m_tagList.end(), tag, tagOrder ) - m_tagList.begin();
+        tag.m_logCount = log( (float) tag.m_count );
+
+        beginInsertRows( QModelIndex(), row, row );
+        m_tagList.insert( row, tag );
+        m_counts.insert( tag.m_name, tag.m_count );
+        endInsertRows();
+
+        m_maxTrackCount = qMax( tag.m_count, m_maxTrackCount );
+        m_maxWeight = qMax( tag.m_weight, m_maxWeight );
+        m_maxLogCount = qMax( m_maxLogCount, tag.m_logCount );
+        m_minLogCount = qMin( m_minLogCount, tag.m_logCount );
+        return;
+    }
+
+    // merge into existing tag, which may move it up the list
+    const int from = rowOf( tag.m_name, *count );
+    BoffinTagItem merged = m_tagList[from];
+    merged.m_weight += tag.m_weight;
+    merged.m_count += tag.m_count;
+    merged.m_seconds += tag.m_seconds;
+    merged.m_logCount = log( (float) merged.m_count );
+
+    int to = from;
+    if (from > 0 && tagOrder( merged, m_tagList[from - 1] ))
+        to = qLowerBound( m_tagList.begin(), m_tagList.begin() + from, merged, tagOrder ) - m_tagList.begin();
+
+    if (to != from) {
+        beginMoveRows( QModelIndex(), from, from, QModelIndex(), to );
+        m_tagList.move( from, to );
+        endMoveRows();
+    }
+
+    m_tagList[to] = merged;
+    m_counts[merged.m_name] = merged.m_count;
+    emit dataChanged( index( to, 0 ), index( to, 0 ) );
+
+    m_maxTrackCount = qMax( merged.m_count, m_maxTrackCount );
+    m_maxWeight = qMax( merged.m_weight, m_maxWeight );
+    m_maxLogCount = qMax( merged.m_logCount, m_maxLogCount );
+}
+
+int
+PlaydarTagCloudModel::rowOf( const QString& name, int count ) const
 {
-	m_loadingTimer->deleteLater();
-	m_loadingTimer = 0;
-//	beginInsertRows( QModelIndex(), m_tagList.size(), m_tagListBuffer.size() );
-		m_tagList = m_tagListBuffer;
-		qSort( m_tagList.begin(), m_tagList.end(), qGreater<BoffinTagItem >() );
-//	endInsertRows();
-    reset();
-	emit fetchedTags();
+    BoffinTagItem key( name );
+    key.m_count = count;
+    QList<BoffinTagItem>::const_iterator i = qLowerBound( m_tagList.constBegin(), m_tagList.constEnd(), key, tagOrder );
+    if (i == m_tagList.constEnd() || i->m_name != name)
+        return -1;
+    return i - m_tagList.constBegin();
 }
 
 void
@@ -167,7 +260,10 @@ PlaydarTagCloudModel::index( int row, int column, const QModelIndex& parent /*=
 QModelIndex
 PlaydarTagCloudModel::indexOf( const BoffinTagItem& tag )
 {
-	return createIndex( m_tagList.indexOf( tag ), 0 );
+    QHash<QString, int>::const_iterator count = m_counts.constFind( tag.m_name );
+    if (count == m_counts.constEnd())
+        return QModelIndex();
+	return createIndex( rowOf( tag.m_name, *count ), 0 );
 }
 
 //virtual
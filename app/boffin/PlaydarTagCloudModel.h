@@ -25,6 +25,7 @@
 #include <lastfm/global.h>
 #include <QAbstractItemModel>
 #include <QAbstractTableModel>
+#include <QHash>
 #include <QSet>
 #include <QMap>
 #include <QList>
@@ -65,16 +66,25 @@ signals:
 private slots:
     void onTag(BoffinTagItem tag);
     void onTagError();
-    void onFetchedTags();
+    void onRequestDestroyed();
+    void publish();
 
 private:
+    void publishTag(BoffinTagItem tag);
+    int rowOf(const QString& name, int count) const;
+
     PlaydarConnection* m_playdar;
+    BoffinTagRequest* m_req;
 
     QSet<QString> m_hostFilter;     // hosts to filter from this tag cloud
     QSet<QString> m_hosts;          // hosts contributing to this tag cloud
 
-    QList< BoffinTagItem > m_tagListBuffer;
-    QList< BoffinTagItem > m_tagList;
+    QList< BoffinTagItem > m_tagList;   // in tagOrder
+    QHash< QString, int > m_counts;     // the count of each tag in m_tagList, which finds its row
+
+    // tags waiting for the next publish(), merged by name
+    QHash< QString, BoffinTagItem > m_pending;
+    QList< QString > m_pendingNames;
 
     BoffinTagItem m_tag;    // the last tag provided via onTags
 
@@ -87,7 +97,7 @@ private:
     float m_minLogCount;
 //    float m_minLogWeight, m_maxLogWeight;
 
-    class QTimer* m_loadingTimer;
+    class QTimer* m_publishTimer;
 };
 
 #endif
@@ -53,7 +53,18 @@ ScanProgressWidget::onNewDirectory( const QString& directory )
 
 
 void
-ScanProgressWidget::onNewTrack( const Track& t )
+ScanProgressWidget::onNewTracks( const QList<Track>& tracks )
+{
+    foreach (const Track& t, tracks)
+        addTrack( t );
+
+    // once per batch, the scanner can find thousands a second
+    updateStatusMessage();
+}
+
+
+void
+ScanProgressWidget::addTrack( const Track& t )
 {
     int& i = count( t.artist() );
     i++;
@@ -61,8 +72,6 @@ ScanProgressWidget::onNewTrack( const Track& t )
     m_artist_count = track_counts.size();
     m_track_count++;
 
-    updateStatusMessage();
-
     if (t.url().isValid()) {
         paths += t.url().path();
         // so this is a time saving way to keep the list the size of the screen
@@ -86,12 +86,13 @@ signals:
 
 public slots:
     void onNewDirectory( const QString& );
-    void onNewTrack( const Track& );
+    void onNewTracks( const QList<Track>& );
     void onFinished();
 
 private slots:
     void onImageFucked();
 
 private:
+    void addTrack( const Track& );
     void updateStatusMessage();
 };
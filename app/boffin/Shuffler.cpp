@@ -18,125 +18,80 @@
    along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "Shuffler.h"
+#include "EditDistance.h"
 
 
 ////////////////////////////////////////////////////////////////////////
 
 
-// lifted from playdar
-int levenshtein(const QString& source, const QString& target) 
-{
-  // Step 1
-  const int n = source.length();
-  const int m = target.length();
-  if (n == 0) {
-    return m;
-  }
-  if (m == 0) {
-    return n;
-  }
-  // Good form to declare a TYPEDEF
-  typedef std::vector< std::vector<int> > Tmatrix; 
-  Tmatrix matrix(n+1);
-  // Size the vectors in the 2.nd dimension. Unfortunately C++ doesn't
-  // allow for allocation on declaration of 2.nd dimension of vec of vec
-  for (int i = 0; i <= n; i++) {
-    matrix[i].resize(m+1);
-  }
-  // Step 2
-  for (int i = 0; i <= n; i++) {
-    matrix[i][0]=i;
-  }
-  for (int j = 0; j <= m; j++) {
-    matrix[0][j]=j;
-  }
-  // Step 3
-  for (int i = 1; i <= n; i++) {
-    const QChar s_i = source[i-1];
-    // Step 4
-    for (int j = 1; j <= m; j++) {
-      const QChar t_j = target[j-1];
-      // Step 5
-      int cost;
-      if (s_i == t_j) {
-        cost = 0;
-      }
-      else {
-        cost = 1;
-      }
-      // Step 6
-      const int above = matrix[i-1][j];
-      const int left = matrix[i][j-1];
-      const int diag = matrix[i-1][j-1];
-      //int cell = min( above + 1, min(left + 1, diag + cost));
-      int cell = (((left+1)>(diag+cost))?diag+cost:left+1);
-      if(above+1 < cell) cell = above+1;
-      // Step 6A: Cover transposition, in addition to deletion,
-      // insertion and substitution. This step is taken from:
-      // Berghel, Hal ; Roach, David : "An Extension of Ukkonen's 
-      // Enhanced Dynamic Programming ASM Algorithm"
-      // (http://www.acm.org/~hlb/publications/asm/asm.html)
-      if (i>2 && j>2) {
-        int trans=matrix[i-2][j-2]+1;
-        if (source[i-2]!=t_j) trans++;
-        if (s_i!=target[j-2]) trans++;
-        if (cell>trans) cell=trans;
-      }
-      matrix[i][j]=cell;
-    }
-  }
-  // Step 7
-  return matrix[n][m];
-}
+// levenshtein values not very reliable when less than this
+static const float k_minSimilarity = 0.5;
 
 
-float
-normalisedLevenshtein(const BoffinPlayableItem& a, const BoffinPlayableItem& b)
+// how much of original is left after editing it into candidate, as a
+// fraction of original's length. 0 if playdar would fail them outright,
+// or (roughly) if the result couldn't be over minimum.
+static float
+nameScore(const QString& original, const QString& candidate, float minimum)
 {
     // logic lifted from playdar's Resolver::calculate_score
-    // not yet comparing album titles
-
-    using namespace boost;
-    // original names from the query:
-    QString o_art = a.artist().simplified().toLower();
-    QString o_trk = a.track().simplified().toLower();
-
-    // names from candidate result:
-    QString art = b.artist().simplified().toLower();
-    QString trk = b.track().simplified().toLower();
-
-    // short-circuit for exact match
-    if (o_art == art && o_trk == trk) return 1.0;
 
-    // the real deal, with edit distances:
-    int trked = levenshtein(trk, o_trk);
-    int arted = levenshtein(art, o_art);
-
-    // tolerances:
-    const float tol_art = 1.5;
-    const float tol_trk = 1.5;
+    // tolerance:
+    const float tol = 1.5;
     
     // names less than this many chars aren't dismissed based on % edit-dist:
     const int grace_len = 6; 
+
+    const int length = original.length();
     
+    // if edit distance longer than original name, fail them outright:
+    int max = length - 1;
+
     // if % edit distance is greater than tolerance, fail them outright:
-    if( o_art.length() > grace_len && arted > o_art.length()/tol_art )
-        return 0.0;
+    if( length > grace_len )
+        max = qMin( max, int( length/tol ) );
+
+    // no point going further than would bring us down to minimum, give or
+    // take one so that rounding never loses a pair that makes it:
+    if( minimum > 0 )
+        max = qMin( max, int( length * (1 - minimum) ) + 1 );
 
-    if( o_trk.length() > grace_len && trked > o_trk.length()/tol_trk )
+    if( max < 0 )
         return 0.0;
 
-    // if edit distance longer than original name, fail them outright:
-    if( arted >= o_art.length() )
+    int ed = boundedLevenshtein(candidate, original, max);
+    if( ed > max )
         return 0.0;
 
-    if( trked >= o_trk.length() )
+    return (length - ed) / (float) length;
+}
+
+
+// the artist score of an item by itemKey against a song by historicKey, true
+// if songs by the two could be similar at all
+static bool
+artistsSimilar(const QString& itemKey, const QString& historicKey, float& score)
+{
+    score = nameScore(itemKey, historicKey, k_minSimilarity);
+    // the same artist always can be, by an exact match
+    return score > k_minSimilarity || itemKey == historicKey;
+}
+
+
+// how similar a song is to another, as playdar's resolver scores them
+// but not yet comparing album titles. artistScore is the artist score of
+// a against b. Only scores over k_minSimilarity are exact.
+static float
+similarity(const BoffinPlayableItem& a, const BoffinPlayableItem& b, float artistScore)
+{
+    // short-circuit for exact match
+    if (a.artistKey() == b.artistKey() && a.trackKey() == b.trackKey()) return 1.0;
+
+    if (artistScore <= k_minSimilarity)
         return 0.0;
-    
+
     // combine the edit distance of artist & track into a final score:
-    float artdist_pc = (o_art.length()-arted) / (float) o_art.length();
-    float trkdist_pc = (o_trk.length()-trked) / (float) o_trk.length();
-    return artdist_pc * trkdist_pc;
+    return artistScore * nameScore(a.trackKey(), b.trackKey(), k_minSimilarity / artistScore);
 }
 
 
@@ -145,8 +100,10 @@ normalisedLevenshtein(const BoffinPlayableItem& a, const BoffinPlayableItem& b)
 
 Shuffler::Shuffler(QObject* parent /* = 0 */)
 : QObject(parent)
+, m_live(0)
 , m_artistHistorySize(4)        // to mix up the artists
 , m_songHistorySize(100)        // to suppress dup songs
+, m_nextSerial(0)
 {
 }
 
@@ -156,15 +113,27 @@ Shuffler::sampleOne()
     BoffinPlayableItem result = sample();
     if (result.isValid()) {
         // artist memory
-        m_artistHistory.push_back(result.artist());
+        QStringList changedArtists(result.artistKey());
+        m_artistHistory.push_back(result.artistKey());
         while (m_artistHistory.size() > m_artistHistorySize) {
+            changedArtists << m_artistHistory.front();
             m_artistHistory.pop_front();
         }
         // track memory
-        m_songHistory.push_back(result);
-        while (m_songHistory.size() > m_songHistorySize) {
-            m_songHistory.pop_front();
-        }
+        QSet<int> changedSlots;
+        pushSongHistory(result);
+        while (m_songHistory.size() > m_songHistorySize)
+            popSongHistory(changedSlots);
+
+        // a song's pushdown depends on its place in the history, so
+        // everything similar to anything in there may have moved
+        foreach (const HistoricSong& h, m_songHistory)
+            foreach (const SimilarSlot& s, h.similar)
+                changedSlots << s.first;
+
+        updateSongPushdowns(changedSlots);
+        foreach (const QString& artist, changedArtists)
+            reweighArtist(artist);
     }
     return result;
 }
@@ -172,6 +141,8 @@ Shuffler::sampleOne()
 const Shuffler::ItemList& 
 Shuffler::items()
 {
+    if (m_live < m_items.size())
+        compact();
     return m_items;
 }
 
@@ -181,10 +152,38 @@ Shuffler::setArtistHistorySize(unsigned size)
     m_artistHistorySize = size;
 }
 
+void
+Shuffler::setSongHistorySize(unsigned size)
+{
+    m_songHistorySize = size;
+
+    QSet<int> changedSlots;
+    while (m_songHistory.size() > m_songHistorySize)
+        popSongHistory(changedSlots);
+
+    // the size scales every song's pushdown
+    foreach (const HistoricSong& h, m_songHistory)
+        foreach (const SimilarSlot& s, h.similar)
+            changedSlots << s.first;
+
+    updateSongPushdowns(changedSlots);
+}
+
 void
 Shuffler::clear()
 {
     m_items.clear();
+    m_removed.clear();
+    m_live = 0;
+    m_songPushdown.clear();
+    m_artistSlots.clear();
+    m_artistKeysByLength.clear();
+    m_sampler.clear();
+
+    for (QList<HistoricSong>::iterator h = m_songHistory.begin(); h != m_songHistory.end(); ++h)
+        h->similar.clear();
+    for (QHash<QString, HistoricArtist>::iterator a = m_historicArtists.begin(); a != m_historicArtists.end(); ++a)
+        a->similar.clear();
 }
 
 void
@@ -192,11 +191,14 @@ Shuffler::clearHistory()
 {
     m_artistHistory.clear();
     m_songHistory.clear();
-}
+    m_historicArtists.clear();
 
-bool orderByWorkingWeightDesc(const BoffinPlayableItem& a, const BoffinPlayableItem& b)
-{
-    return a.workingweight() > b.workingweight();
+    for (int slot = 0; slot < m_items.size(); ++slot) {
+        if (!m_removed.testBit(slot)) {
+            m_songPushdown[slot] = 1.0;
+            reweigh(slot);
+        }
+    }
 }
 
 // pull out a single item
@@ -205,61 +207,280 @@ Shuffler::sample()
 {
     BoffinPlayableItem result;
 
-    if (m_items.size()) {
-        ItemList::iterator begin = m_items.begin();
-        ItemList::iterator end = m_items.end();
-        ItemList::iterator it;
+    if (m_live > 0) {
+        int slot = m_sampler.sample();
+
+        // nothing has any weight left, so any item will do
+        if (slot < 0)
+            for (slot = 0; m_removed.testBit(slot); ++slot);
+
+        result = m_items[slot];
+        removeSlot(slot);
+    }
+
+    return result;
+}
 
-        // reweight:
-        float totalWeight = 0;
-        for (it = begin; it != end; it++) {
-            it->workingweight() = it->weight() * pushdown(*it);
-            totalWeight += it->workingweight();
+void
+Shuffler::removeSlot(int slot)
+{
+    m_sampler.remove(slot);
+    m_removed.setBit(slot);
+    --m_live;
+
+    QString const artist = m_items[slot].artistKey();
+    QHash<QString, QList<int> >::iterator it = m_artistSlots.find(artist);
+    if (it != m_artistSlots.end()) {
+        it->removeOne(slot);
+        if (it->isEmpty()) {
+            m_artistSlots.erase(it);
+            removeArtistKey(artist);
         }
-        // normalise weights, sum to 1
-        for (it = begin; it != end; it++) {
-            it->workingweight() /= totalWeight;
+    }
+
+    m_items[slot] = BoffinPlayableItem();
+
+    // holes cost memory and time in the sampler, and history lists may
+    // refer to them, so squeeze them out once they're the majority
+    if (m_items.size() > 1024 && m_live < m_items.size() / 2)
+        compact();
+}
+
+void
+Shuffler::compact()
+{
+    QVector<int> remap(m_items.size(), -1);
+    ItemList items;
+    QVector<float> songPushdown;
+    items.reserve(m_live);
+    songPushdown.reserve(m_live);
+
+    for (int slot = 0; slot < m_items.size(); ++slot) {
+        if (!m_removed.testBit(slot)) {
+            remap[slot] = items.size();
+            items << m_items[slot];
+            songPushdown << m_songPushdown[slot];
         }
-        qSort(begin, end, orderByWorkingWeightDesc);
+    }
 
-        ItemList::iterator sample = m_sampler.singleSample(begin, end, true);
-        result = *sample;
-        m_items.removeAt(sample - begin);
+    m_items = items;
+    m_songPushdown = songPushdown;
+    m_removed = QBitArray(m_items.size());
+    m_artistSlots.clear();
+    m_sampler.clear();
+
+    // the same artists are still live, so m_artistKeysByLength and
+    // m_historicArtists stand
+    for (int slot = 0; slot < m_items.size(); ++slot) {
+        m_artistSlots[m_items[slot].artistKey()] << slot;
+        m_sampler.add(m_items[slot].workingweight());
     }
 
-    return result;
+    for (QList<HistoricSong>::iterator h = m_songHistory.begin(); h != m_songHistory.end(); ++h) {
+        SimilarSlots similar;
+        foreach (const SimilarSlot& s, h->similar)
+            if (remap[s.first] != -1)
+                similar << qMakePair(remap[s.first], s.second);
+        h->similar = similar;
+    }
+}
+
+
+void
+Shuffler::pushSongHistory(const BoffinPlayableItem& item)
+{
+    HistoricArtist& artist = m_historicArtists[item.artistKey()];
+    if (artist.serials.isEmpty())
+        artist.similar = similarArtists(item.artistKey());
+
+    HistoricSong song;
+    song.item = item;
+    song.serial = m_nextSerial++;
+    song.similar = similarSlots(item);
+
+    artist.serials << song.serial;
+    m_songHistory.push_back(song);
+}
+
+// drops the oldest song from the history, adding the slots it was pushing
+// down to changed
+void
+Shuffler::popSongHistory(QSet<int>& changed)
+{
+    const HistoricSong& song = m_songHistory.front();
+    foreach (const SimilarSlot& s, song.similar)
+        changed << s.first;
+
+    QHash<QString, HistoricArtist>::iterator it = m_historicArtists.find(song.item.artistKey());
+    if (it != m_historicArtists.end()) {
+        it->serials.removeOne(song.serial);
+        if (it->serials.isEmpty())
+            m_historicArtists.erase(it);
+    }
+
+    m_songHistory.pop_front();
+}
+
+// a new artist in the collection, that songs in the history might be similar to
+void
+Shuffler::addArtistKey(const QString& key)
+{
+    if (m_artistKeysByLength.size() <= key.length())
+        m_artistKeysByLength.resize(key.length() + 1);
+    m_artistKeysByLength[key.length()] << key;
+
+    for (QHash<QString, HistoricArtist>::iterator it = m_historicArtists.begin(); it != m_historicArtists.end(); ++it) {
+        float score;
+        if (artistsSimilar(key, it.key(), score))
+            it->similar.insert(key, score);
+    }
+}
+
+// the last item by an artist has left the collection
+void
+Shuffler::removeArtistKey(const QString& key)
+{
+    m_artistKeysByLength[key.length()].remove(key);
+
+    for (QHash<QString, HistoricArtist>::iterator it = m_historicArtists.begin(); it != m_historicArtists.end(); ++it)
+        it->similar.remove(key);
 }
 
 
 float 
-Shuffler::pushdown(const BoffinPlayableItem& item)
+Shuffler::artistPushdown(const QString& artistKey) const
 {
-    return pushdownSong(item) * 
-        (m_artistHistory.contains(item.artist(), Qt::CaseInsensitive) ? 0.00001 : 1.0);
+    return m_artistHistory.contains(artistKey) ? 0.00001 : 1.0;
 }
 
 
+// how far a song similar to m_songHistory[historyIndex] is pushed down
 float
-Shuffler::pushdownSong(const BoffinPlayableItem& item)
+Shuffler::songScore(int historyIndex, float nl) const
 {
-    int i = 1;
-    float result = 1.0;
-    foreach(const BoffinPlayableItem& historicItem, m_songHistory) {
-        float nl = normalisedLevenshtein(item,  historicItem);
-        // levenshtein values not very reliable when less than 0.5
-        if (nl > 0.5) {
-            float score = 0.1 * (nl * i / (float) m_songHistorySize);
-            if (score < result) {
-                result = score;
-            }
+    return 0.1 * (nl * (historyIndex + 1) / (float) m_songHistorySize);
+}
+
+
+// the artists in the collection whose songs can be similar to songs by
+// historicKey, and their artist scores against it
+QHash<QString, float>
+Shuffler::similarArtists(const QString& historicKey) const
+{
+    // an artist scores over k_minSimilarity when the edit distance is less
+    // than half its length, and the distance is at least the difference in
+    // lengths. so only artists between 2/3 and twice the length can be close
+    const int length = historicKey.length();
+    const int shortest = qMin(length, 2 * length / 3 + 1);
+    const int longest = qMin(qMax(length, 2 * length - 1), m_artistKeysByLength.size() - 1);
+
+    QHash<QString, float> similar;
+    for (int l = shortest; l <= longest; ++l) {
+        foreach (const QString& key, m_artistKeysByLength[l]) {
+            float score;
+            if (artistsSimilar(key, historicKey, score))
+                similar.insert(key, score);
         }
-        i++;
     }
-    return result;
+    return similar;
+}
+
+
+Shuffler::SimilarSlots
+Shuffler::similarSlots(const BoffinPlayableItem& historicItem) const
+{
+    SimilarSlots similar;
+
+    const HistoricArtist& artist = *m_historicArtists.constFind(historicItem.artistKey());
+    for (QHash<QString, float>::const_iterator a = artist.similar.constBegin(); a != artist.similar.constEnd(); ++a) {
+        foreach (int slot, m_artistSlots.value(a.key())) {
+            float nl = similarity(m_items[slot], historicItem, a.value());
+            if (nl > k_minSimilarity)
+                similar << qMakePair(slot, nl);
+        }
+    }
+    return similar;
 }
 
+
+// recomputes the song pushdown of each changed slot from the history, that
+// is the lowest score of any historic song it is similar to
+void
+Shuffler::updateSongPushdowns(const QSet<int>& changed)
+{
+    if (changed.isEmpty())
+        return;
+
+    QHash<int, float> lowest;
+    for (int i = 0; i < m_songHistory.size(); ++i) {
+        foreach (const SimilarSlot& s, m_songHistory[i].similar) {
+            float score = songScore(i, s.second);
+            QHash<int, float>::iterator it = lowest.find(s.first);
+            if (it == lowest.end())
+                lowest.insert(s.first, score);
+            else if (score < *it)
+                *it = score;
+        }
+    }
+
+    foreach (int slot, changed) {
+        if (m_removed.testBit(slot))
+            continue;
+        m_songPushdown[slot] = qMin(1.0f, lowest.value(slot, 1.0f));
+        reweigh(slot);
+    }
+}
+
+
+void
+Shuffler::reweigh(int slot)
+{
+    BoffinPlayableItem& item = m_items[slot];
+    item.workingweight() = item.weight() * m_songPushdown[slot] * artistPushdown(item.artistKey());
+    m_sampler.update(slot, item.workingweight());
+}
+
+
+void
+Shuffler::reweighArtist(const QString& artistKey)
+{
+    foreach (int slot, m_artistSlots.value(artistKey))
+        reweigh(slot);
+}
+
+
 void 
 Shuffler::receivePlayableItem(BoffinPlayableItem item)
 {
+    int const slot = m_items.size();
     m_items.push_back(item);
-}
\ No newline at end of file
+    m_removed.resize(slot + 1);
+    ++m_live;
+
+    QList<int>& artistSlots = m_artistSlots[item.artistKey()];
+    if (artistSlots.isEmpty())
+        addArtistKey(item.artistKey());
+    artistSlots << slot;
+
+    // only songs by artists similar to this one can be similar to it
+    float pushdown = 1.0;
+    const int firstSerial = m_songHistory.isEmpty() ? 0 : m_songHistory.front().serial;
+    for (QHash<QString, HistoricArtist>::const_iterator a = m_historicArtists.constBegin(); a != m_historicArtists.constEnd(); ++a) {
+        QHash<QString, float>::const_iterator score = a->similar.constFind(item.artistKey());
+        if (score == a->similar.constEnd())
+            continue;
+
+        foreach (int serial, a->serials) {
+            const int i = serial - firstSerial;
+            float nl = similarity(item, m_songHistory[i].item, *score);
+            if (nl > k_minSimilarity) {
+                m_songHistory[i].similar << qMakePair(slot, nl);
+                pushdown = qMin(pushdown, songScore(i, nl));
+            }
+        }
+    }
+    m_songPushdown << pushdown;
+
+    item.workingweight() = item.weight() * pushdown * artistPushdown(item.artistKey());
+    m_sampler.add(item.workingweight());
+}
@@ -20,11 +20,26 @@
 #ifndef SHUFFLER_H
 #define SHUFFLER_H
 
+#include <QBitArray>
+#include <QHash>
+#include <QPair>
+#include <QSet>
 #include <QStringList>
+#include <QVector>
 #include "playdar/BoffinPlayableItem.h"
-#include "sample/SampleFromDistribution.h"
-
-
+#include "sample/FenwickSampler.h"
+
+
+// Items are drawn with probability proportional to their weight, pushed
+// down if they are similar to a recently played song or by a recently
+// played artist. Each item keeps its slot in m_items until it is drawn, and
+// the sampler holds the current pushed-down weight of every slot, so when
+// the history moves on only the slots it affects are reweighed.
+//
+// Songs are only similar if their artists are, so items are grouped by
+// artist and each artist in the song history remembers which of those
+// groups are close to it. Comparing a song with the collection, or an item
+// with the history, then only compares tracks within similar artists.
 class Shuffler : public QObject
 {
     Q_OBJECT
@@ -44,41 +59,55 @@ public slots:
     void receivePlayableItem(BoffinPlayableItem item);
 
 private:
-    BoffinPlayableItem sample();
-    void result(const BoffinPlayableItem& item);
-    float pushdown(const BoffinPlayableItem& item);
-    float pushdownSong(const BoffinPlayableItem& item);
+    friend class TestShuffler;      // checks the weights against the old reweigh-everything loop
 
-    struct AccessPolicy
+    typedef QPair<int, float> SimilarSlot;
+    typedef QList<SimilarSlot> SimilarSlots;
+
+    struct HistoricSong
     {
-        float operator()(const QList<BoffinPlayableItem>::const_iterator& el) const
-        { 
-            return el->workingweight(); 
-        }
+        BoffinPlayableItem item;
+        int serial;             // m_songHistory index plus the number of songs that have left it
+        SimilarSlots similar;   // live slots that are similar to this, and their similarity
     };
 
-    struct CopyPolicy
+    struct HistoricArtist
     {
-       template <typename IT>
-       BoffinPlayableItem operator()(IT& it) const
-       {
-          return *it;
-       }
-
-       template <typename IT>
-       const BoffinPlayableItem operator()(const IT& it) const
-       {
-          return *it;
-       }
+        QList<int> serials;             // of the songs in m_songHistory by this artist
+        QHash<QString, float> similar;  // keys of m_artistSlots whose songs can be similar to this artist's, and their artist score
     };
 
-
-    fm::last::algo::ListBasedSampler<AccessPolicy, CopyPolicy> m_sampler;
-    ItemList m_items;               // items arrive here
-    QStringList m_artistHistory;
+    BoffinPlayableItem sample();
+    void removeSlot(int slot);
+    void compact();
+
+    void pushSongHistory(const BoffinPlayableItem& item);
+    void popSongHistory(QSet<int>& changed);
+    void addArtistKey(const QString& key);
+    void removeArtistKey(const QString& key);
+
+    float artistPushdown(const QString& artistKey) const;
+    float songScore(int historyIndex, float nl) const;
+    QHash<QString, float> similarArtists(const QString& historicKey) const;
+    SimilarSlots similarSlots(const BoffinPlayableItem& item) const;
+    void updateSongPushdowns(const QSet<int>& changed);
+    void reweigh(int slot);
+    void reweighArtist(const QString& artistKey);
+
+    fm::last::algo::FenwickSampler m_sampler;
+    ItemList m_items;               // items arrive here, drawn ones leave holes until compact()
+    QBitArray m_removed;
+    int m_live;
+    QVector<float> m_songPushdown;  // per slot
+    QHash<QString, QList<int> > m_artistSlots;  // artistKey() to live slots
+    QVector<QSet<QString> > m_artistKeysByLength;   // the keys of m_artistSlots
+
+    QStringList m_artistHistory;    // artistKey()s
     int m_artistHistorySize;
-    QList<BoffinPlayableItem> m_songHistory;
+    QList<HistoricSong> m_songHistory;
     int m_songHistorySize;
+    int m_nextSerial;
+    QHash<QString, HistoricArtist> m_historicArtists;   // by artistKey()
 };
 
 #endif
@@ -17,7 +17,6 @@
    You should have received a copy of the GNU General Public License
    along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
 */
-#include <boost/timer.hpp>
 #include "TagCloudView.h"
 #include "PlaydarTagCloudModel.h"
 #include <QApplication>
@@ -27,8 +26,15 @@
 #include <limits.h>
 
 
+static const int VIEWPORT_MARGIN = 10;
+
+
 TagCloudView::TagCloudView( QWidget* parent )
              : QAbstractItemView( parent )
+             , m_relayoutFrom( 0 )
+             , m_staleFrom( INT_MAX )
+             , m_staleTo( -1 )
+             , m_layoutWidth( -1 )
              , m_fetched( false )
 {
     QFont f = font();
@@ -63,12 +69,10 @@ TagCloudView::setSelection( const QRect& rect, QItemSelectionModel::SelectionFla
         return;
 
     QRect r = rect.translated( 0, verticalScrollBar()->value());
-    RectsConstIt it = m_rects.constBegin();
-    for (int c = 0; it != m_rects.constEnd(); it++, c++) {
-        if (it->intersects(r)) {
-            selectionModel()->select(model()->index(c, 0), f);
-        }
-    }
+    for (int l = firstLineBelow( r.top() ); l < m_lines.size() && m_lines[l].top <= r.bottom(); ++l)
+        for (int c = m_lines[l].first; c < m_lines[l].end; ++c)
+            if (m_items[c].rect.intersects( r ))
+                selectionModel()->select( model()->index( c, 0 ), f );
 }
 
 
@@ -94,23 +98,26 @@ TagCloudView::paintEvent( QPaintEvent* e )
 		return;
     }
 
-    if (m_dirty) {
+    if (needsLayout())
         updateGeometries();
-        m_dirty = false;
-    }
 
-    if (m_rects.isEmpty()) {
+    if (m_items.isEmpty()) {
         p.drawText( viewport()->rect(), Qt::AlignCenter,  "No tags have been found!" );
         return;
     }
 
+    const int scroll = verticalScrollBar()->value();
+    const QRect exposed = e->rect().translated( 0, scroll );
+
     QStyleOptionViewItem opt = viewOptions();
-    RectsConstIt it = m_rects.constBegin();
-    for (int c = 0; it != m_rects.constEnd(); it++, c++) 
+    for (int l = firstLineBelow( exposed.top() ); l < m_lines.size() && m_lines[l].top <= exposed.bottom(); ++l)
     {
-        opt.rect = it->translated( 0, -verticalScrollBar()->value() );
+        for (int c = m_lines[l].first; c < m_lines[l].end; ++c)
+        {
+            if (!m_items[c].rect.intersects( exposed ))
+                continue;
 
-        if( e->rect().intersects( opt.rect )) {
+            opt.rect = m_items[c].rect.translated( 0, -scroll );
             const QModelIndex& index = model()->index(c, 0);
 
             opt.state = QStyle::State_None;
@@ -142,91 +149,250 @@ void
 TagCloudView::setModel(QAbstractItemModel *model)
 {
     QAbstractItemView::setModel(model);
-    connect(model, SIGNAL(rowsInserted(QModelIndex, int, int)), SLOT(onRows(QModelIndex, int, int)));
-    connect(model, SIGNAL(rowsRemoved(QModelIndex, int, int)), SLOT(onRows(QModelIndex, int, int)));
-//    connect(model, SIGNAL(modelReset()), SLOT(onModelReset()));
+    connect(model, SIGNAL(rowsInserted(QModelIndex, int, int)), SLOT(onRowsInserted(QModelIndex, int, int)));
+    connect(model, SIGNAL(rowsRemoved(QModelIndex, int, int)), SLOT(onRowsRemoved(QModelIndex, int, int)));
+    // the tag cloud model moves tags up as their counts grow
+    connect(model, SIGNAL(layoutChanged()), SLOT(onLayoutChanged()));
+    connect(model, SIGNAL(modelReset()), SLOT(onModelReset()));
+    onLayoutChanged();
 }
 
 void
-TagCloudView::onRows(const QModelIndex & parent, int start, int end)
+TagCloudView::onRowsInserted(const QModelIndex& parent, int start, int end)
 {
-    qDebug() << ".";
-	Q_UNUSED(parent);
-    Q_UNUSED(start);
-    Q_UNUSED(end);
-    // the model has changed (row inserted or deleted)
-    // which means our rects are now rubbish 
-    // (they will get refreshed in paintEvent()
-    //  ...which will happen eventually)
-    m_dirty = true;
+    if (parent.isValid())
+        return;
+
+    const int n = end - start + 1;
+    m_items.insert( start, n, Item() );
+    m_relayoutFrom = qMin( m_relayoutFrom, start );
+
+    // rows still to be measured move down with the rest
+    if (m_staleFrom <= m_staleTo) {
+        if (m_staleFrom >= start)
+            m_staleFrom += n;
+        if (m_staleTo >= start)
+            m_staleTo += n;
+    }
     viewport()->update();
 }
 
-int gBaseline, gLeftMargin; //filthy but easiest
 void
-TagCloudView::rectcalc()
+TagCloudView::onRowsRemoved(const QModelIndex& parent, int start, int end)
 {
-    QStyleOptionViewItem const opt = viewOptions();
-    int baseline = 0;
+    if (parent.isValid())
+        return;
 
-    m_rects.clear();
-    for (int j = 0; j < model()->rowCount(); ++j)
-    {
-        QModelIndex const i = model()->index( j, 0 );
-        QRect r( QPoint(), itemDelegate()->sizeHint( opt, i ) );
-        if (baseline == 0)
-            baseline = gBaseline;
+    const int n = end - start + 1;
+    m_items.remove( start, n );
+    m_relayoutFrom = qMin( m_relayoutFrom, start );
+
+    // and up, the removed ones with them
+    if (m_staleFrom <= m_staleTo) {
+        m_staleFrom = m_staleFrom > end ? m_staleFrom - n : qMin( m_staleFrom, start );
+        m_staleTo = m_staleTo > end ? m_staleTo - n : qMin( m_staleTo, start - 1 );
+        if (m_staleFrom > m_staleTo) {
+            m_staleFrom = INT_MAX;
+            m_staleTo = -1;
+        }
+    }
+    viewport()->update();
+}
 
-        r.moveTo( gLeftMargin, baseline-gBaseline );
+void
+TagCloudView::onLayoutChanged()
+{
+    // any row could be any tag now, but the sizes of the tags are the same
+    m_items.fill( Item(), model() ? model()->rowCount() : 0 );
+    m_lines.clear();
+    m_relayoutFrom = 0;
+    markStale( 0, m_items.size() - 1 );
+    viewport()->update();
+}
+
+void
+TagCloudView::onModelReset()
+{
+    // the tags may all be different ones, don't hang on to the old sizes
+    m_measured.clear();
+    onLayoutChanged();
+}
 
-        m_rects.insert(j, r);
+// virtual
+void
+TagCloudView::dataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight)
+{
+    // a tag's weight, and so its size, may have changed
+    if (topLeft.isValid() && bottomRight.isValid())
+        markStale( topLeft.row(), bottomRight.row() );
+    else
+        markStale( 0, m_items.size() - 1 );
+    QAbstractItemView::dataChanged(topLeft, bottomRight);
+}
+
+void
+TagCloudView::markStale( int first, int last )
+{
+    m_staleFrom = qMin( m_staleFrom, first );
+    m_staleTo = qMax( m_staleTo, last );
+    viewport()->update();
+}
+
+bool
+TagCloudView::needsLayout() const
+{
+    return m_relayoutFrom != INT_MAX || m_staleFrom <= m_staleTo || m_layoutWidth != viewport()->width();
+}
+
+int gBaseline, gLeftMargin; // set by TagDelegate::sizeHint, filthy but easiest
+
+// returns true if the tag's size or alignment changed
+bool
+TagCloudView::measure( int row, const QStyleOptionViewItem& opt )
+{
+    const QModelIndex i = model()->index( row, 0 );
+    const QString text = i.data().toString();
+    const float weight = i.data( PlaydarTagCloudModel::LinearWeightRole ).value<float>();
+
+    Item& item = m_items[row];
+    if (item.size.isValid() && item.weight == weight && item.text == text)
+        return false;
+
+    // a tag keeps its size as it moves about the cloud
+    Item m;
+    QHash<QString, Item>::const_iterator cached = m_measured.constFind( text );
+    if (cached != m_measured.constEnd() && cached->weight == weight) {
+        m = *cached;
+    } else {
+        m.text = text;
+        m.weight = weight;
+        m.size = itemDelegate()->sizeHint( opt, i );
+        m.baseline = gBaseline;
+        m.leftMargin = gLeftMargin;
+        m_measured.insert( text, m );
     }
+
+    const bool changed = m.size != item.size || m.baseline != item.baseline || m.leftMargin != item.leftMargin;
+    m.rect = item.rect;
+    item = m;
+    return changed;
 }
 
+// the first line that could reach down to y
+int
+TagCloudView::firstLineBelow( int y ) const
+{
+    int lo = 0, hi = m_lines.size();
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        if (m_lines[mid].y <= y)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    int l = qMax( 0, lo - 1 );
+    // tags are aligned on their baselines, so a line can hang below the next one's top
+    while (l > 0 && m_lines[l - 1].bottom >= y)
+        --l;
+    return l;
+}
+
+// the line row is on, or would start
+int
+TagCloudView::lineOf( int row ) const
+{
+    int lo = 0, hi = m_lines.size();
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        if (m_lines[mid].first <= row)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return qMax( 0, lo - 1 );
+}
 
 void
 TagCloudView::updateGeometries()
 {
-    boost::timer bt;
-
     if (!model())
         return;
 
-    rectcalc(); //TODO only needs to be done once when data is set!
+    const int width = viewport()->width();
+    if (width != m_layoutWidth) {
+        m_layoutWidth = width;
+        m_relayoutFrom = 0;
+    }
+
+    // measure what has changed, only changes of size move anything
+    QStyleOptionViewItem const opt = viewOptions();
+    const int count = m_items.size();
+    for (int j = qMax( 0, m_staleFrom ); j <= m_staleTo && j < count; ++j)
+        if (measure( j, opt ))
+            m_relayoutFrom = qMin( m_relayoutFrom, j );
+    m_staleFrom = INT_MAX;
+    m_staleTo = -1;
+
+    if (m_relayoutFrom == INT_MAX) {
+        QAbstractItemView::updateGeometries();
+        return;
+    }
 
-    const int VIEWPORT_MARGIN = 10;
+    // rows inserted with no stale range still need measuring
+    for (int j = m_relayoutFrom; j < count; ++j)
+        if (!m_items[j].size.isValid())
+            measure( j, opt );
 
+    // lay out again from the line before the first change, whose last tag
+    // could now fit on it, everything before that stays where it is
+    const int line = m_relayoutFrom == 0 ? 0 : qMax( 0, lineOf( m_relayoutFrom ) - 1 );
+    int j = 0;
     int y = VIEWPORT_MARGIN;
-    int left_margin = 0; // the left baseline to align text against
+    if (line > 0) {
+        j = m_lines[line].first;
+        y = m_lines[line].y;
+    }
+    m_lines.resize( line );
+
+    // the first tag's alignment is the one every line is aligned against
+    const int baseline = count ? m_items[0].baseline : 0;
+    const int left_margin = count ? m_items[0].leftMargin : 0;
 
     // iterate in model-order to lay the tags out left to right
-    for (int j = 0; j < model()->rowCount(); ++j)
+    while (j < count)
     {
-        QRect r = m_rects[j];
-        if (left_margin == 0) 
-            left_margin = r.x();
+        Line l;
+        l.first = j;
+        l.y = y;
+        l.top = INT_MAX;
+        l.bottom = INT_MIN;
 
         // do new row
-        int x = VIEWPORT_MARGIN + (left_margin - r.x());
+        int x = VIEWPORT_MARGIN + (left_margin - m_items[j].leftMargin);
         int tallest = 0;
-        for (; j < model()->rowCount(); ++j)
+        for (; j < count; ++j)
         {
-            QRect r = m_rects[j];
-            r.moveTo( x, y + r.y() );
+            QRect r( QPoint( x, y + baseline - m_items[j].baseline ), m_items[j].size );
 
             x += r.width();
             if (tallest != 0 //need at least one thing per row
-                && x > viewport()->width() - VIEWPORT_MARGIN) 
+                && x > width - VIEWPORT_MARGIN) 
             { 
-                --j; break; 
+                break; 
             }
 
-            m_rects[j] = r;
+            m_items[j].rect = r;
             tallest = qMax( tallest, r.bottom() - y );
+            l.top = qMin( l.top, r.top() );
+            l.bottom = qMax( l.bottom, r.bottom() );
         }
 
+        l.end = j;
+        m_lines << l;
         y += tallest;
     }
+    m_relayoutFrom = INT_MAX;
 
     verticalScrollBar()->setRange( 0, y + VIEWPORT_MARGIN - viewport()->height() );
     verticalScrollBar()->setPageStep( viewport()->height() );
@@ -250,11 +416,24 @@ QModelIndex
 TagCloudView::indexAt( const QPoint& pos ) const
 {
     QPoint p = pos + QPoint( 0, verticalScrollBar()->value());
-    RectsConstIt it = m_rects.constBegin();
-    for (int c = 0; it != m_rects.constEnd(); it++, c++) {
-        if( it->contains( p )) {
-            return model()->index(c, 0);
+
+    for (int l = firstLineBelow( p.y() ); l < m_lines.size() && m_lines[l].top <= p.y(); ++l)
+    {
+        const Line& line = m_lines[l];
+        if (p.y() > line.bottom)
+            continue;
+
+        // the tags on a line run left to right, find the last to start before p
+        int lo = line.first, hi = line.end;
+        while (lo < hi) {
+            const int mid = (lo + hi) / 2;
+            if (m_items[mid].rect.left() <= p.x())
+                lo = mid + 1;
+            else
+                hi = mid;
         }
+        if (lo > line.first && m_items[lo - 1].rect.contains( p ))
+            return model()->index(lo - 1, 0);
     }
     return QModelIndex();
 }
@@ -263,7 +442,9 @@ TagCloudView::indexAt( const QPoint& pos ) const
 QRect
 TagCloudView::visualRect( const QModelIndex& i ) const
 {
-    return m_rects[ i.row() ].translated( 0, -verticalScrollBar()->value());
+    if (!i.isValid() || i.row() >= m_items.size())
+        return QRect();
+    return m_items[ i.row() ].rect.translated( 0, -verticalScrollBar()->value());
 }
 
 
@@ -286,15 +467,18 @@ TagCloudView::viewportEvent( QEvent* event )
             QMouseEvent* e = static_cast< QMouseEvent* >( event );
             QModelIndex const oldindex = m_hoverIndex;
             m_hoverIndex = indexAt( e->pos() );
-            if (oldindex != m_hoverIndex)
-                viewport()->update();
+            // only the tags that were and are under the mouse need repainting
+            if (oldindex != m_hoverIndex) {
+                viewport()->update( visualRect( oldindex ) );
+                viewport()->update( visualRect( m_hoverIndex ) );
+            }
             break;
         }
 
         case QEvent::MouseButtonPress:
         case QEvent::MouseButtonRelease:
             if (m_hoverIndex.isValid())
-                viewport()->update();
+                viewport()->update( visualRect( m_hoverIndex ) );
             break;
 
         case QEvent::KeyPress:
@@ -308,4 +492,13 @@ TagCloudView::viewportEvent( QEvent* event )
 }
 
 
-
+void
+TagCloudView::changeEvent( QEvent* event )
+{
+    // every tag is a different size in a different font
+    if (event->type() == QEvent::FontChange || event->type() == QEvent::StyleChange) {
+        m_measured.clear();
+        onLayoutChanged();
+    }
+    QAbstractItemView::changeEvent( event );
+}
@@ -21,6 +21,8 @@
 #define TAG_CLOUD_VIEW_H
 
 #include <QAbstractItemView>
+#include <QHash>
+#include <QVector>
 #include "playdar/BoffinTagRequest.h"
 
 class TagCloudView : public QAbstractItemView
@@ -42,13 +44,15 @@ public slots:
 
 protected slots:
     virtual void updateGeometries();
-    void onRows(const QModelIndex & parent, int start, int end);
+    void onRowsInserted(const QModelIndex & parent, int start, int end);
+    void onRowsRemoved(const QModelIndex & parent, int start, int end);
+    void onLayoutChanged();
+    void onModelReset();
+    virtual void dataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight);
     void onFetchedTags();
     void onTag( const BoffinTagItem& );
 
 protected:
-    void rectcalc();
-
     virtual void paintEvent( QPaintEvent* );
     virtual bool isIndexHidden( const QModelIndex& ) const{ return false; }
     virtual void setSelection( const QRect&, QItemSelectionModel ){};
@@ -59,16 +63,53 @@ protected:
     virtual void setSelection( const QRect&, QItemSelectionModel::SelectionFlags );
 
     virtual bool viewportEvent(QEvent *event);
+    virtual void changeEvent(QEvent *event);
 
     QModelIndex m_hoverIndex;
-    QHash<int, QRect> m_rects;      // row -> QRect
 
-    typedef QHash<int, QRect>::const_iterator RectsConstIt;
-    typedef QHash<int, QRect>::iterator RectsIt;
+private:
+    /** a tag as the delegate measured it, and where it was laid out */
+    struct Item
+    {
+        Item() : weight( -1 ), leftMargin( 0 ), baseline( 0 ) {}
+
+        QString text;
+        float weight;
+        QSize size;
+        int leftMargin;
+        int baseline;
+        QRect rect;         // in contents coordinates
+    };
+
+    /** the rows laid out side by side, for finding tags by position */
+    struct Line
+    {
+        int first;
+        int end;
+        int y;
+        int top;            // of the highest and lowest tag on it
+        int bottom;
+    };
+
+    bool measure( int row, const QStyleOptionViewItem& );
+    void markStale( int first, int last );
+    bool needsLayout() const;
+    int firstLineBelow( int y ) const;
+    int lineOf( int row ) const;
+
+    QVector<Item> m_items;              // by row
+    QVector<Line> m_lines;              // top to bottom
+    QHash<QString, Item> m_measured;    // so moving tags aren't measured again
+
+    int m_relayoutFrom;                 // INT_MAX if the layout is good
+    int m_staleFrom;                    // rows to measure again
+    int m_staleTo;
+    int m_layoutWidth;
 
-    bool m_dirty;
     bool m_fetched;
     QString m_loadedTag;
+
+    friend class TestTagCloudView;  // checks the sizes it measured
 };
 
 #endif //TAG_CLOUD_VIEW_H
@@ -0,0 +1,368 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include "TrackPrefetcher.h"
+
+
+namespace
+{
+    const qint64 k_defaultMaxCacheSize = 64 * 1024 * 1024;
+
+    // the track Phonon is playing and the one queued after it
+    const int k_maxPlaying = 2;
+
+    const int k_maxRedirects = 5;
+
+    int status( QNetworkReply* reply )
+    {
+        return reply->attribute( QNetworkRequest::HttpStatusCodeAttribute ).toInt();
+    }
+}
+
+
+TrackPrefetcher::TrackPrefetcher( const QString& cacheDir, QObject* parent )
+               : QObject( parent )
+               , m_nam( new QNetworkAccessManager( this ) )
+               , m_dir( cacheDir )
+               , m_maxCacheSize( k_defaultMaxCacheSize )
+               , m_cacheSize( 0 )
+               , m_serial( 0 )
+{
+    QDir dir;
+    dir.mkpath( m_dir );
+
+    // whatever the last run left, if it couldn't remove a file that was playing
+    dir.setPath( m_dir );
+    foreach (const QString& name, dir.entryList( QDir::Files ))
+        dir.remove( name );
+}
+
+
+TrackPrefetcher::~TrackPrefetcher()
+{
+    foreach (Entry* e, m_upcoming)
+        drop( e );
+    foreach (const QString& path, m_playing)
+        QFile::remove( path );
+}
+
+
+void
+TrackPrefetcher::setMaxCacheSize( qint64 bytes )
+{
+    m_maxCacheSize = bytes;
+}
+
+
+void
+TrackPrefetcher::setUpcoming( const QList<QUrl>& urls )
+{
+    QList<Entry*> upcoming;
+    QList<QUrl> seen;
+    foreach (const QUrl& url, urls)
+    {
+        if (url.scheme() != "http" || seen.contains( url ))
+            continue;
+        seen << url;
+
+        Entry* e = find( url );
+        if (!e)
+        {
+            e = new Entry;
+            e->url = url;
+            e->reply = 0;
+            e->file = 0;
+            e->size = 0;
+            e->redirects = 0;
+            e->done = false;
+            e->failed = false;
+        }
+        upcoming << e;
+    }
+
+    foreach (Entry* e, m_upcoming)
+        if (!upcoming.contains( e ))
+            drop( e );
+
+    m_upcoming = upcoming;
+    startNext();
+}
+
+
+QUrl
+TrackPrefetcher::take( const QUrl& url )
+{
+    Entry* e = find( url );
+    if (!e)
+        return url;
+
+    QUrl result = url;
+    if (e->done)
+    {
+        // the file isn't the upcoming tracks' to count any more, it's Phonon's
+        const QString path = e->file->fileName();
+        result = QUrl::fromLocalFile( path );
+        m_playing << path;
+        m_cacheSize -= e->size;
+        delete e->file;
+        e->file = 0;
+        e->size = 0;
+
+        while (m_playing.size() > k_maxPlaying)
+            QFile::remove( m_playing.takeFirst() );
+    }
+
+    // if it wasn't done Phonon will stream it, so there's no point in carrying on
+    drop( e );
+    startNext();
+    return result;
+}
+
+
+bool
+TrackPrefetcher::isCached( const QUrl& url ) const
+{
+    Entry* e = find( url );
+    return e && e->done;
+}
+
+
+TrackPrefetcher::Entry*
+TrackPrefetcher::find( const QUrl& url ) const
+{
+    foreach (Entry* e, m_upcoming)
+        if (e->url == url)
+            return e;
+    return 0;
+}
+
+
+TrackPrefetcher::Entry*
+TrackPrefetcher::entry( QObject* reply ) const
+{
+    foreach (Entry* e, m_upcoming)
+        if (e->reply == reply)
+            return e;
+    return 0;
+}
+
+
+void
+TrackPrefetcher::startNext()
+{
+    foreach (Entry* e, m_upcoming)
+        if (e->reply)
+            return;     // one at a time, or the next track would wait on the rest
+
+    foreach (Entry* e, m_upcoming)
+    {
+        if (e->done || e->failed)
+            continue;
+
+        e->file = new QFile( m_dir + '/' + QString::number( m_serial++ ) + ".part" );
+        if (!e->file->open( QIODevice::WriteOnly | QIODevice::Truncate ))
+        {
+            fail( e, "couldn't write to the cache" );
+            continue;
+        }
+
+        fetch( e, e->url );
+        return;
+    }
+}
+
+
+void
+TrackPrefetcher::fetch( Entry* e, const QUrl& url )
+{
+    e->reply = m_nam->get( QNetworkRequest( url ) );
+    connect( e->reply, SIGNAL(readyRead()), SLOT(onReadyRead()) );
+    connect( e->reply, SIGNAL(finished()), SLOT(onFinished()) );
+}
+
+
+void
+TrackPrefetcher::onReadyRead()
+{
+    Entry* e = entry( sender() );
+    if (!e)
+        return;
+
+    // a redirect's body, or an error page's, isn't the track. onFinished
+    // sorts out which it was
+    const QByteArray data = e->reply->readAll();
+    if (status( e->reply ) / 100 != 2)
+        return;
+
+    if (m_cacheSize + data.size() > m_maxCacheSize)
+    {
+        fail( e, "doesn't fit in the cache" );
+        startNext();
+        return;
+    }
+    if (e->file->write( data ) != data.size())
+    {
+        fail( e, "couldn't write to the cache" );
+        startNext();
+        return;
+    }
+
+    e->size += data.size();
+    m_cacheSize += data.size();
+}
+
+
+void
+TrackPrefetcher::onFinished()
+{
+    Entry* e = entry( sender() );
+    if (!e)
+        return;
+
+    if (e->reply->error() != QNetworkReply::NoError)
+    {
+        fail( e, "couldn't fetch it" );
+        startNext();
+        return;
+    }
+
+    const int code = status( e->reply );
+    if (code / 100 == 3)
+    {
+        const QUrl target = e->reply->attribute( QNetworkRequest::RedirectionTargetAttribute ).toUrl();
+        if (target.isEmpty() || ++e->redirects > k_maxRedirects)
+        {
+            fail( e, "couldn't follow the redirect" );
+            startNext();
+            return;
+        }
+
+        // nothing has been written to the file, it was all redirect
+        const QUrl url = e->reply->url().resolved( target );
+        stopFetching( e );
+        fetch( e, url );
+        return;
+    }
+    if (code / 100 != 2)
+    {
+        fail( e, "couldn't fetch it" );
+        startNext();
+        return;
+    }
+
+    // anything readyRead didn't get
+    if (e->reply->bytesAvailable())
+    {
+        onReadyRead();
+        if (e->failed)
+            return;
+    }
+
+    // backends that go by the extension need the right one
+    const QString contentType = e->reply->header( QNetworkRequest::ContentTypeHeader ).toString();
+    QString path = e->file->fileName();
+    path.replace( path.length() - 4, 4, suffix( contentType ) );
+
+    stopFetching( e );
+    e->file->close();
+    if (!e->file->rename( path ))
+    {
+        fail( e, "couldn't rename it" );
+        startNext();
+        return;
+    }
+
+    e->done = true;
+    emit cached( e->url );
+    startNext();
+}
+
+
+void
+TrackPrefetcher::stopFetching( Entry* e )
+{
+    if (e->reply)
+    {
+        e->reply->disconnect( this );
+        e->reply->abort();
+        e->reply->deleteLater();
+        e->reply = 0;
+    }
+}
+
+
+void
+TrackPrefetcher::drop( Entry* e )
+{
+    stopFetching( e );
+    if (e->file)
+    {
+        e->file->remove();
+        delete e->file;
+    }
+    m_cacheSize -= e->size;
+    m_upcoming.removeAll( e );
+    delete e;
+}
+
+
+void
+TrackPrefetcher::fail( Entry* e, const char* why )
+{
+    qDebug() << "not prefetching" << e->url << why;
+
+    stopFetching( e );
+    if (e->file)
+    {
+        e->file->remove();
+        delete e->file;
+        e->file = 0;
+    }
+    m_cacheSize -= e->size;
+    e->size = 0;
+    e->failed = true;
+}
+
+
+//static
+QString
+TrackPrefetcher::suffix( const QString& contentType )
+{
+    const QString type = contentType.section( ';', 0, 0 ).trimmed().toLower();
+
+    if (type == "audio/mpeg" || type == "audio/mp3")
+        return "mp3";
+    if (type == "audio/mp4" || type == "audio/x-m4a" || type == "audio/aac")
+        return "m4a";
+    if (type == "audio/ogg" || type == "application/ogg" || type == "audio/vorbis")
+        return "ogg";
+    if (type == "audio/flac" || type == "audio/x-flac")
+        return "flac";
+    if (type == "audio/wav" || type == "audio/x-wav")
+        return "wav";
+    if (type == "audio/x-ms-wma")
+        return "wma";
+    return "audio";
+}
@@ -0,0 +1,100 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRACK_PREFETCHER_H
+#define TRACK_PREFETCHER_H
+
+#include <QList>
+#include <QObject>
+#include <QStringList>
+#include <QUrl>
+
+class QFile;
+class QNetworkAccessManager;
+class QNetworkReply;
+
+/** Downloads the tracks that are coming up into a local cache, so that by
+  * the time MediaPipeline gets to one Phonon can open a file instead of
+  * waiting on the network. One track is fetched at a time, soonest first.
+  *
+  * Only http urls are fetched, anything else is played as it is. */
+class TrackPrefetcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    /** files are kept in cacheDir, which is made if it isn't there */
+    TrackPrefetcher( const QString& cacheDir, QObject* parent = 0 );
+    ~TrackPrefetcher();
+
+    /** The upcoming tracks never take more than this much disk between them,
+      * one that would take it over isn't cached. 64MB by default. */
+    void setMaxCacheSize( qint64 bytes );
+    qint64 maxCacheSize() const { return m_maxCacheSize; }
+
+    /** the urls that are coming up, soonest first. anything we've fetched
+      * or are fetching that isn't in here any more is thrown away */
+    void setUpcoming( const QList<QUrl>& urls );
+
+    /** What to play for url, which is about to start. A local file if all
+      * of it was fetched, otherwise url itself. */
+    QUrl take( const QUrl& url );
+
+    bool isCached( const QUrl& url ) const;
+    qint64 cacheSize() const { return m_cacheSize; }
+
+signals:
+    void cached( const QUrl& url );
+
+private slots:
+    void onReadyRead();
+    void onFinished();
+
+private:
+    struct Entry
+    {
+        QUrl url;
+        QNetworkReply* reply;   // while it's being fetched
+        QFile* file;
+        qint64 size;
+        int redirects;          // followed so far, QNetworkAccessManager doesn't
+        bool done;
+        bool failed;            // or didn't fit, we don't try again
+    };
+
+    Entry* find( const QUrl& url ) const;
+    Entry* entry( QObject* reply ) const;
+    void startNext();
+    void fetch( Entry*, const QUrl& );
+    void stopFetching( Entry* );
+    void drop( Entry* );
+    void fail( Entry*, const char* why );
+    static QString suffix( const QString& contentType );
+
+    QNetworkAccessManager* m_nam;
+    QString m_dir;
+    qint64 m_maxCacheSize;
+    qint64 m_cacheSize;
+    int m_serial;
+
+    QList<Entry*> m_upcoming;
+    QStringList m_playing;      // files we've handed out, kept until they're played
+};
+
+#endif
@@ -77,10 +77,18 @@ TrackSource::size()
     return m_buffer.size();
 }
 
+// MediaPipeline prefetches everything in the buffer, so this is its lookahead too.
+// Shrinking it keeps what's there, the shuffler has already drawn those tracks
+// and won't give them to us again this time round, so it goes down as they're
+// played
 void
 TrackSource::setSize(unsigned maxSize)
 {
+    const int size = m_buffer.size();
     m_maxSize = maxSize;
+    fillBuffer();
+    if (m_buffer.size() != size)
+        emit changed();
 }
 
 void
@@ -30,6 +30,7 @@
 XspfDialog::XspfDialog(QString path, PlaydarConnection* playdar, QWidget *parent)
 :QDialog(parent)
 ,m_playdar(playdar)
+,m_count(0)
 {
     QLayout* layout = new QHBoxLayout();
     m_treewidget = new QTreeWidget();
@@ -42,30 +43,31 @@ XspfDialog::XspfDialog(QString path, PlaydarConnection* playdar, QWidget *parent
     setLayout(layout);
     setSizeGripEnabled(true);
 
-    m_reader = new XspfReader(path);
-    connect(m_reader, SIGNAL(xspf(lastfm::Xspf)), SLOT(onXspf(lastfm::Xspf)));
+    // tracks are resolved as they're read, rather than once it's all downloaded
+    m_reader = new XspfReader(QUrl::fromLocalFile(path));
+    m_reader->setParent(this);
+    connect(m_reader, SIGNAL(title(QString)), SLOT(setWindowTitle(QString)));
+    connect(m_reader, SIGNAL(tracks(QList<Track>)), SLOT(onTracks(QList<Track>)));
 }
 
 void
-XspfDialog::onXspf(const lastfm::Xspf& xspf)
+XspfDialog::onTracks(const QList<Track>& tracks)
 {
-    setWindowTitle(xspf.title());
-    int i = 0;
-    foreach(const lastfm::Track& t, xspf.tracks()) {
+    foreach(const lastfm::Track& t, tracks) {
         TrackResolveRequest* req = m_playdar->trackResolve(t.artist(), t.album(), t.title());
 
         QTreeWidgetItem* item = new QTreeWidgetItem();
-        m_reqmap[req->qid()] = item;
-        item->setData(0, Qt::DisplayRole, QString::number(i));
+        if (req) {
+            m_reqmap[req->qid()] = item;
+            connect(req, SIGNAL(result(BoffinPlayableItem)), SLOT(onResolveResult(BoffinPlayableItem)));
+        }
+        item->setData(0, Qt::DisplayRole, QString::number(m_count++));
         item->setData(1, Qt::DisplayRole, (QString)t.artist());
         item->setData(2, Qt::DisplayRole, (QString)t.album());
         item->setData(3, Qt::DisplayRole, (QString)t.title());
         item->setData(4, Qt::DisplayRole, t.duration());
         item->setData(5, Qt::DisplayRole, t.url().toString());
         m_treewidget->addTopLevelItem(item);
-
-        connect(req, SIGNAL(result(BoffinPlayableItem)), SLOT(onResolveResult(BoffinPlayableItem)));
-        i++;
     }
 }
 
@@ -21,7 +21,8 @@
 
 #include <QDialog>
 #include <QMap>
-#include <lastfm/Xspf>
+#include <QList>
+#include <types/Track.h>
 
 class QTreeWidget;
 class QTreeWidgetItem;
@@ -37,7 +38,7 @@ public:
     XspfDialog(QString url, PlaydarConnection* playdar, QWidget *parent = 0);
 
 private slots:
-    void onXspf(const lastfm::Xspf& xspf);
+    void onTracks(const QList<Track>& tracks);
     void onResolveResult(const BoffinPlayableItem& item);
 
 private:
@@ -45,6 +46,7 @@ private:
     QTreeWidget* m_treewidget;
     PlaydarConnection* m_playdar;
     QMap<QString, QTreeWidgetItem*> m_reqmap;    // map request qid to index
+    int m_count;                                 // tracks so far
 };
 
 #endif
@@ -18,6 +18,7 @@
  ***************************************************************************/
 
 #include "XspfReader.h"
+#include <QDebug>
 #include <QNetworkReply>
 #include <QNetworkRequest>
 #include <lastfm/NetworkAccessManager>
@@ -25,31 +26,152 @@
 
  XspfReader::XspfReader(QUrl url)
 : m_url(url)
+, m_depth(0)
+, m_playlistDepth(0)
+, m_trackListDepth(0)
+, m_trackDepth(0)
+, m_field(None)
+, m_fieldDepth(0)
+, m_duration(0)
 {
     m_reply = (new lastfm::NetworkAccessManager(this))->get(QNetworkRequest(m_url));
+    connect(m_reply, SIGNAL(readyRead()), SLOT(onReadyRead()));
     connect(m_reply, SIGNAL(finished()), SLOT(onFinished()));
 }
 
+void
+XspfReader::onReadyRead()
+{
+    m_xml.addData(m_reply->readAll());
+    parse();
+    flush();
+}
+
 void
 XspfReader::onFinished()
 {
-    QDomDocument xmldoc;
-    xmldoc.setContent(m_reply);
-    QDomElement docElement(xmldoc.documentElement());
-    if (docElement.tagName() == "playlist") {
-        handleXspf(docElement);
-    } else if (docElement.tagName() == "lfm") {
-        handleXspf(docElement.firstChildElement("playlist"));
-    } else {
-        // todo
+    m_xml.addData(m_reply->readAll());
+    parse();
+    flush();
+
+    // running out of data is only an error now we know there's no more
+    if (m_reply->error() != QNetworkReply::NoError) {
+        qWarning() << "couldn't fetch" << m_url << m_reply->errorString();
+    } else if (m_xml.hasError()) {
+        qWarning() << "xspf error in" << m_url << "at line" << m_xml.lineNumber() << m_xml.errorString();
     }
+
     m_reply->deleteLater();
     m_reply = 0;
+    emit finished();
 }
 
-void 
-XspfReader::handleXspf(const QDomElement& playlistElement)
+void
+XspfReader::parse()
 {
-    Xspf xspf(playlistElement);
-    emit XspfReader::xspf(xspf);
+    while (!m_xml.atEnd()) {
+        switch (m_xml.readNext()) {
+            case QXmlStreamReader::StartElement:
+                ++m_depth;
+                startElement();
+                break;
+
+            case QXmlStreamReader::EndElement:
+                endElement();
+                --m_depth;
+                break;
+
+            case QXmlStreamReader::Characters:
+                if (m_field != None)
+                    m_text += m_xml.text();
+                break;
+
+            default:
+                break;
+        }
+    }
+    // atEnd() with PrematureEndOfDocumentError just means we need more data
+}
+
+void
+XspfReader::startElement()
+{
+    const QStringRef name = m_xml.name();
+
+    if (!m_playlistDepth) {
+        if (name == QLatin1String("playlist") && m_depth <= 2)
+            m_playlistDepth = m_depth;
+    } else if (m_trackDepth) {
+        if (m_depth == m_trackDepth + 1) {
+            m_field = name == QLatin1String("location") ? Location
+                    : name == QLatin1String("title") ? Title
+                    : name == QLatin1String("creator") ? Creator
+                    : name == QLatin1String("album") ? Album
+                    : name == QLatin1String("duration") ? Duration
+                    : None;
+            m_fieldDepth = m_depth;
+        }
+    } else if (m_trackListDepth) {
+        if (m_depth == m_trackListDepth + 1 && name == QLatin1String("track")) {
+            m_trackDepth = m_depth;
+            m_location.clear();
+            m_title.clear();
+            m_creator.clear();
+            m_album.clear();
+            m_duration = 0;
+        }
+    } else if (m_depth == m_playlistDepth + 1) {
+        if (name == QLatin1String("trackList"))
+            m_trackListDepth = m_depth;
+        else if (name == QLatin1String("title")) {
+            m_field = Title;
+            m_fieldDepth = m_depth;
+        }
+    }
+}
+
+void
+XspfReader::endElement()
+{
+    if (m_field != None && m_depth == m_fieldDepth) {
+        const QString text = m_text.trimmed();
+        if (!m_trackDepth) {
+            emit title(text);
+        } else switch (m_field) {
+            case Location: m_location = text; break;
+            case Title: m_title = text; break;
+            case Creator: m_creator = text; break;
+            case Album: m_album = text; break;
+            case Duration: m_duration = text.toInt(); break;
+            default: break;
+        }
+        m_field = None;
+        m_text.clear();
+    } else if (m_field != None) {
+        // something inside a field, its text is the field's
+    } else if (m_depth == m_trackDepth) {
+        Track t;
+        MutableTrack mt(t);
+        mt.setUrl(QUrl(m_location));
+        mt.setTitle(m_title);
+        mt.setArtist(m_creator);
+        mt.setAlbum(m_album);
+        mt.setDuration(m_duration / 1000);
+        mt.setSource(Track::Player);
+        m_tracks << t;
+        m_trackDepth = 0;
+    } else if (m_depth == m_trackListDepth) {
+        m_trackListDepth = 0;
+    } else if (m_depth == m_playlistDepth) {
+        m_playlistDepth = 0;
+    }
+}
+
+void
+XspfReader::flush()
+{
+    if (m_tracks.size()) {
+        emit tracks(m_tracks);
+        m_tracks.clear();
+    }
 }
@@ -16,28 +16,57 @@
  *   Free Software Foundation, Inc.,                                       *
  *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
  ***************************************************************************/
-
 #ifndef XSPF_READER
 #define XSPF_READER
  
 #include <QList>
-#include <lastfm/Xspf>
+#include <QUrl>
+#include <QXmlStreamReader>
+#include <types/Track.h>
 
 
+// Reads an xspf playlist as it downloads, a playlist element on its own
+// or in an lfm one. Tracks are emitted as soon as their elements close,
+// in batches of whatever arrived together, so nothing is kept that's
+// already been emitted.
 class XspfReader : public QObject
 {
     Q_OBJECT
 
+    enum Field { None, Title, Location, Creator, Album, Duration };
+
     QUrl m_url;
     class QNetworkReply *m_reply;
-    QList<Track> m_queue;
+    QXmlStreamReader m_xml;
+
+    int m_depth;            // of the element we're in, the document element is 1
+    int m_playlistDepth;    // 0 until we find it
+    int m_trackListDepth;
+    int m_trackDepth;       // 0 when we're not in a track
+    Field m_field;
+    int m_fieldDepth;
+    QString m_text;         // of m_field so far
+
+    QString m_location;
+    QString m_title;
+    QString m_creator;
+    QString m_album;
+    int m_duration;         // milliseconds
+
+    QList<Track> m_tracks;  // parsed but not emitted yet
 
-    void handleXspf(const QDomElement& playlistElement);
+    void parse();
+    void startElement();
+    void endElement();
+    void flush();
 
 signals:
-    void xspf(lastfm::Xspf);
+    void title(const QString&);
+    void tracks(const QList<Track>&);
+    void finished();
 
 private slots:
+    void onReadyRead();
     void onFinished();
 
 public:
@@ -1,4 +1,4 @@
-CONFIG += unicorn boost yajl
+CONFIG += unicorn boost yajl taglib
 QT += opengl sql phonon
 VERSION = 1.0.0
 DEFINES += LASTFM_COLLAPSE_NAMESPACE
@@ -37,19 +37,23 @@ SOURCES += \
 	playdar/PlaydarAuthRequest.cpp \
 	playdar/jsonGetMember.cpp \
 	playdar/CometRequest.cpp \
+	playdar/TrackResolveQueue.cpp \
 	playdar/BoffinTagRequest.cpp \
 	playdar/BoffinRqlRequest.cpp \
 	playdar/BoffinPlayableItem.cpp \
 	PickDirsDialog.cpp \
 	MediaPipeline.cpp \
+	TrackPrefetcher.cpp \
 	MainWindow.cpp \
 	main.cpp \
 	LocalCollectionScanner.cpp \
+	LocalCollectionIndex.cpp \
 	layouts/SideBySideLayout.cpp \
 	json_spirit/json_spirit_writer.cpp \
 	json_spirit/json_spirit_value.cpp \
 	json_spirit/json_spirit_reader.cpp \
 	HistoryWidget.cpp \
+	EditDistance.cpp \
 	comet/CometParser.cpp \
 	App.cpp
     
@@ -65,6 +69,7 @@ HEADERS += \
 	ScrobSocket.h \
 	ScanProgressWidget.h \
 	sample/SampleFromDistribution.h \
+	sample/FenwickSampler.h \
 	PlaylistWidget.h \
 	PlaylistModel.h \
 	Playlist.h \
@@ -79,13 +84,16 @@ HEADERS += \
 	playdar/PlaydarApi.h \
 	playdar/jsonGetMember.h \
 	playdar/CometRequest.h \
+	playdar/TrackResolveQueue.h \
 	playdar/BoffinTagRequest.h \
 	playdar/BoffinRqlRequest.h \
 	playdar/BoffinPlayableItem.h \
 	PickDirsDialog.h \
 	MediaPipeline.h \
+	TrackPrefetcher.h \
 	MainWindow.h \
 	LocalCollectionScanner.h \
+	LocalCollectionIndex.h \
 	layouts/SideBySideLayout.h \
 	json_spirit/json_spirit_writer.h \
 	json_spirit/json_spirit_value.h \
@@ -93,7 +101,9 @@ HEADERS += \
 	json_spirit/json_spirit_reader.h \
 	json_spirit/json_spirit.h \
 	HistoryWidget.h \
+	EditDistance.h \
 	comet/CometParser.h \
+	comet/CometKeyTable.hpp \
 	App.h
     
 RESOURCES += \
@@ -0,0 +1,181 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COMET_KEY_TABLE_HPP
+#define COMET_KEY_TABLE_HPP
+
+#include <cmath>
+#include <cstring>
+#include <QString>
+#include <QtGlobal>
+
+// a key, string or number straight from yajl: utf8, not nul terminated,
+// and only good until the callback it was passed to returns
+struct CometToken
+{
+    CometToken(const char* s, unsigned int len) : s(s), len(len) {}
+
+    QString toString() const { return QString::fromUtf8(s, len); }
+
+    const char* s;
+    unsigned int len;
+};
+
+
+// json number text to an int. like jsonGetMember, only integers will do
+inline bool
+cometToInt(const CometToken& t, int& out)
+{
+    const char* p = t.s;
+    const char* const end = t.s + t.len;
+    const bool negative = p != end && *p == '-';
+    if (negative)
+        ++p;
+    if (p == end)
+        return false;
+
+    qlonglong n = 0;
+    for (; p != end; ++p) {
+        if (*p < '0' || *p > '9')
+            return false;
+        n = n * 10 + (*p - '0');
+        if (n > 0x7fffffff)
+            return false;
+    }
+    out = (int) (negative ? -n : n);
+    return true;
+}
+
+// json number text to a double, without going through a QString.
+// yajl has already checked the syntax
+inline bool
+cometToDouble(const CometToken& t, double& out)
+{
+    const char* p = t.s;
+    const char* const end = t.s + t.len;
+    const bool negative = p != end && *p == '-';
+    if (negative)
+        ++p;
+    if (p == end)
+        return false;
+
+    double mantissa = 0;
+    int exponent = 0;
+    for (; p != end && *p >= '0' && *p <= '9'; ++p)
+        mantissa = mantissa * 10 + (*p - '0');
+    if (p != end && *p == '.') {
+        for (++p; p != end && *p >= '0' && *p <= '9'; ++p) {
+            mantissa = mantissa * 10 + (*p - '0');
+            --exponent;
+        }
+    }
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        const bool negativeExponent = p != end && *p == '-';
+        if (p != end && (*p == '-' || *p == '+'))
+            ++p;
+        int e = 0;
+        for (; p != end && *p >= '0' && *p <= '9'; ++p)
+            e = qMin(e * 10 + (*p - '0'), 9999);
+        exponent += negativeExponent ? -e : e;
+    }
+    if (p != end)
+        return false;
+
+    if (exponent < 0)
+        mantissa /= std::pow(10.0, -exponent);
+    else if (exponent > 0)
+        mantissa *= std::pow(10.0, exponent);
+    out = negative ? -mantissa : mantissa;
+    return true;
+}
+
+
+// A compile time table from the keys of a comet result to the members of
+// T they set, so the typed CometParser can fill T in as the values arrive.
+// Tables must be sorted by key, bytewise (as strcmp does it).
+//
+//  static const TCometKey<Foo> keys[] = {
+//      { "count", cometInt<Foo, &Foo::count> },
+//      { "name", cometString<Foo, &Foo::name> }
+//  };
+//
+template <typename T>
+struct TCometKey
+{
+    const char* key;
+    bool (*set)(T& target, const CometToken& value, bool isString);
+};
+
+template <typename T, QString T::*member>
+bool
+cometString(T& target, const CometToken& value, bool isString)
+{
+    if (!isString)
+        return false;
+    target.*member = value.toString();
+    return true;
+}
+
+template <typename T, int T::*member>
+bool
+cometInt(T& target, const CometToken& value, bool isString)
+{
+    return !isString && cometToInt(value, target.*member);
+}
+
+// integers are fine here, unlike jsonGetMember's float
+template <typename T, float T::*member>
+bool
+cometFloat(T& target, const CometToken& value, bool isString)
+{
+    double d;
+    if (isString || !cometToDouble(value, d))
+        return false;
+    target.*member = (float) d;
+    return true;
+}
+
+// sets the member of target that key names. returns the key's index in
+// table, or -1 if it's not in there or value was the wrong type for it
+template <typename T, int N>
+int
+cometSetMember(const TCometKey<T> (&table)[N], T& target, const CometToken& key, const CometToken& value, bool isString)
+{
+    int lo = 0;
+    int hi = N;
+    while (lo < hi) {
+        const int mid = (lo + hi) / 2;
+        const unsigned int len = (unsigned int) strlen(table[mid].key);
+
+        int c = memcmp(key.s, table[mid].key, qMin(key.len, len));
+        if (c == 0)
+            c = key.len < len ? -1 : key.len > len ? 1 : 0;
+
+        if (c == 0)
+            return table[mid].set(target, value, isString) ? mid : -1;
+        if (c < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return -1;
+}
+
+#endif
@@ -17,10 +17,17 @@
    You should have received a copy of the GNU General Public License
    along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <cstring>
 #include "CometParser.h"
 
 CometParser::CometParser(QObject *parent)
 : QObject(parent)
+, m_handler(0)
+, m_depth(0)
+, m_query(NoQuery)
+, m_inResult(false)
+, m_fallbackDepth(0)
+, m_keyLen(-1)
 {
     yajl_parser_config cfg = { 1 /* allow comments */, 0 /* don't check the incoming utf8 */ };
     m_handle = yajl_alloc(&CometCallbacks::callbacks, &cfg, NULL, (void *) this);
@@ -39,6 +46,12 @@ CometParser::push(const QByteArray& ba)
     return status == yajl_status_ok || status == yajl_status_insufficient_data;
 }
 
+void
+CometParser::setResultHandler(CometResultHandler* handler)
+{
+    m_handler = handler;
+}
+
 
 //static
 void
@@ -84,93 +97,236 @@ CometParser::nop()
 {
 }
 
+int
+CometParser::startObject()
+{
+    if (m_insertStack.size() == 0)
+        return 0;       // the comet stream we expect has objects wrapped in an array, thx.
+
+    Object *o = new Object();
+    m_atEndStack.push( boost::bind(&CometParser::postObjectInserter, m_insertStack.top(), m_key, o) );
+    m_insertStack.push( boost::bind(&CometParser::objectInserter, o, _1, _2) );
+    return 1;
+}
+
+int
+CometParser::startArray()
+{
+    if (m_insertStack.size() == 0) {
+        // the first enclosing array...
+        // has a special inserter to call the function to emit the haveObject signal
+        m_atEndStack.push( boost::bind(&CometParser::nop) );
+        m_insertStack.push( boost::bind(&CometParser::haveObject, this, _1, _2) );
+    } else {
+        Array *a = new Array();
+        m_atEndStack.push( boost::bind(&CometParser::postArrayInserter, m_insertStack.top(), m_key, a) );
+        m_insertStack.push( boost::bind(&CometParser::arrayInserter, a, _1, _2) );
+    }
+    return 1;
+}
+
+void
+CometParser::insert(const QVariant& v)
+{
+    m_insertStack.top()( m_key, v );
+}
+
+int
+CometParser::end()
+{
+    m_insertStack.pop();
+    m_atEndStack.pop()();
+
+    if (m_handler && --m_fallbackDepth == 0) {
+        // that was the result, lose the inserter typedStartMap gave it
+        m_insertStack.pop();
+        m_atEndStack.pop();
+        --m_depth;
+    }
+    return 1;
+}
+
+////////////////////////////////
+
+// typed mode:
+//
+// the depth tells us where we are: 1 is the stream's array, 2 one of its
+// objects and 3 that object's result. anything deeper, and any member we
+// don't want, is only counted past.
+
+int
+CometParser::typedStartMap()
+{
+    if (m_depth == 0)
+        return 0;       // as startObject
+
+    ++m_depth;
+    if (m_depth == 2) {
+        m_query = NoQuery;
+        m_inResult = false;
+        m_fallback.clear();
+    } else if (m_depth == 3 && keyIs("result")) {
+        if (m_query == Accepted) {
+            m_inResult = true;
+        } else if (m_query == NoQuery) {
+            // we don't know who it's for yet, so build it the old way
+            m_atEndStack.push( boost::bind(&CometParser::nop) );
+            m_insertStack.push( boost::bind(&CometParser::objectInserter, &m_fallback, _1, _2) );
+            m_key = "result";
+            m_fallbackDepth = 1;
+            return startObject();
+        }
+    }
+    return 1;
+}
+
+int
+CometParser::typedEndMap()
+{
+    if (m_depth == 3 && m_inResult) {
+        m_inResult = false;
+        m_handler->endResult();
+    } else if (m_depth == 2 && m_fallback.size()) {
+        if (m_fallback.contains("query"))
+            emit haveObject(m_fallback);
+        m_fallback.clear();
+    }
+    --m_depth;
+    return 1;
+}
+
+void
+CometParser::typedScalar(const CometToken& value, bool isString)
+{
+    if (m_depth == 3 && m_inResult) {
+        if (m_keyLen >= 0)
+            m_handler->resultMember(CometToken(m_keyBuf, m_keyLen), value, isString);
+    } else if (m_depth == 2 && isString && keyIs("query")) {
+        if (m_fallback.size())
+            m_fallback.insert("query", value.toString());
+        else if (m_query == NoQuery)
+            m_query = m_handler->beginResult(value) ? Accepted : Rejected;
+    }
+}
+
+bool
+CometParser::keyIs(const char* key) const
+{
+    return m_keyLen == (int) strlen(key) && memcmp(m_keyBuf, key, m_keyLen) == 0;
+}
+
 ////////////////////////////////
 
 // yajl callbacks:
 int
 CometParser::json_null()
 {
-    m_insertStack.top()( m_key, QVariant() );
+    if (m_handler && !m_fallbackDepth)
+        return 1;       // nothing we fill in can be null
+
+    insert( QVariant() );
     return 1;
 }
 
 int
 CometParser::json_boolean(int boolVal)
 {
-    m_insertStack.top()( m_key, QVariant(boolVal ? true : false) );
+    if (m_handler && !m_fallbackDepth)
+        return 1;       // or a bool
+
+    insert( QVariant(boolVal ? true : false) );
     return 1;
 }
 
 int
-CometParser::json_number(const QString& s)
+CometParser::json_number(const CometToken& t)
 {
+    if (m_handler && !m_fallbackDepth) {
+        typedScalar(t, false);
+        return 1;
+    }
+
+    const QString s = t.toString();
     bool ok;
     qlonglong l;
     double d;
 
     if ((l = s.toLongLong(&ok), ok)) {
-        m_insertStack.top()( m_key, QVariant(l) );
+        insert( QVariant(l) );
     } else if ((d = s.toDouble(&ok), ok)) {
-        m_insertStack.top()( m_key, QVariant(d) );
+        insert( QVariant(d) );
     }
     return 1;
 }
 
 int
-CometParser::json_string(const QString& s)
+CometParser::json_string(const CometToken& t)
 {
-    m_insertStack.top()( m_key, QVariant(s) );
+    if (m_handler && !m_fallbackDepth) {
+        typedScalar(t, true);
+        return 1;
+    }
+
+    insert( QVariant(t.toString()) );
     return 1;
 }
 
 int
 CometParser::json_start_map()
 {
-    if (m_insertStack.size() == 0)
-        return 0;       // the comet stream we expect has objects wrapped in an array, thx.
-
-    Object *o = new Object();
-    m_atEndStack.push( boost::bind(&CometParser::postObjectInserter, m_insertStack.top(), m_key, o) );
-    m_insertStack.push( boost::bind(&CometParser::objectInserter, o, _1, _2) );
-    return 1;
+    if (m_handler) {
+        if (!m_fallbackDepth)
+            return typedStartMap();
+        ++m_fallbackDepth;
+    }
+    return startObject();
 }
 
 int
-CometParser::json_map_key(const QString& s)
+CometParser::json_map_key(const CometToken& t)
 {
-    m_key = s;
+    if (m_handler && !m_fallbackDepth) {
+        // yajl may reuse the key's buffer for the value, so keep a copy
+        if (t.len < sizeof(m_keyBuf)) {
+            memcpy(m_keyBuf, t.s, t.len);
+            m_keyLen = t.len;
+        } else {
+            m_keyLen = -1;
+        }
+        return 1;
+    }
+
+    m_key = t.toString();
     return 1;
 }
 
 int
 CometParser::json_start_array()
 {
-    Array *a = new Array();
-    if (m_insertStack.size() == 0) {
-        // the first enclosing array...
-        // has a special inserter to call the function to emit the haveObject signal
-        m_atEndStack.push( boost::bind(&CometParser::nop) );
-        m_insertStack.push( boost::bind(&CometParser::haveObject, this, _1, _2) );
-    } else {
-        m_atEndStack.push( boost::bind(&CometParser::postArrayInserter, m_insertStack.top(), m_key, a) );
-        m_insertStack.push( boost::bind(&CometParser::arrayInserter, a, _1, _2) );
+    if (m_handler) {
+        if (!m_fallbackDepth) {
+            ++m_depth;
+            return 1;
+        }
+        ++m_fallbackDepth;
     }
-    return 1;
+    return startArray();
 }
 
 int
 CometParser::json_end_map()
 {
-    m_insertStack.pop();
-    m_atEndStack.pop()();
-    return 1;
+    if (m_handler && !m_fallbackDepth)
+        return typedEndMap();
+    return end();
 }
 
 int
 CometParser::json_end_array()
 {
-    m_insertStack.pop();
-    m_atEndStack.pop()();
-    return 1;
+    if (m_handler && !m_fallbackDepth) {
+        --m_depth;
+        return 1;
+    }
+    return end();
 }
-
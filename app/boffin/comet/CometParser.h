@@ -29,6 +29,23 @@
 #include <boost/bind.hpp>
 
 #include "YajlCallbacks.hpp"
+#include "CometKeyTable.hpp"
+
+// In typed mode the parser expects the stream's objects to look like
+//      {"query": "<qid>", "result": {...}}
+// and hands the string and number members of each result to one of these,
+// straight from yajl, rather than building a QVariantMap of it.
+//
+class CometResultHandler
+{
+public:
+    virtual ~CometResultHandler() {}
+
+    // return false to have the result skipped
+    virtual bool beginResult(const CometToken& qid) = 0;
+    virtual void resultMember(const CometToken& key, const CometToken& value, bool isString) = 0;
+    virtual void endResult() = 0;
+};
 
 // parses a neverending json comet stream like:
 //      "[ {}, {}, ...."
@@ -36,28 +53,29 @@
 // signal emitted for each top-level object
 //
 // yajl does the json (developed using yajl 1.0.5)
-// this class transforms the tokens into QVariantMap types
+// this class transforms the tokens into QVariantMap types, or in typed
+// mode passes the results' members to a CometResultHandler
 //
 class CometParser : public QObject
 {
     Q_OBJECT;
     Q_DISABLE_COPY(CometParser);
 
-    struct QStringPolicy
+    struct TokenPolicy
     {
-        static QString stringize(const char* s, unsigned int len)
+        static CometToken stringize(const char* s, unsigned int len)
         {
-            return QString::fromUtf8(s, len);
+            return CometToken(s, len);
         }
     };
 
-    typedef TYajlCallbacks<CometParser, QStringPolicy> CometCallbacks;
+    typedef TYajlCallbacks<CometParser, TokenPolicy> CometCallbacks;
     typedef QVariantMap Object;
     typedef QVariantList Array;
     typedef boost::function<void(const QString&, const QVariant&)> Inserter;
     typedef boost::function<void()> AtEnd;
 
-    friend class TYajlCallbacks<CometParser, QStringPolicy>;
+    friend class TYajlCallbacks<CometParser, TokenPolicy>;
 
 public:
     CometParser(QObject *parent = 0);
@@ -65,6 +83,10 @@ public:
 
     bool push(const QByteArray& ba);        // push data in...
 
+    // switches to typed mode. a result that comes before its query is
+    // still built into a QVariantMap and emitted with haveObject
+    void setResultHandler(CometResultHandler* handler);
+
 signals:
     void haveObject(QVariantMap o);         // ...and objects pop out
 
@@ -79,15 +101,26 @@ private:
     void haveObject(const QString&, const QVariant& v);
     static void nop();
 
+    int startObject();
+    int startArray();
+    void insert(const QVariant& v);
+    int end();
+
+    // typed mode
+    int typedStartMap();
+    int typedEndMap();
+    void typedScalar(const CometToken& value, bool isString);
+    bool keyIs(const char* key) const;
+
     ////////////////////////////////
     // yajl callbacks
 
     int json_null();
     int json_boolean(int boolVal);
-    int json_number(const QString& s);
-    int json_string(const QString& s);
+    int json_number(const CometToken& t);
+    int json_string(const CometToken& t);
     int json_start_map();
-    int json_map_key(const QString& s);
+    int json_map_key(const CometToken& t);
     int json_start_array();
     int json_end_map();
     int json_end_array();
@@ -98,6 +131,18 @@ private:
     QStack<Inserter> m_insertStack;     // inserters are used to put values into objects and arrays
     QStack<AtEnd> m_atEndStack;         // we call these at the end of an object or array
 
+    // typed mode
+    enum QueryState { NoQuery, Accepted, Rejected };
+
+    CometResultHandler* m_handler;
+    int m_depth;                        // objects and arrays we're in, the stream's array is 1
+    QueryState m_query;                 // of the current top-level object
+    bool m_inResult;                    // the handler is getting this object's members
+    int m_fallbackDepth;                // while building a result the QVariant way, how deep in it we are
+    Object m_fallback;                  // the top-level object of that result
+    char m_keyBuf[32];                  // the last key, if it fit. none of the keys we want are long
+    int m_keyLen;                       // -1 if it didn't
+
     yajl_handle m_handle;
 };
 
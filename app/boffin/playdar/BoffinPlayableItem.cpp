@@ -20,6 +20,40 @@
 #include "BoffinPlayableItem.h"
 #include "jsonGetMember.h"
 
+namespace
+{
+    typedef BoffinPlayableItemData Data;
+
+    // the members fromTrackResolveResult and fromBoffinRqlResult read, sorted by key
+    const TCometKey<Data> k_trackResolveKeys[] = {
+        { "album", cometString<Data, &Data::album> },
+        { "artist", cometString<Data, &Data::artist> },
+        { "bitrate", cometInt<Data, &Data::bitrate> },
+        { "duration", cometInt<Data, &Data::duration> },
+        { "mimetype", cometString<Data, &Data::mimetype> },
+        { "preference", cometInt<Data, &Data::preference> },
+        { "score", cometFloat<Data, &Data::score> },
+        { "size", cometInt<Data, &Data::size> },
+        { "source", cometString<Data, &Data::source> },
+        { "track", cometString<Data, &Data::track> },
+        { "url", cometString<Data, &Data::url> }
+    };
+
+    const TCometKey<Data> k_boffinRqlKeys[] = {
+        { "album", cometString<Data, &Data::album> },
+        { "artist", cometString<Data, &Data::artist> },
+        { "bitrate", cometInt<Data, &Data::bitrate> },
+        { "duration", cometInt<Data, &Data::duration> },
+        { "mimetype", cometString<Data, &Data::mimetype> },
+        { "preference", cometInt<Data, &Data::preference> },
+        { "size", cometInt<Data, &Data::size> },
+        { "source", cometString<Data, &Data::source> },
+        { "track", cometString<Data, &Data::track> },
+        { "url", cometString<Data, &Data::url> },
+        { "weight", cometFloat<Data, &Data::weight> }
+    };
+}
+
 BoffinPlayableItemData::BoffinPlayableItemData()
     :size(-1)
     ,bitrate(-1)
@@ -53,6 +87,7 @@ BoffinPlayableItem::fromTrackResolveResult(const QVariantMap& map)
     jsonGetMember(map, "size", result.d->size);
     jsonGetMember(map, "track", result.d->track);
     jsonGetMember(map, "url", result.d->url);
+    result.updateKeys();
     return result;
 }
 
@@ -72,5 +107,45 @@ BoffinPlayableItem::fromBoffinRqlResult(const QVariantMap& map)
     jsonGetMember(map, "track", result.d->track);
     jsonGetMember(map, "url", result.d->url);
     jsonGetMember(map, "weight", result.d->weight);
+    result.updateKeys();
+    return result;
+}
+
+//static
+BoffinPlayableItem
+BoffinPlayableItem::fromLocalTrack(const QString& artist, const QString& album, const QString& track,
+                                   const QString& url, int duration, const QString& source,
+                                   float weight, float score)
+{
+    BoffinPlayableItem result;
+    result.d->artist = artist;
+    result.d->album = album;
+    result.d->track = track;
+    result.d->url = url;
+    result.d->duration = duration;
+    result.d->source = source;
+    result.d->weight = weight;
+    result.d->score = score;
+    result.updateKeys();
     return result;
 }
+
+bool
+BoffinPlayableItem::setTrackResolveMember(const CometToken& key, const CometToken& value, bool isString)
+{
+    return cometSetMember(k_trackResolveKeys, *d, key, value, isString) >= 0;
+}
+
+bool
+BoffinPlayableItem::setBoffinRqlMember(const CometToken& key, const CometToken& value, bool isString)
+{
+    return cometSetMember(k_boffinRqlKeys, *d, key, value, isString) >= 0;
+}
+
+// the Shuffler compares every item with its history, so normalise once here
+void
+BoffinPlayableItem::updateKeys()
+{
+    d->artistKey = d->artist.simplified().toLower();
+    d->trackKey = d->track.simplified().toLower();
+}
@@ -23,6 +23,7 @@
 #include <QSharedData>
 #include <QVariant>
 #include <QString>
+#include "../comet/CometKeyTable.hpp"
 
 struct BoffinPlayableItemData : QSharedData
 {
@@ -43,6 +44,10 @@ struct BoffinPlayableItemData : QSharedData
 
     float workingweight;
     int artistId;
+
+    // artist and track simplified and lowercased, for comparing items
+    QString artistKey;
+    QString trackKey;
 };
 
 class BoffinPlayableItem
@@ -69,14 +74,29 @@ public:
     float workingweight() const { return d->workingweight; }
     int artistId() const { return d->artistId; }
 
+    QString artistKey() const { return d->artistKey; }
+    QString trackKey() const { return d->trackKey; }
+
     // mutable:
     float& workingweight() { return d->workingweight; }
     int& artistId() { return d->artistId; }
 
     static BoffinPlayableItem fromTrackResolveResult(const QVariantMap& map);
     static BoffinPlayableItem fromBoffinRqlResult(const QVariantMap& map);
+    static BoffinPlayableItem fromLocalTrack(const QString& artist, const QString& album, const QString& track,
+                                             const QString& url, int duration, const QString& source,
+                                             float weight, float score);
+
+    // for the typed CometParser: set the member a result's key names, false
+    // if that kind of result doesn't have it or the value's the wrong type.
+    // call finishMembers() once they're all in
+    bool setTrackResolveMember(const CometToken& key, const CometToken& value, bool isString);
+    bool setBoffinRqlMember(const CometToken& key, const CometToken& value, bool isString);
+    void finishMembers() { updateKeys(); }
 
 protected:
+    void updateKeys();
+
     QExplicitlySharedDataPointer<BoffinPlayableItemData> d;
 };
 
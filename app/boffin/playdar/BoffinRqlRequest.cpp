@@ -19,6 +19,7 @@
 */
 
 #include <QNetworkReply>
+#include <QTimer>
 #include <lastfm/NetworkAccessManager>
 #include "BoffinRqlRequest.h"
 #include "jsonGetMember.h"
@@ -59,7 +60,55 @@ BoffinRqlRequest::issueRequest(lastfm::NetworkAccessManager* wam, PlaydarApi& ap
 void
 BoffinRqlRequest::receiveResult(const QVariantMap& o)
 {
-    emit playableItem( BoffinPlayableItem::fromBoffinRqlResult(o) );
+    receiveItem( BoffinPlayableItem::fromBoffinRqlResult(o) );
+}
+
+//virtual
+void
+BoffinRqlRequest::beginResult()
+{
+    m_result = BoffinPlayableItem();
+}
+
+//virtual
+void
+BoffinRqlRequest::resultMember(const CometToken& key, const CometToken& value, bool isString)
+{
+    m_result.setBoffinRqlMember(key, value, isString);
+}
+
+//virtual
+void
+BoffinRqlRequest::endResult()
+{
+    m_result.finishMembers();
+    receiveItem( m_result );
+}
+
+void
+BoffinRqlRequest::receiveItem(const BoffinPlayableItem& item)
+{
+    // the local index has given us this host's tracks already
+    if (m_localSource.size() && item.source() == m_localSource)
+        return;
+
+    emit playableItem( item );
+}
+
+void
+BoffinRqlRequest::receiveLocalResults(const QList<BoffinPlayableItem>& items, const QString& localSource)
+{
+    m_localResults = items;
+    m_localSource = localSource;
+    QTimer::singleShot(0, this, SLOT(emitLocalResults()));
+}
+
+void
+BoffinRqlRequest::emitLocalResults()
+{
+    foreach (const BoffinPlayableItem& item, m_localResults)
+        emit playableItem( item );
+    m_localResults.clear();
 }
 
 void
@@ -24,6 +24,7 @@
 #include <lastfm/global.h>
 #include "PlaydarApi.h"
 #include "CometRequest.h"
+#include <QList>
 #include "BoffinPlayableItem.h"
 
 class BoffinRqlRequest : public CometRequest
@@ -33,6 +34,14 @@ class BoffinRqlRequest : public CometRequest
 public:
     void issueRequest(lastfm::NetworkAccessManager* wam, PlaydarApi& api, const QString& rql, const QString& session);
     virtual void receiveResult(const QVariantMap& o);
+    virtual void beginResult();
+    virtual void resultMember(const CometToken& key, const CometToken& value, bool isString);
+    virtual void endResult();
+
+    /** Results from the LocalCollectionIndex, emitted once we're back in
+      * the event loop so the caller has had a chance to connect. Playdar's
+      * own results for localSource are ignored after this. */
+    void receiveLocalResults(const QList<BoffinPlayableItem>& items, const QString& localSource);
 
 signals:
     void error();
@@ -41,9 +50,16 @@ signals:
 
 private slots:
     void onFinished();
+    void emitLocalResults();
 
 private:
     void fail(const char* message);
+    void receiveItem(const BoffinPlayableItem& item);
+
+    QList<BoffinPlayableItem> m_localResults;
+    QString m_localSource;
+
+    BoffinPlayableItem m_result;        // the one the comet parser is filling in
 };
 
 #endif
@@ -19,12 +19,27 @@
 */
 
 #include <QNetworkReply>
+#include <QTimer>
 #include <lastfm/NetworkAccessManager>
 #include "PlaydarApi.h"
 #include "BoffinTagRequest.h"
 #include "jsonGetMember.h"
 
 
+namespace
+{
+    // a tag result must have all of these, sorted by key
+    const TCometKey<BoffinTagItem> k_tagKeys[] = {
+        { "count", cometInt<BoffinTagItem, &BoffinTagItem::m_count> },
+        { "name", cometString<BoffinTagItem, &BoffinTagItem::m_name> },
+        { "seconds", cometInt<BoffinTagItem, &BoffinTagItem::m_seconds> },
+        { "source", cometString<BoffinTagItem, &BoffinTagItem::m_host> },
+        { "weight", cometFloat<BoffinTagItem, &BoffinTagItem::m_weight> }
+    };
+
+    const int k_allTagMembers = (1 << (sizeof(k_tagKeys) / sizeof(k_tagKeys[0]))) - 1;
+}
+
 
 // virtual 
 void 
@@ -74,10 +89,60 @@ BoffinTagRequest::receiveResult(const QVariantMap& o)
         jsonGetMember(o, "weight", weight) && 
         jsonGetMember(o, "seconds", seconds))
     {
-        emit tagItem(BoffinTagItem(tagName, hostName, count, static_cast<float>(weight), seconds));
+        receiveItem(BoffinTagItem(tagName, hostName, count, static_cast<float>(weight), seconds));
     }
 }
 
+// virtual
+void
+BoffinTagRequest::beginResult()
+{
+    m_result = BoffinTagItem();
+    m_resultMembers = 0;
+}
+
+// virtual
+void
+BoffinTagRequest::resultMember(const CometToken& key, const CometToken& value, bool isString)
+{
+    const int i = cometSetMember(k_tagKeys, m_result, key, value, isString);
+    if (i >= 0)
+        m_resultMembers |= 1 << i;
+}
+
+// virtual
+void
+BoffinTagRequest::endResult()
+{
+    if (m_resultMembers == k_allTagMembers)
+        receiveItem(m_result);
+}
+
+void
+BoffinTagRequest::receiveItem(const BoffinTagItem& item)
+{
+    if (m_localSource.size() && item.m_host == m_localSource)
+        return;
+
+    emit tagItem(item);
+}
+
+void
+BoffinTagRequest::receiveLocalResults(const QList<BoffinTagItem>& items, const QString& localSource)
+{
+    m_localResults = items;
+    m_localSource = localSource;
+    QTimer::singleShot(0, this, SLOT(emitLocalResults()));
+}
+
+void
+BoffinTagRequest::emitLocalResults()
+{
+    foreach (const BoffinTagItem& item, m_localResults)
+        emit tagItem(item);
+    m_localResults.clear();
+}
+
 void 
 BoffinTagRequest::fail(const char* message)
 {
@@ -24,6 +24,7 @@
 #include <lastfm/global.h>
 #include "PlaydarApi.h"
 #include "CometRequest.h"
+#include <QList>
 
 
 struct BoffinTagItem
@@ -66,8 +67,16 @@ class BoffinTagRequest : public CometRequest
     Q_OBJECT
 
 public:
+    BoffinTagRequest() : m_resultMembers(0) {}
+
     void issueRequest(lastfm::NetworkAccessManager* wam, PlaydarApi& api, const QString& rql, const QString& session);
     virtual void receiveResult(const QVariantMap& o);
+    virtual void beginResult();
+    virtual void resultMember(const CometToken& key, const CometToken& value, bool isString);
+    virtual void endResult();
+
+    // see BoffinRqlRequest
+    void receiveLocalResults(const QList<BoffinTagItem>& items, const QString& localSource);
 
 signals:
     void error();
@@ -75,9 +84,17 @@ signals:
     void requestMade( const QString );
 private slots:
     void onFinished();
+    void emitLocalResults();
 
 private:
     void fail(const char* message);
+    void receiveItem(const BoffinTagItem& item);
+
+    QList<BoffinTagItem> m_localResults;
+    QString m_localSource;
+
+    BoffinTagItem m_result;         // the one the comet parser is filling in
+    int m_resultMembers;            // a bit for each of its members it's set
 };
 
 #endif
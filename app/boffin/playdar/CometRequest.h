@@ -23,6 +23,7 @@
 #include <QString>
 #include <QVariant>
 #include <QByteArray>
+#include "../comet/CometKeyTable.hpp"
 
 class CometRequest : public QObject
 {
@@ -33,6 +34,11 @@ public:
     const QString& qid() const;
     virtual void receiveResult(const QVariantMap& o) = 0;
 
+    // the typed alternative to receiveResult, see CometResultHandler
+    virtual void beginResult() = 0;
+    virtual void resultMember(const CometToken& key, const CometToken& value, bool isString) = 0;
+    virtual void endResult() = 0;
+
 protected:
     bool getQueryId(const QByteArray& data, QString& out);
 
@@ -33,7 +33,7 @@ PlaydarCometRequest::PlaydarCometRequest()
 
 // returns the sessionId, empty string if request fails
 bool
-PlaydarCometRequest::issueRequest(lastfm::NetworkAccessManager* wam, PlaydarApi& api)
+PlaydarCometRequest::issueRequest(lastfm::NetworkAccessManager* wam, PlaydarApi& api, CometResultHandler* handler)
 {
     QNetworkReply* reply = wam->get(QNetworkRequest(api.comet(m_sessionId)));
     if (!reply) {
@@ -41,6 +41,7 @@ PlaydarCometRequest::issueRequest(lastfm::NetworkAccessManager* wam, PlaydarApi&
     }
 
     m_parser = new CometParser(this);
+    m_parser->setResultHandler(handler);
     connect(m_parser, SIGNAL(haveObject(QVariantMap)), SIGNAL(receivedObject(QVariantMap)));
     connect(reply, SIGNAL(readyRead()), SLOT(onFirstReadyRead()));
     connect(reply, SIGNAL(readyRead()), SLOT(onReadyRead()));
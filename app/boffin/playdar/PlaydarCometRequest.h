@@ -26,6 +26,7 @@
 #include <QVariant>
 
 class CometParser;
+class CometResultHandler;
 
 // makes a request to playdar for comet results, 
 // emits signals as result objects arrive
@@ -38,7 +39,9 @@ public:
     PlaydarCometRequest();
 
     // returns the sessionId, empty string if request fails
-    bool issueRequest(lastfm::NetworkAccessManager* wam, PlaydarApi& api);
+    // with a handler, results are parsed in the CometParser's typed mode
+    // and only those that can't be are emitted as receivedObject
+    bool issueRequest(lastfm::NetworkAccessManager* wam, PlaydarApi& api, CometResultHandler* handler = 0);
 
 signals:
     void receivedObject(QVariantMap);
@@ -18,6 +18,7 @@
    along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <QHostInfo>
 #include <QTimer>
 #include "PlaydarConnection.h"
 #include "PlaydarStatRequest.h"
@@ -25,13 +26,18 @@
 #include "PlaydarRosterRequest.h"
 #include "PlaydarCometRequest.h"
 #include "TrackResolveRequest.h"
+#include "TrackResolveQueue.h"
 #include "BoffinRqlRequest.h"
 #include "BoffinTagRequest.h"
+#include "../LocalCollectionIndex.h"
 #include <lastfm/NetworkAccessManager>
 
 
 PlaydarConnection::PlaydarConnection(lastfm::NetworkAccessManager* wam, PlaydarApi& api)
 : m_comet(0)
+, m_resultRequest(0)
+, m_index(0)
+, m_resolveQueue(new TrackResolveQueue(wam, api, this))
 , m_wam(wam)
 , m_api(api)
 , m_state(Querying)
@@ -124,7 +130,7 @@ void
 PlaydarConnection::makeCometRequest()
 {
     m_comet = new PlaydarCometRequest();
-    if (m_comet->issueRequest(m_wam, m_api)) {
+    if (m_comet->issueRequest(m_wam, m_api, this)) {
         connect(m_comet, SIGNAL(connected(QString)), SLOT(onCometConnected(QString)));
         connect(m_comet, SIGNAL(error()), SLOT(onError()));
         connect(m_comet, SIGNAL(receivedObject(QVariantMap)), SLOT(receivedCometObject(QVariantMap)));
@@ -135,6 +141,7 @@ void
 PlaydarConnection::onCometConnected(const QString& sessionId)
 {
     m_cometSession = sessionId;
+    m_resolveQueue->setSession(sessionId);
     m_state = Connected;
     updateText();
     emit connected();
@@ -163,42 +170,86 @@ PlaydarConnection::hostsModel()
     return &m_hostsModel;
 }
 
+void
+PlaydarConnection::setLocalIndex(LocalCollectionIndex* index)
+{
+    m_index = index;
+}
+
+bool
+PlaydarConnection::hasLocalIndex() const
+{
+    return m_index && m_index->isOpen();
+}
+
+// what Playdar calls this host in its results
+QString
+PlaydarConnection::localSource() const
+{
+    return m_hostname.length() ? m_hostname : QHostInfo::localHostName();
+}
+
 TrackResolveRequest* 
 PlaydarConnection::trackResolve(const QString& artist, const QString& album, const QString& track)
 {
-    if (!m_cometSession.length()) {
+    if (!m_cometSession.length() && !hasLocalIndex()) {
         return 0;
     }
     TrackResolveRequest* r = new TrackResolveRequest();
-    connect(r, SIGNAL(requestMade(QString)), SLOT(onRequestMade(QString)));
-    connect(r, SIGNAL(destroyed(QObject*)), SLOT(onRequestDestroyed(QObject*)));
-    r->issueRequest(m_wam, m_api, artist, album, track, m_cometSession);
+    TrackResolveRequest* query = m_resolveQueue->subscribe(r, artist, album, track);
+    if (!query) {
+        // someone's already asked
+        return r;
+    }
+    if (hasLocalIndex()) {
+        query->receiveLocalResults(m_index->resolve(artist, album, track, localSource()), localSource());
+    }
+    // without a session yet the queue holds on to it until there is one
+    connect(query, SIGNAL(requestMade(QString)), SLOT(onRequestMade(QString)));
+    connect(query, SIGNAL(destroyed(QObject*)), SLOT(onRequestDestroyed(QObject*)));
+    m_resolveQueue->enqueue(query);
     return r;
 }
 
+void
+PlaydarConnection::setMaxResolvesInFlight(int max)
+{
+    m_resolveQueue->setMaxInFlight(max);
+}
+
 BoffinRqlRequest*
 PlaydarConnection::boffinRql(const QString& rql)
 {
-    if (!m_cometSession.length()) {
+    if (!m_cometSession.length() && !hasLocalIndex()) {
         return 0;
     }
     BoffinRqlRequest* r = new BoffinRqlRequest();
-    connect(r, SIGNAL(requestMade(QString)), SLOT(onRequestMade(QString)));
-    connect(r, SIGNAL(destroyed(QObject*)), SLOT(onRequestDestroyed(QObject*)));
-    r->issueRequest(m_wam, m_api, rql, m_cometSession);
+    if (hasLocalIndex()) {
+        r->receiveLocalResults(m_index->rql(rql, localSource()), localSource());
+    }
+    if (m_cometSession.length()) {
+        connect(r, SIGNAL(requestMade(QString)), SLOT(onRequestMade(QString)));
+        connect(r, SIGNAL(destroyed(QObject*)), SLOT(onRequestDestroyed(QObject*)));
+        r->issueRequest(m_wam, m_api, rql, m_cometSession);
+    }
     return r;
 }
 
 BoffinTagRequest*
 PlaydarConnection::boffinTagcloud(const QString& rql)
 {
-    if (!m_cometSession.length()) {
+    if (!m_cometSession.length() && !hasLocalIndex()) {
         return 0;
     }
     BoffinTagRequest* r = new BoffinTagRequest();
-    connect(r, SIGNAL(requestMade(QString)), SLOT(onRequestMade(QString)));
-    connect(r, SIGNAL(destroyed(QObject*)), SLOT(onRequestDestroyed(QObject*)));
-    r->issueRequest(m_wam, m_api, rql, m_cometSession);
+    if (hasLocalIndex()) {
+        r->receiveLocalResults(m_index->tagcloud(rql, localSource()), localSource());
+    }
+    if (m_cometSession.length()) {
+        connect(r, SIGNAL(requestMade(QString)), SLOT(onRequestMade(QString)));
+        connect(r, SIGNAL(destroyed(QObject*)), SLOT(onRequestDestroyed(QObject*)));
+        r->issueRequest(m_wam, m_api, rql, m_cometSession);
+    }
     return r;
 }
 
@@ -206,12 +257,16 @@ void
 PlaydarConnection::onRequestMade(const QString& qid)
 {
     m_cometReqMap[qid] = (CometRequest*) sender();
+    m_cometReqQids[sender()] = qid;
 }
 
 void
 PlaydarConnection::onRequestDestroyed(QObject* o)
 {
-    m_cometReqMap.remove(((CometRequest*)o)->qid());
+    if (o == m_resultRequest)
+        m_resultRequest = 0;
+    // o's only a QObject by now, its qid has gone
+    m_cometReqMap.remove(m_cometReqQids.take(o));
 }
 
 void
@@ -234,3 +289,34 @@ PlaydarConnection::receivedCometObject(const QVariantMap& obj)
     }
 }
 
+// the comet parser's typed mode, for results in the order they stream in.
+// the request can go away between two reads of the stream
+
+bool
+PlaydarConnection::beginResult(const CometToken& qid)
+{
+    m_resultRequest = m_cometReqMap.value(qid.toString());
+    if (!m_resultRequest) {
+        qDebug() << "warning: result for unknown query " << qid.toString() << " was discarded";
+        return false;
+    }
+    m_resultRequest->beginResult();
+    return true;
+}
+
+void
+PlaydarConnection::resultMember(const CometToken& key, const CometToken& value, bool isString)
+{
+    if (m_resultRequest)
+        m_resultRequest->resultMember(key, value, isString);
+}
+
+void
+PlaydarConnection::endResult()
+{
+    // whoever gets the result might delete the request
+    CometRequest* r = m_resultRequest;
+    m_resultRequest = 0;
+    if (r)
+        r->endResult();
+}
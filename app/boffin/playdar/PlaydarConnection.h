@@ -23,15 +23,19 @@
 
 #include "PlaydarApi.h"
 #include <lastfm/global.h>
+#include <QHash>
 #include <QStringListModel>
+#include "../comet/CometParser.h"
 
 class PlaydarCometRequest;
 class CometRequest;
 class TrackResolveRequest;
 class BoffinTagRequest;
 class BoffinRqlRequest;
+class LocalCollectionIndex;
+class TrackResolveQueue;
 
-class PlaydarConnection : public QObject
+class PlaydarConnection : public QObject, private CometResultHandler
 {
     Q_OBJECT
 
@@ -41,7 +45,15 @@ public:
     void start();
     QStringListModel* hostsModel();
 
+    /** Queries about this host's tracks are answered from index rather than
+      * Playdar's, and can be made before we've connected. */
+    void setLocalIndex(LocalCollectionIndex* index);
+
+    // resolves go through a TrackResolveQueue, the same track is only
+    // asked for once and only so many are waiting on Playdar at a time
     TrackResolveRequest* trackResolve(const QString& artist, const QString& album, const QString& track);
+    void setMaxResolvesInFlight(int max);
+
     BoffinTagRequest* boffinTagcloud(const QString& rql);
     BoffinRqlRequest* boffinRql(const QString& rql);
 
@@ -66,6 +78,13 @@ private:
     void updateText();
     void makeCometRequest();
     QString cometSession();
+    QString localSource() const;
+    bool hasLocalIndex() const;
+
+    // CometResultHandler
+    virtual bool beginResult(const CometToken& qid);
+    virtual void resultMember(const CometToken& key, const CometToken& value, bool isString);
+    virtual void endResult();
 
     enum State
     {
@@ -81,6 +100,11 @@ private:
     PlaydarCometRequest* m_comet;
     QString m_cometSession;
     QMap<QString, CometRequest*> m_cometReqMap;
+    QHash<QObject*, QString> m_cometReqQids;        // for when they're destroyed
+    CometRequest* m_resultRequest;      // the one whose result the comet parser is in
+
+    LocalCollectionIndex* m_index;
+    TrackResolveQueue* m_resolveQueue;
 
     lastfm::NetworkAccessManager* m_wam;
     PlaydarApi& m_api;
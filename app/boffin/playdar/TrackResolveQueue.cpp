@@ -0,0 +1,208 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QTimer>
+#include "TrackResolveQueue.h"
+#include "TrackResolveRequest.h"
+
+namespace
+{
+    // QNetworkAccessManager keeps up to six connections to a host, so this
+    // keeps them all busy without queuing anything behind them
+    const int k_defaultMaxInFlight = 6;
+}
+
+
+TrackResolveQueue::TrackResolveQueue(lastfm::NetworkAccessManager* wam, PlaydarApi& api, QObject* parent)
+: QObject(parent)
+, m_wam(wam)
+, m_api(api)
+, m_maxInFlight(k_defaultMaxInFlight)
+, m_pumpScheduled(false)
+{
+}
+
+TrackResolveQueue::~TrackResolveQueue()
+{
+    // our requests are our children, so QObject deletes them
+    qDeleteAll(m_queries);
+}
+
+void
+TrackResolveQueue::setSession(const QString& session)
+{
+    m_session = session;
+    schedulePump();
+}
+
+void
+TrackResolveQueue::setMaxInFlight(int max)
+{
+    m_maxInFlight = qMax(1, max);
+    schedulePump();
+}
+
+//static
+QString
+TrackResolveQueue::key(const QString& artist, const QString& album, const QString& track)
+{
+    // simplified() leaves no tabs
+    return artist.simplified().toLower() + '\t' + album.simplified().toLower() + '\t' + track.simplified().toLower();
+}
+
+TrackResolveRequest*
+TrackResolveQueue::subscribe(TrackResolveRequest* r, const QString& artist, const QString& album, const QString& track)
+{
+    TrackResolveRequest* created = 0;
+
+    const QString k = key(artist, album, track);
+    Query* q = m_queries.value(k);
+    if (!q) {
+        q = new Query;
+        q->key = k;
+        q->artist = artist;
+        q->album = album;
+        q->track = track;
+        q->request = created = new TrackResolveRequest();
+        q->request->setParent(this);
+        connect(q->request, SIGNAL(result(BoffinPlayableItem)), SLOT(onResult(BoffinPlayableItem)));
+        connect(q->request, SIGNAL(replied()), SLOT(onReplied()));
+        connect(q->request, SIGNAL(error()), SLOT(onError()));
+
+        m_queries.insert(k, q);
+        m_byRequest.insert(q->request, q);
+    } else if (q->results.size()) {
+        r->deliver(q->results);
+    }
+
+    q->subscribers << r;
+    m_bySubscriber.insert(r, q);
+    connect(q->request, SIGNAL(error()), r, SIGNAL(error()));
+    connect(r, SIGNAL(destroyed(QObject*)), SLOT(onSubscriberDestroyed(QObject*)));
+
+    return created;
+}
+
+void
+TrackResolveQueue::enqueue(TrackResolveRequest* query)
+{
+    Query* q = m_byRequest.value(query);
+    if (q) {
+        m_waiting << q;
+        schedulePump();
+    }
+}
+
+// a whole playlist is usually subscribed in one go, so wait for it before issuing
+void
+TrackResolveQueue::schedulePump()
+{
+    if (!m_pumpScheduled) {
+        m_pumpScheduled = true;
+        QTimer::singleShot(0, this, SLOT(pump()));
+    }
+}
+
+void
+TrackResolveQueue::pump()
+{
+    m_pumpScheduled = false;
+
+    // the queries made before Playdar's comet session wait for it
+    if (m_session.isEmpty())
+        return;
+
+    while (m_waiting.size() && m_inFlight.size() < m_maxInFlight) {
+        Query* q = m_waiting.takeFirst();
+        m_inFlight.insert(q->request);
+
+        // a request that can't be made fails straight away, which forgets
+        // q, so it mustn't be passed its own strings
+        const QString artist = q->artist;
+        const QString album = q->album;
+        const QString track = q->track;
+        q->request->issueRequest(m_wam, m_api, artist, album, track, m_session);
+    }
+}
+
+void
+TrackResolveQueue::onReplied()
+{
+    if (m_inFlight.remove(sender()))
+        schedulePump();
+}
+
+void
+TrackResolveQueue::onResult(const BoffinPlayableItem& item)
+{
+    Query* q = m_byRequest.value(sender());
+    if (!q)
+        return;
+
+    q->results << item;
+    const QList<BoffinPlayableItem> items = QList<BoffinPlayableItem>() << item;
+    foreach (TrackResolveRequest* r, q->subscribers)
+        r->deliver(items);
+}
+
+void
+TrackResolveQueue::onError()
+{
+    // the subscribers are sent the error too, the next one for this track
+    // gets a query of its own rather than one that will never answer
+    Query* q = m_byRequest.value(sender());
+    if (!q)
+        return;
+
+    foreach (TrackResolveRequest* r, q->subscribers) {
+        m_bySubscriber.remove(r);
+        disconnect(r, SIGNAL(destroyed(QObject*)), this, SLOT(onSubscriberDestroyed(QObject*)));
+    }
+    forget(q);
+}
+
+void
+TrackResolveQueue::onSubscriberDestroyed(QObject* o)
+{
+    // o is only a QObject by now, but we only need the pointer
+    Query* q = m_bySubscriber.take(o);
+    if (!q)
+        return;
+
+    q->subscribers.removeAll(static_cast<TrackResolveRequest*>(o));
+    if (q->subscribers.size())
+        return;
+
+    // nobody wants this track any more
+    forget(q);
+}
+
+void
+TrackResolveQueue::forget(Query* q)
+{
+    m_queries.remove(q->key);
+    m_byRequest.remove(q->request);
+    m_waiting.removeAll(q);
+    if (m_inFlight.remove(q->request))
+        schedulePump();
+
+    q->request->disconnect(this);
+    q->request->deleteLater();
+    delete q;
+}
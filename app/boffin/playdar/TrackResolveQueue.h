@@ -0,0 +1,100 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRACK_RESOLVE_QUEUE_H
+#define TRACK_RESOLVE_QUEUE_H
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QSet>
+#include <lastfm/global.h>
+#include "PlaydarApi.h"
+#include "BoffinPlayableItem.h"
+
+class TrackResolveRequest;
+
+// Stands between PlaydarConnection::trackResolve and Playdar, so importing
+// a playlist of thousands of tracks doesn't mean thousands of GETs at once.
+//
+// Each distinct track is one query, a TrackResolveRequest of our own. The
+// requests the callers get are subscribers to it, and are sent everything
+// it receives, including what it got before they subscribed. The queries
+// are issued in the order they were made, with no more than maxInFlight()
+// GETs waiting on Playdar at once, and none before it has given us a comet
+// session. Their results come back over the comet session as usual. A
+// query that fails is forgotten once its subscribers have been told.
+//
+class TrackResolveQueue : public QObject
+{
+    Q_OBJECT
+
+public:
+    TrackResolveQueue(lastfm::NetworkAccessManager* wam, PlaydarApi& api, QObject* parent = 0);
+    ~TrackResolveQueue();
+
+    void setSession(const QString& session);
+
+    void setMaxInFlight(int max);
+    int maxInFlight() const { return m_maxInFlight; }
+
+    // subscribes r to the query for this track. if there wasn't one it's
+    // returned, for the caller to give any local results to and enqueue
+    TrackResolveRequest* subscribe(TrackResolveRequest* r, const QString& artist, const QString& album, const QString& track);
+
+    // issues query to Playdar when there's room and a session
+    void enqueue(TrackResolveRequest* query);
+
+private slots:
+    void pump();
+    void onReplied();
+    void onResult(const BoffinPlayableItem& item);
+    void onError();
+    void onSubscriberDestroyed(QObject* o);
+
+private:
+    struct Query
+    {
+        QString key;
+        QString artist;
+        QString album;
+        QString track;
+        TrackResolveRequest* request;
+        QList<TrackResolveRequest*> subscribers;
+        QList<BoffinPlayableItem> results;      // for the subscribers that come late
+    };
+
+    static QString key(const QString& artist, const QString& album, const QString& track);
+    void schedulePump();
+    void forget(Query* q);
+
+    lastfm::NetworkAccessManager* m_wam;
+    PlaydarApi& m_api;
+    QString m_session;
+    int m_maxInFlight;
+    bool m_pumpScheduled;
+
+    QHash<QString, Query*> m_queries;                   // by key
+    QHash<QObject*, Query*> m_byRequest;                // ours
+    QHash<QObject*, Query*> m_bySubscriber;             // theirs
+    QList<Query*> m_waiting;                            // enqueued, not issued yet
+    QSet<QObject*> m_inFlight;                          // issued, Playdar hasn't replied
+};
+
+#endif
@@ -19,6 +19,7 @@
 */
 
 #include <QNetworkReply>
+#include <QTimer>
 #include <lastfm/NetworkAccessManager>
 #include "TrackResolveRequest.h"
 #include "BoffinPlayableItem.h"
@@ -33,6 +34,7 @@ TrackResolveRequest::issueRequest(lastfm::NetworkAccessManager* wam, PlaydarApi&
         emit requestMade( qid());
     } else {
         fail("couldn't issue boffin request");
+        emit replied();
     }
 }
 
@@ -40,13 +42,75 @@ TrackResolveRequest::issueRequest(lastfm::NetworkAccessManager* wam, PlaydarApi&
 void 
 TrackResolveRequest::receiveResult(const QVariantMap& o)
 {
-    emit result(BoffinPlayableItem::fromTrackResolveResult(o));
+    receiveItem(BoffinPlayableItem::fromTrackResolveResult(o));
+}
+
+//virtual
+void
+TrackResolveRequest::beginResult()
+{
+    m_result = BoffinPlayableItem();
+}
+
+//virtual
+void
+TrackResolveRequest::resultMember(const CometToken& key, const CometToken& value, bool isString)
+{
+    m_result.setTrackResolveMember(key, value, isString);
+}
+
+//virtual
+void
+TrackResolveRequest::endResult()
+{
+    m_result.finishMembers();
+    receiveItem(m_result);
+}
+
+void
+TrackResolveRequest::receiveItem(const BoffinPlayableItem& item)
+{
+    if (m_localSource.size() && item.source() == m_localSource)
+        return;
+
+    emit result(item);
+}
+
+void
+TrackResolveRequest::receiveLocalResults(const QList<BoffinPlayableItem>& items, const QString& localSource)
+{
+    // Playdar is better at near misses than the index, so if we've
+    // nothing it can have a go
+    if (items.isEmpty())
+        return;
+
+    m_localSource = localSource;
+    deliver(items);
+}
+
+void
+TrackResolveRequest::deliver(const QList<BoffinPlayableItem>& items)
+{
+    if (m_pendingResults.isEmpty())
+        QTimer::singleShot(0, this, SLOT(emitPendingResults()));
+    m_pendingResults += items;
+}
+
+void
+TrackResolveRequest::emitPendingResults()
+{
+    // a slot might deliver more
+    const QList<BoffinPlayableItem> items = m_pendingResults;
+    m_pendingResults.clear();
+    foreach (const BoffinPlayableItem& item, items)
+        emit result(item);
 }
 
 void 
 TrackResolveRequest::onFinished()
 {
     sender()->deleteLater();
+    emit replied();
     QNetworkReply *reply = (QNetworkReply*) sender();
     if (reply->error() == QNetworkReply::NoError) {
         QString queryId;
@@ -24,6 +24,7 @@
 #include <lastfm/global.h>
 #include "PlaydarApi.h"
 #include "CometRequest.h"
+#include <QList>
 #include "BoffinPlayableItem.h"
 
 class TrackResolveRequest : public CometRequest
@@ -33,17 +34,35 @@ class TrackResolveRequest : public CometRequest
 public:
     void issueRequest(lastfm::NetworkAccessManager* wam, PlaydarApi& api, const QString& artist, const QString& album, const QString& track, const QString& session);
     virtual void receiveResult(const QVariantMap& o);
+    virtual void beginResult();
+    virtual void resultMember(const CometToken& key, const CometToken& value, bool isString);
+    virtual void endResult();
+
+    /** as BoffinRqlRequest's, except Playdar still gets to resolve the
+      * track on this host if the local index couldn't */
+    void receiveLocalResults(const QList<BoffinPlayableItem>& items, const QString& localSource);
+
+    // emits items once we're back in the event loop, see TrackResolveQueue
+    void deliver(const QList<BoffinPlayableItem>& items);
 
 signals:
     void error();
     void result( BoffinPlayableItem );
     void requestMade( const QString );
+    void replied();                     // Playdar has answered the GET, or it failed
 
 private slots:
     void onFinished();
+    void emitPendingResults();
 
 private:
     void fail(const char* message);
+    void receiveItem(const BoffinPlayableItem& item);
+
+    QList<BoffinPlayableItem> m_pendingResults;
+    QString m_localSource;
+
+    BoffinPlayableItem m_result;        // the one the comet parser is filling in
 };
 
 #endif
@@ -0,0 +1,206 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Weighted sampling from a distribution that changes between draws.
+//
+// Each slot has a weight and the slots' partial sums are kept in a Fenwick
+// (binary indexed) tree, so drawing a slot, changing a slot's weight and
+// removing a slot (setting its weight to zero) are all O(log n). Compare
+// ListBasedSampler, which has to be given the whole distribution again,
+// and walks it, for every draw.
+//
+// Updates are applied to the tree as differences, so rounding error builds
+// up over time. The tree is rebuilt from the weights after as many updates
+// as there are slots, which keeps that bounded at O(1) amortised per update.
+
+#ifndef __FENWICK_SAMPLER_H
+#define __FENWICK_SAMPLER_H
+
+#include <vector>
+#include <ctime>
+
+#include <boost/random.hpp>
+
+namespace fm { namespace last { namespace algo {
+
+// -----------------------------------------------------------------------------
+
+class FenwickSampler
+{
+   std::vector<double> m_tree;      // 1-based, m_tree[i] sums the weights of (i - lowbit(i), i]
+   std::vector<double> m_weights;   // 0-based slots
+   size_t m_updates;                // since the last rebuild
+
+   boost::mt19937                            m_randomGenerator;
+   // like ListBasedSampler, not thread safe because of this
+   boost::uniform_01<boost::mt19937>         m_uniform01Distr;
+
+   static size_t lowbit( size_t i ) { return i & ( ~i + 1 ); }
+
+   // sum of the weights of slots [0, n)
+   double prefix( size_t n ) const
+   {
+      double sum = 0;
+      for ( ; n > 0; n -= lowbit(n) )
+         sum += m_tree[n];
+      return sum;
+   }
+
+public:
+
+   FenwickSampler() :
+      m_tree( 1, 0.0 ),
+      m_updates( 0 ),
+      m_randomGenerator(),
+      m_uniform01Distr(m_randomGenerator)
+      {
+         m_uniform01Distr.base().seed( static_cast<boost::uint32_t>( time(0) ) );
+      }
+
+   // -----------------------------------------------------------------------------
+
+   void seed( boost::uint32_t seed ) { m_uniform01Distr.base().seed( seed ); }
+
+   int size() const { return static_cast<int>( m_weights.size() ); }
+
+   double weight( int slot ) const { return m_weights[slot]; }
+
+   // O(log n)
+   double total() const { return prefix( m_weights.size() ); }
+
+   void clear()
+   {
+      m_tree.assign( 1, 0.0 );
+      m_weights.clear();
+      m_updates = 0;
+   }
+
+   // appends a slot, returns its index. O(log n)
+   int add( double weight )
+   {
+      if ( weight < 0 ) weight = 0;
+
+      m_weights.push_back( weight );
+      const size_t i = m_weights.size();
+
+      // the new node covers the slots (i - lowbit(i), i]
+      m_tree.push_back( weight + prefix( i - 1 ) - prefix( i - lowbit(i) ) );
+
+      return static_cast<int>( i - 1 );
+   }
+
+   // O(log n), amortised over the occasional rebuild
+   void update( int slot, double weight )
+   {
+      if ( weight < 0 ) weight = 0;
+
+      const double delta = weight - m_weights[slot];
+      if ( delta == 0 )
+         return;
+
+      m_weights[slot] = weight;
+
+      if ( ++m_updates >= m_weights.size() )
+      {
+         rebuild();
+         return;
+      }
+
+      for ( size_t i = slot + 1; i < m_tree.size(); i += lowbit(i) )
+         m_tree[i] += delta;
+   }
+
+   // the slot keeps its index but will never be drawn. O(log n)
+   void remove( int slot ) { update( slot, 0 ); }
+
+   // recomputes the tree from the weights, O(n)
+   void rebuild()
+   {
+      const size_t n = m_weights.size();
+      m_tree.assign( n + 1, 0.0 );
+
+      for ( size_t i = 1; i <= n; ++i )
+      {
+         m_tree[i] += m_weights[i - 1];
+         const size_t parent = i + lowbit(i);
+         if ( parent <= n )
+            m_tree[parent] += m_tree[i];
+      }
+
+      m_updates = 0;
+   }
+
+   // -----------------------------------------------------------------------------
+
+   // draws a slot with probability proportional to its weight, or returns -1
+   // if every weight is zero. O(log n)
+   int sample() { return sample( m_uniform01Distr() ); }
+
+   // the slot u, in [0, 1), of the way through the total weight falls in
+   int sample( double u )
+   {
+      const size_t n = m_weights.size();
+
+      for ( int attempt = 0; attempt < 2; ++attempt )
+      {
+         const double sum = total();
+         if ( !( sum > 0 ) )
+            return -1;
+
+         double randPos = u * sum;
+
+         // find the last position whose prefix sum is <= randPos, the slot
+         // after it is the one randPos falls in
+         size_t step = 1;
+         while ( step * 2 <= n ) step *= 2;
+
+         size_t pos = 0;
+         for ( ; step > 0; step /= 2 )
+         {
+            if ( pos + step <= n && m_tree[pos + step] <= randPos )
+            {
+               pos += step;
+               randPos -= m_tree[pos];
+            }
+         }
+
+         // only rounding error can land us past the end or on a zero
+         // weight, start again from exact sums
+         if ( pos < n && m_weights[pos] > 0 )
+            return static_cast<int>( pos );
+
+         rebuild();
+      }
+
+      // the tree is exact now, so if we still missed just take the first
+      // slot that can be drawn
+      for ( size_t i = 0; i < n; ++i )
+         if ( m_weights[i] > 0 )
+            return static_cast<int>( i );
+
+      return -1;
+   }
+
+};
+
+// -----------------------------------------------------------------------------
+
+}}} // end of namespaces
+
+#endif // __FENWICK_SAMPLER_H
@@ -0,0 +1,314 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Edit distance kernels against the full matrix implementation the Shuffler
+// used to have, which is copied here as the reference.
+//
+// ./bench_levenshtein [--iterations <n>] [--pairs <n>] [--seed <n>]
+//
+// Pairs of artist and track like names are generated for each set: "near"
+// pairs are a name and a copy with a few typos, "far" pairs are unrelated
+// names. "short" names fit the bit-parallel kernel, "long" ones don't.
+// Every kernel is checked against the reference before it is timed, and
+// results are written to stdout as one JSON object per line:
+//
+// {"kernel":"bounded","set":"short_near","pairs":20000,"iterations":5,
+//  "seconds":0.0031,"mean_seconds":0.0033,"pairs_per_sec":6451612}
+//
+// "bounded" passes the bound normalisedLevenshtein uses, the others work
+// out the whole distance. seconds is the best of the iterations.
+
+#include <limits>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QTextStream>
+#include <QVector>
+
+#include "EditDistance.h"
+
+
+namespace
+{
+    struct Pair
+    {
+        QString a;
+        QString b;
+        int max;    // what normalisedLevenshtein would pass for a
+    };
+
+    enum Kernel { Reference, Unbounded, Bounded };
+    const char* const kernelNames[] = { "reference", "levenshtein", "bounded" };
+
+    quint32 s_seed = 1;
+
+    int
+    randomInt( int n )
+    {
+        s_seed = s_seed * 1103515245 + 12345;
+        return int( ( s_seed >> 8 ) % quint32( n ) );
+    }
+}
+
+
+// the Shuffler's levenshtein() before it was replaced, lifted from playdar
+static int
+referenceLevenshtein(const QString& source, const QString& target)
+{
+  const int n = source.length();
+  const int m = target.length();
+  if (n == 0) {
+    return m;
+  }
+  if (m == 0) {
+    return n;
+  }
+  typedef std::vector< std::vector<int> > Tmatrix;
+  Tmatrix matrix(n+1);
+  for (int i = 0; i <= n; i++) {
+    matrix[i].resize(m+1);
+  }
+  for (int i = 0; i <= n; i++) {
+    matrix[i][0]=i;
+  }
+  for (int j = 0; j <= m; j++) {
+    matrix[0][j]=j;
+  }
+  for (int i = 1; i <= n; i++) {
+    const QChar s_i = source[i-1];
+    for (int j = 1; j <= m; j++) {
+      const QChar t_j = target[j-1];
+      int cost;
+      if (s_i == t_j) {
+        cost = 0;
+      }
+      else {
+        cost = 1;
+      }
+      const int above = matrix[i-1][j];
+      const int left = matrix[i][j-1];
+      const int diag = matrix[i-1][j-1];
+      int cell = (((left+1)>(diag+cost))?diag+cost:left+1);
+      if(above+1 < cell) cell = above+1;
+      if (i>2 && j>2) {
+        int trans=matrix[i-2][j-2]+1;
+        if (source[i-2]!=t_j) trans++;
+        if (s_i!=target[j-2]) trans++;
+        if (cell>trans) cell=trans;
+      }
+      matrix[i][j]=cell;
+    }
+  }
+  return matrix[n][m];
+}
+
+
+static const QStringList&
+words()
+{
+    static QStringList list;
+    if ( list.isEmpty() )
+    {
+        list = QString::fromUtf8(
+            "the of and a love night blue song girl boy heart world live remix "
+            "version radio edit feat. dub mix part ii iii beyoncé motörhead "
+            "sigur rós björk mötley crüe café tango señor días ça été blur "
+            "pixies smiths joy division new order radiohead massive attack "
+            "東京事変 椎名林檎 ボーカロイド 사랑 любовь ночь" ).split( ' ' );
+    }
+    return list;
+}
+
+
+static QString
+name( int minLength, int maxWords )
+{
+    QString s = words().at( randomInt( words().size() ) );
+    for ( int n = randomInt( maxWords ); n > 0 || s.length() < minLength; --n )
+        s += ' ' + words().at( randomInt( words().size() ) );
+    return s;
+}
+
+
+static QString
+typos( QString s, int count )
+{
+    for ( int n = 0; n < count && s.length() > 1; ++n )
+    {
+        const int i = randomInt( s.length() - 1 );
+        switch ( randomInt( 4 ) )
+        {
+            case 0: s[i] = s[randomInt( s.length() )]; break;
+            case 1: s.insert( i, s[randomInt( s.length() )] ); break;
+            case 2: s.remove( i, 1 ); break;
+            case 3: { QChar c = s[i]; s[i] = s[i + 1]; s[i + 1] = c; break; }
+        }
+    }
+    return s;
+}
+
+
+static int
+bound( const QString& original )
+{
+    // as normalisedLevenshtein works it out
+    int max = original.length() - 1;
+    if ( original.length() > 6 )
+        max = qMin( max, int( original.length() / 1.5f ) );
+    return max;
+}
+
+
+static QVector<Pair>
+pairs( int count, bool isLong, bool similar )
+{
+    QVector<Pair> v;
+    v.reserve( count );
+
+    while ( v.size() < count )
+    {
+        Pair p;
+        p.a = isLong ? name( 65, 20 ) : name( 1, 3 );
+        p.b = similar ? typos( p.a, 1 + randomInt( 3 ) ) : ( isLong ? name( 65, 20 ) : name( 1, 3 ) );
+        p.max = bound( p.a );
+
+        // an empty name is an outright fail, normalisedLevenshtein never asks
+        if ( p.max >= 0 )
+            v << p;
+    }
+
+    return v;
+}
+
+
+static int
+run( Kernel kernel, const Pair& p )
+{
+    switch ( kernel )
+    {
+        case Reference: return referenceLevenshtein( p.b, p.a );
+        case Unbounded: return levenshtein( p.b, p.a );
+        case Bounded: return boundedLevenshtein( p.b, p.a, p.max );
+    }
+    return -1;
+}
+
+
+/** returns the number of pairs the kernel gets wrong */
+static int
+check( Kernel kernel, const QVector<Pair>& v, QTextStream& err )
+{
+    int wrong = 0;
+
+    foreach ( const Pair& p, v )
+    {
+        int expected = referenceLevenshtein( p.b, p.a );
+        if ( kernel == Bounded )
+            expected = qMin( expected, p.max + 1 );
+
+        const int got = run( kernel, p );
+        if ( got != expected )
+        {
+            if ( wrong++ < 10 )
+                err << kernelNames[kernel] << ": \"" << p.b << "\" \"" << p.a << "\" got "
+                    << got << " expected " << expected << "\n";
+        }
+    }
+
+    err.flush();
+    return wrong;
+}
+
+
+int main( int argc, char** argv )
+{
+    QCoreApplication app( argc, argv );
+    QStringList args = app.arguments();
+
+    int iterations = 5;
+    int count = 20000;
+
+    int i;
+    if ( ( i = args.indexOf( "--iterations" ) ) != -1 && i + 1 < args.size() ) iterations = qMax( 1, args.at( i + 1 ).toInt() );
+    if ( ( i = args.indexOf( "--pairs" ) ) != -1 && i + 1 < args.size() ) count = qMax( 1, args.at( i + 1 ).toInt() );
+    if ( ( i = args.indexOf( "--seed" ) ) != -1 && i + 1 < args.size() ) s_seed = args.at( i + 1 ).toUInt();
+
+    QTextStream out( stdout );
+    QTextStream err( stderr );
+
+    struct Set { const char* name; bool isLong; bool similar; };
+    const Set sets[] =
+    {
+        { "short_near", false, true },
+        { "short_far", false, false },
+        { "long_near", true, true },
+        { "long_far", true, false }
+    };
+
+    int failures = 0;
+
+    for ( size_t s = 0 ; s < sizeof( sets ) / sizeof( sets[0] ) ; ++s )
+    {
+        const QVector<Pair> v = pairs( count, sets[s].isLong, sets[s].similar );
+
+        for ( int k = Reference ; k <= Bounded ; ++k )
+        {
+            const Kernel kernel = Kernel( k );
+
+            if ( kernel != Reference && check( kernel, v, err ) )
+            {
+                ++failures;
+                continue;
+            }
+
+            double best = std::numeric_limits<double>::max();
+            double total = 0;
+            volatile int sink = 0;
+
+            for ( int n = 0 ; n < iterations ; ++n )
+            {
+                QElapsedTimer timer;
+                timer.start();
+
+                foreach ( const Pair& p, v )
+                    sink += run( kernel, p );
+
+                const double seconds = timer.nsecsElapsed() / 1e9;
+                best = qMin( best, seconds );
+                total += seconds;
+            }
+
+            best = qMax( best, 1e-9 );
+
+            out << "{\"kernel\":\"" << kernelNames[kernel] << "\""
+                << ",\"set\":\"" << sets[s].name << "\""
+                << ",\"pairs\":" << v.size()
+                << ",\"iterations\":" << iterations
+                << ",\"seconds\":" << best
+                << ",\"mean_seconds\":" << total / iterations
+                << ",\"pairs_per_sec\":" << qint64( v.size() / best )
+                << "}\n";
+            out.flush();
+        }
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,237 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <QtTest>
+
+#include "sample/FenwickSampler.h"
+
+using fm::last::algo::FenwickSampler;
+
+
+class TestFenwickSampler : public QObject
+{
+    Q_OBJECT
+
+    /** Integer weights that add up to total, a power of two, so every
+      * prefix sum and every u * total in sample() is exact and a draw can
+      * be aimed at either side of a boundary. */
+    static QVector<double> weights( int n, int total )
+    {
+        QVector<double> w( n, 0.0 );
+        int left = total;
+        for ( int i = 0; i < n - 1 && left > 0; ++i )
+        {
+            // every third slot is empty, to be skipped over
+            w[i] = i % 3 == 1 ? 0 : qMin( left, 1 + qrand() % ( 2 * total / n + 1 ) );
+            left -= int( w[i] );
+        }
+        w[n - 1] += left;
+        return w;
+    }
+
+    /** every slot with weight is drawn from the start of its range to just
+      * before the end, and the empty ones never are */
+    static void checkBoundaries( FenwickSampler& sampler, const QVector<double>& w, double total )
+    {
+        QCOMPARE( sampler.size(), w.size() );
+        QCOMPARE( sampler.total(), total );
+
+        double prefix = 0;
+        for ( int slot = 0; slot < w.size(); ++slot )
+        {
+            QCOMPARE( sampler.weight( slot ), w[slot] );
+            if ( w[slot] > 0 )
+            {
+                QCOMPARE( sampler.sample( prefix / total ), slot );
+                QCOMPARE( sampler.sample( ( prefix + w[slot] / 2 ) / total ), slot );
+                QCOMPARE( sampler.sample( ( prefix + w[slot] - 0.5 ) / total ), slot );
+            }
+            prefix += w[slot];
+        }
+        QCOMPARE( prefix, total );
+    }
+
+private slots:
+    void initTestCase()
+    {
+        qsrand( 1 );
+    }
+
+    void empty()
+    {
+        FenwickSampler sampler;
+        QCOMPARE( sampler.size(), 0 );
+        QCOMPARE( sampler.total(), 0.0 );
+        QCOMPARE( sampler.sample(), -1 );
+
+        // negative weights are taken as none
+        QCOMPARE( sampler.add( 0 ), 0 );
+        QCOMPARE( sampler.add( -1 ), 1 );
+        QCOMPARE( sampler.weight( 1 ), 0.0 );
+        QCOMPARE( sampler.sample(), -1 );
+        QCOMPARE( sampler.sample( 0.5 ), -1 );
+
+        sampler.update( 1, 2 );
+        QCOMPARE( sampler.sample( 0 ), 1 );
+        QCOMPARE( sampler.sample( 0.999 ), 1 );
+
+        sampler.clear();
+        QCOMPARE( sampler.size(), 0 );
+        QCOMPARE( sampler.sample(), -1 );
+    }
+
+    void prefixSums_data()
+    {
+        QTest::addColumn<int>( "n" );
+
+        // the tree's shape changes at the powers of two
+        const int sizes[] = { 1, 2, 3, 4, 5, 7, 8, 9, 16, 17, 31, 100, 1000 };
+        for ( size_t i = 0; i < sizeof( sizes ) / sizeof( sizes[0] ); ++i )
+            QTest::newRow( QByteArray::number( sizes[i] ) ) << sizes[i];
+    }
+
+    void prefixSums()
+    {
+        QFETCH( int, n );
+
+        const double total = 4096;
+        const QVector<double> w = weights( n, int( total ) );
+
+        FenwickSampler sampler;
+        for ( int i = 0; i < n; ++i )
+            QCOMPARE( sampler.add( w[i] ), i );
+
+        checkBoundaries( sampler, w, total );
+        if ( QTest::currentTestFailed() )
+            return;
+
+        sampler.rebuild();
+        checkBoundaries( sampler, w, total );
+    }
+
+    void update_data()
+    {
+        prefixSums_data();
+    }
+
+    void update()
+    {
+        QFETCH( int, n );
+
+        const double total = 4096;
+        QVector<double> w = weights( n, int( total ) );
+
+        FenwickSampler sampler;
+        foreach ( double weight, w )
+            sampler.add( weight );
+
+        // move weight between random slots, often enough for the tree to
+        // be rebuilt a few times along the way
+        for ( int i = 0; i < 3 * n + 3; ++i )
+        {
+            const int from = qrand() % n;
+            const int to = qrand() % n;
+            const double moved = w[from] > 0 ? 1 + qrand() % int( w[from] ) : 0;
+
+            w[from] -= moved;
+            sampler.update( from, w[from] );
+            w[to] += moved;
+            sampler.update( to, w[to] );
+
+            checkBoundaries( sampler, w, total );
+            if ( QTest::currentTestFailed() )
+                return;
+        }
+
+        // a removed slot keeps its index and its neighbours their ranges
+        for ( int slot = 0; slot < n - 1; ++slot )
+        {
+            w[n - 1] += w[slot];
+            w[slot] = 0;
+            sampler.remove( slot );
+            sampler.update( n - 1, w[n - 1] );
+        }
+        checkBoundaries( sampler, w, total );
+        QCOMPARE( sampler.sample(), n - 1 );
+    }
+
+    void roundingDoesntBuildUp()
+    {
+        FenwickSampler sampler;
+        QVector<double> w;
+        for ( int i = 0; i < 64; ++i )
+        {
+            w << 0.1 * ( i + 1 );
+            sampler.add( w.last() );
+        }
+
+        for ( int i = 0; i < 100000; ++i )
+        {
+            const int slot = qrand() % w.size();
+            w[slot] = ( qrand() % 1000 ) / 7.0;
+            sampler.update( slot, w[slot] );
+        }
+
+        double total = 0;
+        foreach ( double weight, w )
+            total += weight;
+        QVERIFY( qAbs( sampler.total() - total ) < 1e-9 * total );
+    }
+
+    void distribution()
+    {
+        const double w[] = { 1, 0, 2, 3, 4 };
+        const int draws = 100000;
+
+        FenwickSampler sampler;
+        sampler.seed( 42 );
+        for ( int i = 0; i < 5; ++i )
+            sampler.add( w[i] );
+
+        int counts[5] = { 0, 0, 0, 0, 0 };
+        for ( int i = 0; i < draws; ++i )
+        {
+            const int slot = sampler.sample();
+            QVERIFY( slot >= 0 && slot < 5 );
+            ++counts[slot];
+        }
+
+        QCOMPARE( counts[1], 0 );
+        for ( int i = 0; i < 5; ++i )
+            QVERIFY( qAbs( counts[i] / double( draws ) - w[i] / 10 ) < 0.01 );
+    }
+
+    void seeded()
+    {
+        FenwickSampler a, b;
+        a.seed( 7 );
+        b.seed( 7 );
+        for ( int i = 0; i < 50; ++i )
+        {
+            a.add( i % 5 );
+            b.add( i % 5 );
+        }
+
+        for ( int i = 0; i < 1000; ++i )
+            QCOMPARE( a.sample(), b.sample() );
+    }
+};
+
+
+QTEST_MAIN( TestFenwickSampler )
+#include "TestFenwickSampler.moc"
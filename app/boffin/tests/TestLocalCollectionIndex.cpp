@@ -0,0 +1,271 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <QtTest>
+
+#include "LocalCollectionIndex.h"
+
+
+class TestLocalCollectionIndex : public QObject
+{
+    Q_OBJECT
+
+    QString m_path;
+
+    static LocalCollectionIndex::Entry entry( const QString& artist, const QString& album, const QString& title,
+                                              const QString& path, const QString& tags )
+    {
+        LocalCollectionIndex::Entry e;
+        e.artist = artist;
+        e.album = album;
+        e.title = title;
+        e.path = path;
+        e.duration = 200;
+        if ( tags.size() )
+            e.tags = tags.split( ',' );
+        return e;
+    }
+
+    static QList<LocalCollectionIndex::Entry> collection()
+    {
+        QList<LocalCollectionIndex::Entry> found;
+        found << entry( "ABBA", "Arrival", "Dancing Queen", "/music/abba/01.mp3", "Pop,Disco" )
+              << entry( "ABBA", "Arrival", "Money, Money, Money", "/music/abba/02.mp3", "pop" )
+              << entry( "Led Zeppelin", "IV", "Black Dog", "/music/zep/01.mp3", "Rock,Classic Rock" )
+              << entry( "Led Zeppelin", "IV", "Rock and Roll", "/music/zep/02.mp3", "rock" )
+              << entry( "Queen", "A Night at the Opera", "Bohemian Rhapsody", "/music/queen/01.mp3", "Rock, Pop" )
+              << entry( "Aphex Twin", "Drukqs", "Avril 14th", "/music/aphex/01.mp3", "" );
+        return found;
+    }
+
+    /** the titles of what rql finds, sorted so the order doesn't matter */
+    static QStringList titles( const QList<BoffinPlayableItem>& items )
+    {
+        QStringList result;
+        foreach ( const BoffinPlayableItem& item, items )
+            result << item.track();
+        result.sort();
+        return result;
+    }
+
+private slots:
+    void init()
+    {
+        m_path = QDir::temp().filePath( QString( "test_collection_index_%1" ).arg( QCoreApplication::applicationPid() ) );
+        QFile::remove( m_path );
+        QFile::remove( m_path + ".new" );
+        QFile::remove( m_path + ".old" );
+    }
+
+    void cleanup()
+    {
+        QFile::remove( m_path );
+        QFile::remove( m_path + ".new" );
+        QFile::remove( m_path + ".old" );
+    }
+
+    void roundTrip()
+    {
+        {
+            LocalCollectionIndex index( m_path );
+            QVERIFY( !index.open() );
+            QVERIFY( index.update( collection(), QStringList() << "/music", QSet<QString>() ) );
+            QVERIFY( index.isOpen() );
+            QCOMPARE( index.trackCount(), 6 );
+        }
+
+        LocalCollectionIndex index( m_path );
+        QVERIFY( index.open() );
+        QCOMPARE( index.trackCount(), 6 );
+
+        QList<LocalCollectionIndex::Entry> expected = collection();
+        for ( int id = 0; id < index.trackCount(); ++id )
+        {
+            const LocalCollectionIndex::Entry e = index.track( id );
+            QCOMPARE( e.artist, expected[id].artist );
+            QCOMPARE( e.album, expected[id].album );
+            QCOMPARE( e.title, expected[id].title );
+            QCOMPARE( e.path, expected[id].path );
+            QCOMPARE( e.duration, expected[id].duration );
+        }
+
+        // tags come back as they're indexed, simplified and lowercased
+        QStringList tags = index.track( 2 ).tags;
+        tags.sort();
+        QCOMPARE( tags, QStringList() << "classic rock" << "rock" );
+        tags = index.track( 4 ).tags;
+        tags.sort();
+        QCOMPARE( tags, QStringList() << "pop" << "rock" );
+
+        QVERIFY( index.track( index.trackCount() ).path.isEmpty() );
+    }
+
+    void rql_data()
+    {
+        QTest::addColumn<QString>( "rql" );
+        QTest::addColumn<QStringList>( "expected" );
+
+        const QStringList all = QStringList() << "Avril 14th" << "Black Dog" << "Bohemian Rhapsody"
+                                              << "Dancing Queen" << "Money, Money, Money" << "Rock and Roll";
+
+        QTest::newRow( "empty" ) << "" << all;
+        QTest::newRow( "tag" ) << "tag:\"rock\"" << ( QStringList() << "Black Dog" << "Bohemian Rhapsody" << "Rock and Roll" );
+        QTest::newRow( "tag is normalised" ) << "tag:\"  ROCK \"" << ( QStringList() << "Black Dog" << "Bohemian Rhapsody" << "Rock and Roll" );
+        QTest::newRow( "tag with a space" ) << "tag:\"classic rock\"" << ( QStringList() << "Black Dog" );
+        QTest::newRow( "bare word is a tag" ) << "disco" << ( QStringList() << "Dancing Queen" );
+        QTest::newRow( "quoted is a tag" ) << "\"disco\"" << ( QStringList() << "Dancing Queen" );
+        QTest::newRow( "artist" ) << "artist:\"led zeppelin\"" << ( QStringList() << "Black Dog" << "Rock and Roll" );
+        QTest::newRow( "artist needs every word" ) << "artist:\"led abba\"" << QStringList();
+        QTest::newRow( "album" ) << "album:opera" << ( QStringList() << "Bohemian Rhapsody" );
+        QTest::newRow( "title" ) << "title:money" << ( QStringList() << "Money, Money, Money" );
+        QTest::newRow( "track" ) << "track:\"rock and roll\"" << ( QStringList() << "Rock and Roll" );
+        QTest::newRow( "and" ) << "tag:rock and tag:pop" << ( QStringList() << "Bohemian Rhapsody" );
+        QTest::newRow( "implicit and" ) << "tag:rock tag:pop" << ( QStringList() << "Bohemian Rhapsody" );
+        QTest::newRow( "or" ) << "tag:disco or artist:queen" << ( QStringList() << "Bohemian Rhapsody" << "Dancing Queen" );
+        QTest::newRow( "or binds looser than and" ) << "tag:disco or tag:rock and tag:pop" << ( QStringList() << "Bohemian Rhapsody" << "Dancing Queen" );
+        QTest::newRow( "not" ) << "not tag:rock" << ( QStringList() << "Avril 14th" << "Dancing Queen" << "Money, Money, Money" );
+        QTest::newRow( "not not" ) << "not not tag:disco" << ( QStringList() << "Dancing Queen" );
+        QTest::newRow( "and not group" ) << "tag:\"rock\" and not ( tag:\"pop\" or artist:\"abba\" )" << ( QStringList() << "Black Dog" << "Rock and Roll" );
+        QTest::newRow( "keywords any case" ) << "tag:pop AND NOT artist:queen" << ( QStringList() << "Dancing Queen" << "Money, Money, Money" );
+        QTest::newRow( "unknown tag" ) << "tag:jazz" << QStringList();
+        QTest::newRow( "unknown field" ) << "genre:rock" << QStringList();
+        QTest::newRow( "unterminated quote" ) << "tag:\"rock" << QStringList();
+        QTest::newRow( "unbalanced" ) << "( tag:rock" << QStringList();
+        QTest::newRow( "stray close" ) << "tag:rock )" << QStringList();
+        QTest::newRow( "missing value" ) << "tag:" << QStringList();
+        QTest::newRow( "dangling or" ) << "tag:rock or" << QStringList();
+    }
+
+    void rql()
+    {
+        QFETCH( QString, rql );
+        QFETCH( QStringList, expected );
+
+        LocalCollectionIndex index( m_path );
+        QVERIFY( index.update( collection(), QStringList() << "/music", QSet<QString>() ) );
+
+        const QList<BoffinPlayableItem> items = index.rql( rql, "local" );
+        QCOMPARE( titles( items ), expected );
+        foreach ( const BoffinPlayableItem& item, items )
+        {
+            QCOMPARE( item.source(), QString( "local" ) );
+            QVERIFY( item.url().startsWith( "file://" ) );
+        }
+    }
+
+    void tagcloud()
+    {
+        LocalCollectionIndex index( m_path );
+        QVERIFY( index.update( collection(), QStringList() << "/music", QSet<QString>() ) );
+
+        QMap<QString, int> counts;
+        foreach ( const BoffinTagItem& tag, index.tagcloud( "", "local" ) )
+            counts[tag.m_name] = tag.m_count;
+        QCOMPARE( counts.value( "rock" ), 3 );
+        QCOMPARE( counts.value( "pop" ), 3 );
+        QCOMPARE( counts.value( "classic rock" ), 1 );
+        QCOMPARE( counts.value( "disco" ), 1 );
+
+        counts.clear();
+        foreach ( const BoffinTagItem& tag, index.tagcloud( "artist:abba", "local" ) )
+            counts[tag.m_name] = tag.m_count;
+        QCOMPARE( counts.size(), 2 );
+        QCOMPARE( counts.value( "pop" ), 2 );
+        QCOMPARE( counts.value( "disco" ), 1 );
+    }
+
+    void resolve()
+    {
+        LocalCollectionIndex index( m_path );
+        QVERIFY( index.update( collection(), QStringList() << "/music", QSet<QString>() ) );
+
+        QList<BoffinPlayableItem> items = index.resolve( "Led Zeppelin", "IV", "Black Dog", "local" );
+        QCOMPARE( items.size(), 1 );
+        QCOMPARE( items[0].track(), QString( "Black Dog" ) );
+        QCOMPARE( items[0].score(), 1.0f );
+
+        // a different album only costs a little
+        items = index.resolve( "led zeppelin", "Mothership", "black dog", "local" );
+        QCOMPARE( items.size(), 1 );
+        QVERIFY( items[0].score() < 1.0f );
+        QVERIFY( items[0].score() > 0.9f );
+
+        QVERIFY( index.resolve( "Led Zeppelin", "", "Stairway to Heaven", "local" ).isEmpty() );
+        QVERIFY( index.resolve( "Queen", "", "Black Dog", "local" ).isEmpty() );
+    }
+
+    void updateKeepsWhatWasntScanned()
+    {
+        LocalCollectionIndex index( m_path );
+        QVERIFY( index.update( collection(), QStringList() << "/music", QSet<QString>() ) );
+
+        // a rescan of /music/abba that found one track, /music/zep was
+        // unchanged and /music/queen is outside the roots
+        QList<LocalCollectionIndex::Entry> found;
+        found << entry( "ABBA", "Arrival", "Fernando", "/music/abba/03.mp3", "pop" );
+        QVERIFY( index.update( found,
+                               QStringList() << "/music/abba" << "/music/zep" << "/music/aphex",
+                               QSet<QString>() << "/music/zep" ) );
+
+        QCOMPARE( titles( index.rql( "", "local" ) ),
+                  QStringList() << "Black Dog" << "Bohemian Rhapsody" << "Fernando" << "Rock and Roll" );
+        QCOMPARE( titles( index.rql( "tag:pop", "local" ) ),
+                  QStringList() << "Bohemian Rhapsody" << "Fernando" );
+        QVERIFY( !QFile::exists( m_path + ".new" ) );
+    }
+
+    void writeThenReplace()
+    {
+        LocalCollectionIndex index( m_path );
+        QVERIFY( index.write( collection(), QStringList() << "/music", QSet<QString>() ) );
+
+        // the old index answers queries until the new one replaces it
+        QVERIFY( !index.isOpen() );
+        QVERIFY( QFile::exists( m_path + ".new" ) );
+
+        QVERIFY( index.replace() );
+        QCOMPARE( index.trackCount(), 6 );
+        QVERIFY( !index.replace() );
+        QCOMPARE( index.trackCount(), 6 );
+
+        // and again over the old one, which isn't left lying around
+        QVERIFY( index.write( collection().mid( 1 ), QStringList() << "/music", QSet<QString>() ) );
+        QCOMPARE( index.trackCount(), 6 );
+        QVERIFY( index.replace() );
+        QCOMPARE( index.trackCount(), 5 );
+        QVERIFY( !QFile::exists( m_path + ".old" ) );
+        QVERIFY( !QFile::exists( m_path + ".new" ) );
+    }
+
+    void openRejectsGarbage()
+    {
+        QFile file( m_path );
+        QVERIFY( file.open( QIODevice::WriteOnly ) );
+        file.write( QByteArray( 256, 'x' ) );
+        file.close();
+
+        LocalCollectionIndex index( m_path );
+        QVERIFY( !index.open() );
+        QCOMPARE( index.trackCount(), 0 );
+        QVERIFY( index.rql( "", "local" ).isEmpty() );
+    }
+};
+
+
+QTEST_MAIN( TestLocalCollectionIndex )
+#include "TestLocalCollectionIndex.moc"
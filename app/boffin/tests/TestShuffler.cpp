@@ -0,0 +1,512 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <vector>
+
+#include <QtTest>
+
+#include "Shuffler.h"
+
+
+// the Shuffler's levenshtein() and normalisedLevenshtein() before the
+// Fenwick sampler, lifted from playdar
+static int
+referenceLevenshtein(const QString& source, const QString& target)
+{
+  const int n = source.length();
+  const int m = target.length();
+  if (n == 0) {
+    return m;
+  }
+  if (m == 0) {
+    return n;
+  }
+  typedef std::vector< std::vector<int> > Tmatrix;
+  Tmatrix matrix(n+1);
+  for (int i = 0; i <= n; i++) {
+    matrix[i].resize(m+1);
+  }
+  for (int i = 0; i <= n; i++) {
+    matrix[i][0]=i;
+  }
+  for (int j = 0; j <= m; j++) {
+    matrix[0][j]=j;
+  }
+  for (int i = 1; i <= n; i++) {
+    const QChar s_i = source[i-1];
+    for (int j = 1; j <= m; j++) {
+      const QChar t_j = target[j-1];
+      int cost;
+      if (s_i == t_j) {
+        cost = 0;
+      }
+      else {
+        cost = 1;
+      }
+      const int above = matrix[i-1][j];
+      const int left = matrix[i][j-1];
+      const int diag = matrix[i-1][j-1];
+      int cell = (((left+1)>(diag+cost))?diag+cost:left+1);
+      if(above+1 < cell) cell = above+1;
+      if (i>2 && j>2) {
+        int trans=matrix[i-2][j-2]+1;
+        if (source[i-2]!=t_j) trans++;
+        if (s_i!=target[j-2]) trans++;
+        if (cell>trans) cell=trans;
+      }
+      matrix[i][j]=cell;
+    }
+  }
+  return matrix[n][m];
+}
+
+
+static float
+referenceNormalisedLevenshtein(const BoffinPlayableItem& a, const BoffinPlayableItem& b)
+{
+    QString o_art = a.artist().simplified().toLower();
+    QString o_trk = a.track().simplified().toLower();
+
+    QString art = b.artist().simplified().toLower();
+    QString trk = b.track().simplified().toLower();
+
+    if (o_art == art && o_trk == trk) return 1.0;
+
+    int trked = referenceLevenshtein(trk, o_trk);
+    int arted = referenceLevenshtein(art, o_art);
+
+    const float tol_art = 1.5;
+    const float tol_trk = 1.5;
+    const int grace_len = 6;
+
+    if( o_art.length() > grace_len && arted > o_art.length()/tol_art )
+        return 0.0;
+
+    if( o_trk.length() > grace_len && trked > o_trk.length()/tol_trk )
+        return 0.0;
+
+    if( arted >= o_art.length() )
+        return 0.0;
+
+    if( trked >= o_trk.length() )
+        return 0.0;
+
+    float artdist_pc = (o_art.length()-arted) / (float) o_art.length();
+    float trkdist_pc = (o_trk.length()-trked) / (float) o_trk.length();
+    return artdist_pc * trkdist_pc;
+}
+
+
+// the artist half of referenceNormalisedLevenshtein, with o_art the item's
+// artist and art the historic song's
+static float
+referenceArtistScore(const QString& o_art, const QString& art)
+{
+    int arted = referenceLevenshtein(art, o_art);
+
+    const float tol_art = 1.5;
+    const int grace_len = 6;
+
+    if( o_art.length() > grace_len && arted > o_art.length()/tol_art )
+        return 0.0;
+
+    if( arted >= o_art.length() )
+        return 0.0;
+
+    return (o_art.length()-arted) / (float) o_art.length();
+}
+
+
+/** What the Shuffler weighed every item with before it kept the weights in
+  * a Fenwick tree: the whole history is gone through again for each item
+  * on every draw. Fed the same draws, it has to come up with the same
+  * weights. */
+class ReferenceShuffler
+{
+public:
+    ReferenceShuffler() : m_artistHistorySize(4), m_songHistorySize(100) {}
+
+    void setSongHistorySize(int size)
+    {
+        m_songHistorySize = size;
+        while (m_songHistory.size() > m_songHistorySize)
+            m_songHistory.pop_front();
+    }
+
+    void clearHistory()
+    {
+        m_artistHistory.clear();
+        m_songHistory.clear();
+    }
+
+    void drawn(const BoffinPlayableItem& result)
+    {
+        m_artistHistory.push_back(result.artist());
+        while (m_artistHistory.size() > m_artistHistorySize)
+            m_artistHistory.pop_front();
+        m_songHistory.push_back(result);
+        while (m_songHistory.size() > m_songHistorySize)
+            m_songHistory.pop_front();
+    }
+
+    float weight(const BoffinPlayableItem& item) const
+    {
+        return item.weight() * pushdownSong(item) *
+            (m_artistHistory.contains(item.artist(), Qt::CaseInsensitive) ? 0.00001 : 1.0);
+    }
+
+private:
+    float pushdownSong(const BoffinPlayableItem& item) const
+    {
+        int i = 1;
+        float result = 1.0;
+        foreach(const BoffinPlayableItem& historicItem, m_songHistory) {
+            float nl = referenceNormalisedLevenshtein(item, historicItem);
+            if (nl > 0.5) {
+                float score = 0.1 * (nl * i / (float) m_songHistorySize);
+                if (score < result) {
+                    result = score;
+                }
+            }
+            i++;
+        }
+        return result;
+    }
+
+    QStringList m_artistHistory;
+    int m_artistHistorySize;
+    QList<BoffinPlayableItem> m_songHistory;
+    int m_songHistorySize;
+};
+
+
+class TestShuffler : public QObject
+{
+    Q_OBJECT
+
+    int m_nextId;
+
+    // Near misses of each other, so plenty of songs push others down.
+    // Artists only differ in case, which the old artist history ignored
+    // too, not in spacing, which it didn't
+    static QString pick(const char* const names[], int count)
+    {
+        return QString::fromUtf8(names[qrand() % count]);
+    }
+
+    static QString randomName(int words)
+    {
+        QStringList result;
+        for (int w = 0; w < words; ++w) {
+            QString word;
+            for (int i = 1 + qrand() % 5; i > 0; --i)
+                word += QChar('a' + qrand() % 3);
+            result << word;
+        }
+        return result.join(" ");
+    }
+
+    // a few edits away from s, or more than a few
+    static QString typo(QString s)
+    {
+        for (int edits = 1 + qrand() % qMax(1, s.length() / 2); edits > 0; --edits) {
+            const int i = s.isEmpty() ? 0 : qrand() % s.length();
+            const QChar c('a' + qrand() % 4);
+            switch (s.isEmpty() ? 0 : qrand() % 4) {
+                case 0: s.insert(i, c); break;
+                case 1: s.remove(i, 1); break;
+                case 2: s[i] = c; break;
+                case 3:
+                    if (i + 1 < s.length()) {
+                        const QChar t = s[i];
+                        s[i] = s[i + 1];
+                        s[i + 1] = t;
+                    }
+                    break;
+            }
+        }
+        return s;
+    }
+
+    // names from 1 to 24 letters, each with a few near misses, from an
+    // alphabet small enough for unrelated names to come close too
+    static QStringList generatedNames(int count)
+    {
+        QStringList names;
+        for (int n = 0; n < count; ++n) {
+            QString name;
+            for (int i = 1 + qrand() % 24; i > 0; --i)
+                name += QChar('a' + qrand() % 4);
+            names << name;
+
+            for (int i = qrand() % 4; i > 0; --i) {
+                const QString near = typo(name);
+                if (near.size())
+                    names << near;
+            }
+        }
+        names.removeDuplicates();
+        return names;
+    }
+
+    BoffinPlayableItem randomItem()
+    {
+        static const char* const artists[] = { "The Beatles", "the beatles", "Beatles", "Radiohead", "Radiohed",
+                                                "Björk", "Bjork", "Aphex Twin", "Aphex Twins", "Boards of Canada" };
+        static const char* const tracks[] = { "Yesterday", "Yesterday (Remastered)", "Paranoid Android",
+                                               "Paranoid  android", "Windowlicker", "Window Licker", "Roygbiv",
+                                               "Roygbiv - live", "Hey Jude", "Hey Jude!" };
+
+        QString artist, track;
+        if (qrand() % 3) {
+            artist = pick(artists, sizeof(artists) / sizeof(artists[0]));
+            track = pick(tracks, sizeof(tracks) / sizeof(tracks[0]));
+        } else {
+            artist = randomName(1 + qrand() % 2);
+            track = randomName(1 + qrand() % 3);
+        }
+
+        const QString url = QString("file:///%1.mp3").arg(m_nextId++);
+        return BoffinPlayableItem::fromLocalTrack(artist, "", track, url, 200, "local", (qrand() % 100 + 1) / 100.0f, 0);
+    }
+
+    /** every live slot weighs what the reference says, and nothing else
+      * can be drawn */
+    static void compareWeights(const Shuffler& s, const ReferenceShuffler& reference)
+    {
+        int live = 0;
+        for (int slot = 0; slot < s.m_items.size(); ++slot) {
+            if (s.m_removed.testBit(slot)) {
+                QCOMPARE(s.m_sampler.weight(slot), 0.0);
+                continue;
+            }
+            ++live;
+
+            const float expected = reference.weight(s.m_items[slot]);
+            const double actual = s.m_sampler.weight(slot);
+            if (qAbs(expected - actual) > 1e-6 * qMax(1.0f, expected))
+                QFAIL(qPrintable(QString("slot %1, %2 - %3 weighs %4, should be %5")
+                                 .arg(slot).arg(s.m_items[slot].artist()).arg(s.m_items[slot].track())
+                                 .arg(actual).arg(expected)));
+        }
+        QCOMPARE(live, s.m_live);
+    }
+
+    static BoffinPlayableItem item(const QString& artist, const QString& track, int id)
+    {
+        return BoffinPlayableItem::fromLocalTrack(artist, "", track, QString("file:///%1.mp3").arg(id), 200, "local", 1, 0);
+    }
+
+private slots:
+    void init()
+    {
+        qsrand(3);
+        m_nextId = 0;
+    }
+
+    void drawsEverythingOnce()
+    {
+        Shuffler s;
+        s.m_sampler.seed(1);
+
+        QSet<QString> urls;
+        for (int i = 0; i < 300; ++i) {
+            BoffinPlayableItem item = randomItem();
+            urls << item.url();
+            s.receivePlayableItem(item);
+        }
+
+        for (int i = 0; i < 300; ++i) {
+            const BoffinPlayableItem item = s.sampleOne();
+            QVERIFY(item.isValid());
+            QVERIFY(urls.remove(item.url()));
+        }
+        QVERIFY(!s.sampleOne().isValid());
+
+        s.receivePlayableItem(randomItem());
+        s.clear();
+        QVERIFY(!s.sampleOne().isValid());
+    }
+
+    void weightsMatchTheOldShuffler_data()
+    {
+        QTest::addColumn<uint>("seed");
+        QTest::newRow("1") << 1u;
+        QTest::newRow("1234") << 1234u;
+        QTest::newRow("20130611") << 20130611u;
+    }
+
+    void weightsMatchTheOldShuffler()
+    {
+        QFETCH(uint, seed);
+
+        Shuffler s;
+        ReferenceShuffler reference;
+        s.m_sampler.seed(seed);
+
+        // short enough for songs to leave it
+        s.setSongHistorySize(7);
+        reference.setSongHistorySize(7);
+
+        for (int round = 0; round < 40; ++round) {
+            for (int i = qrand() % 60; i > 0; --i)
+                s.receivePlayableItem(randomItem());
+            compareWeights(s, reference);
+            if (QTest::currentTestFailed())
+                return;
+
+            for (int i = qrand() % 50; i > 0; --i) {
+                const BoffinPlayableItem item = s.sampleOne();
+                if (!item.isValid()) {
+                    QCOMPARE(s.m_live, 0);
+                    break;
+                }
+                reference.drawn(item);
+
+                compareWeights(s, reference);
+                if (QTest::currentTestFailed())
+                    return;
+            }
+
+            if (round == 20) {
+                s.clearHistory();
+                reference.clearHistory();
+            } else if (round == 25) {
+                s.setSongHistorySize(4);
+                reference.setSongHistorySize(4);
+            } else if (round == 30) {
+                // squeezes the holes out
+                QCOMPARE(s.items().size(), s.m_live);
+            }
+
+            compareWeights(s, reference);
+            if (QTest::currentTestFailed())
+                return;
+        }
+    }
+
+    // Only artists between 2/3 and twice the length of a historic artist are
+    // compared with it, with the edit distance cut off at what could still
+    // score over 0.5. Comparing every pair in full has to find the same ones.
+    void similarArtistsMatchAllPairs()
+    {
+        const QStringList artists = generatedNames(150);
+
+        Shuffler s;
+        for (int i = 0; i < artists.size(); ++i)
+            s.receivePlayableItem(item(artists[i], "track", i));
+
+        QStringList historic = artists;
+        historic << generatedNames(50);
+
+        foreach (const QString& h, historic) {
+            QHash<QString, float> expected;
+            foreach (const QString& a, artists) {
+                const float score = referenceArtistScore(a, h);
+                if (score > 0.5 || a == h)
+                    expected.insert(a, a == h ? 1.0f : score);
+            }
+
+            const QHash<QString, float> actual = s.similarArtists(h);
+            foreach (const QString& a, expected.keys())
+                if (!actual.contains(a))
+                    QFAIL(qPrintable(QString("%1 is similar to %2, but was pruned").arg(a).arg(h)));
+            foreach (const QString& a, actual.keys()) {
+                if (!expected.contains(a))
+                    QFAIL(qPrintable(QString("%1 isn't similar to %2").arg(a).arg(h)));
+                if (qAbs(actual.value(a) - expected.value(a)) > 1e-6)
+                    QFAIL(qPrintable(QString("%1 against %2 scores %3, should be %4")
+                                     .arg(a).arg(h).arg(actual.value(a)).arg(expected.value(a))));
+            }
+        }
+    }
+
+    // and the songs similar to each one in the history are the ones the old
+    // all-pairs normalisedLevenshtein puts over 0.5, with the same scores
+    void similarSongsMatchAllPairs()
+    {
+        const QStringList artists = generatedNames(20);
+        const QStringList tracks = generatedNames(20);
+
+        Shuffler s;
+        s.m_sampler.seed(9);
+        int id = 0;
+        for (int i = 0; i < 600; ++i)
+            s.receivePlayableItem(item(artists[qrand() % artists.size()], tracks[qrand() % tracks.size()], id++));
+
+        for (int round = 0; round < 10; ++round) {
+            for (int i = 0; i < 10; ++i)
+                QVERIFY(s.sampleOne().isValid());
+
+            // items that arrive after a song entered the history are
+            // compared with it then
+            for (int i = 0; i < 20; ++i)
+                s.receivePlayableItem(item(artists[qrand() % artists.size()], tracks[qrand() % tracks.size()], id++));
+        }
+        QCOMPARE(s.m_songHistory.size(), 100);
+
+        foreach (const Shuffler::HistoricSong& h, s.m_songHistory) {
+            QHash<int, float> actual;
+            foreach (const Shuffler::SimilarSlot& similar, h.similar)
+                if (!s.m_removed.testBit(similar.first))
+                    actual.insert(similar.first, similar.second);
+
+            for (int slot = 0; slot < s.m_items.size(); ++slot) {
+                if (s.m_removed.testBit(slot))
+                    continue;
+
+                const BoffinPlayableItem& i = s.m_items[slot];
+                const float nl = referenceNormalisedLevenshtein(i, h.item);
+                if (nl > 0.5) {
+                    if (!actual.contains(slot))
+                        QFAIL(qPrintable(QString("%1 - %2 is similar to %3 - %4, but was pruned")
+                                         .arg(i.artist()).arg(i.track()).arg(h.item.artist()).arg(h.item.track())));
+                    QVERIFY(qAbs(actual.take(slot) - nl) < 1e-6);
+                }
+            }
+
+            if (actual.size()) {
+                const BoffinPlayableItem& i = s.m_items[actual.keys().first()];
+                QFAIL(qPrintable(QString("%1 - %2 isn't similar to %3 - %4")
+                                 .arg(i.artist()).arg(i.track()).arg(h.item.artist()).arg(h.item.track())));
+            }
+        }
+    }
+
+    void weightsMatchAfterCompaction()
+    {
+        Shuffler s;
+        ReferenceShuffler reference;
+        s.m_sampler.seed(5);
+        s.setSongHistorySize(10);
+        reference.setSongHistorySize(10);
+
+        // compaction only kicks in past 1024 slots
+        for (int i = 0; i < 2000; ++i)
+            s.receivePlayableItem(randomItem());
+        for (int i = 0; i < 1500; ++i)
+            reference.drawn(s.sampleOne());
+
+        QVERIFY(s.m_items.size() < 2000);
+        compareWeights(s, reference);
+    }
+};
+
+
+QTEST_MAIN( TestShuffler )
+#include "TestShuffler.moc"
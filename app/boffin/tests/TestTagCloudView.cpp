@@ -0,0 +1,114 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <QtTest>
+#include <QStandardItemModel>
+
+#include "TagCloudView.h"
+
+
+class TestTagCloudView : public QObject
+{
+    Q_OBJECT
+
+    /** the row every tag is at has the size the delegate gives it */
+    static void checkSizes( TagCloudView& view )
+    {
+        view.updateGeometries();
+
+        const QStyleOptionViewItem opt = view.viewOptions();
+        QCOMPARE( view.m_items.size(), view.model()->rowCount() );
+        for (int row = 0; row < view.m_items.size(); ++row) {
+            const QModelIndex i = view.model()->index( row, 0 );
+            QCOMPARE( view.m_items[row].text, i.data().toString() );
+            QCOMPARE( view.m_items[row].size, view.itemDelegate()->sizeHint( opt, i ) );
+        }
+    }
+
+    static void fill( QStandardItemModel& model )
+    {
+        const char* tags[] = { "rock", "pop", "jazz", "classical", "hip hop", "ambient" };
+        for (size_t i = 0; i < sizeof( tags ) / sizeof( tags[0] ); ++i)
+            model.appendRow( new QStandardItem( tags[i] ) );
+    }
+
+private slots:
+    void staleRowsMoveWithInserts_data()
+    {
+        QTest::addColumn<int>( "changed" );
+        QTest::addColumn<int>( "inserted" );
+
+        QTest::newRow( "before" ) << 3 << 0;
+        QTest::newRow( "at" ) << 3 << 3;
+        QTest::newRow( "after" ) << 3 << 5;
+    }
+
+    void staleRowsMoveWithInserts()
+    {
+        QFETCH( int, changed );
+        QFETCH( int, inserted );
+
+        QStandardItemModel model;
+        fill( model );
+        TagCloudView view;
+        view.resize( 300, 200 );
+        view.setModel( &model );
+        checkSizes( view );
+
+        // one publish() merging a weight and adding a tag, with no layout
+        // in between
+        model.item( changed )->setText( "progressive death metal" );
+        model.insertRow( inserted, new QStandardItem( "folk" ) );
+        checkSizes( view );
+    }
+
+    void staleRowsMoveWithRemoves_data()
+    {
+        QTest::addColumn<int>( "changed" );
+        QTest::addColumn<int>( "removed" );
+        QTest::addColumn<int>( "count" );
+
+        QTest::newRow( "before" ) << 3 << 0 << 2;
+        QTest::newRow( "just before" ) << 3 << 2 << 1;
+        QTest::newRow( "itself" ) << 3 << 3 << 1;
+        QTest::newRow( "around" ) << 3 << 2 << 3;
+        QTest::newRow( "after" ) << 3 << 4 << 2;
+    }
+
+    void staleRowsMoveWithRemoves()
+    {
+        QFETCH( int, changed );
+        QFETCH( int, removed );
+        QFETCH( int, count );
+
+        QStandardItemModel model;
+        fill( model );
+        TagCloudView view;
+        view.resize( 300, 200 );
+        view.setModel( &model );
+        checkSizes( view );
+
+        model.item( changed )->setText( "progressive death metal" );
+        model.removeRows( removed, count );
+        checkSizes( view );
+    }
+};
+
+
+QTEST_MAIN( TestTagCloudView )
+#include "TestTagCloudView.moc"
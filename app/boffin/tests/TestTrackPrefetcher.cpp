@@ -0,0 +1,357 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <QtTest>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#include "TrackPrefetcher.h"
+
+
+/** Serves files from memory, with just enough HTTP/1.1 for
+  * QNetworkAccessManager, which keeps its connections alive. */
+class FileServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    FileServer() : m_requests( 0 )
+    {
+        connect( this, SIGNAL(newConnection()), SLOT(onNewConnection()) );
+        listen( QHostAddress::LocalHost );
+    }
+
+    void add( const QString& path, const QByteArray& data, const QByteArray& contentType )
+    {
+        m_files[path] = qMakePair( data, contentType );
+    }
+
+    /** path answers with a status other than 200, and a page saying so */
+    void add( const QString& path, const QByteArray& status, const QByteArray& location )
+    {
+        m_others[path] = qMakePair( status, location );
+    }
+
+    QUrl url( const QString& path ) const
+    {
+        return QUrl( QString( "http://127.0.0.1:%1%2" ).arg( serverPort() ).arg( path ) );
+    }
+
+    int requests() const { return m_requests; }
+
+private slots:
+    void onNewConnection()
+    {
+        while ( hasPendingConnections() )
+        {
+            QTcpSocket* socket = nextPendingConnection();
+            connect( socket, SIGNAL(readyRead()), SLOT(onReadyRead()) );
+            connect( socket, SIGNAL(disconnected()), SLOT(onDisconnected()) );
+        }
+    }
+
+    void onReadyRead()
+    {
+        QTcpSocket* socket = static_cast<QTcpSocket*>( sender() );
+        QByteArray& buffer = m_buffers[socket];
+        buffer += socket->readAll();
+
+        int end;
+        while ( ( end = buffer.indexOf( "\r\n\r\n" ) ) >= 0 )
+        {
+            // GET /path HTTP/1.1
+            const QList<QByteArray> request = buffer.left( buffer.indexOf( "\r\n" ) ).split( ' ' );
+            buffer.remove( 0, end + 4 );
+            ++m_requests;
+
+            const QString path = request.value( 1 );
+            if ( m_files.contains( path ) )
+            {
+                const QPair<QByteArray, QByteArray> file = m_files[path];
+                socket->write( "HTTP/1.1 200 OK\r\n"
+                               "Content-Type: " + file.second + "\r\n"
+                               "Content-Length: " + QByteArray::number( file.first.size() ) + "\r\n\r\n" );
+                socket->write( file.first );
+            }
+            else if ( m_others.contains( path ) )
+            {
+                const QPair<QByteArray, QByteArray> other = m_others[path];
+                const QByteArray page = "<html>" + other.first + "</html>";
+                socket->write( "HTTP/1.1 " + other.first + "\r\n"
+                               "Content-Type: text/html\r\n" +
+                               ( other.second.isEmpty() ? QByteArray() : "Location: " + other.second + "\r\n" ) +
+                               "Content-Length: " + QByteArray::number( page.size() ) + "\r\n\r\n" );
+                socket->write( page );
+            }
+            else
+            {
+                socket->write( "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n" );
+            }
+        }
+    }
+
+    void onDisconnected()
+    {
+        m_buffers.remove( sender() );
+        sender()->deleteLater();
+    }
+
+private:
+    QMap<QString, QPair<QByteArray, QByteArray> > m_files;
+    QMap<QString, QPair<QByteArray, QByteArray> > m_others;    // status and location
+    QHash<QObject*, QByteArray> m_buffers;
+    int m_requests;
+};
+
+
+class TestTrackPrefetcher : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+
+    void testFetchesUpcomingTracks();
+    void testTakeWhileFetchingStreams();
+    void testDropsTracksNoLongerUpcoming();
+    void testCacheIsBounded();
+    void testIgnoresFilesAndFailures();
+    void testFollowsRedirects();
+    void testOnlyCachesSuccess();
+
+private:
+    static QByteArray track( int seed, int size );
+    static QByteArray contents( const QUrl& fileUrl );
+    bool waitForCached( const QUrl& url );
+
+    FileServer* m_server;
+    TrackPrefetcher* m_prefetcher;
+    QString m_dir;
+};
+
+
+QByteArray //static
+TestTrackPrefetcher::track( int seed, int size )
+{
+    QByteArray data( size, '\0' );
+    for ( int i = 0 ; i < size ; ++i )
+        data[i] = char( ( i * 31 + seed ) % 251 );
+    return data;
+}
+
+QByteArray //static
+TestTrackPrefetcher::contents( const QUrl& fileUrl )
+{
+    QFile file( fileUrl.toLocalFile() );
+    return file.open( QIODevice::ReadOnly ) ? file.readAll() : QByteArray();
+}
+
+bool
+TestTrackPrefetcher::waitForCached( const QUrl& url )
+{
+    for ( int i = 0 ; i < 500 && !m_prefetcher->isCached( url ) ; ++i )
+        QTest::qWait( 10 );
+    return m_prefetcher->isCached( url );
+}
+
+void
+TestTrackPrefetcher::init()
+{
+    m_server = new FileServer;
+    QVERIFY( m_server->isListening() );
+
+    m_server->add( "/sid/1", track( 1, 300 * 1000 ), "audio/mpeg" );
+    m_server->add( "/sid/2", track( 2, 200 * 1000 ), "application/ogg" );
+    m_server->add( "/sid/3", track( 3, 100 * 1000 ), "audio/mpeg; charset=binary" );
+
+    m_dir = QDir::temp().filePath( "TestTrackPrefetcher" );
+    m_prefetcher = new TrackPrefetcher( m_dir );
+}
+
+void
+TestTrackPrefetcher::cleanup()
+{
+    delete m_prefetcher;
+    delete m_server;
+
+    // everything is cleaned up after
+    QCOMPARE( QDir( m_dir ).entryList( QDir::Files ), QStringList() );
+}
+
+void
+TestTrackPrefetcher::testFetchesUpcomingTracks()
+{
+    const QUrl one = m_server->url( "/sid/1" );
+    const QUrl two = m_server->url( "/sid/2" );
+    m_prefetcher->setUpcoming( QList<QUrl>() << one << two );
+
+    QVERIFY( waitForCached( one ) );
+    QVERIFY( waitForCached( two ) );
+    QCOMPARE( m_prefetcher->cacheSize(), qint64( 500 * 1000 ) );
+
+    const QUrl file = m_prefetcher->take( one );
+    QVERIFY( file.scheme() == "file" );
+    QVERIFY( file.toLocalFile().endsWith( ".mp3" ) );
+    QCOMPARE( contents( file ), track( 1, 300 * 1000 ) );
+    QCOMPARE( m_prefetcher->cacheSize(), qint64( 200 * 1000 ) );
+
+    const QUrl file2 = m_prefetcher->take( two );
+    QVERIFY( file2.toLocalFile().endsWith( ".ogg" ) );
+    QCOMPARE( contents( file2 ), track( 2, 200 * 1000 ) );
+
+    // both are still there for Phonon, until it can't be playing them
+    QVERIFY( QFile::exists( file.toLocalFile() ) );
+    m_prefetcher->setUpcoming( QList<QUrl>() << m_server->url( "/sid/3" ) );
+    QVERIFY( waitForCached( m_server->url( "/sid/3" ) ) );
+    m_prefetcher->take( m_server->url( "/sid/3" ) );
+    QVERIFY( !QFile::exists( file.toLocalFile() ) );
+    QVERIFY( QFile::exists( file2.toLocalFile() ) );
+
+    QCOMPARE( m_server->requests(), 3 );
+}
+
+void
+TestTrackPrefetcher::testTakeWhileFetchingStreams()
+{
+    const QUrl one = m_server->url( "/sid/1" );
+    m_prefetcher->setUpcoming( QList<QUrl>() << one );
+
+    // straight away, before the event loop has had a chance to fetch anything
+    QCOMPARE( m_prefetcher->take( one ), one );
+    QVERIFY( !m_prefetcher->isCached( one ) );
+    QCOMPARE( m_prefetcher->cacheSize(), qint64( 0 ) );
+
+    // and something we were never told about
+    const QUrl other = m_server->url( "/sid/2" );
+    QCOMPARE( m_prefetcher->take( other ), other );
+}
+
+void
+TestTrackPrefetcher::testDropsTracksNoLongerUpcoming()
+{
+    const QUrl one = m_server->url( "/sid/1" );
+    const QUrl two = m_server->url( "/sid/2" );
+    m_prefetcher->setUpcoming( QList<QUrl>() << one << two );
+    QVERIFY( waitForCached( two ) );
+
+    // the shuffler changed its mind about one, two is kept rather than fetched again
+    m_prefetcher->setUpcoming( QList<QUrl>() << two );
+    QVERIFY( !m_prefetcher->isCached( one ) );
+    QVERIFY( m_prefetcher->isCached( two ) );
+    QCOMPARE( m_prefetcher->cacheSize(), qint64( 200 * 1000 ) );
+    QCOMPARE( QDir( m_dir ).entryList( QDir::Files ).size(), 1 );
+    QCOMPARE( m_server->requests(), 2 );
+
+    m_prefetcher->setUpcoming( QList<QUrl>() );
+    QCOMPARE( m_prefetcher->cacheSize(), qint64( 0 ) );
+    QCOMPARE( QDir( m_dir ).entryList( QDir::Files ).size(), 0 );
+}
+
+void
+TestTrackPrefetcher::testCacheIsBounded()
+{
+    m_prefetcher->setMaxCacheSize( 420 * 1000 );
+
+    const QUrl one = m_server->url( "/sid/1" );
+    const QUrl two = m_server->url( "/sid/2" );
+    const QUrl three = m_server->url( "/sid/3" );
+    m_prefetcher->setUpcoming( QList<QUrl>() << one << two << three );
+
+    // two won't fit after one, but three will
+    QVERIFY( waitForCached( three ) );
+    QVERIFY( m_prefetcher->isCached( one ) );
+    QVERIFY( !m_prefetcher->isCached( two ) );
+    QCOMPARE( m_prefetcher->cacheSize(), qint64( 400 * 1000 ) );
+
+    QCOMPARE( m_prefetcher->take( two ), two );
+}
+
+void
+TestTrackPrefetcher::testIgnoresFilesAndFailures()
+{
+    const QUrl local = QUrl::fromLocalFile( QDir::temp().filePath( "track.mp3" ) );
+    const QUrl missing = m_server->url( "/sid/404" );
+    const QUrl one = m_server->url( "/sid/1" );
+    m_prefetcher->setUpcoming( QList<QUrl>() << local << missing << one );
+
+    QVERIFY( waitForCached( one ) );
+    QVERIFY( !m_prefetcher->isCached( missing ) );
+    QCOMPARE( m_server->requests(), 2 );
+
+    // a failure isn't tried again while it's still coming up
+    m_prefetcher->setUpcoming( QList<QUrl>() << missing << one );
+    QTest::qWait( 50 );
+    QCOMPARE( m_server->requests(), 2 );
+
+    QCOMPARE( m_prefetcher->take( local ), local );
+    QCOMPARE( m_prefetcher->take( missing ), missing );
+}
+
+void
+TestTrackPrefetcher::testFollowsRedirects()
+{
+    // relative, absolute, and one to another
+    m_server->add( "/redirect/1", "302 Found", "/sid/1" );
+    m_server->add( "/redirect/2", "301 Moved Permanently", m_server->url( "/sid/2" ).toEncoded() );
+    m_server->add( "/redirect/twice", "307 Temporary Redirect", "/redirect/1" );
+
+    const QUrl one = m_server->url( "/redirect/1" );
+    const QUrl two = m_server->url( "/redirect/2" );
+    const QUrl twice = m_server->url( "/redirect/twice" );
+    m_prefetcher->setUpcoming( QList<QUrl>() << one << two << twice );
+
+    QVERIFY( waitForCached( twice ) );
+    QVERIFY( m_prefetcher->isCached( one ) );
+    QVERIFY( m_prefetcher->isCached( two ) );
+    QCOMPARE( m_prefetcher->cacheSize(), qint64( 800 * 1000 ) );
+    QCOMPARE( m_server->requests(), 7 );
+
+    const QUrl file = m_prefetcher->take( one );
+    QVERIFY( file.toLocalFile().endsWith( ".mp3" ) );
+    QCOMPARE( contents( file ), track( 1, 300 * 1000 ) );
+    QCOMPARE( contents( m_prefetcher->take( two ) ), track( 2, 200 * 1000 ) );
+    QCOMPARE( contents( m_prefetcher->take( twice ) ), track( 1, 300 * 1000 ) );
+}
+
+void
+TestTrackPrefetcher::testOnlyCachesSuccess()
+{
+    // none of these are the track, though none of them is an error to Qt
+    m_server->add( "/loop", "302 Found", "/loop" );
+    m_server->add( "/nowhere", "302 Found", "" );
+    m_server->add( "/choices", "300 Multiple Choices", "" );
+
+    QList<QUrl> urls;
+    urls << m_server->url( "/loop" ) << m_server->url( "/nowhere" )
+         << m_server->url( "/choices" ) << m_server->url( "/sid/3" );
+    m_prefetcher->setUpcoming( urls );
+
+    QVERIFY( waitForCached( urls.last() ) );
+    for ( int i = 0 ; i < urls.size() - 1 ; ++i )
+    {
+        QVERIFY( !m_prefetcher->isCached( urls[i] ) );
+        QCOMPARE( m_prefetcher->take( urls[i] ), urls[i] );
+    }
+    QCOMPARE( m_prefetcher->cacheSize(), qint64( 100 * 1000 ) );
+    QCOMPARE( QDir( m_dir ).entryList( QDir::Files ).size(), 1 );
+}
+
+QTEST_MAIN( TestTrackPrefetcher )
+
+#include "TestTrackPrefetcher.moc"
@@ -0,0 +1,11 @@
+TEMPLATE = app
+TARGET = bench_levenshtein
+QT = core
+CONFIG -= app_bundle
+include( ../../../admin/include.qmake )
+INCLUDEPATH += ..
+
+SOURCES = BenchLevenshtein.cpp \
+          ../EditDistance.cpp
+
+HEADERS = ../EditDistance.h
@@ -0,0 +1,18 @@
+TEMPLATE = app
+TARGET = test_collection_index
+QT = core network testlib
+CONFIG += lastfm boost
+CONFIG -= app_bundle
+DEFINES += LASTFM_COLLAPSE_NAMESPACE
+include( ../../../admin/include.qmake )
+INCLUDEPATH += ..
+
+SOURCES = TestLocalCollectionIndex.cpp \
+          ../LocalCollectionIndex.cpp \
+          ../EditDistance.cpp \
+          ../playdar/BoffinPlayableItem.cpp \
+          ../playdar/jsonGetMember.cpp
+
+HEADERS = ../LocalCollectionIndex.h \
+          ../EditDistance.h \
+          ../playdar/BoffinPlayableItem.h
@@ -0,0 +1,10 @@
+TEMPLATE = app
+TARGET = test_fenwick_sampler
+QT = core testlib
+CONFIG -= app_bundle
+include( ../../../admin/include.qmake )
+INCLUDEPATH += ..
+
+SOURCES = TestFenwickSampler.cpp
+
+HEADERS = ../sample/FenwickSampler.h
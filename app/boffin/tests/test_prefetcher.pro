@@ -0,0 +1,11 @@
+TEMPLATE = app
+TARGET = test_prefetcher
+QT = core network testlib
+CONFIG -= app_bundle
+include( ../../../admin/include.qmake )
+INCLUDEPATH += ..
+
+SOURCES = TestTrackPrefetcher.cpp \
+          ../TrackPrefetcher.cpp
+
+HEADERS = ../TrackPrefetcher.h
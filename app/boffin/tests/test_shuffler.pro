@@ -0,0 +1,17 @@
+TEMPLATE = app
+TARGET = test_shuffler
+QT = core testlib
+CONFIG -= app_bundle
+include( ../../../admin/include.qmake )
+INCLUDEPATH += ..
+
+SOURCES = TestShuffler.cpp \
+          ../Shuffler.cpp \
+          ../EditDistance.cpp \
+          ../playdar/BoffinPlayableItem.cpp \
+          ../playdar/jsonGetMember.cpp
+
+HEADERS = ../Shuffler.h \
+          ../EditDistance.h \
+          ../sample/FenwickSampler.h \
+          ../playdar/BoffinPlayableItem.h
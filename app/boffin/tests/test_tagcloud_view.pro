@@ -0,0 +1,13 @@
+TEMPLATE = app
+TARGET = test_tagcloud_view
+QT = core gui testlib
+CONFIG += lastfm
+CONFIG -= app_bundle
+include( ../../../admin/include.qmake )
+INCLUDEPATH += ..
+DEFINES += LASTFM_COLLAPSE_NAMESPACE
+
+SOURCES = TestTagCloudView.cpp \
+          ../TagCloudView.cpp
+
+HEADERS = ../TagCloudView.h
@@ -67,6 +67,7 @@
 #include "Application.h"
 #include "MainWindow.h"
 #include "AudioscrobblerSettings.h"
+#include "FingerprintSocket.h"
 
 #if !defined(Q_OS_WIN) && !defined(Q_OS_MAC)
 #include "Mpris2/Mpris2.h"
@@ -507,24 +508,19 @@ Application::onTrackStarted( const lastfm::Track& track, const Track& oldTrack )
         if ( trackFileInfo.exists()
              && trackFileInfo.isWritable() ) // this stops us fingerprinting CDs (but maybe other things)
         {
-            QProcess* fpProcess = new QProcess( this );
-            connect( fpProcess, SIGNAL(finished(int)), fpProcess, SLOT(deleteLater()) );
-
-            QStringList arguments;
-            arguments << "--username" << User().name();
-            arguments << "--filename" << track.url().toLocalFile();
-            arguments << "--title" << track.title();
-            arguments << "--album" << track.album();
-            arguments << "--artist" << track.artist();
-
+            if ( !m_fingerprintSocket )
+            {
 #ifdef Q_OS_WIN
-            QString fpExe = QDir( QCoreApplication::applicationDirPath() ).absoluteFilePath( "fingerprinter.exe" );
+                QString fpExe = QDir( QCoreApplication::applicationDirPath() ).absoluteFilePath( "fingerprinter.exe" );
 #elif defined( Q_OS_MAC )
-            QString fpExe = QDir( QCoreApplication::applicationDirPath() ).absoluteFilePath( "../Helpers/fingerprinter" );
+                QString fpExe = QDir( QCoreApplication::applicationDirPath() ).absoluteFilePath( "../Helpers/fingerprinter" );
 #else
-            QString fpExe = QDir( QCoreApplication::applicationDirPath() ).absoluteFilePath( "fingerprinter" );
+                QString fpExe = QDir( QCoreApplication::applicationDirPath() ).absoluteFilePath( "fingerprinter" );
 #endif
-            fpProcess->start( fpExe, arguments );
+                m_fingerprintSocket = new FingerprintSocket( fpExe, this );
+            }
+
+            m_fingerprintSocket->fingerprint( track, User().name() );
         }
     }
 
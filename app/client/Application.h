@@ -40,6 +40,7 @@ class MainWindow;
 class RadioWidget;
 class QAction;
 class ScrobbleInfoFetcher;
+class FingerprintSocket;
 class Drawer;
 class QMenuBar;
 class UserManagerDialog;
@@ -98,6 +99,7 @@ namespace audioscrobbler
 #endif
 
         QPointer<AbstractBootstrapper> m_bootstrapper;
+        QPointer<FingerprintSocket> m_fingerprintSocket;
 
         Track m_currentTrack;
         Track m_trackToScrobble;
@@ -0,0 +1,254 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "FingerprintSocket.h"
+#include <lastfm/misc.h>
+#include <QDebug>
+#include <QProcess>
+#include <QStringList>
+#include <QTimer>
+
+// how long we'll wait for a daemon we started to begin listening. The wait
+// doubles with each attempt that fails, so a slow start doesn't use them up
+static const int k_retryInterval = 250; // ms
+static const int k_maxRetryInterval = 4000; // ms
+static const int k_maxRetries = 8;
+
+
+static inline QString encodeAmp( QString data )
+{
+    return data.replace( '&', "&&" );
+}
+
+
+static QString serverName()
+{
+    // must match FingerprintDaemon::serverName()
+    QString const name = "lastfm_fingerprinter";
+#ifdef Q_OS_WIN
+    return name;
+#else
+    return lastfm::dir::runtimeData().absolutePath() + "/" + name;
+#endif
+}
+
+
+FingerprintSocket::FingerprintSocket( const QString& fingerprinter, QObject* parent )
+: QLocalSocket( parent )
+, m_fingerprinter( fingerprinter )
+, m_daemon( 0 )
+, m_daemonFailed( false )
+, m_retries( 0 )
+, m_nextId( 0 )
+{
+    m_retryTimer = new QTimer( this );
+    m_retryTimer->setSingleShot( true );
+    connect( m_retryTimer, SIGNAL(timeout()), SLOT(retry()) );
+
+    connect( this, SIGNAL(connected()), SLOT(onConnected()) );
+    connect( this, SIGNAL(disconnected()), SLOT(onDisconnected()) );
+    connect( this, SIGNAL(readyRead()), SLOT(onReadyRead()) );
+    connect( this, SIGNAL(error(QLocalSocket::LocalSocketError)), SLOT(onError(QLocalSocket::LocalSocketError)) );
+}
+
+
+FingerprintSocket::~FingerprintSocket()
+{
+    if (m_daemon)
+    {
+        disconnect( m_daemon, 0, this, 0 );
+        m_daemon->terminate();
+        if (!m_daemon->waitForFinished( 1000 ))
+            m_daemon->kill();
+    }
+}
+
+
+void
+FingerprintSocket::fingerprint( const lastfm::Track& track, const QString& username )
+{
+    Job job;
+    job.id = QString::number( m_nextId++ );
+    job.username = username;
+    job.track = track;
+
+    if (m_daemonFailed)
+    {
+        launchProcess( job );
+        return;
+    }
+
+    m_pending << job;
+
+    if (state() == QLocalSocket::ConnectedState)
+        onConnected();
+    else if (state() == QLocalSocket::UnconnectedState)
+        doConnect();
+}
+
+
+void
+FingerprintSocket::doConnect()
+{
+    connectToServer( serverName() );
+}
+
+
+void
+FingerprintSocket::onConnected()
+{
+    m_retries = 0;
+    m_retryTimer->stop();
+
+    foreach (const Job& job, m_pending)
+    {
+        lastfm::Track const& t = job.track;
+        QString const line = "FINGERPRINT i=" + job.id + "&"
+                             "u=" + encodeAmp( job.username ) + "&"
+                             "p=" + encodeAmp( t.url().toLocalFile() ) + "&"
+                             "a=" + encodeAmp( t.artist() ) + "&"
+                             "t=" + encodeAmp( t.title() ) + "&"
+                             "b=" + encodeAmp( t.album().title() ) + '\n';
+        write( line.toUtf8() );
+        m_sent[job.id] = job;
+    }
+
+    m_pending.clear();
+    flush();
+}
+
+
+void
+FingerprintSocket::onDisconnected()
+{
+    // the daemon went away, the jobs it had are lost but fingerprinting is
+    // only ever best effort so we don't try them again
+    if (!m_sent.isEmpty())
+        qWarning() << "Fingerprint daemon disconnected with" << m_sent.count() << "jobs outstanding";
+    m_sent.clear();
+
+    if (!m_pending.isEmpty())
+        doConnect();
+}
+
+
+void
+FingerprintSocket::onReadyRead()
+{
+    while (canReadLine())
+    {
+        QString const line = QString::fromUtf8( readLine() ).trimmed();
+
+        // job ids are numbers so they never contain an escaped '&'
+        int const start = line.indexOf( " i=" );
+        if (start != -1)
+        {
+            int const end = line.indexOf( '&', start );
+            m_sent.remove( line.mid( start + 3, end == -1 ? -1 : end - start - 3 ) );
+        }
+
+        if (line.startsWith( "OK" ))
+            qDebug() << line;
+        else
+            qWarning() << line;
+    }
+}
+
+
+void
+FingerprintSocket::onError( QLocalSocket::LocalSocketError error )
+{
+    switch (error)
+    {
+        case ServerNotFoundError:
+        case ConnectionRefusedError:
+            // not running yet, or still starting up. Restarting the timer
+            // rather than adding another means errors can't pile retries up
+            if (!m_daemon || m_daemon->state() == QProcess::NotRunning)
+                startDaemon();
+            m_retryTimer->start( qMin( k_retryInterval << m_retries, k_maxRetryInterval ) );
+            break;
+
+        case PeerClosedError:
+            // handled by onDisconnected
+            break;
+
+        default:
+            qWarning() << errorString();
+            break;
+    }
+}
+
+
+void
+FingerprintSocket::retry()
+{
+    if (m_pending.isEmpty() || state() != QLocalSocket::UnconnectedState)
+        return;
+
+    // the process hasn't even started yet, so it can't be listening and
+    // this attempt doesn't count against it
+    if (m_daemon && m_daemon->state() == QProcess::Starting)
+    {
+        m_retryTimer->start( k_retryInterval );
+        return;
+    }
+
+    if (++m_retries <= k_maxRetries)
+    {
+        doConnect();
+        return;
+    }
+
+    qWarning() << "Couldn't connect to the fingerprint daemon, falling back to one process per track";
+    m_daemonFailed = true;
+
+    foreach (const Job& job, m_pending)
+        launchProcess( job );
+    m_pending.clear();
+}
+
+
+void
+FingerprintSocket::startDaemon()
+{
+    if (!m_daemon)
+    {
+        m_daemon = new QProcess( this );
+        m_daemon->setProcessChannelMode( QProcess::ForwardedChannels );
+    }
+
+    m_daemon->start( m_fingerprinter, QStringList() << "--daemon" );
+}
+
+
+void
+FingerprintSocket::launchProcess( const Job& job )
+{
+    QProcess* fpProcess = new QProcess( this );
+    connect( fpProcess, SIGNAL(finished(int)), fpProcess, SLOT(deleteLater()) );
+
+    QStringList arguments;
+    arguments << "--username" << job.username;
+    arguments << "--filename" << job.track.url().toLocalFile();
+    arguments << "--title" << job.track.title();
+    arguments << "--album" << job.track.album();
+    arguments << "--artist" << job.track.artist();
+
+    fpProcess->start( m_fingerprinter, arguments );
+}
@@ -0,0 +1,78 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FINGERPRINT_SOCKET_H
+#define FINGERPRINT_SOCKET_H
+
+#include <lastfm/Track.h>
+#include <QHash>
+#include <QList>
+#include <QLocalSocket>
+
+class QProcess;
+class QTimer;
+
+/** Sends tracks to a fingerprinter started with --daemon, starting it the
+  * first time we can't connect. If the daemon won't come up we go back to
+  * running one fingerprinter process per track.
+  */
+class FingerprintSocket : public QLocalSocket
+{
+    Q_OBJECT
+
+public:
+    /** fingerprinter is the path to the fingerprinter executable */
+    FingerprintSocket( const QString& fingerprinter, QObject* parent = 0 );
+    ~FingerprintSocket();
+
+public slots:
+    void fingerprint( const lastfm::Track& track, const QString& username );
+
+private slots:
+    void onConnected();
+    void onDisconnected();
+    void onReadyRead();
+    void onError( QLocalSocket::LocalSocketError );
+    void retry();
+
+private:
+    struct Job
+    {
+        QString id;
+        QString username;
+        lastfm::Track track;
+    };
+
+    void doConnect();
+    void startDaemon();
+    void launchProcess( const Job& job );
+
+private:
+    QString m_fingerprinter;
+    QProcess* m_daemon;
+    QTimer* m_retryTimer;
+    bool m_daemonFailed;
+    int m_retries;
+    int m_nextId;
+
+    QList<Job> m_pending;
+    QHash<QString, Job> m_sent;
+};
+
+#endif
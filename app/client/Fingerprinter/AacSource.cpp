@@ -21,6 +21,7 @@
 */
 #include "AacSource.h"
 #include "AacSource_p.h"
+#include "common/c++/silence.h"
 
 #include <QFile>
 #include <algorithm>
@@ -105,6 +106,10 @@ static int adts_sample_rates[] =
 
 AAC_ADTS_File::AAC_ADTS_File( const QString& fileName, int headerType ) : AAC_File(fileName, headerType)
     , m_file( NULL )
+    , m_mapFile( NULL )
+    , m_map( NULL )
+    , m_mapSize( 0 )
+    , m_mapPos( 0 )
     , m_adifSamplerate( 0 )
     , m_adifChannels( 0 )
 {
@@ -117,6 +122,22 @@ AAC_ADTS_File::~AAC_ADTS_File()
     {
         fclose( m_file );
     }
+    if ( m_mapFile )
+    {
+        // m_inBuf points into the mapping, don't let ~AAC_File free it
+        m_inBuf = NULL;
+        m_inBufSize = 0;
+        delete m_mapFile;
+    }
+}
+
+
+// Tags at the end of the file that would otherwise be fed to the decoder
+static bool atTrailingTag( const unsigned char* buf, size_t bufSize )
+{
+    return ( bufSize > 3 && memcmp( buf, "TAG", 3 ) == 0 )
+        || ( bufSize > 11 && memcmp( buf, "LYRICSBEGIN", 11 ) == 0 )
+        || ( bufSize > 8 && memcmp( buf, "APETAGEX", 8 ) == 0 );
 }
 
 
@@ -132,25 +153,50 @@ void AAC_ADTS_File::fillBuffer( FILE*& fp, unsigned char*& buf, size_t& bufSize,
         bread = fread( (void*)(buf + bufSize), 1, bytesConsumed, fp );
         bufSize += bread;
 
-        if ( bufSize > 3 )
-        {
-            if ( memcmp( buf, "TAG", 3 ) == 0 )
-                bufSize = 0;
-        }
-        if ( bufSize > 11 )
-        {
-            if ( memcmp( buf, "LYRICSBEGIN", 11 ) == 0 )
-                bufSize = 0;
-        }
-        if ( bufSize > 8 )
-        {
-            if ( memcmp( buf, "APETAGEX", 8 ) == 0 )
-                bufSize = 0;
-        }
+        if ( atTrailingTag( buf, bufSize ) )
+            bufSize = 0;
     }
 }
 
 
+bool AAC_ADTS_File::mapFile( size_t offset )
+{
+    m_mapFile = new QFile( m_fileName );
+
+    if ( m_mapFile->open( QIODevice::ReadOnly ) && !m_mapFile->isSequential() && m_mapFile->size() > 0 )
+    {
+        m_map = m_mapFile->map( 0, m_mapFile->size() );
+        m_mapSize = static_cast<size_t>( m_mapFile->size() );
+    }
+
+    if ( !m_map || offset > m_mapSize )
+    {
+        delete m_mapFile;
+        m_mapFile = NULL;
+        m_map = NULL;
+        m_mapSize = 0;
+        return false;
+    }
+
+    free( m_inBuf );
+    m_mapPos = offset;
+    mapWindow();
+    return true;
+}
+
+
+/** Points m_inBuf at the next chunk of the mapping. faad is given the same
+  * amount of input at a time as the fread path would have given it. */
+void AAC_ADTS_File::mapWindow()
+{
+    m_inBuf = m_map + m_mapPos;
+    m_inBufSize = std::min<size_t>( FAAD_MIN_STREAMSIZE * MAX_CHANNELS, m_mapSize - m_mapPos );
+
+    if ( atTrailingTag( m_inBuf, m_inBufSize ) )
+        m_inBufSize = 0;
+}
+
+
 void AAC_ADTS_File::parse( FILE*& fp, unsigned char*& buf, size_t& bufSize, int &bitrate, double &length )
 {
     unsigned int frames, frame_length = 0;
@@ -205,6 +251,57 @@ void AAC_ADTS_File::parse( FILE*& fp, unsigned char*& buf, size_t& bufSize, int
 }
 
 
+/** parse() for a mapped file, walks the frame headers in place */
+static void parseMapped( const unsigned char* buf, size_t bufSize, int &bitrate, double &length )
+{
+    unsigned int frames, frame_length;
+    int t_framelength = 0;
+    int samplerate = 0;
+    double frames_per_sec, bytes_per_frame;
+    size_t pos = 0;
+
+    for ( frames = 0; bufSize - pos > 7; frames++ )
+    {
+        const unsigned char* p = buf + pos;
+
+        if ( atTrailingTag( p, bufSize - pos ) )
+            break;
+
+        /* check syncword */
+        if ( !( (p[0] == 0xFF) && ((p[1] & 0xF6) == 0xF0) ) )
+            break;
+
+        if ( frames == 0 )
+            samplerate = adts_sample_rates[ (p[2] & 0x3c) >> 2 ];
+
+        frame_length = (  ((p[3] & 0x3) << 11)
+                        | ((p[4]) << 3)
+                        | (p[5] >> 5) );
+
+        t_framelength += frame_length - ADTS_HEADER_SIZE;
+
+        if ( frame_length == 0 || frame_length > bufSize - pos )
+            break;
+
+        pos += frame_length;
+    }
+
+    frames_per_sec = samplerate / 1024.0;
+
+    if ( frames != 0 )
+        bytes_per_frame = t_framelength / frames;
+    else
+        bytes_per_frame = 0;
+
+    bitrate = static_cast<int>(8 * bytes_per_frame * frames_per_sec + 0.5);
+
+    if ( frames_per_sec != 0 )
+        length = frames / frames_per_sec;
+    else
+        length = 1;
+}
+
+
 int32_t AAC_ADTS_File::commonSetup( FILE*& fp, NeAACDecHandle& decoder, unsigned char*& buf, size_t& bufSize, unsigned long& samplerate, unsigned char& channels )
 {
     samplerate = 0;
@@ -275,7 +372,11 @@ bool AAC_ADTS_File::init()
      if ( initval >= 0 )
      {
         m_inBufSize -= initval;
-        fillBuffer( m_file, m_inBuf, m_inBufSize, initval );
+
+        // Everything after the headers comes straight from the mapping if
+        // we can get one, otherwise we keep reading through m_file
+        if ( !mapFile( static_cast<size_t>( ftell( m_file ) ) - m_inBufSize ) )
+            fillBuffer( m_file, m_inBuf, m_inBufSize, initval );
 
         // These two only needed for skipping AAC ADIF files
         m_adifSamplerate = initSamplerate;
@@ -317,7 +418,12 @@ void AAC_ADTS_File::getInfo( int& lengthSecs, int& samplerate, int& bitrate, int
 
     if ( (tempBuf[0] == 0xFF) && ((tempBuf[1] & 0xF6) == 0xF0) )
     {
-        parse( fp, tempBuf, tempBufSize, bitrate, initLength );
+        size_t offset = static_cast<size_t>( ftell( fp ) ) - tempBufSize;
+
+        if ( m_map && offset <= m_mapSize )
+            parseMapped( m_map + offset, m_mapSize - offset, bitrate, initLength );
+        else
+            parse( fp, tempBuf, tempBufSize, bitrate, initLength );
     }
     else if (memcmp(tempBuf, "ADIF", 4) == 0)
     {
@@ -348,7 +454,11 @@ void AAC_ADTS_File::getInfo( int& lengthSecs, int& samplerate, int& bitrate, int
 
 void AAC_ADTS_File::skip( const int mSecs )
 {
-    if ( m_header == AAC_ADTS )
+    if ( m_header == AAC_ADTS && m_map )
+    {
+        skipMapped( mSecs );
+    }
+    else if ( m_header == AAC_ADTS )
     {
         // As AAC is VBR we need to check all ADTS headers to enable seeking...
         // There is no other solution
@@ -420,10 +530,7 @@ void AAC_ADTS_File::skip( const int mSecs )
             sampleBuffer = NeAACDecDecode(m_decoder, &frameInfo, m_inBuf, static_cast<uint32_t>(m_inBufSize) );
             totalSamples += frameInfo.samples;
             if ( frameInfo.bytesconsumed > 0 )
-            {
-                m_inBufSize -= frameInfo.bytesconsumed;
-                fillBuffer( m_file, m_inBuf, m_inBufSize, frameInfo.bytesconsumed );
-            }
+                postDecode( frameInfo.bytesconsumed );
             if ( totalSamples >= ( mSecs * m_adifSamplerate * m_adifChannels / 1000 ) )
                 break;
         } while ( sampleBuffer != NULL );
@@ -431,8 +538,61 @@ void AAC_ADTS_File::skip( const int mSecs )
 }
 
 
+/** skip() for ADTS in a mapped file, walks the headers in place */
+void AAC_ADTS_File::skipMapped( const int mSecs )
+{
+    size_t pos = m_mapPos;
+    double seconds = 0;
+
+    while ( seconds * 1000 < mSecs && m_mapSize - pos >= ADTS_HEADER_SIZE )
+    {
+        const unsigned char* header = m_map + pos;
+
+        if ( !strncmp( (const char*)header, "ID3", 3 ) && m_mapSize - pos >= 10 )
+        {
+            // high bit is not used
+            int tagsize = (header[6] << 21) | (header[7] << 14) |
+                (header[8] <<  7) | (header[9] <<  0);
+
+            pos += 10 + tagsize;
+            continue;
+        }
+        if ( !((header[0] == 0xFF) && ((header[1] & 0xF6) == 0xF0)) )
+        {
+            std::cerr << "Error: Bad frame header; file may be corrupt!" << std::endl;
+            break;
+        }
+
+        int samplerate = adts_sample_rates[ (header[2] & 0x3c) >> 2 ];
+        unsigned int frameLength = ( ( header[3] & 0x3 ) << 11 )
+                                   | ( header[4] << 3 )
+                                   | ( header[5] >> 5 );
+
+        if ( samplerate > 0 && frameLength > 0 )
+            seconds += 1024.0 / samplerate;
+        else
+        {
+            std::cerr << "Error: Bad frame header; file may be corrupt!" << std::endl;
+            break;
+        }
+
+        pos += frameLength;
+    }
+
+    m_mapPos = std::min( pos, m_mapSize );
+    mapWindow();
+}
+
+
 void AAC_ADTS_File::postDecode(unsigned long bytesConsumed)
 {
+    if ( m_map )
+    {
+        m_mapPos += std::min<size_t>( bytesConsumed, m_inBufSize );
+        mapWindow();
+        return;
+    }
+
     m_inBufSize -= bytesConsumed;
     fillBuffer( m_file, m_inBuf, m_inBufSize, bytesConsumed );
 }
@@ -461,11 +621,259 @@ AAC_MP4_File::AAC_MP4_File( const QString& fileName, int headerType ) : AAC_File
     , m_mp4SampleId( 0 )
     , m_mp4File ( NULL )
     , m_mp4cb ( NULL )
+    , m_file( NULL )
+    , m_mapFile( NULL )
+    , m_map( NULL )
+    , m_mapSize( 0 )
+{
+}
+
+
+static inline uint32_t be32( const unsigned char* p )
+{
+    return ( static_cast<uint32_t>(p[0]) << 24 ) | ( p[1] << 16 ) | ( p[2] << 8 ) | p[3];
+}
+
+
+static inline uint64_t be64( const unsigned char* p )
+{
+    return ( static_cast<uint64_t>(be32( p )) << 32 ) | be32( p + 4 );
+}
+
+
+/** Finds the nth box of the given type in [begin, end) and sets payload and
+  * payloadEnd to its contents */
+static bool findBox( const unsigned char* begin, const unsigned char* end, const char* type, int n,
+                     const unsigned char*& payload, const unsigned char*& payloadEnd )
+{
+    const unsigned char* p = begin;
+
+    while ( end - p >= 8 )
+    {
+        uint64_t size = be32( p );
+        size_t headerSize = 8;
+
+        if ( size == 1 )
+        {
+            if ( end - p < 16 )
+                return false;
+            size = be64( p + 8 );
+            headerSize = 16;
+        }
+        else if ( size == 0 )
+            size = end - p; // runs to the end of its parent
+
+        if ( size < headerSize || size > static_cast<uint64_t>(end - p) )
+            return false;
+
+        if ( memcmp( p + 4, type, 4 ) == 0 && n-- == 0 )
+        {
+            payload = p + headerSize;
+            payloadEnd = p + size;
+            return true;
+        }
+
+        p += size;
+    }
+
+    return false;
+}
+
+
+/** Reads the payload of the top level moov box */
+static bool readMoov( FILE* fp, std::vector<unsigned char>& moov )
 {
+    long pos = 0;
+    unsigned char header[16];
+
+    for (;;)
+    {
+        if ( fseek( fp, pos, SEEK_SET ) != 0 || fread( header, 1, 8, fp ) != 8 )
+            return false;
+
+        uint64_t size = be32( header );
+        size_t headerSize = 8;
+
+        if ( size == 1 )
+        {
+            if ( fread( header + 8, 1, 8, fp ) != 8 )
+                return false;
+            size = be64( header + 8 );
+            headerSize = 16;
+        }
+
+        if ( memcmp( header + 4, "moov", 4 ) == 0 )
+        {
+            // a moov that runs to the end of the file is legal, but we'd
+            // have to go and find out how big the file is
+            if ( size < headerSize || size - headerSize > 64 * 1024 * 1024 )
+                return false;
+
+            moov.resize( static_cast<size_t>(size - headerSize) );
+            return !moov.empty() && fread( &moov[0], 1, moov.size(), fp ) == moov.size();
+        }
+
+        if ( size < headerSize || size > static_cast<uint64_t>(std::numeric_limits<long>::max() - pos) )
+            return false;
+
+        pos += static_cast<long>(size);
+    }
+}
+
+
+bool AAC_MP4_File::buildIndex( FILE* fp )
+{
+    std::vector<unsigned char> moov;
+    if ( !readMoov( fp, moov ) )
+        return false;
+
+    const unsigned char* const moovEnd = &moov[0] + moov.size();
+    const unsigned char *trak, *trakEnd, *mdia, *mdiaEnd, *minf, *minfEnd, *stbl, *stblEnd;
+    const unsigned char *mdhd, *mdhdEnd, *stts, *sttsEnd, *stsz, *stszEnd, *stsc, *stscEnd, *stco, *stcoEnd;
+
+    // mp4ff numbers the tracks in the order their trak boxes appear
+    if ( !findBox( &moov[0], moovEnd, "trak", m_mp4AudioTrack, trak, trakEnd )
+         || !findBox( trak, trakEnd, "mdia", 0, mdia, mdiaEnd )
+         || !findBox( mdia, mdiaEnd, "mdhd", 0, mdhd, mdhdEnd )
+         || !findBox( mdia, mdiaEnd, "minf", 0, minf, minfEnd )
+         || !findBox( minf, minfEnd, "stbl", 0, stbl, stblEnd )
+         || !findBox( stbl, stblEnd, "stts", 0, stts, sttsEnd )
+         || !findBox( stbl, stblEnd, "stsz", 0, stsz, stszEnd )
+         || !findBox( stbl, stblEnd, "stsc", 0, stsc, stscEnd ) )
+        return false;
+
+    bool co64 = false;
+    if ( !findBox( stbl, stblEnd, "stco", 0, stco, stcoEnd ) )
+    {
+        if ( !findBox( stbl, stblEnd, "co64", 0, stco, stcoEnd ) )
+            return false;
+        co64 = true;
+    }
+
+    // all of these are full boxes, so they start with a version and flags
+    SampleIndex index;
+
+    if ( mdhdEnd - mdhd < 24 )
+        return false;
+    index.timescale = be32( mdhd + ( mdhd[0] == 1 ? 20 : 12 ) );
+
+    // stsz: sample sizes, or one size for every sample
+    if ( stszEnd - stsz < 12 )
+        return false;
+    uint32_t const sampleSize = be32( stsz + 4 );
+    uint32_t const sampleCount = be32( stsz + 8 );
+    if ( sampleCount == 0 || ( sampleSize == 0 && ( stszEnd - stsz - 12 ) / 4 < sampleCount ) )
+        return false;
+
+    index.sizes.resize( sampleCount, sampleSize );
+    if ( sampleSize == 0 )
+        for ( uint32_t i = 0; i < sampleCount; ++i )
+            index.sizes[i] = be32( stsz + 12 + i * 4 );
+
+    // stts: runs of samples with the same duration
+    if ( sttsEnd - stts < 8 )
+        return false;
+    uint32_t const sttsCount = be32( stts + 4 );
+    if ( ( sttsEnd - stts - 8 ) / 8 < sttsCount )
+        return false;
+
+    index.times.reserve( sampleCount + 1 );
+    uint64_t time = 0;
+    for ( uint32_t i = 0; i < sttsCount && index.times.size() < sampleCount; ++i )
+    {
+        uint32_t const count = be32( stts + 8 + i * 8 );
+        uint32_t const delta = be32( stts + 12 + i * 8 );
+        for ( uint32_t j = 0; j < count && index.times.size() < sampleCount; ++j )
+        {
+            index.times.push_back( time );
+            time += delta;
+        }
+    }
+    if ( index.times.size() != sampleCount )
+        return false;
+    index.times.push_back( time );
+
+    // stsc maps chunks to runs of samples, stco/co64 says where each chunk is
+    if ( stscEnd - stsc < 8 || stcoEnd - stco < 8 )
+        return false;
+    uint32_t const stscCount = be32( stsc + 4 );
+    uint32_t const chunkCount = be32( stco + 4 );
+    if ( ( stscEnd - stsc - 8 ) / 12 < stscCount || ( stcoEnd - stco - 8 ) / ( co64 ? 8 : 4 ) < chunkCount )
+        return false;
+
+    index.offsets.resize( sampleCount );
+    uint32_t sample = 0;
+    for ( uint32_t i = 0; i < stscCount && sample < sampleCount; ++i )
+    {
+        const unsigned char* const entry = stsc + 8 + i * 12;
+        uint32_t const firstChunk = be32( entry );
+        uint32_t const samplesPerChunk = be32( entry + 4 );
+        uint32_t const lastChunk = i + 1 < stscCount ? be32( entry + 12 ) - 1 : chunkCount;
+
+        // chunks are numbered from 1
+        for ( uint32_t chunk = firstChunk; chunk >= 1 && chunk <= lastChunk && chunk <= chunkCount && sample < sampleCount; ++chunk )
+        {
+            uint64_t offset = co64 ? be64( stco + 8 + ( chunk - 1 ) * 8 ) : be32( stco + 8 + ( chunk - 1 ) * 4 );
+            for ( uint32_t j = 0; j < samplesPerChunk && sample < sampleCount; ++j, ++sample )
+            {
+                index.offsets[sample] = offset;
+                offset += index.sizes[sample];
+            }
+        }
+    }
+    if ( sample != sampleCount )
+        return false;
+
+    // don't trust tables that disagree with mp4ff or point past the end of the file
+    if ( index.timescale == 0 || static_cast<int32_t>(sampleCount) != mp4ff_num_samples( m_mp4File, m_mp4AudioTrack ) )
+        return false;
+
+    if ( fseek( fp, 0, SEEK_END ) != 0 )
+        return false;
+    long const fileSize = ftell( fp );
+    if ( fileSize < 0 || index.offsets.back() + index.sizes.back() > static_cast<uint64_t>(fileSize) )
+        return false;
+
+    m_index.timescale = index.timescale;
+    m_index.offsets.swap( index.offsets );
+    m_index.sizes.swap( index.sizes );
+    m_index.times.swap( index.times );
+    return true;
 }
 
+
 int32_t AAC_MP4_File::readSample()
 {
+    if ( !m_index.isEmpty() )
+    {
+        if ( m_mp4SampleId >= m_index.sizes.size() )
+            return 0;
+
+        uint64_t const offset = m_index.offsets[m_mp4SampleId];
+        uint32_t const size = m_index.sizes[m_mp4SampleId];
+
+        if ( m_map )
+        {
+            if ( offset + size > m_mapSize )
+                return 0;
+            m_inBuf = m_map + offset;
+        }
+        else
+        {
+            if ( m_sampleBuf.size() < size )
+                m_sampleBuf.resize( size );
+
+            if ( size == 0
+                 || fseek( m_file, static_cast<long>(offset), SEEK_SET ) != 0
+                 || fread( &m_sampleBuf[0], 1, size, m_file ) != size )
+                return 0;
+            m_inBuf = &m_sampleBuf[0];
+        }
+
+        m_inBufSize = size;
+        return static_cast<int32_t>(size);
+    }
+
     unsigned int bsize;
     int32_t rc = mp4ff_read_sample( m_mp4File, m_mp4AudioTrack, m_mp4SampleId, &m_inBuf,  &bsize );
     m_inBufSize = bsize;
@@ -596,6 +1004,16 @@ bool AAC_MP4_File::commonSetup( NeAACDecHandle& decoder, mp4ff_callback_t*& cb,
 
 void AAC_MP4_File::getInfo( int& lengthSecs, int& samplerate, int& bitrate, int& nchannels )
 {
+    if ( m_mp4File && !m_index.isEmpty() )
+    {
+        // everything we need was read at init()
+        samplerate = mp4ff_get_sample_rate( m_mp4File, m_mp4AudioTrack );
+        lengthSecs = static_cast<int>(static_cast<double>(m_index.times.back()) / m_index.timescale + 0.5);
+        bitrate = mp4ff_get_avg_bitrate( m_mp4File, m_mp4AudioTrack );
+        nchannels = mp4ff_get_channel_count( m_mp4File, m_mp4AudioTrack );
+        return;
+    }
+
     FILE* fp = NULL;
     mp4ff_callback_t *cb = NULL;
     NeAACDecHandle decoder = NULL;
@@ -670,19 +1088,52 @@ bool AAC_MP4_File::init()
     if ( buffer )
         free( buffer );
 
+    m_file = fp;
+
+    if ( buildIndex( fp ) )
+    {
+        m_mapFile = new QFile( m_fileName );
+
+        if ( m_mapFile->open( QIODevice::ReadOnly ) && !m_mapFile->isSequential() && m_mapFile->size() > 0 )
+        {
+            m_map = m_mapFile->map( 0, m_mapFile->size() );
+            m_mapSize = static_cast<size_t>( m_mapFile->size() );
+        }
+
+        if ( !m_map )
+        {
+            delete m_mapFile;
+            m_mapFile = NULL;
+            m_mapSize = 0;
+        }
+    }
+
     return true;
 }
 
 
 void AAC_MP4_File::postDecode(unsigned long)
 {
-            free( m_inBuf );
-            m_inBuf = NULL;
-            m_mp4SampleId++;
+    // indexed samples live in the mapping or m_sampleBuf
+    if ( m_index.isEmpty() )
+        free( m_inBuf );
+    m_inBuf = NULL;
+    m_mp4SampleId++;
 }
 
 void AAC_MP4_File::skip( const int mSecs )
 {
+    if ( !m_index.isEmpty() )
+    {
+        // the first sample starting at or after mSecs from here
+        const std::vector<uint64_t>& times = m_index.times;
+        size_t const current = std::min<size_t>( m_mp4SampleId, m_index.sizes.size() );
+        uint64_t const target = times[current] + static_cast<uint64_t>(mSecs) * m_index.timescale / 1000;
+
+        m_mp4SampleId = static_cast<uint32_t>(std::lower_bound( times.begin(), times.end() - 1, target ) - times.begin());
+        return;
+    }
+
     double dur = 0.0;
     int f = 1;
     unsigned char *buff = NULL;
@@ -713,12 +1164,20 @@ void AAC_MP4_File::skip( const int mSecs )
 
 AAC_MP4_File::~AAC_MP4_File()
 {
+    // ~AAC_File would free it, but with an index it isn't ours
+    if ( !m_index.isEmpty() )
+        m_inBuf = NULL;
+
     if ( m_mp4File )
         mp4ff_close( m_mp4File );
     if ( m_mp4cb )
     {
         free( m_mp4cb );
     }
+    if ( m_file )
+        fclose( m_file );
+
+    delete m_mapFile;
 }
 
 
@@ -862,19 +1321,7 @@ void AacSource::skipSilence(double silenceThreshold /* = 0.0001 */)
         }
         else if ( frameInfo.samples > 0 )
         {
-            double sum = 0;
-            int16_t *buf = static_cast<int16_t*>(sampleBuffer);
-            switch ( frameInfo.channels )
-            {
-                case 1:
-                    for (size_t j = 0; j < frameInfo.samples; ++j)
-                        sum += abs( buf[j] );
-                    break;
-                case 2:
-                    for (size_t j = 0; j < frameInfo.samples; j+=2)
-                        sum += abs( (buf[j] >> 1) + (buf[j+1] >> 1) );
-                    break;
-            }
+            double sum = silence::sum( static_cast<int16_t*>(sampleBuffer), frameInfo.samples/frameInfo.channels, frameInfo.channels );
             if ( (sum >= silenceThreshold * static_cast<short>(frameInfo.samples/frameInfo.channels) ) )
                 break;
         }
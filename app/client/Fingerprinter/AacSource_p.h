@@ -20,6 +20,9 @@
 
 #include <faad.h>
 #include <mp4ff.h>
+#include <vector>
+
+class QFile;
 
 class AAC_File
 {
@@ -65,10 +68,36 @@ public:
 private:
     bool commonSetup( NeAACDecHandle& handle, mp4ff_callback_t*& cb, FILE*& fp, mp4ff_t*& mp4, int32_t& audioTrack );
     virtual int32_t getTrack( const mp4ff_t* f );
+    bool buildIndex( FILE* fp );
     int32_t m_mp4AudioTrack;
     uint32_t m_mp4SampleId;
     mp4ff_t *m_mp4File;
     mp4ff_callback_t *m_mp4cb;
+    FILE* m_file;
+
+    // Where each sample of the audio track is and when it starts, built
+    // from the stts, stsz, stsc and stco/co64 boxes at init(). mp4ff walks
+    // these tables for every sample it reads or measures, this lets skip()
+    // binary search and readSample() go straight to the data. If the
+    // tables can't be read it is left empty and we use mp4ff as before.
+    struct SampleIndex
+    {
+        SampleIndex() : timescale( 0 ) {}
+        bool isEmpty() const { return sizes.empty(); }
+
+        uint32_t timescale;
+        std::vector<uint64_t> offsets;
+        std::vector<uint32_t> sizes;
+        std::vector<uint64_t> times;    // in timescale units, with the end of the last sample at the back
+    };
+    SampleIndex m_index;
+
+    // With an index, samples are read straight out of a mapping of the
+    // file, or into m_sampleBuf if it can't be mapped
+    QFile* m_mapFile;
+    unsigned char* m_map;
+    size_t m_mapSize;
+    std::vector<unsigned char> m_sampleBuf;
 };
 
 
@@ -88,7 +117,17 @@ private:
     void parse( FILE*& fp, unsigned char*& buf, size_t& bufSize, int &bitrate, double &length );
     void fillBuffer( FILE*& fp, unsigned char*& buf, size_t& bufSize, const size_t m_bytesConsumed );
 
+    // When the file can be mapped m_inBuf points into the mapping rather
+    // than at a malloced copy, and consuming input just moves it along
+    bool mapFile( size_t offset );
+    void mapWindow();
+    void skipMapped( const int mSecs );
+
     FILE* m_file;
+    QFile* m_mapFile;
+    unsigned char* m_map;
+    size_t m_mapSize;
+    size_t m_mapPos;
     // These two only needed for skipping AAC ADIF files
     uint32_t m_adifSamplerate;
     int m_adifChannels;
@@ -18,6 +18,7 @@
    along with liblastfm.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "FlacSource.h"
+#include "common/c++/silence.h"
 #include <algorithm>
 #include <cassert>
 #include <errno.h>
@@ -40,28 +41,65 @@ FLAC__StreamDecoderWriteStatus FlacSource::_write_callback(const FLAC__StreamDec
 FLAC__StreamDecoderWriteStatus FlacSource::write_callback(const FLAC__Frame *frame, const FLAC__int32 * const buffer[])
 {
     m_outBufLen = 0;
+    m_outBufPos = 0;
 
-    if ( m_outBuf )
+    const unsigned blocksize = frame->header.blocksize;
+    const size_t needed = static_cast<size_t>(blocksize) * m_channels;
+
+    // STREAMINFO's max_blocksize should make this a no-op, but don't trust it
+    if ( needed > m_outBufSize )
     {
-        size_t i;
-        for(i = 0; i < frame->header.blocksize; i++)
-        {
-            switch ( m_channels )
-            {
-                case 1:
-                    m_outBuf[m_outBufLen] = (FLAC__int16)buffer[0][i]; // mono
-                    m_outBufLen++;
-                    break;
-                case 2:
-                    m_outBuf[m_outBufLen] = (FLAC__int16)buffer[0][i]; // left channel
-                    m_outBuf[m_outBufLen+1] = (FLAC__int16)buffer[1][i]; // right channel
-                    m_outBufLen += 2;
-                    break;
-            }
-        }
-        m_samplePos += frame->header.blocksize;
+        short* outBuf = static_cast<short*>(realloc( m_outBuf, sizeof(short) * needed ));
+        if ( !outBuf )
+            return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+        m_outBuf = outBuf;
+        m_outBufSize = needed;
+    }
+
+    // scale everything to 16 bits. Samples narrower than that are scaled up
+    // by multiplying, shifting a negative sample left is undefined
+    const int shift = static_cast<int>(m_bps) - 16;
+    const FLAC__int32 scale = shift < 0 ? 1 << -shift : 1;
+    short* out = m_outBuf;
+
+    switch ( m_channels )
+    {
+        case 1:
+            if ( shift == 0 )
+                for ( unsigned i = 0; i < blocksize; ++i )
+                    *out++ = static_cast<FLAC__int16>(buffer[0][i]); // mono
+            else if ( shift > 0 )
+                for ( unsigned i = 0; i < blocksize; ++i )
+                    *out++ = static_cast<FLAC__int16>(buffer[0][i] >> shift);
+            else
+                for ( unsigned i = 0; i < blocksize; ++i )
+                    *out++ = static_cast<FLAC__int16>(buffer[0][i] * scale);
+            break;
+        case 2:
+            if ( shift == 0 )
+                for ( unsigned i = 0; i < blocksize; ++i )
+                {
+                    *out++ = static_cast<FLAC__int16>(buffer[0][i]); // left channel
+                    *out++ = static_cast<FLAC__int16>(buffer[1][i]); // right channel
+                }
+            else if ( shift > 0 )
+                for ( unsigned i = 0; i < blocksize; ++i )
+                {
+                    *out++ = static_cast<FLAC__int16>(buffer[0][i] >> shift);
+                    *out++ = static_cast<FLAC__int16>(buffer[1][i] >> shift);
+                }
+            else
+                for ( unsigned i = 0; i < blocksize; ++i )
+                {
+                    *out++ = static_cast<FLAC__int16>(buffer[0][i] * scale);
+                    *out++ = static_cast<FLAC__int16>(buffer[1][i] * scale);
+                }
+            break;
     }
 
+    m_outBufLen = out - m_outBuf;
+    m_samplePos += blocksize;
+
     return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 
@@ -84,9 +122,12 @@ void FlacSource::metadata_callback( const FLAC__StreamMetadata *metadata )
             m_totalSamples = metadata->data.stream_info.total_samples;
             m_samplerate = metadata->data.stream_info.sample_rate;
             m_bps = metadata->data.stream_info.bits_per_sample;
-            m_maxFrameSize = metadata->data.stream_info.max_framesize;
+            m_maxBlockSize = metadata->data.stream_info.max_blocksize;
             break;
         case FLAC__METADATA_TYPE_VORBIS_COMMENT:
+            // we see the metadata again if the decoder is reset
+            if ( m_commentData )
+                FLAC__metadata_object_delete( m_commentData );
             m_commentData = FLAC__metadata_object_clone(metadata);
             break;
         default:
@@ -114,11 +155,13 @@ void FlacSource::error_callback(FLAC__StreamDecoderErrorStatus status)
 FlacSource::FlacSource()
     : m_decoder( 0 )
     , m_fileSize( 0 )
+    , m_audioOffset( 0 )
     , m_outBuf( 0 )
+    , m_outBufSize( 0 )
     , m_outBufLen( 0 )
     , m_outBufPos( 0 )
     , m_samplePos( 0 )
-    , m_maxFrameSize( 0 )
+    , m_maxBlockSize( 0 )
     , m_commentData( 0 )
     , m_bps( 0 )
     , m_channels( 0 )
@@ -182,17 +225,28 @@ void FlacSource::init(const QString& fileName)
                 return;
 
             FLAC__stream_decoder_process_until_end_of_metadata( m_decoder );
-            m_outBuf = static_cast<signed short*>(malloc( sizeof(signed short)*m_maxFrameSize));
 
-            if ( m_bps != 16 )
+            // the decoder is now sitting on the first frame, which saves
+            // getInfo() going through the metadata again for the bitrate
+            if ( !FLAC__stream_decoder_get_decode_position( m_decoder, &m_audioOffset ) )
+                m_audioOffset = 0;
+
+            // write_callback() scales everything to 16 bits
+            if ( m_bps < 4 || m_bps > 24 )
             {
                 FLAC__stream_decoder_finish( m_decoder );
                 FLAC__stream_decoder_delete( m_decoder );
                 FLAC__metadata_object_delete( m_commentData );
                 m_decoder = 0;
                 m_commentData = 0;
-                throw std::runtime_error( "ERROR: only 16 bit FLAC files are currently supported!" );
+                throw std::runtime_error( "ERROR: only FLAC files of up to 24 bits per sample are supported!" );
             }
+
+            // one block, allocated once
+            m_outBufSize = static_cast<size_t>(m_maxBlockSize) * m_channels;
+            m_outBuf = static_cast<signed short*>(malloc( sizeof(signed short) * m_outBufSize ));
+            if ( !m_outBuf )
+                m_outBufSize = 0;
         }
         else
             throw std::runtime_error( "ERROR: cannot load FLAC file!" );
@@ -238,7 +292,11 @@ void FlacSource::getInfo(int& lengthSecs, int& samplerate, int& bitrate, int& nc
             lengthSecs = static_cast<int>( static_cast<double>(m_totalSamples)/m_samplerate + 0.5);
 
         // Calcuate bitrate
-        if ( lengthSecs > 0 )
+        if ( lengthSecs > 0 && m_audioOffset > 0 )
+        {
+            bitrate = static_cast<int>( static_cast<double>(m_fileSize - m_audioOffset) * 8 / lengthSecs + 0.5 );
+        }
+        else if ( lengthSecs > 0 )
         {
             FLAC__Metadata_SimpleIterator *it = FLAC__metadata_simple_iterator_new();
             FLAC__metadata_simple_iterator_init( it, QFile::encodeName(m_fileName), true, true );
@@ -258,10 +316,27 @@ void FlacSource::getInfo(int& lengthSecs, int& samplerate, int& bitrate, int& nc
 
 void FlacSource::skip( const int mSecs )
 {
-    FLAC__uint64 absSample = mSecs * m_samplerate / 1000 + m_samplePos;
-    if ( !FLAC__stream_decoder_seek_absolute(m_decoder, absSample) )
-        FLAC__stream_decoder_reset( m_decoder );
+    if ( mSecs <= 0 || !m_decoder || m_channels == 0 )
+        return;
+
+    // from the next sample updateBuffer() would hand out
+    FLAC__uint64 const current = m_samplePos - ( m_outBufLen - m_outBufPos ) / m_channels;
+    FLAC__uint64 const absSample = current + static_cast<FLAC__uint64>(mSecs) * m_samplerate / 1000;
+
+    // libFLAC uses the SEEKTABLE if there is one and bisects the file if
+    // not. Either way it finishes by decoding the block containing
+    // absSample into m_outBuf, starting at absSample, so keep that.
     m_outBufLen = 0;
+    m_outBufPos = 0;
+
+    if ( FLAC__stream_decoder_seek_absolute(m_decoder, absSample) )
+        m_samplePos = absSample + m_outBufLen / m_channels;
+    else
+    {
+        FLAC__stream_decoder_reset( m_decoder );
+        m_outBufLen = 0;
+        m_samplePos = 0;
+    }
 }
 
 // ---------------------------------------------------------------------
@@ -271,28 +346,17 @@ void FlacSource::skipSilence(double silenceThreshold /* = 0.0001 */)
     silenceThreshold *= static_cast<double>( std::numeric_limits<short>::max() );
     for ( ;; )
     {
-        double sum = 0;
         bool result = FLAC__stream_decoder_process_single( m_decoder );
-        // there was a fatal read
-        if ( !result )
+        // there was a fatal read, or the whole file is silent
+        if ( !result || FLAC__stream_decoder_get_state( m_decoder ) == FLAC__STREAM_DECODER_END_OF_STREAM )
             break;
 
-        switch ( m_channels )
-        {
-            case 1:
-                for (size_t j = 0; j < m_outBufLen; ++j)
-                    sum += abs( m_outBuf[j] );
-                break;
-            case 2:
-                for ( size_t j = 0; j < m_outBufLen; j+=2 )
-                    sum += abs( (m_outBuf[j] >> 1)
-                                + (m_outBuf[j+1] >> 1) );
-                break;
-        }
+        double sum = silence::sum( m_outBuf, m_outBufLen/m_channels, m_channels );
         if ( (sum >= silenceThreshold * static_cast<double>(m_outBufLen) ) )
             break;
     }
     m_outBufLen = 0;
+    m_outBufPos = 0;
 }
 
 // ---------------------------------------------------------------------
@@ -311,7 +375,7 @@ int FlacSource::updateBuffer( signed short *pBuffer, size_t bufferSize )
         memcpy( pBufferIt, m_outBuf + m_outBufPos, sizeof(signed short)*samples_to_use );
 
         if ( samples_to_use < m_outBufLen - m_outBufPos )
-            m_outBufPos = samples_to_use;
+            m_outBufPos += samples_to_use;
         else
         {
             m_outBufPos = 0;
@@ -56,11 +56,13 @@ private:
     FLAC__StreamDecoder *m_decoder;
     QString m_fileName;
     size_t m_fileSize;
-    short *m_outBuf;
+    FLAC__uint64 m_audioOffset; // of the first frame, 0 if we don't know it
+    short *m_outBuf;            // one block of interleaved s16, reused for every block
+    size_t m_outBufSize;
     size_t m_outBufLen;
     size_t m_outBufPos;
-    FLAC__uint64 m_samplePos;
-    unsigned m_maxFrameSize;
+    FLAC__uint64 m_samplePos;   // of the end of the block in m_outBuf
+    unsigned m_maxBlockSize;
     FLAC__StreamMetadata* m_commentData;
     unsigned m_bps;
     unsigned m_channels;
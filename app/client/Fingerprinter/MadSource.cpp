@@ -27,8 +27,10 @@
 #include <cstdlib>
 #include <sstream>
 #include <cassert>
+#include <algorithm>
 #include <stdexcept>
 #include "MadSource.h"
+#include "common/c++/silence.h"
 
 #undef max // was definded in mad
 
@@ -38,7 +40,15 @@ using namespace std;
 // -----------------------------------------------------------
 
 MadSource::MadSource()
-          : m_pMP3_Buffer ( new unsigned char[m_MP3_BufferSize+MAD_BUFFER_GUARD] )
+          : m_map ( NULL )
+          , m_mapSize ( 0 )
+          , m_pMP3_Buffer ( new unsigned char[m_MP3_BufferSize+MAD_BUFFER_GUARD] )
+          , m_seekMode ( SeekNone )
+          , m_audioStart ( 0 )
+          , m_audioBytes ( 0 )
+          , m_duration ( 0 )
+          , m_bitrate ( 0 )
+          , m_vbriSecsPerEntry ( 0 )
 {}
 
 // -----------------------------------------------------------
@@ -47,6 +57,7 @@ MadSource::~MadSource()
 {
    if ( m_inputFile.isOpen() )
    {
+      if ( m_map ) m_inputFile.unmap( m_map );
       m_inputFile.close();
       mad_synth_finish(&m_mad_synth);
       mad_frame_finish(&m_mad_frame);
@@ -200,12 +211,21 @@ void MadSource::init(const QString& fileName)
       throw std::runtime_error ("Cannot load mp3 file!");
    }
 
+   // Decode straight out of the page cache if we can. If the file can't be
+   // mapped (pipes, or too big for the address space) we read it in chunks.
+   m_mapSize = m_inputFile.isSequential() ? 0 : m_inputFile.size();
+   m_map = m_mapSize > 0 ? m_inputFile.map( 0, m_mapSize ) : NULL;
+   if ( !m_map )
+      m_mapSize = 0;
+
    mad_stream_init(&m_mad_stream);
    mad_frame_init (&m_mad_frame);
    mad_synth_init (&m_mad_synth);
    mad_timer_reset(&m_mad_timer);
 
    m_pcmpos = m_mad_synth.pcm.length;
+
+   buildSeekIndex();
 }
 
 // -----------------------------------------------------------------------------
@@ -245,8 +265,13 @@ void MadSource::getInfo(int& lengthSecs, int& samplerate, int& bitrate, int& nch
    double avgNChannels = 0;
    int nFrames = 0;
 
-   while ( fetchData( inputFile, pMP3_Buffer, m_MP3_BufferSize, madStream) )
+   for (;;)
    {
+      bool fine = m_map ? fetchMappedData( m_map, m_mapSize, pMP3_Buffer, m_MP3_BufferSize, madStream )
+                        : fetchData( inputFile, pMP3_Buffer, m_MP3_BufferSize, madStream );
+      if ( !fine )
+         break;
+
       if ( mad_header_decode(&madHeader, &madStream) != 0 )
       {
          if ( isRecoverable(madStream.error) )
@@ -354,6 +379,64 @@ bool MadSource::fetchData( QFile& mp3File,
    return true;
 }
 
+/** The mapped equivalent of fetchData(). libmad is given the mapped file as
+  * one buffer, so nothing is copied until it runs out with
+  * MAD_ERROR_BUFLEN. The last frame needs MAD_BUFFER_GUARD zero bytes after
+  * it, which we can't write into the mapping, so whatever libmad left
+  * over is moved to pMP3_Buffer with the guard after it.
+  */
+bool MadSource::fetchMappedData( const unsigned char* pMap,
+                                  qint64 mapSize,
+                                  unsigned char* pMP3_Buffer,
+                                  const int MP3_BufferSize,
+                                  mad_stream& madStream )
+{
+   if ( madStream.buffer == NULL )
+   {
+      mad_stream_buffer( &madStream, pMap, static_cast<unsigned long>(mapSize) );
+      madStream.error = MAD_ERROR_NONE;
+   }
+   else if ( madStream.error == MAD_ERROR_BUFLEN )
+   {
+      // already decoding the tail, so that's everything
+      if ( madStream.buffer == pMP3_Buffer )
+         return false;
+
+      const unsigned char* next = madStream.next_frame ? madStream.next_frame : madStream.buffer;
+      size_t remaining = std::min<size_t>( madStream.bufend - next, MP3_BufferSize );
+
+      memcpy( pMP3_Buffer, next, remaining );
+      memset( pMP3_Buffer + remaining, 0, MAD_BUFFER_GUARD );
+
+      mad_stream_buffer( &madStream, pMP3_Buffer,
+                         static_cast<unsigned long>(remaining + MAD_BUFFER_GUARD) );
+      madStream.error = MAD_ERROR_NONE;
+   }
+
+   return true;
+}
+
+// -----------------------------------------------------------------------------
+
+bool MadSource::fetch()
+{
+   if ( m_map )
+      return fetchMappedData( m_map, m_mapSize, m_pMP3_Buffer, m_MP3_BufferSize, m_mad_stream );
+
+   return fetchData( m_inputFile, m_pMP3_Buffer, m_MP3_BufferSize, m_mad_stream );
+}
+
+// -----------------------------------------------------------------------------
+
+bool MadSource::eof() const
+{
+   // like atEnd() below, true once libmad has the last bytes of the file
+   if ( m_map )
+      return m_mad_stream.buffer == m_pMP3_Buffer;
+
+   return m_inputFile.atEnd();
+}
+
 // -----------------------------------------------------------------------------
 
 void MadSource::skipSilence(double silenceThreshold /* = 0.0001 */)
@@ -368,7 +451,7 @@ void MadSource::skipSilence(double silenceThreshold /* = 0.0001 */)
 
    for (;;)
    {
-      if ( !fetchData( m_inputFile, m_pMP3_Buffer, m_MP3_BufferSize, m_mad_stream) )
+      if ( !fetch() )
          break;
 
       if ( mad_frame_decode(&madFrame, &m_mad_stream) != 0 )
@@ -383,17 +466,16 @@ void MadSource::skipSilence(double silenceThreshold /* = 0.0001 */)
 
       double sum = 0;
 
+      // same as abs(f2s(...)) over each (down mixed) sample
       switch (madSynth.pcm.channels)
       {
       case 1:
-         for (size_t j = 0; j < madSynth.pcm.length; ++j)
-            sum += abs(f2s(madSynth.pcm.samples[0][j]));
+         sum = silence::sumFixed(madSynth.pcm.samples[0], NULL,
+                                 madSynth.pcm.length, MAD_F_FRACBITS);
          break;
       case 2:
-         for (size_t j = 0; j < madSynth.pcm.length; ++j)
-            sum += abs(f2s(
-                     (madSynth.pcm.samples[0][j] >> 1)
-                   + (madSynth.pcm.samples[1][j] >> 1)));
+         sum = silence::sumFixed(madSynth.pcm.samples[0], madSynth.pcm.samples[1],
+                                 madSynth.pcm.length, MAD_F_FRACBITS);
          break;
       }
 
@@ -406,17 +488,380 @@ void MadSource::skipSilence(double silenceThreshold /* = 0.0001 */)
 
 // -----------------------------------------------------------------------------
 
+namespace
+{
+   struct Mp3Header
+   {
+      int version;         // 1 for MPEG 1, 2 for MPEG 2 and 2.5
+      int samplerate;
+      int bitrate;         // bits per second
+      int frameLength;     // bytes, including the header
+      int samplesPerFrame;
+      bool mono;
+   };
+
+   /** Parses a Layer III frame header. We only build seek indexes for
+     * Layer III, anything else is skipped by walking the headers. */
+   bool parseHeader(const unsigned char* p, Mp3Header& h)
+   {
+      static const int bitrates[2][15] =
+      {
+         { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+         { 0,  8, 16, 24, 32, 40, 48, 56,  64,  80,  96, 112, 128, 144, 160 }
+      };
+      static const int samplerates[3][3] =
+      {
+         { 44100, 48000, 32000 },
+         { 22050, 24000, 16000 },
+         { 11025, 12000,  8000 }
+      };
+
+      if ( p[0] != 0xFF || (p[1] & 0xE0) != 0xE0 )
+         return false;
+
+      int versionBits = (p[1] >> 3) & 3;   // 0: 2.5, 1: reserved, 2: 2, 3: 1
+      int layerBits = (p[1] >> 1) & 3;     // 1: Layer III
+      int bitrateIndex = p[2] >> 4;
+      int samplerateIndex = (p[2] >> 2) & 3;
+
+      if ( versionBits == 1 || layerBits != 1 || bitrateIndex == 0 || bitrateIndex == 15 || samplerateIndex == 3 )
+         return false;
+
+      h.version = versionBits == 3 ? 1 : 2;
+      h.samplerate = samplerates[versionBits == 3 ? 0 : versionBits == 2 ? 1 : 2][samplerateIndex];
+      h.bitrate = bitrates[h.version - 1][bitrateIndex] * 1000;
+      h.samplesPerFrame = h.version == 1 ? 1152 : 576;
+      h.frameLength = (h.samplesPerFrame / 8) * h.bitrate / h.samplerate + ((p[2] >> 1) & 1);
+      h.mono = (p[3] >> 6) == 3;
+      return true;
+   }
+
+   inline quint32 be32(const unsigned char* p)
+   {
+      return (quint32(p[0]) << 24) | (quint32(p[1]) << 16) | (quint32(p[2]) << 8) | quint32(p[3]);
+   }
+
+   inline quint32 be16(const unsigned char* p)
+   {
+      return (quint32(p[0]) << 8) | quint32(p[1]);
+   }
+}
+
+// -----------------------------------------------------------------------------
+
+/** Reads the first frame of the file to work out how to turn a time into a
+  * byte offset. VBR encoders put a Xing (or Info) or a VBRI header with a
+  * table of contents in there. Without one we assume constant bitrate.
+  */
+void MadSource::buildSeekIndex()
+{
+   m_seekMode = SeekNone;
+   m_vbriToc.clear();
+
+   QFile file(m_fileName);
+   if ( !file.open( QIODevice::ReadOnly ) || file.isSequential() )
+      return;
+
+   const qint64 fileSize = file.size();
+   qint64 start = 0;
+
+   QByteArray head = file.read(10);
+   if ( head.size() == 10 && head.startsWith("ID3") )
+   {
+      const unsigned char* p = reinterpret_cast<const unsigned char*>(head.constData());
+      // syncsafe size, plus the header and an optional footer
+      start = ((p[6] & 0x7F) << 21) | ((p[7] & 0x7F) << 14) | ((p[8] & 0x7F) << 7) | (p[9] & 0x7F);
+      start += 10 + ((p[5] & 0x10) ? 10 : 0);
+   }
+
+   if ( !file.seek(start) )
+      return;
+
+   QByteArray data = file.read(m_MP3_BufferSize);
+   const unsigned char* p = reinterpret_cast<const unsigned char*>(data.constData());
+   const int size = data.size();
+
+   Mp3Header h;
+   int i = 0;
+   for ( ; i + 4 <= size ; ++i )
+   {
+      Mp3Header next;
+      if ( parseHeader(p + i, h)
+           && i + h.frameLength + 4 <= size
+           && parseHeader(p + i + h.frameLength, next)
+           && next.samplerate == h.samplerate )
+         break;
+   }
+
+   if ( i + 4 > size )
+      return;
+
+   m_audioStart = start + i;
+   m_audioBytes = fileSize - m_audioStart;
+   m_bitrate = h.bitrate;
+
+   const unsigned char* frame = p + i;
+   const int frameSize = std::min(h.frameLength, size - i);
+   const int xingOffset = 4 + (h.version == 1 ? (h.mono ? 17 : 32) : (h.mono ? 9 : 17));
+   const int vbriOffset = 4 + 32;
+
+   if ( xingOffset + 8 <= frameSize
+        && ( memcmp(frame + xingOffset, "Xing", 4) == 0 || memcmp(frame + xingOffset, "Info", 4) == 0 ) )
+   {
+      const unsigned char* x = frame + xingOffset + 4;
+      quint32 flags = be32(x);
+      x += 4;
+
+      quint32 frames = 0;
+      if ( flags & 0x1 ) { frames = be32(x); x += 4; }
+      if ( flags & 0x2 ) { m_audioBytes = std::min<qint64>(be32(x), m_audioBytes); x += 4; }
+
+      if ( frames > 0 && (flags & 0x4) && x + 100 <= frame + frameSize )
+      {
+         memcpy(m_xingToc, x, 100);
+         m_duration = static_cast<double>(frames) * h.samplesPerFrame / h.samplerate;
+         m_seekMode = SeekXing;
+         return;
+      }
+   }
+   else if ( vbriOffset + 26 <= frameSize && memcmp(frame + vbriOffset, "VBRI", 4) == 0 )
+   {
+      const unsigned char* v = frame + vbriOffset + 4;
+      m_audioBytes = std::min<qint64>(be32(v + 6), m_audioBytes);
+      quint32 frames = be32(v + 10);
+      int entries = be16(v + 14);
+      int scale = be16(v + 16);
+      int entrySize = be16(v + 18);
+      int framesPerEntry = be16(v + 20);
+      const unsigned char* toc = v + 22;
+
+      if ( frames > 0 && entries > 0 && entrySize >= 1 && entrySize <= 4
+           && toc + entries * entrySize <= frame + frameSize )
+      {
+         qint64 offset = 0;
+         m_vbriToc.reserve(entries + 1);
+         m_vbriToc.push_back(0);
+         for ( int e = 0 ; e < entries ; ++e, toc += entrySize )
+         {
+            quint32 value = 0;
+            for ( int b = 0 ; b < entrySize ; ++b )
+               value = (value << 8) | toc[b];
+            offset += static_cast<qint64>(value) * scale;
+            m_vbriToc.push_back(offset);
+         }
+
+         m_duration = static_cast<double>(frames) * h.samplesPerFrame / h.samplerate;
+         m_vbriSecsPerEntry = static_cast<double>(framesPerEntry) * h.samplesPerFrame / h.samplerate;
+         m_seekMode = SeekVbri;
+         return;
+      }
+   }
+
+   m_duration = static_cast<double>(m_audioBytes) * 8 / m_bitrate;
+   m_seekMode = SeekCbr;
+}
+
+// -----------------------------------------------------------------------------
+
+/** The file offset of the next frame libmad will decode */
+qint64 MadSource::decoderPos() const
+{
+   if ( m_map )
+   {
+      if ( !m_mad_stream.buffer || !m_mad_stream.next_frame )
+         return 0;
+
+      if ( m_mad_stream.buffer != m_pMP3_Buffer )
+         return m_mad_stream.next_frame - m_map;
+
+      // the tail is the end of the file plus the guard
+      qint64 tailStart = m_mapSize - (m_mad_stream.bufend - m_mad_stream.buffer - MAD_BUFFER_GUARD);
+      return tailStart + (m_mad_stream.next_frame - m_mad_stream.buffer);
+   }
+
+   qint64 pos = m_inputFile.pos();
+   if ( m_mad_stream.buffer && m_mad_stream.next_frame )
+      pos -= m_mad_stream.bufend - m_mad_stream.next_frame;
+   return pos;
+}
+
+// -----------------------------------------------------------------------------
+
+double MadSource::byteToSecs(qint64 pos) const
+{
+   double bytes = static_cast<double>( std::max<qint64>(0, std::min(pos - m_audioStart, m_audioBytes)) );
+
+   switch ( m_seekMode )
+   {
+   case SeekXing:
+      {
+         double f = bytes * 256.0 / m_audioBytes;
+         int i = 0;
+         while ( i < 99 && m_xingToc[i + 1] <= f )
+            ++i;
+         double lo = m_xingToc[i];
+         double hi = i < 99 ? m_xingToc[i + 1] : 256.0;
+         double percent = i + (hi > lo ? (f - lo) / (hi - lo) : 0);
+         return std::min(percent, 100.0) * m_duration / 100.0;
+      }
+   case SeekVbri:
+      {
+         size_t i = 0;
+         while ( i + 2 < m_vbriToc.size() && m_vbriToc[i + 1] <= bytes )
+            ++i;
+         double lo = static_cast<double>(m_vbriToc[i]);
+         double hi = static_cast<double>(m_vbriToc[i + 1]);
+         double entry = i + (hi > lo ? (bytes - lo) / (hi - lo) : 0);
+         return std::min(entry * m_vbriSecsPerEntry, m_duration);
+      }
+   case SeekCbr:
+      return bytes * 8 / m_bitrate;
+   default:
+      return 0;
+   }
+}
+
+// -----------------------------------------------------------------------------
+
+qint64 MadSource::secsToByte(double secs) const
+{
+   double bytes = 0;
+
+   switch ( m_seekMode )
+   {
+   case SeekXing:
+      {
+         double percent = std::max(0.0, std::min(secs * 100.0 / m_duration, 100.0));
+         int i = std::min(static_cast<int>(percent), 99);
+         double lo = m_xingToc[i];
+         double hi = i < 99 ? m_xingToc[i + 1] : 256.0;
+         bytes = (lo + (hi - lo) * (percent - i)) / 256.0 * m_audioBytes;
+         break;
+      }
+   case SeekVbri:
+      {
+         double entry = std::max(0.0, secs / m_vbriSecsPerEntry);
+         size_t i = std::min(static_cast<size_t>(entry), m_vbriToc.size() - 2);
+         double lo = static_cast<double>(m_vbriToc[i]);
+         double hi = static_cast<double>(m_vbriToc[i + 1]);
+         bytes = lo + (hi - lo) * std::min(entry - i, 1.0);
+         break;
+      }
+   case SeekCbr:
+      bytes = std::max(0.0, secs) * m_bitrate / 8;
+      break;
+   default:
+      break;
+   }
+
+   return m_audioStart + std::min(static_cast<qint64>(bytes), m_audioBytes);
+}
+
+// -----------------------------------------------------------------------------
+
+/** Finds the first frame header at or after pos that is followed by another
+  * matching header, so we don't lock on to a sync word inside audio data. */
+qint64 MadSource::findFrame(qint64 pos)
+{
+   QByteArray data;
+   bool atEnd;
+
+   if ( m_map )
+   {
+      if ( pos < 0 || pos >= m_mapSize )
+         return -1;
+
+      int size = static_cast<int>( std::min<qint64>(m_MP3_BufferSize, m_mapSize - pos) );
+      data = QByteArray::fromRawData( reinterpret_cast<const char*>(m_map + pos), size );
+      atEnd = pos + size == m_mapSize;
+   }
+   else
+   {
+      if ( !m_inputFile.seek(pos) )
+         return -1;
+
+      data = m_inputFile.read(m_MP3_BufferSize);
+      atEnd = m_inputFile.atEnd();
+   }
+
+   const unsigned char* p = reinterpret_cast<const unsigned char*>(data.constData());
+   const int size = data.size();
+
+   for ( int i = 0 ; i + 4 <= size ; ++i )
+   {
+      Mp3Header h, next;
+      if ( !parseHeader(p + i, h) )
+         continue;
+
+      // the last frame in the file has nothing after it to check against
+      if ( i + h.frameLength == size && atEnd )
+         return pos + i;
+
+      if ( i + h.frameLength + 4 <= size
+           && parseHeader(p + i + h.frameLength, next)
+           && next.samplerate == h.samplerate )
+         return pos + i;
+   }
+
+   return -1;
+}
+
+// -----------------------------------------------------------------------------
+
+bool MadSource::seekTo(qint64 pos)
+{
+   qint64 oldPos = m_inputFile.pos();
+   qint64 framePos = findFrame(pos);
+
+   if ( framePos < 0 || ( !m_map && !m_inputFile.seek(framePos) ) )
+   {
+      m_inputFile.seek(oldPos);
+      return false;
+   }
+
+   // Start libmad afresh at the new position. The first frame or two may
+   // complain about the bit reservoir, which updateBuffer recovers from.
+   mad_stream_finish(&m_mad_stream);
+   mad_stream_init(&m_mad_stream);
+   if ( m_map )
+      mad_stream_buffer(&m_mad_stream, m_map + framePos, static_cast<unsigned long>(m_mapSize - framePos));
+   mad_frame_mute(&m_mad_frame);
+   mad_synth_mute(&m_mad_synth);
+   m_pcmpos = m_mad_synth.pcm.length;
+
+   return true;
+}
+
+// -----------------------------------------------------------------------------
+
 void MadSource::skip(const int mSecs)
 {
    if ( mSecs <= 0 )
       return;
 
+   long remaining = mSecs - mad_timer_count(m_mad_timer, MAD_UNITS_MILLISECONDS);
+
+   if ( remaining > 0 && m_seekMode != SeekNone && !m_inputFile.isSequential() )
+   {
+      double target = byteToSecs( decoderPos() ) + remaining / 1000.0;
+
+      if ( seekTo( secsToByte( target ) ) )
+      {
+         mad_timer_t skipped;
+         mad_timer_set(&skipped, remaining / 1000, remaining % 1000, 1000);
+         mad_timer_add(&m_mad_timer, skipped);
+         return;
+      }
+   }
+
+   // Couldn't seek, so walk the frame headers instead. This is exact but
+   // has to read everything up to the target.
    mad_header  madHeader;
    mad_header_init(&madHeader);
 
    for (;;)
    {
-      if (!fetchData( m_inputFile, m_pMP3_Buffer, m_MP3_BufferSize, m_mad_stream))
+      if ( !fetch() )
          break;
 
       if ( mad_header_decode(&madHeader, &m_mad_stream) != 0 )
@@ -452,7 +897,7 @@ int MadSource::updateBuffer(signed short* pBuffer, size_t bufferSize)
       // - we are starting a stream
       if ( m_pcmpos == m_mad_synth.pcm.length )
       {
-         if ( !fetchData( m_inputFile, m_pMP3_Buffer, m_MP3_BufferSize, m_mad_stream) )
+         if ( !fetch() )
          {
             break; // nothing else to read
          }
@@ -40,7 +40,7 @@ public:
     virtual int updateBuffer(signed short* pBuffer, size_t bufferSize);
     virtual void skip(const int mSecs);
     virtual void skipSilence(double silenceThreshold = 0.0001);
-    virtual bool eof() const { return m_inputFile.atEnd(); }
+    virtual bool eof() const;
 
 private:
     static bool fetchData( QFile& mp3File,
@@ -48,10 +48,34 @@ private:
                            const int MP3_BufferSize,
                            mad_stream& madStream );
 
+    static bool fetchMappedData( const unsigned char* pMap,
+                                 qint64 mapSize,
+                                 unsigned char* pMP3_Buffer,
+                                 const int MP3_BufferSize,
+                                 mad_stream& madStream );
+
+    bool fetch();
+
     static bool isRecoverable(const mad_error& error, bool log = false);
 
     static std::string MadErrorString(const mad_error& error);
 
+    // Seeking support for skip(), see buildSeekIndex()
+    void buildSeekIndex();
+    qint64 decoderPos() const;
+    double byteToSecs(qint64 pos) const;
+    qint64 secsToByte(double secs) const;
+    qint64 findFrame(qint64 pos);
+    bool seekTo(qint64 pos);
+
+    enum SeekMode
+    {
+        SeekNone = 0,  // decode headers up to the target
+        SeekXing,      // Xing/Info percentage TOC
+        SeekVbri,      // Fraunhofer VBRI TOC
+        SeekCbr        // constant bitrate estimate
+    };
+
     struct mad_stream    m_mad_stream;
     struct mad_frame     m_mad_frame;
     mad_timer_t          m_mad_timer;
@@ -59,11 +83,24 @@ private:
 
     QFile                m_inputFile;
 
+    // The whole file when it could be mapped, see fetchMappedData()
+    uchar*               m_map;
+    qint64               m_mapSize;
+
     unsigned char*       m_pMP3_Buffer;
     static const int     m_MP3_BufferSize = (5*8192);
     QString              m_fileName;
 
     size_t               m_pcmpos;
+
+    SeekMode             m_seekMode;
+    qint64               m_audioStart;
+    qint64               m_audioBytes;
+    double               m_duration;
+    int                  m_bitrate;
+    unsigned char        m_xingToc[100];
+    std::vector<qint64>  m_vbriToc; // offsets from m_audioStart of each TOC entry
+    double               m_vbriSecsPerEntry;
 };
 
 #endif
@@ -18,6 +18,7 @@
    along with liblastfm.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "VorbisSource.h"
+#include "common/c++/silence.h"
 #include <QFile>
 #include <cassert>
 #include <cstdlib>
@@ -132,19 +133,8 @@ void VorbisSource::skipSilence(double silenceThreshold /* = 0.0001 */)
         }
         else if ( charReadBytes > 0 )
         {
-            double sum = 0;
-            char *buf = sampleBuffer;
-            switch ( m_channels )
-            {
-                case 1:
-                    for (long j = 0; j < charReadBytes/wordSize; j++)
-                        sum += abs( buf[j] );
-                    break;
-                case 2:
-                    for (long j = 0; j < charReadBytes/wordSize; j+=2)
-                        sum += abs( (buf[j] >> 1) + (buf[j+1] >> 1) );
-                    break;
-            }
+            // ov_read gives us native endian 16 bit samples
+            double sum = silence::sum( reinterpret_cast<int16_t*>(sampleBuffer), charReadBytes/wordSize/m_channels, m_channels );
             if ( sum >= silenceThreshold * static_cast<double>(charReadBytes/wordSize/m_channels) )
                 break;
         }
@@ -38,6 +38,7 @@ SOURCES += \
     Application.cpp \
     StationSearch.cpp \
     ScrobSocket.cpp \
+    FingerprintSocket.cpp \
     MediaDevices/MediaDevice.cpp \
     MediaDevices/IpodDevice.cpp \
     MediaDevices/DeviceScrobbler.cpp \
@@ -110,6 +111,7 @@ SOURCES += \
 
 HEADERS += \
     ScrobSocket.h \
+    FingerprintSocket.h \
     AudioscrobblerSettings.h \
     Application.h \
     MainWindow.h \
@@ -0,0 +1,255 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+
+#include <QDebug>
+#include <QDirIterator>
+#include <QFile>
+#include <QNetworkReply>
+#include <QUrl>
+
+#include <lastfm/Fingerprint.h>
+#include <lastfm/Track.h>
+
+#include "FingerprintBatch.h"
+#include "FingerprintCache.h"
+
+
+static QString
+jsonString( const QString& in )
+{
+    QString out;
+    out.reserve( in.size() + 2 );
+    out += '"';
+
+    foreach ( const QChar& c, in )
+    {
+        switch ( c.unicode() )
+        {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if ( c.unicode() < 0x20 )
+                    out += QString( "\\u%1" ).arg( c.unicode(), 4, 16, QChar( '0' ) );
+                else
+                    out += c;
+        }
+    }
+
+    out += '"';
+    return out;
+}
+
+
+FingerprintBatch::FingerprintBatch( const QStringList& files, int threads, FingerprintCache* cache, bool pipeline, QObject* parent )
+    :QObject( parent ), m_files( files ), m_cache( cache ), m_next( 0 ), m_queued( 0 ), m_done( 0 ), m_out( stdout )
+{
+    m_out.setCodec( "UTF-8" );
+
+    for ( int i = 0 ; i < qMax( 1, threads ) ; ++i )
+    {
+        FingerprintWorker* worker = new FingerprintWorker( m_queue, pipeline, this );
+        connect( worker, SIGNAL(generated(int,int)), SLOT(onGenerated(int,int)) );
+        m_workers << worker;
+    }
+}
+
+FingerprintBatch::~FingerprintBatch()
+{
+    m_queue.close();
+
+    foreach ( FingerprintWorker* worker, m_workers )
+        worker->wait();
+
+    qDeleteAll( m_fingerprints );
+}
+
+QStringList //static
+FingerprintBatch::filesFromManifest( const QString& manifest )
+{
+    QStringList files;
+
+    QFile file( manifest );
+
+    if ( file.open( QIODevice::ReadOnly | QIODevice::Text ) )
+    {
+        QTextStream in( &file );
+        in.setCodec( "UTF-8" );
+
+        while ( !in.atEnd() )
+        {
+            QString line = in.readLine().trimmed();
+
+            if ( !line.isEmpty() && !line.startsWith( '#' ) )
+                files << line;
+        }
+    }
+    else
+        qWarning() << "Could not open manifest:" << manifest;
+
+    return files;
+}
+
+QStringList //static
+FingerprintBatch::filesFromDir( const QString& dir )
+{
+    QStringList nameFilters;
+    nameFilters << "*.mp3" << "*.m4a" << "*.mp4" << "*.aac" << "*.flac"
+                << "*.ogg" << "*.oga" << "*.opus" << "*.wma" << "*.wav"
+                << "*.aif" << "*.aiff" << "*.ape" << "*.mpc" << "*.wv";
+
+    QStringList files;
+
+    QDirIterator it( dir, nameFilters, QDir::Files | QDir::Readable, QDirIterator::Subdirectories | QDirIterator::FollowSymlinks );
+
+    while ( it.hasNext() )
+        files << it.next();
+
+    return files;
+}
+
+void
+FingerprintBatch::start()
+{
+    foreach ( FingerprintWorker* worker, m_workers )
+        worker->start();
+
+    feed();
+}
+
+void
+FingerprintBatch::feed()
+{
+    // keep every worker busy with one job waiting behind it, but don't
+    // build a Fingerprint for every file in the library up front
+    const int maxQueued = m_workers.count() * 2;
+
+    while ( m_queued < maxQueued && m_next < m_files.count() )
+    {
+        int index = m_next++;
+
+        FingerprintCache::Entry entry;
+        if ( m_cache && m_cache->lookup( m_files.at( index ), entry ) )
+        {
+            if ( entry.state == FingerprintCache::Submitted )
+                write( index, "cached", "fpid", entry.fpid );
+            else
+                write( index, "error", "error", fingerprintErrorString( entry.error ) );
+
+            ++m_done;
+            continue;
+        }
+
+        lastfm::MutableTrack track;
+        track.setUrl( QUrl::fromLocalFile( m_files.at( index ) ) );
+
+        lastfm::Fingerprint* fp = new lastfm::Fingerprint( track );
+        m_fingerprints[index] = fp;
+        if ( m_cache ) m_identities[index] = entry.identity;
+
+        if ( !fp->id().isNull() )
+        {
+            QString fpid = fp->id();
+            write( index, "known", "fpid", fpid );
+            done( index );
+        }
+        else
+        {
+            FingerprintQueue::Job job;
+            job.index = index;
+            job.fp = fp;
+            m_queue.enqueue( job );
+            ++m_queued;
+        }
+    }
+
+    if ( m_done == m_files.count() )
+    {
+        m_queue.close();
+        emit finished();
+    }
+}
+
+void
+FingerprintBatch::onGenerated( int index, int error )
+{
+    --m_queued;
+
+    if ( error == FingerprintWorker::NoError )
+    {
+        QNetworkReply* reply = m_fingerprints[index]->submit();
+        m_submissions[reply] = index;
+        connect( reply, SIGNAL(finished()), SLOT(onFingerprintSubmitted()) );
+    }
+    else
+    {
+        lastfm::Fingerprint::Error e = static_cast<lastfm::Fingerprint::Error>( error );
+        if ( m_cache ) m_cache->storeError( m_files.at( index ), m_identities.value( index ), e );
+        write( index, "error", "error", fingerprintErrorString( e ) );
+        done( index );
+    }
+
+    feed();
+}
+
+void
+FingerprintBatch::onFingerprintSubmitted()
+{
+    QNetworkReply* reply = static_cast<QNetworkReply*>( sender() );
+    int index = m_submissions.take( reply );
+    reply->deleteLater();
+
+    try
+    {
+        m_fingerprints[index]->decode( reply );
+        QString fpid = m_fingerprints[index]->id();
+        if ( m_cache ) m_cache->storeId( m_files.at( index ), m_identities.value( index ), fpid );
+        write( index, "ok", "fpid", fpid );
+    }
+    catch ( const lastfm::Fingerprint::Error& error )
+    {
+        if ( m_cache ) m_cache->storeError( m_files.at( index ), m_identities.value( index ), error );
+        write( index, "error", "error", fingerprintErrorString( error ) );
+    }
+
+    done( index );
+    feed();
+}
+
+void
+FingerprintBatch::write( int index, const QString& status, const QString& key, const QString& value )
+{
+    m_out << "{\"file\":" << jsonString( m_files.at( index ) )
+          << ",\"status\":" << jsonString( status )
+          << ",\"" << key << "\":" << jsonString( value )
+          << "}\n";
+    m_out.flush();
+}
+
+void
+FingerprintBatch::done( int index )
+{
+    delete m_fingerprints.take( index );
+    m_identities.remove( index );
+    ++m_done;
+}
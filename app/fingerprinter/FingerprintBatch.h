@@ -0,0 +1,90 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FINGERPRINT_BATCH_H
+#define FINGERPRINT_BATCH_H
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QStringList>
+#include <QTextStream>
+
+#include "FingerprintWorker.h"
+
+#include "FingerprintCache.h"
+
+class QNetworkReply;
+
+/** Fingerprints a list of files in one process using a pool of
+  * FingerprintWorkers. Fingerprints are generated on the workers and
+  * submitted from the main thread. One JSON object per file is written
+  * to stdout as soon as that file is done, e.g.
+  *
+  * {"file":"/music/a.mp3","status":"ok","fpid":"1234"}
+  * {"file":"/music/b.mp3","status":"error","error":"track too short"}
+  *
+  * Files found in the FingerprintCache are reported with a "cached" status
+  * without being decoded or submitted.
+  */
+class FingerprintBatch : public QObject
+{
+    Q_OBJECT
+public:
+    FingerprintBatch( const QStringList& files, int threads, FingerprintCache* cache = 0, bool pipeline = false, QObject* parent = 0 );
+    ~FingerprintBatch();
+
+    /** one path per line, blank lines and lines starting with # are ignored */
+    static QStringList filesFromManifest( const QString& manifest );
+    /** all the audio files below dir */
+    static QStringList filesFromDir( const QString& dir );
+
+public slots:
+    void start();
+
+signals:
+    void finished();
+
+private slots:
+    void onGenerated( int index, int error );
+    void onFingerprintSubmitted();
+
+private:
+    void feed();
+    void write( int index, const QString& status, const QString& key, const QString& value );
+    void done( int index );
+
+private:
+    QStringList m_files;
+    FingerprintCache* m_cache;
+    QList<FingerprintWorker*> m_workers;
+    FingerprintQueue m_queue;
+
+    QHash<int, lastfm::Fingerprint*> m_fingerprints;
+    QHash<int, FingerprintCache::Identity> m_identities;    // the files as lookup() found them
+    QHash<QNetworkReply*, int> m_submissions;
+
+    int m_next;
+    int m_queued;
+    int m_done;
+
+    QTextStream m_out;
+};
+
+#endif // FINGERPRINT_BATCH_H
@@ -0,0 +1,231 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/stat.h>
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariant>
+
+#include <lastfm/misc.h>
+
+#include "FingerprintCache.h"
+
+#define TABLE_NAME "fingerprints"
+#define SCHEMA "device          INTEGER," \
+               "inode           INTEGER," \
+               "size            INTEGER," \
+               "mtime           INTEGER," \
+               "hash            VARCHAR( 40 )," \
+               "path            TEXT," \
+               "state           INTEGER," \
+               "fpid            VARCHAR( 32 )," \
+               "error           INTEGER," \
+               "PRIMARY KEY ( device, inode )"
+
+
+FingerprintCache::FingerprintCache( const QString& path, int hashKBytes )
+    :m_hashKBytes( hashKBytes )
+{
+    QDir().mkpath( QFileInfo( path ).absolutePath() );
+
+    m_db = QSqlDatabase::addDatabase( "QSQLITE", path /*connection-name*/ );
+    m_db.setDatabaseName( path );
+
+    if ( !m_db.open() )
+    {
+        qWarning() << "Could not open fingerprint cache" << path << m_db.lastError().text();
+        return;
+    }
+
+    QSqlQuery query( m_db );
+
+    // it's only a cache, losing the last few entries in a crash is fine
+    query.exec( "PRAGMA synchronous = OFF" );
+
+    if ( !m_db.tables().contains( TABLE_NAME ) )
+    {
+        query.exec( "CREATE TABLE " TABLE_NAME " ( " SCHEMA " )" );
+        query.exec( "CREATE INDEX path_idx ON " TABLE_NAME " ( path )" );
+    }
+}
+
+FingerprintCache::~FingerprintCache()
+{
+    // the connection is named after the file, and is only ours, so it goes
+    // with us. It can only be removed once nothing refers to it
+    const QString connection = m_db.connectionName();
+    m_db.close();
+    m_db = QSqlDatabase();
+    QSqlDatabase::removeDatabase( connection );
+}
+
+QString //static
+FingerprintCache::storedPath( const QString& file )
+{
+    return QDir::toNativeSeparators( QDir::cleanPath( QFileInfo( file ).absoluteFilePath() ) );
+}
+
+QString //static
+FingerprintCache::defaultPath()
+{
+    return lastfm::dir::cache().filePath( "fingerprints.db" );
+}
+
+bool
+FingerprintCache::identify( const QString& file, Identity& id ) const
+{
+#ifdef WIN32
+    struct _stat st;
+    if ( _wstat( reinterpret_cast<const wchar_t*>( file.utf16() ), &st ) != 0 )
+        return false;
+
+    // there are no inode numbers on Windows, so the path stands in for one
+    id.device = st.st_dev;
+    id.inode = qHash( QFileInfo( file ).absoluteFilePath().toLower() );
+#else
+    struct stat st;
+    if ( stat( QFile::encodeName( file ), &st ) != 0 )
+        return false;
+
+    id.device = st.st_dev;
+    id.inode = st.st_ino;
+#endif
+    id.size = st.st_size;
+    id.mtime = st.st_mtime;
+
+    if ( m_hashKBytes > 0 )
+    {
+        QFile f( file );
+        if ( !f.open( QIODevice::ReadOnly ) )
+            return false;
+
+        id.hash = QCryptographicHash::hash( f.read( m_hashKBytes * 1024 ), QCryptographicHash::Sha1 ).toHex();
+    }
+
+    return true;
+}
+
+bool
+FingerprintCache::lookup( const QString& file, Entry& entry )
+{
+    entry.identity = Identity();
+    if ( !m_db.isOpen() || !identify( file, entry.identity ) )
+        return false;
+
+    const Identity& id = entry.identity;
+
+    QSqlQuery query( m_db );
+    query.prepare( "SELECT state, fpid, error, hash FROM " TABLE_NAME " "
+                   "WHERE device = :device AND inode = :inode AND size = :size AND mtime = :mtime" );
+    query.bindValue( ":device", id.device );
+    query.bindValue( ":inode", id.inode );
+    query.bindValue( ":size", id.size );
+    query.bindValue( ":mtime", id.mtime );
+
+    if ( !query.exec() || !query.next() )
+        return false;
+
+    if ( m_hashKBytes > 0 && query.value( 3 ).toString() != id.hash )
+        return false;
+
+    entry.state = static_cast<State>( query.value( 0 ).toInt() );
+    entry.fpid = query.value( 1 ).toString();
+    entry.error = static_cast<lastfm::Fingerprint::Error>( query.value( 2 ).toInt() );
+    return true;
+}
+
+void
+FingerprintCache::storeId( const QString& file, const Identity& id, const QString& fpid )
+{
+    store( file, id, Submitted, fpid, 0 );
+}
+
+void
+FingerprintCache::storeError( const QString& file, const Identity& id, lastfm::Fingerprint::Error error )
+{
+    switch ( error )
+    {
+        case lastfm::Fingerprint::HeadersError:
+        case lastfm::Fingerprint::DecodeError:
+        case lastfm::Fingerprint::TrackTooShortError:
+            store( file, id, Failed, QString(), error );
+            break;
+        default:
+            // worth trying again next time
+            break;
+    }
+}
+
+void
+FingerprintCache::store( const QString& file, const Identity& id, State state, const QString& fpid, int error )
+{
+    if ( !m_db.isOpen() || id.isNull() )
+        return;
+
+    QSqlQuery query( m_db );
+    query.prepare( "INSERT OR REPLACE INTO " TABLE_NAME " "
+                   "( device, inode, size, mtime, hash, path, state, fpid, error ) "
+                   "VALUES ( :device, :inode, :size, :mtime, :hash, :path, :state, :fpid, :error )" );
+    query.bindValue( ":device", id.device );
+    query.bindValue( ":inode", id.inode );
+    query.bindValue( ":size", id.size );
+    query.bindValue( ":mtime", id.mtime );
+    query.bindValue( ":hash", id.hash );
+    query.bindValue( ":path", storedPath( file ) );
+    query.bindValue( ":state", state );
+    query.bindValue( ":fpid", fpid );
+    query.bindValue( ":error", error );
+
+    if ( !query.exec() )
+        qWarning() << query.lastError().text() << "in query:\n" << query.lastQuery();
+}
+
+int
+FingerprintCache::clear()
+{
+    QSqlQuery query( m_db );
+    query.exec( "DELETE FROM " TABLE_NAME );
+    return query.numRowsAffected();
+}
+
+int
+FingerprintCache::invalidate( const QString& path )
+{
+    QSqlQuery query( m_db );
+    query.prepare( "DELETE FROM " TABLE_NAME " "
+                   "WHERE path = :path OR substr( path, 1, :length ) = :dir" );
+
+    // the path itself and what's below it, but not its siblings that start
+    // the same way, /music isn't above /music2
+    const QString prefix = storedPath( path );
+    const QString dir = prefix.endsWith( QDir::separator() ) ? prefix : prefix + QDir::separator();
+    query.bindValue( ":path", prefix );
+    query.bindValue( ":length", dir.length() );
+    query.bindValue( ":dir", dir );
+
+    if ( !query.exec() )
+        qWarning() << query.lastError().text() << "in query:\n" << query.lastQuery();
+    return query.numRowsAffected();
+}
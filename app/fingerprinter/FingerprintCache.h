@@ -0,0 +1,104 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FINGERPRINT_CACHE_H
+#define FINGERPRINT_CACHE_H
+
+#include <QSqlDatabase>
+#include <QString>
+
+#include <lastfm/Fingerprint.h>
+
+/** Remembers what happened the last time we fingerprinted a file so that
+  * unchanged files are neither decoded nor submitted again.
+  *
+  * Files are identified by device and inode, and an entry is only used if
+  * the size and modification time (and optionally a hash of the first few
+  * KB of the file) still match.
+  */
+class FingerprintCache
+{
+public:
+    enum State
+    {
+        Submitted = 1,  // we have the fingerprint id
+        Failed          // the file can't be fingerprinted
+    };
+
+    /** what a file was when lookup() saw it */
+    struct Identity
+    {
+        Identity() : device( 0 ), inode( 0 ), size( -1 ), mtime( 0 ) {}
+
+        bool isNull() const { return size < 0; }
+
+        qint64 device;
+        qint64 inode;
+        qint64 size;
+        qint64 mtime;
+        QString hash;
+    };
+
+    struct Entry
+    {
+        Entry() : state( Submitted ), error( lastfm::Fingerprint::InternalError ) {}
+
+        State state;
+        QString fpid;
+        lastfm::Fingerprint::Error error;
+        /** set whether or not the file was found, null if it couldn't be read */
+        Identity identity;
+    };
+
+    /** hashKBytes is how much of each file to hash, 0 to rely on
+      * size and mtime alone */
+    explicit FingerprintCache( const QString& path = defaultPath(), int hashKBytes = 0 );
+    ~FingerprintCache();
+
+    static QString defaultPath();
+
+    bool lookup( const QString& file, Entry& entry );
+
+    /** id is the Entry::identity lookup() gave us before the file was
+      * fingerprinted, so that a file changed in the meantime isn't stored
+      * as its new self with the old result */
+    void storeId( const QString& file, const Identity& id, const QString& fpid );
+    /** only errors that will happen again next time are stored */
+    void storeError( const QString& file, const Identity& id, lastfm::Fingerprint::Error error );
+
+    /** forget everything, returns the number of entries removed */
+    int clear();
+    /** forget every file below path */
+    int invalidate( const QString& path );
+
+private:
+    /** absolute, with the platform's separators */
+    static QString storedPath( const QString& file );
+
+    bool identify( const QString& file, Identity& id ) const;
+    void store( const QString& file, const Identity& id, State state, const QString& fpid, int error );
+
+private:
+    Q_DISABLE_COPY( FingerprintCache )
+
+    QSqlDatabase m_db;
+    int m_hashKBytes;
+};
+
+#endif // FINGERPRINT_CACHE_H
@@ -0,0 +1,305 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdexcept>
+
+#include <QDebug>
+#include <QFile>
+#include <QLocalSocket>
+#include <QMap>
+#include <QNetworkReply>
+#include <QStringList>
+#include <QUrl>
+
+#include <lastfm/Fingerprint.h>
+#include <lastfm/Track.h>
+#include <lastfm/misc.h>
+#include <lastfm/ws.h>
+
+#include "FingerprintDaemon.h"
+#include "FingerprintCache.h"
+
+
+/** replaces '&&' and splits on remaining single '&', as PlayerCommandParser does */
+static QStringList
+splitArgs( QString line )
+{
+    QStringList parts;
+    int start = 0, i = 0;
+    int end = 0;
+    while ( ( end = line.indexOf( '&', i ) ) != -1 )
+    {
+        i = end + 1;
+        if ( i < line.size() && line[i] == '&' )
+        {
+            line.remove( end, 1 ); //convert && to &
+            continue;
+        }
+        parts += line.mid( start, end - start );
+        start = i;
+    }
+    return parts << line.mid( start );
+}
+
+static QMap<QChar, QString>
+parseArgs( const QString& line )
+{
+    QMap<QChar, QString> args;
+
+    foreach ( const QString& part, splitArgs( line ) )
+        if ( part.size() >= 2 && part[1] == '=' )
+            args[part[0]] = part.mid( 2 );
+
+    return args;
+}
+
+static inline QString
+encodeAmp( QString data )
+{
+    return data.replace( '&', "&&" );
+}
+
+
+FingerprintDaemon::FingerprintDaemon( int threads, FingerprintCache* cache, bool pipeline, QObject* parent )
+    :QLocalServer( parent ), m_cache( cache ), m_nextIndex( 0 )
+{
+    connect( this, SIGNAL(newConnection()), SLOT(onNewConnection()) );
+
+    for ( int i = 0 ; i < qMax( 1, threads ) ; ++i )
+    {
+        FingerprintWorker* worker = new FingerprintWorker( m_queue, pipeline, this );
+        connect( worker, SIGNAL(generated(int,int)), SLOT(onGenerated(int,int)) );
+        m_workers << worker;
+    }
+}
+
+FingerprintDaemon::~FingerprintDaemon()
+{
+    close();
+    m_queue.close();
+
+    foreach ( FingerprintWorker* worker, m_workers )
+        worker->wait();
+
+    foreach ( const Job& job, m_jobs )
+        delete job.fp;
+}
+
+QString //static
+FingerprintDaemon::serverName()
+{
+    QString const name = "lastfm_fingerprinter";
+
+#ifdef Q_OS_WIN
+    // a named pipe, these are per session and clean up after themselves
+    return name;
+#else
+    return lastfm::dir::runtimeData().absolutePath() + "/" + name;
+#endif
+}
+
+bool
+FingerprintDaemon::start()
+{
+    QString const name = serverName();
+
+    // the client starts us whenever it can't connect, so make sure we
+    // don't steal the socket from a daemon that was just slow to answer
+    QLocalSocket probe;
+    probe.connectToServer( name );
+    if ( probe.waitForConnected( 500 ) )
+    {
+        qWarning() << "A fingerprint daemon is already listening on" << name;
+        return false;
+    }
+
+#ifndef Q_OS_WIN
+    if ( QFile::exists( name ) )
+        QFile::remove( name );
+#endif
+
+    if ( !listen( name ) )
+    {
+        qWarning() << "Could not listen on" << name << errorString();
+        return false;
+    }
+
+    foreach ( FingerprintWorker* worker, m_workers )
+        worker->start();
+
+    return true;
+}
+
+void
+FingerprintDaemon::onNewConnection()
+{
+    while ( hasPendingConnections() )
+    {
+        QLocalSocket* socket = nextPendingConnection();
+        connect( socket, SIGNAL(readyRead()), SLOT(onReadyRead()) );
+        connect( socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()) );
+    }
+}
+
+void
+FingerprintDaemon::onReadyRead()
+{
+    QLocalSocket* socket = qobject_cast<QLocalSocket*>( sender() );
+    if ( !socket ) return;
+
+    while ( socket->canReadLine() )
+        processLine( socket, QString::fromUtf8( socket->readLine() ).trimmed() );
+}
+
+void
+FingerprintDaemon::processLine( QLocalSocket* socket, const QString& line )
+{
+    if ( line.isEmpty() )
+        return;
+
+    QMap<QChar, QString> args;
+
+    try
+    {
+        int const n = line.indexOf( ' ' );
+        if ( n == -1 ) throw std::invalid_argument( "Unable to parse" );
+
+        args = parseArgs( line.mid( n + 1 ) );
+
+        if ( line.left( n ).toUpper() != "FINGERPRINT" ) throw std::invalid_argument( "Invalid command" );
+        if ( args['i'].isEmpty() ) throw std::invalid_argument( "Mandatory argument unspecified: i" );
+        if ( args['u'].isEmpty() ) throw std::invalid_argument( "Mandatory argument unspecified: u" );
+        if ( args['p'].isEmpty() ) throw std::invalid_argument( "Mandatory argument unspecified: p" );
+    }
+    catch ( std::invalid_argument& e )
+    {
+        qWarning() << e.what() << line;
+
+        QString response = "ERROR ";
+        if ( !args['i'].isEmpty() ) response += "i=" + encodeAmp( args['i'] ) + "&";
+        reply( socket, response + "e=" + encodeAmp( QString::fromStdString( e.what() ) ) );
+        return;
+    }
+
+    int const index = m_nextIndex++;
+
+    Job& job = m_jobs[index];
+    job.socket = socket;
+    job.id = args['i'];
+    job.username = args['u'];
+    job.file = args['p'];
+
+    FingerprintCache::Entry entry;
+    if ( m_cache && m_cache->lookup( job.file, entry ) )
+    {
+        if ( entry.state == FingerprintCache::Submitted )
+            done( index, entry.fpid );
+        else
+            failed( index, entry.error );
+        return;
+    }
+    job.identity = entry.identity;
+
+    lastfm::MutableTrack track;
+    track.setUrl( QUrl::fromLocalFile( job.file ) );
+    if ( args.contains( 'a' ) ) track.setArtist( args['a'] );
+    if ( args.contains( 't' ) ) track.setTitle( args['t'] );
+    if ( args.contains( 'b' ) ) track.setAlbum( args['b'] );
+
+    job.fp = new lastfm::Fingerprint( track );
+
+    if ( !job.fp->id().isNull() )
+    {
+        done( index, job.fp->id() );
+        return;
+    }
+
+    FingerprintQueue::Job queued;
+    queued.index = index;
+    queued.fp = job.fp;
+    m_queue.enqueue( queued );
+}
+
+void
+FingerprintDaemon::onGenerated( int index, int error )
+{
+    if ( error != FingerprintWorker::NoError )
+    {
+        lastfm::Fingerprint::Error e = static_cast<lastfm::Fingerprint::Error>( error );
+        if ( m_cache ) m_cache->storeError( m_jobs[index].file, m_jobs[index].identity, e );
+        failed( index, e );
+        return;
+    }
+
+    // submissions all happen on this thread, one at a time as far as
+    // ws is concerned, so it's safe to switch users between them
+    lastfm::ws::Username = m_jobs[index].username;
+
+    QNetworkReply* reply = m_jobs[index].fp->submit();
+    m_submissions[reply] = index;
+    connect( reply, SIGNAL(finished()), SLOT(onFingerprintSubmitted()) );
+}
+
+void
+FingerprintDaemon::onFingerprintSubmitted()
+{
+    QNetworkReply* reply = static_cast<QNetworkReply*>( sender() );
+    int index = m_submissions.take( reply );
+    reply->deleteLater();
+
+    try
+    {
+        m_jobs[index].fp->decode( reply );
+        QString fpid = m_jobs[index].fp->id();
+        if ( m_cache ) m_cache->storeId( m_jobs[index].file, m_jobs[index].identity, fpid );
+        done( index, fpid );
+    }
+    catch ( const lastfm::Fingerprint::Error& error )
+    {
+        if ( m_cache ) m_cache->storeError( m_jobs[index].file, m_jobs[index].identity, error );
+        failed( index, error );
+    }
+}
+
+void
+FingerprintDaemon::reply( QLocalSocket* socket, const QString& line )
+{
+    // the client may have gone away while we were working
+    if ( !socket || socket->state() != QLocalSocket::ConnectedState )
+        return;
+
+    socket->write( ( line + '\n' ).toUtf8() );
+    socket->flush();
+}
+
+void
+FingerprintDaemon::done( int index, const QString& fpid )
+{
+    Job job = m_jobs.take( index );
+    reply( job.socket, "OK i=" + encodeAmp( job.id ) + "&f=" + encodeAmp( fpid ) );
+    delete job.fp;
+}
+
+void
+FingerprintDaemon::failed( int index, lastfm::Fingerprint::Error error )
+{
+    Job job = m_jobs.take( index );
+    reply( job.socket, "ERROR i=" + encodeAmp( job.id ) + "&e=" + encodeAmp( fingerprintErrorString( error ) ) );
+    delete job.fp;
+}
@@ -0,0 +1,103 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FINGERPRINT_DAEMON_H
+#define FINGERPRINT_DAEMON_H
+
+#include <QHash>
+#include <QList>
+#include <QLocalServer>
+#include <QPointer>
+
+#include "FingerprintWorker.h"
+
+class QLocalSocket;
+#include "FingerprintCache.h"
+
+class QNetworkReply;
+
+/** Keeps a pool of FingerprintWorkers running and takes jobs from clients
+  * over a local socket, so the client doesn't have to start a fingerprinter
+  * process for every track it plays.
+  *
+  * Requests are one line each, in the same style as the lastfm_scrobsub
+  * protocol ('&' in values is escaped as "&&"):
+  *
+  * FINGERPRINT i=<job id>&u=<username>&p=<path>[&a=<artist>&t=<title>&b=<album>]
+  *
+  * Each job gets exactly one reply line when it is done. Jobs run in
+  * parallel so replies can arrive in any order, use the job id to match
+  * them up:
+  *
+  * OK i=<job id>&f=<fingerprint id>
+  * ERROR i=<job id>&e=<message>
+  *
+  * Lines that can't be parsed get an ERROR reply straight away, without an
+  * i if the job id couldn't be read either.
+  */
+class FingerprintDaemon : public QLocalServer
+{
+    Q_OBJECT
+public:
+    FingerprintDaemon( int threads, FingerprintCache* cache = 0, bool pipeline = false, QObject* parent = 0 );
+    ~FingerprintDaemon();
+
+    /** what clients should pass to QLocalSocket::connectToServer() */
+    static QString serverName();
+
+    /** Starts the workers and listens on serverName(). Returns false if
+      * another daemon is already listening or the socket can't be created. */
+    bool start();
+
+private slots:
+    void onNewConnection();
+    void onReadyRead();
+    void onGenerated( int index, int error );
+    void onFingerprintSubmitted();
+
+private:
+    struct Job
+    {
+        Job() : fp( 0 ) {}
+
+        QPointer<QLocalSocket> socket;
+        QString id;
+        QString username;
+        QString file;
+        FingerprintCache::Identity identity;    // the file as lookup() found it
+        lastfm::Fingerprint* fp;
+    };
+
+    void processLine( QLocalSocket* socket, const QString& line );
+    void reply( QLocalSocket* socket, const QString& line );
+    void done( int index, const QString& fpid );
+    void failed( int index, lastfm::Fingerprint::Error error );
+
+private:
+    FingerprintCache* m_cache;
+    QList<FingerprintWorker*> m_workers;
+    FingerprintQueue m_queue;
+
+    QHash<int, Job> m_jobs;
+    QHash<QNetworkReply*, int> m_submissions;
+
+    int m_nextIndex;
+};
+
+#endif // FINGERPRINT_DAEMON_H
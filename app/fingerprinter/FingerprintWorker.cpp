@@ -0,0 +1,139 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdexcept>
+
+#include <QDebug>
+#include <QMutexLocker>
+
+#include <lastfm/Fingerprint.h>
+
+#include "LAV_Source.h"
+#include "PipelinedSource.h"
+#include "FingerprintWorker.h"
+
+
+QString
+fingerprintErrorString( lastfm::Fingerprint::Error error )
+{
+    switch ( error )
+    {
+        case lastfm::Fingerprint::ReadError: return "read error";
+        case lastfm::Fingerprint::HeadersError: return "headers error";
+        case lastfm::Fingerprint::DecodeError: return "decode error";
+        case lastfm::Fingerprint::TrackTooShortError: return "track too short";
+        case lastfm::Fingerprint::BadResponseError: return "bad response";
+        case lastfm::Fingerprint::InternalError: return "internal error";
+    }
+
+    return "unknown error";
+}
+
+
+FingerprintQueue::FingerprintQueue()
+    :m_closed( false )
+{
+}
+
+void
+FingerprintQueue::enqueue( const Job& job )
+{
+    QMutexLocker locker( &m_mutex );
+    m_jobs.enqueue( job );
+    m_jobAvailable.wakeOne();
+}
+
+bool
+FingerprintQueue::dequeue( Job& job )
+{
+    QMutexLocker locker( &m_mutex );
+
+    while ( m_jobs.isEmpty() && !m_closed )
+        m_jobAvailable.wait( &m_mutex );
+
+    if ( m_jobs.isEmpty() )
+        return false;
+
+    job = m_jobs.dequeue();
+    return true;
+}
+
+void
+FingerprintQueue::close()
+{
+    QMutexLocker locker( &m_mutex );
+    m_closed = true;
+    m_jobAvailable.wakeAll();
+}
+
+
+FingerprintWorker::FingerprintWorker( FingerprintQueue& queue, bool pipeline, QObject* parent )
+    :QThread( parent ), m_queue( queue ), m_pipeline( 0 )
+{
+    // the source lives as long as the worker so libav setup is paid once
+    // per thread rather than once per file
+    m_source = new LAV_Source();
+
+    if ( pipeline )
+        m_pipeline = new PipelinedSource( m_source );
+}
+
+FingerprintWorker::~FingerprintWorker()
+{
+    wait();
+
+    // the pipeline owns the source
+    if ( m_pipeline )
+        delete m_pipeline;
+    else
+        delete m_source;
+}
+
+void
+FingerprintWorker::run()
+{
+    FingerprintQueue::Job job;
+
+    while ( m_queue.dequeue( job ) )
+    {
+        int error = NoError;
+
+        try
+        {
+            if ( m_pipeline )
+                job.fp->generate( m_pipeline );
+            else
+                job.fp->generate( m_source );
+        }
+        catch ( const lastfm::Fingerprint::Error& e )
+        {
+            error = e;
+        }
+        catch ( const std::exception& e )
+        {
+            qWarning() << "Fingerprint error: " << e.what();
+            error = lastfm::Fingerprint::ReadError;
+        }
+
+        if ( m_pipeline ) m_pipeline->release();
+        m_source->release();
+
+        emit generated( job.index, error );
+    }
+}
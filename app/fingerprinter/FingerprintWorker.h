@@ -0,0 +1,86 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FINGERPRINT_WORKER_H
+#define FINGERPRINT_WORKER_H
+
+#include <QMutex>
+#include <QQueue>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <lastfm/Fingerprint.h>
+
+class LAV_Source;
+class PipelinedSource;
+
+QString fingerprintErrorString( lastfm::Fingerprint::Error error );
+
+/** A blocking job queue shared by all the FingerprintWorkers of a batch.
+  * dequeue() returns false once the queue is closed and drained. */
+class FingerprintQueue
+{
+public:
+    struct Job
+    {
+        int index;
+        lastfm::Fingerprint* fp;
+    };
+
+    FingerprintQueue();
+
+    void enqueue( const Job& job );
+    bool dequeue( Job& job );
+    void close();
+
+private:
+    QMutex m_mutex;
+    QWaitCondition m_jobAvailable;
+    QQueue<Job> m_jobs;
+    bool m_closed;
+};
+
+/** Generates fingerprints for jobs taken from a FingerprintQueue.
+  * Each worker owns its own LAV_Source so decoding state is never shared.
+  * If pipeline is set the LAV_Source is wrapped in a PipelinedSource so
+  * each worker decodes on a second thread. */
+class FingerprintWorker : public QThread
+{
+    Q_OBJECT
+public:
+    FingerprintWorker( FingerprintQueue& queue, bool pipeline = false, QObject* parent = 0 );
+    ~FingerprintWorker();
+
+    enum { NoError = -1 };
+
+signals:
+    /** error is a lastfm::Fingerprint::Error, or NoError if the fingerprint
+      * was generated successfully */
+    void generated( int index, int error );
+
+private:
+    void run();
+
+private:
+    FingerprintQueue& m_queue;
+    LAV_Source* m_source;
+    PipelinedSource* m_pipeline;
+};
+
+#endif // FINGERPRINT_WORKER_H
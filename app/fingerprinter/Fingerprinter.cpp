@@ -31,16 +31,33 @@
 #include <lastfm/Track.h>
 
 #include "LAV_Source.h"
+#include "PipelinedSource.h"
 #include "Fingerprinter.h"
+#include "FingerprintCache.h"
 
 
-Fingerprinter::Fingerprinter( const lastfm::Track& track, QObject* parent )
-    :QObject( parent ), m_fp( track ), m_fpSource( 0 )
+Fingerprinter::Fingerprinter( const lastfm::Track& track, FingerprintCache* cache, bool pipeline, QObject* parent )
+    :QObject( parent ), m_fp( track ), m_fpSource( 0 ), m_track( track ), m_cache( cache )
 {
-    if ( m_fp.id().isNull() )
+    FingerprintCache::Entry entry;
+
+    if ( m_cache && m_cache->lookup( m_track.url().toLocalFile(), entry ) )
+    {
+        if ( entry.state == FingerprintCache::Submitted )
+            qDebug() << "Already Fingerprinted (cached): " << entry.fpid;
+        else
+            qWarning() << "Fingerprint error (cached): " << entry.error;
+
+        QTimer::singleShot(250, qApp, SLOT(quit()));
+    }
+    else if ( m_fp.id().isNull() )
     {
+        m_identity = entry.identity;
         m_fpSource = new LAV_Source();
 
+        if ( pipeline )
+            m_fpSource = new PipelinedSource( m_fpSource );
+
         if ( m_fpSource )
         {
             try
@@ -51,6 +68,7 @@ Fingerprinter::Fingerprinter( const lastfm::Track& track, QObject* parent )
             catch ( const lastfm::Fingerprint::Error& error )
             {
                 qWarning() << "Fingerprint error: " << error;
+                if ( m_cache ) m_cache->storeError( m_track.url().toLocalFile(), m_identity, error );
                 QTimer::singleShot(250, qApp, SLOT(quit()));
             }
         }
@@ -81,6 +99,12 @@ Fingerprinter::onFingerprintSubmitted()
     {
         m_fp.decode( static_cast<QNetworkReply*>( sender() ) );
         qDebug() << "Fingerprint success: " << m_fp.id();
+
+        if ( m_cache )
+        {
+            QString fpid = m_fp.id();
+            m_cache->storeId( m_track.url().toLocalFile(), m_identity, fpid );
+        }
     }
     catch ( const lastfm::Fingerprint::Error& error )
     {
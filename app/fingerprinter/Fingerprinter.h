@@ -24,12 +24,13 @@
 #include <lastfm/Fingerprint.h>
 
 namespace lastfm { class FingerprintableSource; }
+#include "FingerprintCache.h"
 
 class Fingerprinter : public QObject
 {
     Q_OBJECT
 public:
-    explicit Fingerprinter( const lastfm::Track& track, QObject* parent = 0 );
+    explicit Fingerprinter( const lastfm::Track& track, FingerprintCache* cache = 0, bool pipeline = false, QObject* parent = 0 );
     ~Fingerprinter();
 
 private slots:
@@ -40,6 +41,8 @@ private:
     lastfm::Fingerprint m_fp;
     lastfm::FingerprintableSource* m_fpSource;
     lastfm::Track m_track;
+    FingerprintCache* m_cache;
+    FingerprintCache::Identity m_identity;  // the file as we found it, for the cache
 };
 
 
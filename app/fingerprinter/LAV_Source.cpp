@@ -17,6 +17,8 @@
  */
 
 #include "LAV_Source.h"
+#include "PcmBuffer.h"
+#include "common/c++/silence.h"
 
 // Needed by libavutil/common.h
 #ifndef __STDC_CONSTANT_MACROS
@@ -41,6 +43,8 @@ extern "C" {
 #include <stdexcept>
 
 #include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
 
 using namespace std;
 
@@ -68,20 +72,18 @@ public:
         , timestamp(0)
         , bitrate(0)
         , eof(false)
-        , overflowSize(0)
+        , decodedFrame(avcodec_alloc_frame())
+        , pcm(AVCODEC_MAX_AUDIO_FRAME_SIZE*4/outSampleSize)
     {
-        outBuffer = (uint8_t*)av_malloc(sizeof(uint8_t)*AVCODEC_MAX_AUDIO_FRAME_SIZE*4);
-        outBufferSize = sizeof(uint8_t)*AVCODEC_MAX_AUDIO_FRAME_SIZE*4;
-        overflow = (uint8_t*)av_malloc(sizeof(uint8_t)*AVCODEC_MAX_AUDIO_FRAME_SIZE*4);
+        av_init_packet(&packet);
     }
 
     ~LAV_SourcePrivate()
     {
-        av_free(outBuffer);
-        av_free(overflow);
+        avcodec_free_frame(&decodedFrame);
     }
 
-    uint8_t * decodeOneFrame(int &dataSize, int &channels, int& nSamples);
+    const int16_t * decodeOneFrame(int &dataSize, int &channels, int& nSamples);
 
     AVFormatContext *inFormatContext;
     AVCodecContext *inCodecContext;
@@ -95,26 +97,29 @@ public:
     double timestamp;
     int bitrate;
     bool eof;
-    uint8_t *outBuffer;
-    size_t outBufferSize;
-    uint8_t *overflow;
-    size_t overflowSize;
+
+    // Reused for every frame so the decode loop doesn't hit the allocator
+    AVPacket packet;
+    AVFrame *decodedFrame;
+
+    // Decoded (and converted) samples waiting to be handed out
+    PcmBuffer pcm;
 };
 
 
 /** This reads the audio data from one frame, converts it to an acceptable
- * format (if needed), and returns a pointer to the the decoded data.
+ * format (if needed), appends it to pcm and returns a pointer to the newly
+ * decoded data there.
  *
  * @param dataSize bytes of decoded data
  * @param channels number of decoded channels
  * @param nSamples number of decoded samples
  */
-uint8_t * LAV_SourcePrivate::decodeOneFrame(int &dataSize, int &channels, int& nSamples)
+const int16_t * LAV_SourcePrivate::decodeOneFrame(int &dataSize, int &channels, int& nSamples)
 {
     char buf[256];
-    AVPacket packet;
-    AVFrame *decodedFrame = avcodec_alloc_frame();
-    av_init_packet(&packet);
+    const int16_t *out = NULL;
+    avcodec_get_frame_defaults(decodedFrame);
 
     int frameFinished = 0;
     dataSize = 0;
@@ -193,7 +198,14 @@ uint8_t * LAV_SourcePrivate::decodeOneFrame(int &dataSize, int &channels, int& n
 
             if (resampleContext)
             {
-                int maxOutSamples = outBufferSize / channels / outSampleSize;
+                uint8_t *outBuffer = (uint8_t*)pcm.reserve((decodedFrame->nb_samples + 256) * channels);
+                if (!outBuffer)
+                {
+                    cerr << "Decoded frame is too large" << endl;
+                    av_free_packet(&packet);
+                    break;
+                }
+                int maxOutSamples = pcm.space() / channels;
                 int nSamplesOut = swr_convert(resampleContext,
                                               &outBuffer,
                                               maxOutSamples,
@@ -207,6 +219,8 @@ uint8_t * LAV_SourcePrivate::decodeOneFrame(int &dataSize, int &channels, int& n
                 }
                 nSamples = nSamplesOut;
                 dataSize = nSamplesOut * channels * outSampleSize;
+                out = (const int16_t*)outBuffer;
+                pcm.commit(nSamplesOut * channels);
             }
             else
 #elif defined(HAVE_AVRESAMPLE)
@@ -254,8 +268,15 @@ uint8_t * LAV_SourcePrivate::decodeOneFrame(int &dataSize, int &channels, int& n
 
             if (resampleContext)
             {
+                uint8_t *outBuffer = (uint8_t*)pcm.reserve((decodedFrame->nb_samples + 256) * channels);
+                if (!outBuffer)
+                {
+                    cerr << "Decoded frame is too large" << endl;
+                    av_free_packet(&packet);
+                    break;
+                }
                 int outLinesize;
-                int maxOutSamples = outBufferSize / channels / outSampleSize;
+                int maxOutSamples = pcm.space() / channels;
                 av_samples_get_buffer_size(&outLinesize,
                                             channels,
                                             decodedFrame->nb_samples,
@@ -275,28 +296,82 @@ uint8_t * LAV_SourcePrivate::decodeOneFrame(int &dataSize, int &channels, int& n
                 }
                 nSamples = nSamplesOut;
                 dataSize = nSamplesOut * channels * outSampleSize;
+                out = (const int16_t*)outBuffer;
+                pcm.commit(nSamplesOut * channels);
             }
             else
 #endif
             {
+                int16_t *outBuffer = pcm.reserve(dataSize / outSampleSize);
+                if (!outBuffer)
+                {
+                    cerr << "Decoded frame is too large" << endl;
+                    dataSize = 0;
+                    av_free_packet(&packet);
+                    break;
+                }
                 nSamples = decodedFrame->nb_samples;
                 memcpy(outBuffer, decodedFrame->data[0], dataSize);
+                out = outBuffer;
+                pcm.commit(dataSize / outSampleSize);
             }
         }
         if ( packet.pts != AV_NOPTS_VALUE )
             timestamp = av_q2d(inFormatContext->streams[streamIndex]->time_base)*packet.pts;
         av_free_packet(&packet);
     }
-    timestamp += (double)nSamples / decodedFrame->sample_rate;
-    avcodec_free_frame(&decodedFrame);
-    return outBuffer;
+    if (!out)
+        dataSize = 0;
+    if (nSamples)
+        timestamp += (double)nSamples / decodedFrame->sample_rate;
+    return out;
+}
+
+
+/** libav needs a lock manager before codecs can be opened from more than
+ * one thread at a time (the batch mode runs a LAV_Source per worker).
+ */
+static int lockManager(void **mutex, enum AVLockOp op)
+{
+    switch (op)
+    {
+        case AV_LOCK_CREATE:
+            *mutex = new QMutex();
+            return 0;
+        case AV_LOCK_OBTAIN:
+            static_cast<QMutex*>(*mutex)->lock();
+            return 0;
+        case AV_LOCK_RELEASE:
+            static_cast<QMutex*>(*mutex)->unlock();
+            return 0;
+        case AV_LOCK_DESTROY:
+            delete static_cast<QMutex*>(*mutex);
+            *mutex = NULL;
+            return 0;
+    }
+    return 1;
+}
+
+
+static void registerLibav()
+{
+    static QMutex mutex;
+    static bool registered = false;
+
+    QMutexLocker locker(&mutex);
+    if (registered)
+        return;
+
+    av_lockmgr_register(lockManager);
+    av_register_all();
+    registered = true;
 }
 
 
 LAV_Source::LAV_Source()
     : d(new LAV_SourcePrivate())
 {
-    av_register_all();
+    registerLibav();
     avformat_network_init();
 }
 
@@ -429,7 +504,7 @@ void LAV_Source::release()
     d->duration = 0;
     d->bitrate = 0;
     d->eof = false;
-    d->overflowSize = 0;
+    d->pcm.clear();
 }
 
 
@@ -438,22 +513,12 @@ void LAV_Source::skipSilence(double silenceThreshold /* = 0.0001 */)
     silenceThreshold *= static_cast<double>( numeric_limits<short>::max() );
 
     int dataSize, channels, nSamples;
-    uint8_t *out = d->decodeOneFrame(dataSize, channels, nSamples);
+    d->pcm.clear();
+    const int16_t *out = d->decodeOneFrame(dataSize, channels, nSamples);
     while(dataSize > 0)
     {
-        double sum = 0;
-        int16_t *buf = (int16_t*)out;
-        switch ( channels )
-        {
-            case 1:
-                for (int j = 0; j < nSamples; j++)
-                    sum += abs( buf[j] );
-                break;
-            case 2:
-                for (int j = 0; j < nSamples; j+=2)
-                    sum += abs( (buf[j] >> 1) + (buf[j+1] >> 1) );
-                break;
-        }
+        double sum = silence::sum(out, nSamples, channels);
+        d->pcm.clear();
         if ( sum >= silenceThreshold * static_cast<double>(nSamples) )
         {
             break;
@@ -469,9 +534,30 @@ void LAV_Source::skip(const int mSecs)
 {
     double targetTimestamp = d->timestamp + mSecs/1000.0;
     int dataSize, channels, nSamples;
+
+    // Jump to the last keyframe before the target if the container lets
+    // us, then decode forward from there as before.  If it doesn't (pipes,
+    // some raw streams) we just decode everything up to the target.
+    if ( mSecs > 0 && d->inFormatContext->pb && d->inFormatContext->pb->seekable )
+    {
+        AVStream *stream = d->inFormatContext->streams[d->streamIndex];
+        int64_t seekTarget = static_cast<int64_t>(targetTimestamp / av_q2d(stream->time_base));
+
+        if ( av_seek_frame(d->inFormatContext, d->streamIndex, seekTarget, AVSEEK_FLAG_BACKWARD) >= 0 )
+        {
+            avcodec_flush_buffers(d->inCodecContext);
+            d->pcm.clear();
+            d->eof = false;
+            // Packets after a seek normally carry a pts which resets this,
+            // if they don't we have to trust the seek
+            d->timestamp = targetTimestamp;
+        }
+    }
+
     for (;;)
     {
         d->decodeOneFrame(dataSize, channels, nSamples);
+        d->pcm.clear();
         if ( d->timestamp > targetTimestamp || d->eof )
            return;
     }
@@ -480,41 +566,20 @@ void LAV_Source::skip(const int mSecs)
 
 int LAV_Source::updateBuffer(signed short* pBuffer, size_t bufferSize)
 {
-    size_t bufferFill = 0;
-    int dataSize;
-
-    if ( d->overflowSize )
-    {
-        memcpy( pBuffer, d->overflow, d->overflowSize );
-        bufferFill = d->overflowSize/outSampleSize;
-        d->overflowSize = 0;
-    }
+    // Hand out whatever is left over from the last call first, then decode
+    // straight into pcm and copy out until pBuffer is full.  Anything that
+    // doesn't fit stays in pcm for next time.
+    size_t bufferFill = d->pcm.read(pBuffer, bufferSize);
 
-    uint8_t * out;
-    while(bufferFill < bufferSize)
+    while (bufferFill < bufferSize)
     {
-        int channels, nb_samples;
+        int dataSize, channels, nb_samples;
 
-        out = d->decodeOneFrame(dataSize, channels, nb_samples);
+        d->decodeOneFrame(dataSize, channels, nb_samples);
         if (!dataSize)
             break;
 
-        // Only put as many bytes in pBuffer as will fit; save the rest for the
-        // next call to updateBuffer
-        int bytesToBuffer = (bufferSize - bufferFill)*outSampleSize;
-
-        if ( bytesToBuffer < dataSize )
-        {
-            d->overflowSize = dataSize - bytesToBuffer;
-            memcpy( d->overflow, out + bytesToBuffer, d->overflowSize);
-        }
-        else
-        {
-            bytesToBuffer = dataSize;
-        }
-        memcpy( pBuffer + bufferFill, out, bytesToBuffer );
-
-        bufferFill += bytesToBuffer/outSampleSize;
+        bufferFill += d->pcm.read(pBuffer + bufferFill, bufferSize - bufferFill);
     }
 
     return bufferFill;
@@ -0,0 +1,98 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PCM_BUFFER_H
+#define PCM_BUFFER_H
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+/** A fixed capacity buffer of interleaved s16 samples.
+  *
+  * Decoders write straight into the space returned by reserve() and
+  * readers copy out from the front. The read and write positions snap
+  * back to the start whenever the buffer empties, and unread samples are
+  * only slid back when a reserve() would not otherwise fit, so in the
+  * usual decode/drain cycle each sample is copied exactly once on the
+  * way out.
+  */
+class PcmBuffer
+{
+public:
+    explicit PcmBuffer( size_t capacity )
+        :m_data( new int16_t[capacity] ), m_capacity( capacity ), m_read( 0 ), m_write( 0 )
+    {}
+
+    ~PcmBuffer() { delete[] m_data; }
+
+    size_t size() const { return m_write - m_read; }
+    size_t capacity() const { return m_capacity; }
+    bool isEmpty() const { return m_read == m_write; }
+
+    /** the unread samples */
+    const int16_t* data() const { return m_data + m_read; }
+
+    /** Returns contiguous space for at least n samples after the unread
+      * data, or 0 if n samples will never fit. space() then tells you how
+      * much you may actually write before calling commit(). */
+    int16_t* reserve( size_t n )
+    {
+        if ( m_capacity - m_write < n && m_read > 0 )
+        {
+            std::memmove( m_data, m_data + m_read, size() * sizeof( int16_t ) );
+            m_write -= m_read;
+            m_read = 0;
+        }
+
+        return m_capacity - m_write < n ? 0 : m_data + m_write;
+    }
+
+    size_t space() const { return m_capacity - m_write; }
+
+    void commit( size_t n ) { m_write += n; }
+
+    void consume( size_t n )
+    {
+        m_read += n;
+        if ( m_read >= m_write ) clear();
+    }
+
+    /** copies up to n samples into out and returns how many were copied */
+    size_t read( int16_t* out, size_t n )
+    {
+        if ( n > size() ) n = size();
+        std::memcpy( out, data(), n * sizeof( int16_t ) );
+        consume( n );
+        return n;
+    }
+
+    void clear() { m_read = m_write = 0; }
+
+private:
+    PcmBuffer( const PcmBuffer& );
+    PcmBuffer& operator=( const PcmBuffer& );
+
+    int16_t* m_data;
+    size_t m_capacity;
+    size_t m_read;
+    size_t m_write;
+};
+
+#endif // PCM_BUFFER_H
@@ -0,0 +1,123 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PCM_QUEUE_H
+#define PCM_QUEUE_H
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+#include <QAtomicInt>
+
+/** A lock-free ring of s16 samples for exactly one producer thread and one
+  * consumer thread.
+  *
+  * The producer decodes straight into the space returned by writeSpace()
+  * and publishes it with commit(), the consumer copies out with read().
+  * Each side only ever stores its own position, so neither takes a lock.
+  * One slot is always left empty to tell a full ring from an empty one.
+  */
+class PcmQueue
+{
+public:
+    explicit PcmQueue( size_t capacity )
+        :m_data( new int16_t[capacity + 1] ), m_size( capacity + 1 ), m_read( 0 ), m_write( 0 )
+    {}
+
+    ~PcmQueue() { delete[] m_data; }
+
+    size_t capacity() const { return m_size - 1; }
+
+    size_t size() const
+    {
+        size_t r = readPos();
+        size_t w = writePos();
+        return w >= r ? w - r : m_size - r + w;
+    }
+
+    bool isEmpty() const { return readPos() == writePos(); }
+
+    /** producer: contiguous free space at the write position, n is set to
+      * how many samples fit there (0 when the ring is full) */
+    int16_t* writeSpace( size_t& n )
+    {
+        size_t r = readPos();
+        size_t w = writePos();
+
+        if ( w >= r )
+            n = m_size - w - ( r == 0 ? 1 : 0 );
+        else
+            n = r - w - 1;
+
+        return m_data + w;
+    }
+
+    /** producer: publish n samples written to writeSpace() */
+    void commit( size_t n )
+    {
+        size_t w = writePos() + n;
+        if ( w == m_size ) w = 0;
+        m_write.fetchAndStoreOrdered( int( w ) );
+    }
+
+    /** consumer: copies up to n samples into out and returns how many were
+      * copied */
+    size_t read( int16_t* out, size_t n )
+    {
+        size_t r = readPos();
+        size_t w = writePos();
+        size_t copied = 0;
+
+        while ( copied < n && r != w )
+        {
+            size_t chunk = ( w > r ? w : m_size ) - r;
+            if ( chunk > n - copied ) chunk = n - copied;
+
+            std::memcpy( out + copied, m_data + r, chunk * sizeof( int16_t ) );
+            copied += chunk;
+            r += chunk;
+            if ( r == m_size ) r = 0;
+        }
+
+        if ( copied ) m_read.fetchAndStoreOrdered( int( r ) );
+        return copied;
+    }
+
+    /** only safe while neither thread is using the queue */
+    void clear()
+    {
+        m_read.fetchAndStoreOrdered( 0 );
+        m_write.fetchAndStoreOrdered( 0 );
+    }
+
+private:
+    PcmQueue( const PcmQueue& );
+    PcmQueue& operator=( const PcmQueue& );
+
+    size_t readPos() const { return size_t( const_cast<QAtomicInt&>( m_read ).fetchAndAddAcquire( 0 ) ); }
+    size_t writePos() const { return size_t( const_cast<QAtomicInt&>( m_write ).fetchAndAddAcquire( 0 ) ); }
+
+    int16_t* m_data;
+    size_t m_size;
+    QAtomicInt m_read;
+    QAtomicInt m_write;
+};
+
+#endif // PCM_QUEUE_H
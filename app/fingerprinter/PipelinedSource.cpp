@@ -0,0 +1,263 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdexcept>
+#include <string>
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QWaitCondition>
+
+#include "PcmQueue.h"
+#include "PipelinedSource.h"
+
+
+class PipelinedSourcePrivate : public QThread
+{
+public:
+    PipelinedSourcePrivate( lastfm::FingerprintableSource* source, size_t capacity )
+        :source( source ), queue( capacity ), started( false )
+    {}
+
+    void start();
+    void stop();
+
+    void waitForSpace();
+    void waitForData();
+    void wakeProducer();
+    void wakeConsumer();
+
+    lastfm::FingerprintableSource* source;
+    PcmQueue queue;
+    bool started;
+
+    QAtomicInt stopping;
+    QAtomicInt finished;
+    std::string error;
+
+    // Only touched when one side has to sleep. The waiting flags let the
+    // other side skip the mutex entirely while things are flowing.
+    QMutex mutex;
+    QWaitCondition cond;
+    QAtomicInt producerWaiting;
+    QAtomicInt consumerWaiting;
+
+protected:
+    void run();
+};
+
+
+void
+PipelinedSourcePrivate::start()
+{
+    stopping.fetchAndStoreOrdered( 0 );
+    finished.fetchAndStoreOrdered( 0 );
+    error.clear();
+    queue.clear();
+    started = true;
+    QThread::start();
+}
+
+void
+PipelinedSourcePrivate::stop()
+{
+    if ( !started )
+        return;
+
+    stopping.fetchAndStoreOrdered( 1 );
+    wakeProducer();
+    wait();
+
+    queue.clear();
+    started = false;
+}
+
+void
+PipelinedSourcePrivate::waitForSpace()
+{
+    QMutexLocker locker( &mutex );
+    producerWaiting.fetchAndStoreOrdered( 1 );
+
+    size_t space;
+    while ( ( queue.writeSpace( space ), space == 0 ) && !stopping.fetchAndAddOrdered( 0 ) )
+        cond.wait( &mutex );
+
+    producerWaiting.fetchAndStoreOrdered( 0 );
+}
+
+void
+PipelinedSourcePrivate::waitForData()
+{
+    QMutexLocker locker( &mutex );
+    consumerWaiting.fetchAndStoreOrdered( 1 );
+
+    while ( queue.isEmpty() && !finished.fetchAndAddOrdered( 0 ) )
+        cond.wait( &mutex );
+
+    consumerWaiting.fetchAndStoreOrdered( 0 );
+}
+
+void
+PipelinedSourcePrivate::wakeProducer()
+{
+    // the waiter holds the mutex from setting its flag until it sleeps, so
+    // taking it here means the wake can't be lost
+    if ( producerWaiting.fetchAndAddOrdered( 0 ) )
+    {
+        QMutexLocker locker( &mutex );
+        cond.wakeAll();
+    }
+}
+
+void
+PipelinedSourcePrivate::wakeConsumer()
+{
+    if ( consumerWaiting.fetchAndAddOrdered( 0 ) )
+    {
+        QMutexLocker locker( &mutex );
+        cond.wakeAll();
+    }
+}
+
+void
+PipelinedSourcePrivate::run()
+{
+    try
+    {
+        while ( !stopping.fetchAndAddOrdered( 0 ) )
+        {
+            size_t space;
+            int16_t* out = queue.writeSpace( space );
+
+            if ( space == 0 )
+            {
+                waitForSpace();
+                continue;
+            }
+
+            int filled = source->updateBuffer( reinterpret_cast<signed short*>( out ), space );
+            if ( filled <= 0 )
+                break;
+
+            queue.commit( filled );
+            wakeConsumer();
+        }
+    }
+    catch ( const std::exception& e )
+    {
+        error = e.what();
+    }
+
+    finished.fetchAndStoreOrdered( 1 );
+    wakeConsumer();
+}
+
+
+PipelinedSource::PipelinedSource( lastfm::FingerprintableSource* source, size_t capacity )
+    :d( new PipelinedSourcePrivate( source, capacity ) )
+{
+}
+
+PipelinedSource::~PipelinedSource()
+{
+    release();
+    delete d->source;
+    delete d;
+}
+
+void
+PipelinedSource::getInfo( int& lengthSecs, int& samplerate, int& bitrate, int& nchannels )
+{
+    d->source->getInfo( lengthSecs, samplerate, bitrate, nchannels );
+}
+
+void
+PipelinedSource::init( const QString& fileName )
+{
+    d->stop();
+    d->source->init( fileName );
+}
+
+void
+PipelinedSource::release()
+{
+    d->stop();
+}
+
+int
+PipelinedSource::updateBuffer( signed short* pBuffer, size_t bufferSize )
+{
+    if ( !d->started )
+        d->start();
+
+    int16_t* out = reinterpret_cast<int16_t*>( pBuffer );
+    size_t bufferFill = 0;
+
+    while ( bufferFill < bufferSize )
+    {
+        size_t n = d->queue.read( out + bufferFill, bufferSize - bufferFill );
+
+        if ( n )
+        {
+            bufferFill += n;
+            d->wakeProducer();
+        }
+        else if ( d->finished.fetchAndAddOrdered( 0 ) )
+        {
+            // the producer may have committed its last samples just
+            // before finishing, so only stop once the queue is empty too
+            if ( d->queue.isEmpty() )
+                break;
+        }
+        else
+        {
+            d->waitForData();
+        }
+    }
+
+    if ( bufferFill == 0 && !d->error.empty() )
+        throw std::runtime_error( d->error );
+
+    return bufferFill;
+}
+
+void
+PipelinedSource::skip( const int mSecs )
+{
+    Q_ASSERT( !d->started );
+    d->source->skip( mSecs );
+}
+
+void
+PipelinedSource::skipSilence( double silenceThreshold /* = 0.0001 */ )
+{
+    Q_ASSERT( !d->started );
+    d->source->skipSilence( silenceThreshold );
+}
+
+bool
+PipelinedSource::eof() const
+{
+    if ( !d->started )
+        return d->source->eof();
+
+    return d->finished.fetchAndAddOrdered( 0 ) && d->queue.isEmpty();
+}
@@ -0,0 +1,66 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PIPELINED_SOURCE_H
+#define PIPELINED_SOURCE_H
+
+#include <lastfm/FingerprintableSource.h>
+
+/** Runs another source's decoder on its own thread so that decoding and
+  * fingerprint analysis happen on different cores.
+  *
+  * The first updateBuffer() starts a decoder thread that keeps a PcmQueue
+  * topped up, blocking while it is full. updateBuffer() then just copies
+  * out of the queue. init(), getInfo(), skip() and skipSilence() go
+  * straight to the wrapped source, so like lastfm::Fingerprint::generate()
+  * you must call them before the first updateBuffer(). release() only stops
+  * the decoder thread, FingerprintableSource has no release() so the wrapped
+  * source keeps its file until it is next initialised or deleted.
+  *
+  * If the wrapped source throws while decoding, updateBuffer() rethrows a
+  * std::runtime_error once the samples decoded before it are used up.
+  *
+  * Takes ownership of the wrapped source.
+  */
+class PipelinedSource : public lastfm::FingerprintableSource
+{
+public:
+    /** capacity is the size of the queue in samples */
+    explicit PipelinedSource( lastfm::FingerprintableSource* source, size_t capacity = 1 << 19 );
+    ~PipelinedSource();
+
+    void getInfo( int& lengthSecs, int& samplerate, int& bitrate, int& nchannels );
+    void init( const QString& fileName );
+    void release();
+
+    int updateBuffer( signed short* pBuffer, size_t bufferSize );
+
+    void skip( const int mSecs );
+    void skipSilence( double silenceThreshold = 0.0001 );
+
+    bool eof() const;
+
+private:
+    PipelinedSource( const PipelinedSource& );
+    PipelinedSource& operator=( const PipelinedSource& );
+
+    class PipelinedSourcePrivate * const d;
+};
+
+#endif // PIPELINED_SOURCE_H
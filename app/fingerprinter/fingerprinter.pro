@@ -14,10 +14,24 @@ mac {
 
 SOURCES += main.cpp \
             Fingerprinter.cpp \
-            LAV_Source.cpp
+            FingerprintBatch.cpp \
+            FingerprintCache.cpp \
+            FingerprintDaemon.cpp \
+            FingerprintWorker.cpp \
+            LAV_Source.cpp \
+            PipelinedSource.cpp \
+            $$ROOT_DIR/common/c++/silence.cpp
 
 HEADERS += LAV_Source.h \
-            Fingerprinter.h
+            Fingerprinter.h \
+            FingerprintBatch.h \
+            FingerprintCache.h \
+            FingerprintDaemon.h \
+            FingerprintWorker.h \
+            PcmBuffer.h \
+            PcmQueue.h \
+            PipelinedSource.h \
+            $$ROOT_DIR/common/c++/silence.h
 
 
 
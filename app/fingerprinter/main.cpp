@@ -19,6 +19,9 @@
 */
 
 #include "Fingerprinter.h"
+#include "FingerprintBatch.h"
+#include "FingerprintCache.h"
+#include "FingerprintDaemon.h"
 
 #include "lib/unicorn/UnicornCoreApplication.h"
 
@@ -26,9 +29,19 @@
 
 #include <QStringList>
 #include <QCoreApplication>
+#include <QThread>
+#include <QTimer>
 #include <QDebug>
 
 // ./fingerprinter --username <username> --filename <filename> --title <title> --album <album> --artist <artist>
+// ./fingerprinter --username <username> ( --manifest <file> | --dir <path> ) [--threads <n>]
+// ./fingerprinter --daemon [--threads <n>]
+//
+// --daemon stays running and takes jobs over a local socket, see FingerprintDaemon.
+// --pipeline decodes on a separate thread from the fingerprint analysis.
+//
+// Results are cached per file, see FingerprintCache. Cache options:
+//   --no-cache  --hash-kb <n>  --clear-cache  --invalidate <path>
 
 int main(int argc, char *argv[])
 {
@@ -43,8 +56,64 @@ int main(int argc, char *argv[])
 
     int usernameIndex = a.arguments().indexOf( "--username" );
     int filenameIndex = a.arguments().indexOf( "--filename" );
+    int manifestIndex = a.arguments().indexOf( "--manifest" );
+    int dirIndex = a.arguments().indexOf( "--dir" );
+    int threadsIndex = a.arguments().indexOf( "--threads" );
 
-    if ( usernameIndex != -1 && filenameIndex != -1 )
+    bool pipeline = a.arguments().indexOf( "--pipeline" ) != -1;
+
+    FingerprintCache* cache = 0;
+    bool cacheCommand = false;
+
+    if ( a.arguments().indexOf( "--no-cache" ) == -1 )
+    {
+        int hashIndex = a.arguments().indexOf( "--hash-kb" );
+        int clearIndex = a.arguments().indexOf( "--clear-cache" );
+        int invalidateIndex = a.arguments().indexOf( "--invalidate" );
+
+        cache = new FingerprintCache( FingerprintCache::defaultPath(), hashIndex != -1 ? a.arguments().at( hashIndex + 1 ).toInt() : 0 );
+
+        if ( clearIndex != -1 )
+        {
+            qDebug() << "Cleared" << cache->clear() << "cached fingerprints";
+            cacheCommand = true;
+        }
+
+        if ( invalidateIndex != -1 )
+        {
+            qDebug() << "Invalidated" << cache->invalidate( a.arguments().at( invalidateIndex + 1 ) ) << "cached fingerprints";
+            cacheCommand = true;
+        }
+    }
+
+    if ( a.arguments().indexOf( "--daemon" ) != -1 )
+    {
+        int threads = QThread::idealThreadCount();
+        if ( threadsIndex != -1 ) threads = a.arguments().at( threadsIndex + 1 ).toInt();
+
+        FingerprintDaemon* daemon = new FingerprintDaemon( threads, cache, pipeline );
+        if ( daemon->start() )
+            exitCode = a.exec();
+        delete daemon;
+    }
+    else if ( usernameIndex != -1 && ( manifestIndex != -1 || dirIndex != -1 ) )
+    {
+        lastfm::ws::Username = a.arguments().at( usernameIndex + 1 );
+
+        QStringList files;
+        if ( manifestIndex != -1 ) files << FingerprintBatch::filesFromManifest( a.arguments().at( manifestIndex + 1 ) );
+        if ( dirIndex != -1 ) files << FingerprintBatch::filesFromDir( a.arguments().at( dirIndex + 1 ) );
+
+        int threads = QThread::idealThreadCount();
+        if ( threadsIndex != -1 ) threads = a.arguments().at( threadsIndex + 1 ).toInt();
+
+        FingerprintBatch* batch = new FingerprintBatch( files, threads, cache, pipeline );
+        QObject::connect( batch, SIGNAL(finished()), &a, SLOT(quit()) );
+        QTimer::singleShot( 0, batch, SLOT(start()) );
+        exitCode = a.exec();
+        delete batch;
+    }
+    else if ( usernameIndex != -1 && filenameIndex != -1 )
     {
         // username and filename are required fields
         lastfm::ws::Username = a.arguments().at( usernameIndex + 1 );
@@ -61,14 +130,23 @@ int main(int argc, char *argv[])
         if ( albumIndex != -1 ) track.setAlbum( a.arguments().at( albumIndex + 1 ) );
         if ( artistIndex != -1 ) track.setTitle( a.arguments().at( artistIndex + 1 ) );
 
-        Fingerprinter* fingerprinter = new Fingerprinter( track );
+        Fingerprinter* fingerprinter = new Fingerprinter( track, cache, pipeline );
         exitCode = a.exec();
         delete fingerprinter;
     }
+    else if ( cacheCommand )
+    {
+        exitCode = 0;
+    }
     else
     {
-        qWarning() << "Usage: fingerprinter --username <username> --filename <filename> --title <title> --album <album> --artist <artist>";
+        qWarning() << "Usage: fingerprinter --username <username> --filename <filename> --title <title> --album <album> --artist <artist> [--pipeline]";
+        qWarning() << "       fingerprinter --username <username> ( --manifest <file> | --dir <path> ) [--threads <n>] [--pipeline]";
+        qWarning() << "       fingerprinter --daemon [--threads <n>] [--pipeline]";
+        qWarning() << "       fingerprinter [--no-cache] [--hash-kb <n>] [--clear-cache] [--invalidate <path>]";
     }
 
+    delete cache;
+
     return exitCode;
 }
@@ -0,0 +1,331 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Decode throughput for each FingerprintableSource.
+//
+// ./bench_sources [--iterations <n>] [--secs <n>] [--filter <text>] [--dir <path>] [--keep]
+//
+// Synthetic fixtures are encoded into --dir (a temporary directory by
+// default) and every source that can read a fixture is timed doing init(),
+// getInfo(), skipSilence(), skip() and reading the whole file through
+// updateBuffer(). Results are written to stdout as one JSON object per line:
+//
+// {"source":"MadSource","fixture":"tone_44100_2_128k_65s.mp3","op":"updateBuffer","iterations":3,
+//  "seconds":0.41,"mean_seconds":0.42,"samples":5733000,"samples_per_sec":13982926,"mb_per_sec":2.52}
+//
+// seconds is the best of the iterations. samples counts interleaved s16
+// samples produced (or skipped, for skip and skipSilence) and mb_per_sec is
+// the size of the encoded file over seconds, so the two tell you about the
+// decoder and the input side respectively.
+
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QStringList>
+#include <QTextStream>
+#include <QVector>
+
+#include "LAV_Source.h"
+#include "MadSource.h"
+#include "AacSource.h"
+#include "FlacSource.h"
+#include "VorbisSource.h"
+
+#include "FixtureEncoder.h"
+
+
+namespace
+{
+    typedef lastfm::FingerprintableSource* (*SourceFactory)();
+
+    template <class T> lastfm::FingerprintableSource* create() { return new T; }
+
+    struct SourceType
+    {
+        const char* name;
+        const char* extensions;
+        SourceFactory factory;
+    };
+
+    const SourceType sourceTypes[] =
+    {
+        { "LAV_Source", "mp3 aac m4a flac ogg", create<LAV_Source> },
+        { "MadSource", "mp3", create<MadSource> },
+        { "AacSource", "aac m4a", create<AacSource> },
+        { "FlacSource", "flac", create<FlacSource> },
+        { "VorbisSource", "ogg", create<VorbisSource> }
+    };
+
+    enum Op { Init, GetInfo, SkipSilence, Skip, UpdateBuffer };
+    const char* const opNames[] = { "init", "getInfo", "skipSilence", "skip", "updateBuffer" };
+
+    // the fingerprinter asks for this much at a time
+    const size_t k_bufferSize = 131072;
+
+    struct Result
+    {
+        Result() : best( std::numeric_limits<double>::max() ), total( 0 ), samples( 0 ) {}
+
+        double best;
+        double total;
+        qint64 samples;
+        QString error;
+    };
+}
+
+
+static QString
+jsonString( const QString& in )
+{
+    QString out;
+    foreach ( QChar c, in )
+    {
+        if ( c == '"' || c == '\\' ) out += '\\';
+        out += c;
+    }
+    return '"' + out + '"';
+}
+
+
+/** Runs op once on a fresh source, returns the seconds it took */
+static double
+runOnce( const SourceType& type, const Fixture& fixture, const QString& path, Op op, qint64& samples )
+{
+    QVector<signed short> buffer( k_bufferSize );
+    QElapsedTimer timer;
+    samples = 0;
+
+    if ( op == Init )
+        timer.start();
+
+    lastfm::FingerprintableSource* source = type.factory();
+
+    try
+    {
+        source->init( path );
+
+        if ( op != Init )
+            timer.start();
+
+        switch ( op )
+        {
+            case Init:
+                break;
+
+            case GetInfo:
+            {
+                int lengthSecs, samplerate, bitrate, nchannels;
+                source->getInfo( lengthSecs, samplerate, bitrate, nchannels );
+                break;
+            }
+
+            case SkipSilence:
+                source->skipSilence();
+                samples = qint64( fixture.silenceSecs ) * fixture.samplerate * fixture.channels;
+                break;
+
+            case Skip:
+            {
+                // the fingerprinter skips the start of the track like this
+                int ms = fixture.secs * 1000 / 2;
+                source->skip( ms );
+                samples = qint64( ms ) * fixture.samplerate / 1000 * fixture.channels;
+                break;
+            }
+
+            case UpdateBuffer:
+            {
+                int filled;
+                while ( ( filled = source->updateBuffer( buffer.data(), buffer.size() ) ) > 0 )
+                    samples += filled;
+                break;
+            }
+        }
+    }
+    catch ( const std::exception& e )
+    {
+        delete source;
+        throw std::runtime_error( std::string( opNames[op] ) + ": " + e.what() );
+    }
+    catch ( ... )
+    {
+        // MadSource throws a const char* for unrecoverable errors
+        delete source;
+        throw std::runtime_error( std::string( opNames[op] ) + " failed" );
+    }
+
+    double seconds = timer.nsecsElapsed() / 1e9;
+    delete source;
+    return seconds;
+}
+
+
+static void
+report( QTextStream& out, const SourceType& type, const Fixture& fixture, qint64 fileSize, Op op, int iterations, const Result& r )
+{
+    out << "{\"source\":" << jsonString( type.name )
+        << ",\"fixture\":" << jsonString( fixture.name() )
+        << ",\"op\":" << jsonString( opNames[op] );
+
+    if ( !r.error.isEmpty() )
+    {
+        out << ",\"status\":\"error\",\"error\":" << jsonString( r.error ) << "}\n";
+        out.flush();
+        return;
+    }
+
+    double best = qMax( r.best, 1e-9 );
+
+    out << ",\"iterations\":" << iterations
+        << ",\"seconds\":" << best
+        << ",\"mean_seconds\":" << r.total / iterations
+        << ",\"samples\":" << r.samples
+        << ",\"samples_per_sec\":" << qint64( r.samples / best )
+        << ",\"mb_per_sec\":" << fileSize / best / ( 1024 * 1024 )
+        << "}\n";
+    out.flush();
+}
+
+
+static QList<Fixture>
+fixtures( int secs )
+{
+    struct Layout { int samplerate; int channels; };
+    const Layout layouts[] = { { 44100, 2 }, { 22050, 1 } };
+
+    struct Encoding { const char* extension; int bitratePerChannel; };
+    const Encoding encodings[] =
+    {
+        { "mp3", 64000 }, { "mp3", 160000 },
+        { "aac", 64000 }, { "m4a", 64000 },
+        { "flac", 0 },
+        { "ogg", 64000 }
+    };
+
+    QList<Fixture> list;
+
+    for ( int s = 0 ; s < 2 ; ++s )
+        for ( size_t l = 0 ; l < sizeof( layouts ) / sizeof( layouts[0] ) ; ++l )
+            for ( size_t e = 0 ; e < sizeof( encodings ) / sizeof( encodings[0] ) ; ++e )
+            {
+                Fixture f;
+                f.signal = s == 0 ? Fixture::Tone : Fixture::Noise;
+                f.extension = encodings[e].extension;
+                f.samplerate = layouts[l].samplerate;
+                f.channels = layouts[l].channels;
+                f.bitrate = encodings[e].bitratePerChannel * f.channels;
+                f.silenceSecs = 5;
+                f.secs = secs;
+                list << f;
+            }
+
+    return list;
+}
+
+
+int main( int argc, char** argv )
+{
+    QCoreApplication app( argc, argv );
+    QStringList args = app.arguments();
+
+    int iterations = 3;
+    int secs = 60;
+    QString filter;
+    QString dirPath = QDir::temp().filePath( "bench_sources" );
+
+    int i;
+    if ( ( i = args.indexOf( "--iterations" ) ) != -1 && i + 1 < args.size() ) iterations = qMax( 1, args.at( i + 1 ).toInt() );
+    if ( ( i = args.indexOf( "--secs" ) ) != -1 && i + 1 < args.size() ) secs = qMax( 1, args.at( i + 1 ).toInt() );
+    if ( ( i = args.indexOf( "--filter" ) ) != -1 && i + 1 < args.size() ) filter = args.at( i + 1 );
+    if ( ( i = args.indexOf( "--dir" ) ) != -1 && i + 1 < args.size() ) dirPath = args.at( i + 1 );
+    bool keep = args.contains( "--keep" );
+
+    QDir dir;
+    dir.mkpath( dirPath );
+    dir.setPath( dirPath );
+
+    QTextStream out( stdout );
+    QTextStream err( stderr );
+
+    foreach ( const Fixture& fixture, fixtures( secs ) )
+    {
+        const QString path = dir.filePath( fixture.name() );
+
+        // reuse fixtures from a previous --keep run
+        if ( !QFileInfo( path ).exists() )
+        {
+            QString error;
+            if ( !encodeFixture( fixture, path, error ) )
+            {
+                err << "skipping " << fixture.name() << ": " << error << "\n";
+                err.flush();
+                continue;
+            }
+        }
+
+        const qint64 fileSize = QFileInfo( path ).size();
+
+        for ( size_t t = 0 ; t < sizeof( sourceTypes ) / sizeof( sourceTypes[0] ) ; ++t )
+        {
+            const SourceType& type = sourceTypes[t];
+
+            if ( !QString( type.extensions ).split( ' ' ).contains( fixture.extension ) )
+                continue;
+
+            if ( !filter.isEmpty() && !fixture.name().contains( filter ) && !QString( type.name ).contains( filter ) )
+                continue;
+
+            for ( int op = Init ; op <= UpdateBuffer ; ++op )
+            {
+                Result r;
+
+                for ( int n = 0 ; n < iterations && r.error.isEmpty() ; ++n )
+                {
+                    try
+                    {
+                        qint64 samples;
+                        double seconds = runOnce( type, fixture, path, Op( op ), samples );
+                        r.best = qMin( r.best, seconds );
+                        r.total += seconds;
+                        r.samples = samples;
+                    }
+                    catch ( const std::exception& e )
+                    {
+                        r.error = QString::fromLocal8Bit( e.what() );
+                    }
+                }
+
+                report( out, type, fixture, fileSize, Op( op ), iterations, r );
+            }
+        }
+
+        if ( !keep )
+            QFile::remove( path );
+    }
+
+    if ( !keep )
+        dir.rmdir( dirPath );
+
+    return 0;
+}
@@ -0,0 +1,267 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+
+#include <QFile>
+
+#include "FixtureEncoder.h"
+
+// Needed by libavutil/common.h
+#ifndef __STDC_CONSTANT_MACROS
+#define __STDC_CONSTANT_MACROS 1
+#endif
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/mem.h>
+}
+
+
+QString
+Fixture::name() const
+{
+    QString name = QString( "%1_%2_%3" ).arg( signal == Tone ? "tone" : "noise" ).arg( samplerate ).arg( channels );
+
+    if ( extension != "flac" )
+        name += QString( "_%1k" ).arg( bitrate / 1000 );
+
+    return name + QString( "_%1s." ).arg( silenceSecs + secs ) + extension;
+}
+
+
+/** The encoders we'll try for each extension, best first */
+static AVCodec*
+findEncoder( const QString& extension )
+{
+    const char* const mp3[] = { "libmp3lame", 0 };
+    const char* const aac[] = { "libfdk_aac", "libfaac", "aac", 0 };
+    const char* const flac[] = { "flac", 0 };
+    const char* const ogg[] = { "libvorbis", "vorbis", 0 };
+
+    const char* const* names = 0;
+    if ( extension == "mp3" ) names = mp3;
+    else if ( extension == "aac" || extension == "m4a" ) names = aac;
+    else if ( extension == "flac" ) names = flac;
+    else if ( extension == "ogg" ) names = ogg;
+
+    for ( ; names && *names ; ++names )
+        if ( AVCodec* codec = avcodec_find_encoder_by_name( *names ) )
+            return codec;
+
+    return NULL;
+}
+
+
+/** The first of the encoder's sample formats that we know how to fill */
+static AVSampleFormat
+pickSampleFormat( const AVCodec* codec )
+{
+    if ( !codec->sample_fmts )
+        return AV_SAMPLE_FMT_S16;
+
+    for ( const AVSampleFormat* fmt = codec->sample_fmts ; *fmt != AV_SAMPLE_FMT_NONE ; ++fmt )
+        if ( *fmt == AV_SAMPLE_FMT_S16 || *fmt == AV_SAMPLE_FMT_S16P
+             || *fmt == AV_SAMPLE_FMT_FLT || *fmt == AV_SAMPLE_FMT_FLTP )
+            return *fmt;
+
+    return AV_SAMPLE_FMT_NONE;
+}
+
+
+/** Writes frame's samples, pos is the index of its first sample frame */
+static void
+fillFrame( const Fixture& f, AVFrame* frame, AVSampleFormat fmt, int64_t pos, int valid, quint32& noise )
+{
+    const int64_t silence = int64_t( f.silenceSecs ) * f.samplerate;
+    const bool planar = av_sample_fmt_is_planar( fmt );
+
+    for ( int i = 0 ; i < frame->nb_samples ; ++i )
+    {
+        for ( int ch = 0 ; ch < f.channels ; ++ch )
+        {
+            double v = 0;
+            int64_t n = pos + i;
+
+            if ( i < valid && n >= silence )
+            {
+                if ( f.signal == Fixture::Tone )
+                {
+                    double t = double( n - silence ) / f.samplerate;
+                    v = 0.5 * sin( 2 * M_PI * 440 * t ) + 0.25 * sin( 2 * M_PI * 1760 * t + ch );
+                }
+                else
+                {
+                    noise = noise * 1664525u + 1013904223u;
+                    v = ( double( noise ) / 4294967296.0 - 0.5 ) * 0.8;
+                }
+            }
+
+            int index = planar ? i : i * f.channels + ch;
+            uint8_t* plane = frame->extended_data[planar ? ch : 0];
+
+            switch ( fmt )
+            {
+                case AV_SAMPLE_FMT_S16:
+                case AV_SAMPLE_FMT_S16P:
+                    reinterpret_cast<int16_t*>( plane )[index] = int16_t( v * 32767 );
+                    break;
+                default:
+                    reinterpret_cast<float*>( plane )[index] = float( v );
+                    break;
+            }
+        }
+    }
+}
+
+
+/** Encodes frame (or flushes the encoder if it is NULL) and writes out any
+  * packet that comes back. Returns 1 if a packet was written. */
+static int
+encodeAndWrite( AVFormatContext* oc, AVStream* stream, AVFrame* frame )
+{
+    AVCodecContext* c = stream->codec;
+
+    AVPacket packet;
+    av_init_packet( &packet );
+    packet.data = NULL;
+    packet.size = 0;
+
+    int gotPacket = 0;
+    if ( avcodec_encode_audio2( c, &packet, frame, &gotPacket ) < 0 )
+        return -1;
+
+    if ( !gotPacket )
+        return 0;
+
+    if ( packet.pts != AV_NOPTS_VALUE )
+        packet.pts = av_rescale_q( packet.pts, c->time_base, stream->time_base );
+    if ( packet.dts != AV_NOPTS_VALUE )
+        packet.dts = av_rescale_q( packet.dts, c->time_base, stream->time_base );
+    if ( packet.duration > 0 )
+        packet.duration = av_rescale_q( packet.duration, c->time_base, stream->time_base );
+    packet.stream_index = stream->index;
+
+    return av_interleaved_write_frame( oc, &packet ) < 0 ? -1 : 1;
+}
+
+
+bool
+encodeFixture( const Fixture& f, const QString& path, QString& error )
+{
+    av_register_all();
+
+    const QByteArray fileName = QFile::encodeName( path );
+
+    // ADTS for .aac, the mp4 muxer for .m4a and so on
+    AVOutputFormat* format = av_guess_format( NULL, fileName, NULL );
+    AVCodec* codec = findEncoder( f.extension );
+    AVSampleFormat fmt = codec ? pickSampleFormat( codec ) : AV_SAMPLE_FMT_NONE;
+
+    if ( !format || !codec || fmt == AV_SAMPLE_FMT_NONE )
+    {
+        error = "no suitable encoder for " + f.extension;
+        return false;
+    }
+
+    AVFormatContext* oc = avformat_alloc_context();
+    oc->oformat = format;
+
+    AVStream* stream = avformat_new_stream( oc, codec );
+    AVCodecContext* c = stream->codec;
+    c->sample_fmt = fmt;
+    c->sample_rate = f.samplerate;
+    c->channels = f.channels;
+    c->channel_layout = av_get_default_channel_layout( f.channels );
+    c->bit_rate = f.bitrate;
+    c->time_base.num = 1;
+    c->time_base.den = f.samplerate;
+    c->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+    stream->time_base = c->time_base;
+
+    if ( format->flags & AVFMT_GLOBALHEADER )
+        c->flags |= CODEC_FLAG_GLOBAL_HEADER;
+
+    AVFrame* frame = avcodec_alloc_frame();
+    uint8_t* buffer = NULL;
+    bool ok = false;
+
+    if ( avcodec_open2( c, codec, NULL ) < 0 )
+        error = QString( "couldn't open %1 at %2 Hz, %3 channels, %4 bps" ).arg( codec->name ).arg( f.samplerate ).arg( f.channels ).arg( f.bitrate );
+    else if ( avio_open( &oc->pb, fileName, AVIO_FLAG_WRITE ) < 0 )
+        error = "couldn't write " + path;
+    else if ( avformat_write_header( oc, NULL ) < 0 )
+        error = "couldn't write header for " + path;
+    else
+    {
+        const bool variable = codec->capabilities & CODEC_CAP_VARIABLE_FRAME_SIZE;
+        const bool smallLast = codec->capabilities & CODEC_CAP_SMALL_LAST_FRAME;
+        const int frameSize = variable || c->frame_size <= 0 ? 4096 : c->frame_size;
+        const int64_t total = int64_t( f.silenceSecs + f.secs ) * f.samplerate;
+
+        buffer = static_cast<uint8_t*>( av_malloc( av_samples_get_buffer_size( NULL, f.channels, frameSize, fmt, 1 ) ) );
+
+        quint32 noise = 1;
+        ok = true;
+
+        for ( int64_t pos = 0 ; ok && pos < total ; pos += frameSize )
+        {
+            int valid = int( qMin<int64_t>( frameSize, total - pos ) );
+            // codecs with a fixed frame size want the last one padded out
+            int samples = valid < frameSize && !variable && !smallLast ? frameSize : valid;
+
+            avcodec_get_frame_defaults( frame );
+            frame->nb_samples = samples;
+            frame->pts = pos;
+            avcodec_fill_audio_frame( frame, f.channels, fmt, buffer,
+                                      av_samples_get_buffer_size( NULL, f.channels, samples, fmt, 1 ), 1 );
+
+            fillFrame( f, frame, fmt, pos, valid, noise );
+            ok = encodeAndWrite( oc, stream, frame ) >= 0;
+        }
+
+        // drain whatever the encoder is holding on to
+        if ( ok && ( codec->capabilities & CODEC_CAP_DELAY ) )
+        {
+            int written;
+            while ( ( written = encodeAndWrite( oc, stream, NULL ) ) > 0 );
+            ok = written == 0;
+        }
+
+        if ( ok )
+            ok = av_write_trailer( oc ) == 0;
+
+        if ( !ok )
+            error = "encoding failed for " + path;
+    }
+
+    if ( c->codec )
+        avcodec_close( c );
+    if ( oc->pb )
+        avio_close( oc->pb );
+    avformat_free_context( oc );
+    avcodec_free_frame( &frame );
+    av_free( buffer );
+
+    if ( !ok )
+        QFile::remove( path );
+
+    return ok;
+}
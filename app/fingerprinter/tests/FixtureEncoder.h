@@ -0,0 +1,47 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FIXTURE_ENCODER_H
+#define FIXTURE_ENCODER_H
+
+#include <QString>
+
+/** A synthetic audio file for the benchmarks: some digital silence
+  * followed by a tone or white noise, encoded with libav. */
+struct Fixture
+{
+    enum Signal { Tone, Noise };
+
+    Signal signal;
+    QString extension;  // picks both the encoder and the container
+    int samplerate;
+    int channels;
+    int bitrate;        // bits per second, ignored by lossless codecs
+    int silenceSecs;
+    int secs;           // of signal, after the silence
+
+    /** e.g. tone_44100_2_128k_65s.mp3 */
+    QString name() const;
+};
+
+/** Encodes fixture to path. Returns false and sets error if libav can't,
+  * usually because it was built without a suitable encoder. */
+bool encodeFixture( const Fixture& fixture, const QString& path, QString& error );
+
+#endif // FIXTURE_ENCODER_H
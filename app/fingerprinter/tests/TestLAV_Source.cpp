@@ -0,0 +1,433 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <QtTest>
+#include <QtEndian>
+#include <QVector>
+
+#include "LAV_Source.h"
+#include "PcmBuffer.h"
+#include "PipelinedSource.h"
+
+
+namespace
+{
+    // what decodeOneFrame gives us each time, an mp3 frame of stereo
+    const size_t k_frameSamples = 1152 * 2;
+    // AVCODEC_MAX_AUDIO_FRAME_SIZE * 4 bytes, as LAV_Source allocates
+    const size_t k_bufferSamples = 192000 * 4 / sizeof( int16_t );
+
+    /** LAV_Source's buffering before PcmBuffer. Each frame was decoded into
+      * outBuffer and copied out, and whatever didn't fit was copied into
+      * overflow to be copied out again on the next call. */
+    class LegacyBuffering
+    {
+    public:
+        LegacyBuffering( const int16_t* frame, int frames )
+            :m_frame( frame ), m_frames( frames ), m_overflowSize( 0 )
+        {
+            m_outBuffer = new uint8_t[k_bufferSamples * sizeof( int16_t )];
+            m_overflow = new uint8_t[k_bufferSamples * sizeof( int16_t )];
+        }
+
+        ~LegacyBuffering() { delete[] m_outBuffer; delete[] m_overflow; }
+
+        size_t updateBuffer( int16_t* pBuffer, size_t bufferSize )
+        {
+            size_t bufferFill = 0;
+
+            if ( m_overflowSize )
+            {
+                memcpy( pBuffer, m_overflow, m_overflowSize );
+                bufferFill = m_overflowSize / sizeof( int16_t );
+                m_overflowSize = 0;
+            }
+
+            while ( bufferFill < bufferSize && m_frames > 0 )
+            {
+                --m_frames;
+                const size_t dataSize = k_frameSamples * sizeof( int16_t );
+                memcpy( m_outBuffer, m_frame, dataSize );
+
+                size_t bytesToBuffer = ( bufferSize - bufferFill ) * sizeof( int16_t );
+                if ( bytesToBuffer < dataSize )
+                {
+                    m_overflowSize = dataSize - bytesToBuffer;
+                    memcpy( m_overflow, m_outBuffer + bytesToBuffer, m_overflowSize );
+                }
+                else
+                {
+                    bytesToBuffer = dataSize;
+                }
+                memcpy( pBuffer + bufferFill, m_outBuffer, bytesToBuffer );
+                bufferFill += bytesToBuffer / sizeof( int16_t );
+            }
+
+            return bufferFill;
+        }
+
+    private:
+        const int16_t* m_frame;
+        int m_frames;
+        uint8_t* m_outBuffer;
+        uint8_t* m_overflow;
+        size_t m_overflowSize;
+    };
+
+    /** and LAV_Source's buffering now, frames are decoded straight into pcm */
+    class PcmBuffering
+    {
+    public:
+        PcmBuffering( const int16_t* frame, int frames )
+            :m_frame( frame ), m_frames( frames ), m_pcm( k_bufferSamples )
+        {}
+
+        size_t updateBuffer( int16_t* pBuffer, size_t bufferSize )
+        {
+            size_t bufferFill = m_pcm.read( pBuffer, bufferSize );
+
+            while ( bufferFill < bufferSize && m_frames > 0 )
+            {
+                --m_frames;
+                memcpy( m_pcm.reserve( k_frameSamples ), m_frame, k_frameSamples * sizeof( int16_t ) );
+                m_pcm.commit( k_frameSamples );
+                bufferFill += m_pcm.read( pBuffer + bufferFill, bufferSize - bufferFill );
+            }
+
+            return bufferFill;
+        }
+
+    private:
+        const int16_t* m_frame;
+        int m_frames;
+        PcmBuffer m_pcm;
+    };
+
+    /** everything that comes out of buffering, bufferSize at a time */
+    template <typename Buffering>
+    qint64 drain( Buffering& buffering, QVector<int16_t>& buffer, qint64* checksum = 0 )
+    {
+        qint64 total = 0;
+        size_t filled;
+        while ( ( filled = buffering.updateBuffer( buffer.data(), buffer.size() ) ) > 0 )
+        {
+            if ( checksum )
+                for ( size_t i = 0 ; i < filled ; ++i )
+                    *checksum += buffer[i] * ( ( total + i ) % 7 + 1 );
+            total += filled;
+        }
+        return total;
+    }
+}
+
+
+class TestLAV_Source : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void testUpdateBufferReturnsEverySample();
+    void testPipelinedSourceReturnsEverySample();
+    void testPipelinedSourceReleaseMidStream();
+    void testSkipLandsOnTarget_data();
+    void testSkipLandsOnTarget();
+    void benchmarkDecode_data();
+    void benchmarkDecode();
+    void benchmarkBuffering_data();
+    void benchmarkBuffering();
+
+private:
+    enum Format { S16 = 1, Float = 3 };
+
+    static QString writeWav( const QString& name, Format format, int channels, int samplerate, int seconds );
+    static qint16 sample( qint64 i ) { return qint16( ( i * 37 ) % 65536 - 32768 ); }
+
+    QStringList m_files;
+};
+
+
+QString //static
+TestLAV_Source::writeWav( const QString& name, Format format, int channels, int samplerate, int seconds )
+{
+    const int bytesPerSample = format == S16 ? 2 : 4;
+    const quint32 count = channels * samplerate * seconds;
+    const quint32 dataSize = count * bytesPerSample;
+
+    QByteArray data( 44 + dataSize, '\0' );
+    uchar* p = reinterpret_cast<uchar*>( data.data() );
+
+    memcpy( p, "RIFF", 4 );
+    qToLittleEndian<quint32>( 36 + dataSize, p + 4 );
+    memcpy( p + 8, "WAVEfmt ", 8 );
+    qToLittleEndian<quint32>( 16, p + 16 );
+    qToLittleEndian<quint16>( format, p + 20 );
+    qToLittleEndian<quint16>( channels, p + 22 );
+    qToLittleEndian<quint32>( samplerate, p + 24 );
+    qToLittleEndian<quint32>( samplerate * channels * bytesPerSample, p + 28 );
+    qToLittleEndian<quint16>( channels * bytesPerSample, p + 32 );
+    qToLittleEndian<quint16>( bytesPerSample * 8, p + 34 );
+    memcpy( p + 36, "data", 4 );
+    qToLittleEndian<quint32>( dataSize, p + 40 );
+
+    p += 44;
+    for ( quint32 i = 0 ; i < count ; ++i )
+    {
+        if ( format == S16 )
+        {
+            qToLittleEndian<qint16>( sample( i ), p );
+            p += 2;
+        }
+        else
+        {
+            float f = sample( i ) / 32768.0f;
+            quint32 bits;
+            memcpy( &bits, &f, 4 );
+            qToLittleEndian<quint32>( bits, p );
+            p += 4;
+        }
+    }
+
+    QString path = QDir::temp().filePath( name );
+    QFile file( path );
+    file.open( QIODevice::WriteOnly );
+    file.write( data );
+    return path;
+}
+
+void
+TestLAV_Source::initTestCase()
+{
+    m_files << writeWav( "test_lav_s16_stereo.wav", S16, 2, 44100, 30 )
+            << writeWav( "test_lav_s16_mono.wav", S16, 1, 22050, 30 )
+            << writeWav( "test_lav_f32_stereo.wav", Float, 2, 44100, 30 );
+}
+
+void
+TestLAV_Source::cleanupTestCase()
+{
+    foreach ( const QString& file, m_files )
+        QFile::remove( file );
+}
+
+void
+TestLAV_Source::testUpdateBufferReturnsEverySample()
+{
+    LAV_Source source;
+    source.init( m_files.at( 0 ) );
+
+    // an awkward size so that frames straddle calls to updateBuffer
+    QVector<signed short> buffer( 1001 );
+    int i = 0;
+    int filled;
+
+    while ( ( filled = source.updateBuffer( buffer.data(), buffer.size() ) ) > 0 )
+    {
+        for ( int j = 0 ; j < filled ; ++j, ++i )
+            if ( buffer[j] != sample( i ) )
+                QFAIL( qPrintable( QString( "sample %1 differs" ).arg( i ) ) );
+    }
+
+    QCOMPARE( i, 2 * 44100 * 30 );
+}
+
+void
+TestLAV_Source::testPipelinedSourceReturnsEverySample()
+{
+    // a small queue so the decoder thread keeps having to wait for us
+    PipelinedSource source( new LAV_Source(), 4096 );
+    source.init( m_files.at( 0 ) );
+
+    QVector<signed short> buffer( 1001 );
+    int i = 0;
+    int filled;
+
+    while ( ( filled = source.updateBuffer( buffer.data(), buffer.size() ) ) > 0 )
+    {
+        for ( int j = 0 ; j < filled ; ++j, ++i )
+            if ( buffer[j] != sample( i ) )
+                QFAIL( qPrintable( QString( "sample %1 differs" ).arg( i ) ) );
+    }
+
+    QCOMPARE( i, 2 * 44100 * 30 );
+    QVERIFY( source.eof() );
+}
+
+void
+TestLAV_Source::testPipelinedSourceReleaseMidStream()
+{
+    PipelinedSource source( new LAV_Source(), 4096 );
+    QVector<signed short> buffer( 1001 );
+
+    source.init( m_files.at( 0 ) );
+    QCOMPARE( source.updateBuffer( buffer.data(), buffer.size() ), buffer.size() );
+    source.release();
+
+    // and the source is usable again afterwards
+    source.init( m_files.at( 1 ) );
+    QCOMPARE( source.updateBuffer( buffer.data(), buffer.size() ), buffer.size() );
+    QCOMPARE( buffer[0], sample( 0 ) );
+}
+
+void
+TestLAV_Source::testSkipLandsOnTarget_data()
+{
+    QTest::addColumn<int>( "file" );
+    QTest::addColumn<int>( "channels" );
+    QTest::addColumn<int>( "samplerate" );
+
+    QTest::newRow( "s16 stereo 44100" ) << 0 << 2 << 44100;
+    QTest::newRow( "s16 mono 22050" ) << 1 << 1 << 22050;
+}
+
+void
+TestLAV_Source::testSkipLandsOnTarget()
+{
+    QFETCH( int, file );
+    QFETCH( int, channels );
+    QFETCH( int, samplerate );
+
+    LAV_Source source;
+    source.init( m_files.at( file ) );
+
+    QVector<signed short> buffer( 1001 );
+    QCOMPARE( source.updateBuffer( buffer.data(), buffer.size() ), buffer.size() );
+
+    // skip() is relative to what has been decoded, which can be more than
+    // we've read, and seeks rather than decoding the way there. It starts
+    // on the first frame past the target, so it can be a frame or two late
+    // but never early
+    const int skips[] = { 10000, 5000, 1 };
+    qint64 target = buffer.size();
+    for ( size_t k = 0 ; k < sizeof( skips ) / sizeof( skips[0] ) ; ++k )
+    {
+        source.skip( skips[k] );
+        target += qint64( skips[k] ) * samplerate / 1000 * channels;
+
+        QCOMPARE( source.updateBuffer( buffer.data(), buffer.size() ), buffer.size() );
+
+        // the samples only repeat every 65536, so within a tenth of a
+        // second either way the first one gives away where we are
+        const qint64 slack = samplerate * channels / 10;
+        qint64 landed = -1;
+        for ( qint64 i = target - slack ; i < target + slack ; ++i )
+            if ( sample( i ) == buffer[0] )
+                landed = i;
+
+        QVERIFY2( landed >= target,
+                  qPrintable( QString( "skip( %1 ) landed at %2, target %3" ).arg( skips[k] ).arg( landed ).arg( target ) ) );
+        QCOMPARE( landed % channels, qint64( 0 ) );
+
+        for ( int j = 0 ; j < buffer.size() ; ++j )
+            QCOMPARE( buffer[j], sample( landed + j ) );
+
+        target = landed + buffer.size();
+    }
+
+    // past the end
+    source.skip( 60000 );
+    QCOMPARE( source.updateBuffer( buffer.data(), buffer.size() ), 0 );
+}
+
+void
+TestLAV_Source::benchmarkDecode_data()
+{
+    QTest::addColumn<int>( "file" );
+
+    QTest::newRow( "s16 stereo 44100" ) << 0;
+    QTest::newRow( "s16 mono 22050" ) << 1;
+    QTest::newRow( "f32 stereo 44100 (converted)" ) << 2;
+}
+
+void
+TestLAV_Source::benchmarkDecode()
+{
+    QFETCH( int, file );
+
+    LAV_Source source;
+    // the fingerprinter asks for this much at a time
+    QVector<signed short> buffer( 131072 );
+
+    QBENCHMARK
+    {
+        source.init( m_files.at( file ) );
+        while ( source.updateBuffer( buffer.data(), buffer.size() ) > 0 );
+        source.release();
+    }
+}
+
+void
+TestLAV_Source::benchmarkBuffering_data()
+{
+    QTest::addColumn<bool>( "legacy" );
+    QTest::addColumn<int>( "bufferSize" );
+
+    // what the fingerprinter asks for, and an awkward size that leaves
+    // part of most frames over for the next call. The old way wrote the
+    // overflow out without looking, so it needs room for a whole frame
+    QTest::newRow( "overflow buffer, 131072" ) << true << 131072;
+    QTest::newRow( "PcmBuffer, 131072" ) << false << 131072;
+    QTest::newRow( "overflow buffer, 4001" ) << true << 4001;
+    QTest::newRow( "PcmBuffer, 4001" ) << false << 4001;
+}
+
+/** Just the buffering between the decoder and updateBuffer's caller, the
+  * old way and the new, with the decoding taken out. 30 seconds of 44.1kHz
+  * stereo a time. */
+void
+TestLAV_Source::benchmarkBuffering()
+{
+    QFETCH( bool, legacy );
+    QFETCH( int, bufferSize );
+
+    const int frames = 44100 * 2 * 30 / k_frameSamples;
+    QVector<int16_t> frame( k_frameSamples );
+    for ( int i = 0 ; i < frame.size() ; ++i )
+        frame[i] = sample( i );
+    QVector<int16_t> buffer( bufferSize );
+
+    // both hand out the same samples in the same order
+    qint64 expected = 0, checksum = 0;
+    {
+        LegacyBuffering old( frame.constData(), frames );
+        PcmBuffering pcm( frame.constData(), frames );
+        QCOMPARE( drain( old, buffer, &expected ), qint64( frames ) * k_frameSamples );
+        QCOMPARE( drain( pcm, buffer, &checksum ), qint64( frames ) * k_frameSamples );
+        QCOMPARE( checksum, expected );
+    }
+
+    QBENCHMARK
+    {
+        if ( legacy )
+        {
+            LegacyBuffering buffering( frame.constData(), frames );
+            drain( buffering, buffer );
+        }
+        else
+        {
+            PcmBuffering buffering( frame.constData(), frames );
+            drain( buffering, buffer );
+        }
+    }
+}
+
+QTEST_MAIN( TestLAV_Source )
+
+#include "TestLAV_Source.moc"
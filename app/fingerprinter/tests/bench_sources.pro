@@ -0,0 +1,28 @@
+TEMPLATE = app
+TARGET = bench_sources
+QT = core
+CONFIG += fingerprint ffmpeg mad faad flac vorbis
+CONFIG -= app_bundle
+include( ../../../admin/include.qmake )
+INCLUDEPATH += .. ../../client/Fingerprinter
+
+DEFINES += LASTFM_COLLAPSE_NAMESPACE LASTFM_FINGERPRINTER
+
+SOURCES = BenchSources.cpp \
+          FixtureEncoder.cpp \
+          ../LAV_Source.cpp \
+          ../../client/Fingerprinter/MadSource.cpp \
+          ../../client/Fingerprinter/AacSource.cpp \
+          ../../client/Fingerprinter/FlacSource.cpp \
+          ../../client/Fingerprinter/VorbisSource.cpp \
+          $$ROOT_DIR/common/c++/silence.cpp
+
+HEADERS = FixtureEncoder.h \
+          ../LAV_Source.h \
+          ../PcmBuffer.h \
+          ../../client/Fingerprinter/MadSource.h \
+          ../../client/Fingerprinter/AacSource.h \
+          ../../client/Fingerprinter/AacSource_p.h \
+          ../../client/Fingerprinter/FlacSource.h \
+          ../../client/Fingerprinter/VorbisSource.h \
+          $$ROOT_DIR/common/c++/silence.h
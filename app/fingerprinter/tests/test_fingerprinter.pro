@@ -0,0 +1,20 @@
+TEMPLATE = app
+TARGET = test_fingerprinter
+QT = core testlib
+CONFIG += fingerprint ffmpeg
+CONFIG -= app_bundle
+include( ../../../admin/include.qmake )
+INCLUDEPATH += ..
+
+DEFINES += LASTFM_COLLAPSE_NAMESPACE LASTFM_FINGERPRINTER
+
+SOURCES = TestLAV_Source.cpp \
+          ../LAV_Source.cpp \
+          ../PipelinedSource.cpp \
+          $$ROOT_DIR/common/c++/silence.cpp
+
+HEADERS = ../LAV_Source.h \
+          ../PcmBuffer.h \
+          ../PcmQueue.h \
+          ../PipelinedSource.h \
+          $$ROOT_DIR/common/c++/silence.h
@@ -258,12 +258,11 @@ IPod::twiddle()
         }
 
         // this should just be tracks with negative playcount diffs
-        foreach ( const ITunesLibrary::Track& track, tracksToUpdate )
-            db.update( track );
+        db.update( tracksToUpdate );
 
-        // insert all the new tracks we've found
-        foreach ( const ITunesLibrary::Track& track, tracksToInsert )
-            db.insert( track );
+        // insert all the new tracks we've found, after a big import to
+        // iTunes this is most of the library
+        db.insert( tracksToInsert );
 
         db.endTransaction();
     }
@@ -24,13 +24,15 @@
 #include "ITunesLibraryTrack.h"
 #include <lastfm/Track.h>
 #include <QList>
+#include <QSharedPointer>
 
 
 /** @author Max Howell <max@last.fm> - Mac
   * @author <erik@last.fm> - Win
   *
   * This class offers easy access to the iTunes Library database
-  * It uses AppleScript and COM to access and query iTunes
+  * It uses AppleScript and COM to access and query iTunes, though on the mac
+  * we read the library's XML instead if iTunes is sharing an up to date one
   */
 class ITunesLibrary
 {
@@ -53,7 +55,14 @@ private:
     long m_trackCount;
     bool const m_isIPod;
   #else
+    bool openXml();
+    void readXmlTrack();
+
     QList<Track> m_tracks;
+
+    QSharedPointer<ITunesLibraryXml> m_xml;
+    Track m_next; // from m_xml, null at the end
+    int m_xmlTrackCount;
   #endif
 
 private:
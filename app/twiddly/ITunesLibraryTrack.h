@@ -117,6 +117,8 @@ struct IPodLibraryTrackData : public ITunesLibraryTrackData
 #else //MAC
     #include <lastfm/Track.h>
     #include "PlayCountsDatabase.h"
+    #include "ITunesLibraryXml.h"
+    #include <QSharedPointer>
     
     template <typename T> class QList;
     
@@ -128,11 +130,11 @@ struct IPodLibraryTrackData : public ITunesLibraryTrackData
         friend class ITunesLibrary;
         friend class QList<ITunesLibraryTrack>;
         
-        ITunesLibraryTrack() // for QList only
+        ITunesLibraryTrack() : m_xmlOffset( -1 ) // for QList only
         {}
         
     public:
-        ITunesLibraryTrack( const QString& uid, int c ) : PlayCountsDatabase::Track( uid, c )
+        ITunesLibraryTrack( const QString& uid, int c ) : PlayCountsDatabase::Track( uid, c ), m_xmlOffset( -1 )
         {}
         
         lastfm::Track lastfmTrack() const;
@@ -147,6 +149,11 @@ struct IPodLibraryTrackData : public ITunesLibraryTrackData
         /** the persistent ID of the source for this track, if empty, we use
           * the default iTunes library */
         QString m_sourcePersistentId;
+
+        /** set if we came out of the library's XML, then lastfmTrack() reads
+          * our dict from that again rather than asking iTunes */
+        QSharedPointer<ITunesLibraryXml> m_xml;
+        qint64 m_xmlOffset;
     };
 #endif
 
@@ -0,0 +1,482 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "ITunesLibraryXml.h"
+#include <QByteArray>
+#include <QDir>
+#include <QFileInfo>
+#include <QSettings>
+#include <QStringList>
+#include <QUrl>
+#include <QDebug>
+#include <climits>
+#include <cstring>
+
+
+static inline bool
+is( const char* s, int n, const char* literal )
+{
+    return n == (int) strlen( literal ) && memcmp( s, literal, n ) == 0;
+}
+
+
+static const char*
+find( const char* p, const char* end, const char* s )
+{
+    const int n = (int) strlen( s );
+    for (; end - p >= n; ++p)
+    {
+        p = (const char*) memchr( p, s[0], end - p );
+        if (!p || end - p < n)
+            return 0;
+        if (memcmp( p, s, n ) == 0)
+            return p;
+    }
+    return 0;
+}
+
+
+ITunesLibraryXml::ITunesLibraryXml( const QString& path )
+                : m_file( path ),
+                  m_begin( 0 ),
+                  m_end( 0 ),
+                  m_p( 0 ),
+                  m_tracks( 0 ),
+                  m_text( 0 ),
+                  m_textLength( 0 ),
+                  m_hasPending( false ),
+                  m_pending( End ),
+                  m_error( false )
+{
+    if (!m_file.open( QIODevice::ReadOnly ) || m_file.size() == 0)
+        return;
+
+    const char* data = (const char*) m_file.map( 0, m_file.size() );
+    if (!data)
+    {
+        qWarning() << "Couldn't map" << path << m_file.errorString();
+        return;
+    }
+
+    m_begin = m_p = data;
+    m_end = data + m_file.size();
+
+    // <plist><dict> and the root's keys until we get to the tracks
+    if (token() != DictBegin)
+    {
+        m_error = true;
+        return;
+    }
+
+    for (;;)
+    {
+        Token t = token();
+        if (t != Key)
+        {
+            // a library without tracks is fine if it's well formed
+            m_error = t != DictEnd;
+            return;
+        }
+
+        const bool isTracks = is( m_text, m_textLength, "Tracks" );
+
+        t = token();
+        if (isTracks)
+        {
+            if (t == DictBegin)
+                m_tracks = m_p;
+            else
+                m_error = true;
+            return;
+        }
+
+        if (!skipValue( t ))
+        {
+            m_error = true;
+            return;
+        }
+    }
+}
+
+
+ITunesLibraryXml::Token
+ITunesLibraryXml::token()
+{
+    if (m_hasPending)
+    {
+        m_hasPending = false;
+        return m_pending;
+    }
+
+    const char* close;
+    for (;;)
+    {
+        // there's only ever whitespace between the tags of a plist
+        m_p = (const char*) memchr( m_p, '<', m_end - m_p );
+        if (!m_p)
+        {
+            m_p = m_end;
+            return End;
+        }
+
+        const char* skipTo = 0;
+        if (m_end - m_p > 1 && m_p[1] == '?')
+            skipTo = "?>";
+        else if (m_end - m_p > 3 && memcmp( m_p, "<!--", 4 ) == 0)
+            skipTo = "-->";
+        else if (m_end - m_p > 1 && m_p[1] == '!')
+            skipTo = ">"; // DOCTYPE
+
+        close = find( m_p, m_end, skipTo ? skipTo : ">" );
+        if (!close)
+            return Error;
+
+        if (skipTo)
+        {
+            m_p = close + strlen( skipTo );
+            continue;
+        }
+
+        const char* name = m_p + 1;
+        const bool isEndTag = *name == '/';
+        if (isEndTag)
+            ++name;
+        const bool isEmpty = close[-1] == '/';
+
+        int n = 0;
+        while (name + n < close && name[n] != ' ' && name[n] != '/')
+            ++n;
+
+        m_p = close + 1;
+
+        if (is( name, n, "plist" ))
+            continue;
+
+        if (isEndTag)
+        {
+            if (is( name, n, "dict" )) return DictEnd;
+            if (is( name, n, "array" )) return ArrayEnd;
+            return Error;
+        }
+
+        if (is( name, n, "dict" ) || is( name, n, "array" ))
+        {
+            const bool isDict = *name == 'd';
+            if (isEmpty)
+            {
+                m_hasPending = true;
+                m_pending = isDict ? DictEnd : ArrayEnd;
+            }
+            return isDict ? DictBegin : ArrayBegin;
+        }
+
+        if (is( name, n, "true" )) return True;
+        if (is( name, n, "false" )) return False;
+
+        Token t;
+        if (is( name, n, "key" )) t = Key;
+        else if (is( name, n, "string" )) t = String;
+        else if (is( name, n, "integer" )) t = Integer;
+        else if (is( name, n, "real" )) t = Real;
+        else if (is( name, n, "date" )) t = Date;
+        else if (is( name, n, "data" )) t = Data;
+        else return Error;
+
+        m_text = m_p;
+        m_textLength = 0;
+        if (isEmpty)
+            return t;
+
+        // text can't contain a '<', it would be &lt;
+        const char* end = (const char*) memchr( m_p, '<', m_end - m_p );
+        if (!end || m_end - end < n + 3 || end[1] != '/' || memcmp( end + 2, name, n ) != 0 || end[n + 2] != '>')
+            return Error;
+
+        m_textLength = int( end - m_p );
+        m_p = end + n + 3;
+        return t;
+    }
+}
+
+
+bool
+ITunesLibraryXml::skipValue( Token t )
+{
+    switch (t)
+    {
+        case DictBegin:
+        case ArrayBegin:
+        {
+            int depth = 1;
+            while (depth)
+            {
+                switch (token())
+                {
+                    case DictBegin: case ArrayBegin: ++depth; break;
+                    case DictEnd: case ArrayEnd: --depth; break;
+                    case End: case Error: return false;
+                    default: break;
+                }
+            }
+            return true;
+        }
+
+        case End:
+        case Error:
+        case DictEnd:
+        case ArrayEnd:
+            return false;
+
+        default:
+            return true;
+    }
+}
+
+
+QString
+ITunesLibraryXml::text() const
+{
+    const char* p = m_text;
+    const char* const end = m_text + m_textLength;
+
+    const char* amp = (const char*) memchr( p, '&', end - p );
+    if (!amp)
+        return QString::fromUtf8( p, m_textLength );
+
+    QString s;
+    while (amp)
+    {
+        s += QString::fromUtf8( p, int( amp - p ) );
+
+        const char* semicolon = (const char*) memchr( amp, ';', end - amp );
+        if (!semicolon)
+            break;
+
+        const char* e = amp + 1;
+        const int n = int( semicolon - e );
+        if (is( e, n, "amp" )) s += '&';
+        else if (is( e, n, "lt" )) s += '<';
+        else if (is( e, n, "gt" )) s += '>';
+        else if (is( e, n, "quot" )) s += '"';
+        else if (is( e, n, "apos" )) s += '\'';
+        else if (n > 1 && *e == '#')
+        {
+            bool ok;
+            const QByteArray digits( e + 1, n - 1 );
+            const uint ucs4 = digits[0] == 'x' ? digits.mid( 1 ).toUInt( &ok, 16 ) : digits.toUInt( &ok );
+            if (ok)
+                s += QString::fromUcs4( &ucs4, 1 );
+        }
+
+        p = semicolon + 1;
+        amp = (const char*) memchr( p, '&', end - p );
+    }
+
+    return s + QString::fromUtf8( p, int( end - p ) );
+}
+
+
+static bool
+toInt( const char* s, int n, qlonglong& out )
+{
+    const char* const end = s + n;
+    const bool negative = s != end && *s == '-';
+    if (negative)
+        ++s;
+    if (s == end)
+        return false;
+
+    qlonglong i = 0;
+    for (; s != end; ++s)
+    {
+        if (*s < '0' || *s > '9' || i > LLONG_MAX / 10)
+            return false;
+        i = i * 10 + (*s - '0');
+    }
+    out = negative ? -i : i;
+    return true;
+}
+
+
+// iTunes stores file://localhost/Users/max/Music/... and on Windows
+// file://localhost/C:/Users/...
+static QString
+pathFromLocation( const QByteArray& location )
+{
+    QString path = QUrl::fromPercentEncoding( location );
+    if (path.startsWith( "file://localhost/" ))
+        path.remove( 0, 16 );
+    else if (path.startsWith( "file:///" ))
+        path.remove( 0, 7 );
+
+    if (path.length() > 2 && path[0] == '/' && path[2] == ':')
+        path.remove( 0, 1 );
+    return path;
+}
+
+
+bool
+ITunesLibraryXml::readTrack( Track& track )
+{
+    if (token() != DictBegin)
+        return fail();
+
+    bool hasVideo = false;
+    bool isMusicVideo = false;
+
+    for (;;)
+    {
+        Token t = token();
+        if (t == DictEnd)
+            break;
+        if (t != Key)
+            return fail();
+
+        const char* key = m_text;
+        const int n = m_textLength;
+
+        t = token();
+        qlonglong i;
+
+        if (t == String && is( key, n, "Persistent ID" ))
+            track.persistentId = text();
+        else if (t == Integer && is( key, n, "Play Count" ) && toInt( m_text, m_textLength, i ))
+            track.playCount = int( i );
+        else if (t == Date && is( key, n, "Play Date UTC" ))
+        {
+            QDateTime d = QDateTime::fromString( text(), Qt::ISODate );
+            d.setTimeSpec( Qt::UTC );
+            track.playDate = d.toLocalTime();
+        }
+        else if (t == String && is( key, n, "Name" ))
+            track.name = text();
+        else if (t == String && is( key, n, "Artist" ))
+            track.artist = text();
+        else if (t == String && is( key, n, "Album Artist" ))
+            track.albumArtist = text();
+        else if (t == String && is( key, n, "Album" ))
+            track.album = text();
+        else if (t == Integer && is( key, n, "Total Time" ) && toInt( m_text, m_textLength, i ))
+            track.duration = uint( qMax( 0LL, i ) / 1000 );
+        else if (t == String && is( key, n, "Location" ))
+            track.location = pathFromLocation( text().toUtf8() );
+        else if (t == True && is( key, n, "Podcast" ))
+            track.isPodcast = true;
+        else if (t == True && is( key, n, "Has Video" ))
+            hasVideo = true;
+        else if (t == True && is( key, n, "Music Video" ))
+            isMusicVideo = true;
+        else if (!skipValue( t ))
+            return fail();
+    }
+
+    track.isVideo = hasVideo && !isMusicVideo;
+    return true;
+}
+
+
+bool
+ITunesLibraryXml::next( Track& track )
+{
+    if (!m_tracks || m_error)
+        return false;
+
+    Token t = token();
+    if (t == DictEnd)
+    {
+        // the playlists come next, we don't need them
+        m_p = m_end;
+        return false;
+    }
+    if (t != Key)
+        return fail();
+
+    track = Track();
+    track.offset = m_p - m_begin;
+    return readTrack( track );
+}
+
+
+bool
+ITunesLibraryXml::trackAt( qint64 offset, Track& track )
+{
+    if (!m_tracks || offset < m_tracks - m_begin || offset >= m_end - m_begin)
+        return false;
+
+    const char* const p = m_p;
+    const bool hasPending = m_hasPending;
+    const Token pending = m_pending;
+    const bool error = m_error;
+
+    m_p = m_begin + offset;
+    m_hasPending = false;
+
+    track = Track();
+    track.offset = offset;
+    const bool ok = readTrack( track );
+
+    m_p = p;
+    m_hasPending = hasPending;
+    m_pending = pending;
+    m_error = error;
+    return ok;
+}
+
+
+int
+ITunesLibraryXml::trackCount() const
+{
+    if (!m_tracks)
+        return 0;
+
+    const QByteArray data = QByteArray::fromRawData( m_tracks, int( qMin( qint64( m_end - m_tracks ), qint64( INT_MAX ) ) ) );
+    const QByteArray key = "<key>Persistent ID</key>";
+
+    int end = data.indexOf( "<key>Playlists</key>" );
+    if (end == -1)
+        end = data.size();
+
+    int n = 0;
+    for (int i = data.indexOf( key ); i != -1 && i < end; i = data.indexOf( key, i + key.size() ))
+        ++n;
+    return n;
+}
+
+
+QString //static
+ITunesLibraryXml::defaultPath()
+{
+    QStringList paths;
+
+#ifdef Q_OS_MAC
+    // iTunes keeps a list of the libraries it's used, newest first
+    QSettings iApps( "apple.com", "iApps" );
+    foreach (const QString& url, iApps.value( "iTunesRecentDatabases" ).toStringList())
+        paths += QUrl( url ).toLocalFile();
+#endif
+
+    const QDir music = QDir::home().filePath( "Music/iTunes" );
+
+    paths += music.filePath( "iTunes Library.xml" );
+    paths += music.filePath( "iTunes Music Library.xml" );
+
+    foreach (const QString& path, paths)
+        if (QFileInfo( path ).isFile())
+            return path;
+    return "";
+}
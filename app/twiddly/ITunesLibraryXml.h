@@ -0,0 +1,118 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef ITUNES_LIBRARY_XML_H
+#define ITUNES_LIBRARY_XML_H
+
+#include <QDateTime>
+#include <QFile>
+#include <QString>
+
+
+/** Reads the tracks out of the iTunes Library XML plist that iTunes keeps
+  * for other applications, if the user lets it.
+  *
+  * The file is mapped and parsed as we go, one track per next(), so there's
+  * no DOM of a library that can run to hundreds of megabytes, and we stop
+  * at the end of the Tracks dict rather than reading all the playlists too.
+  *
+  * Only the plist we need is understood: dict, array, key, string, integer,
+  * real, date, data, true and false. Anything else is an error.
+  */
+class ITunesLibraryXml
+{
+public:
+    struct Track
+    {
+        Track() : playCount( 0 ), duration( 0 ), isPodcast( false ), isVideo( false ), offset( -1 )
+        {}
+
+        QString persistentId;
+        int playCount;
+        QDateTime playDate; // local time, null if never played
+
+        QString name;
+        QString artist;
+        QString albumArtist;
+        QString album;
+        uint duration; // seconds
+        QString location; // a path, not the file:// url iTunes stores
+        bool isPodcast;
+        bool isVideo; // music videos don't count
+
+        /** where the track's dict starts, for trackAt() */
+        qint64 offset;
+    };
+
+    ITunesLibraryXml( const QString& path );
+
+    /** false if the file couldn't be mapped or isn't an iTunes library */
+    bool isOpen() const { return m_tracks != 0; }
+
+    /** true once we've hit something we don't understand */
+    bool hasError() const { return m_error; }
+
+    /** fills in the next track, or returns false at the end of them */
+    bool next( Track& );
+
+    /** reads the one track whose dict starts at offset, from a Track that
+      * next() gave you */
+    bool trackAt( qint64 offset, Track& );
+
+    /** counts the tracks without parsing them, handy for progress */
+    int trackCount() const;
+
+    /** where iTunes writes the XML for the current user, or an empty string
+      * if it's not there */
+    static QString defaultPath();
+
+private:
+    enum Token
+    {
+        End, Error,
+        DictBegin, DictEnd, ArrayBegin, ArrayEnd,
+        Key, String, Integer, Real, Date, Data, True, False
+    };
+
+    Token token();
+    bool skipValue( Token );
+    bool fail() { m_error = true; return false; }
+    bool readTrack( Track& );
+    QString text() const;
+
+    QFile m_file;
+    const char* m_begin;
+    const char* m_end;
+    const char* m_p;
+    const char* m_tracks; // just inside the Tracks dict
+
+    // the contents of the last key, string, integer, etc.
+    const char* m_text;
+    int m_textLength;
+
+    // <dict/> is a begin and an end, this is the end
+    bool m_hasPending;
+    Token m_pending;
+
+    bool m_error;
+
+private:
+    Q_DISABLE_COPY( ITunesLibraryXml )
+};
+
+#endif
@@ -19,16 +19,23 @@
    along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "ITunesLibrary.h"
+#include "ITunesLibraryXml.h"
 #include "IPodScrobble.h"
 #include "lib/unicorn/mac/AppleScript.h"
 #include <QDateTime>
+#include <QDir>
 #include <QFileInfo>
 #include <QStringList>
 #include <QDebug>
 
 ITunesLibrary::ITunesLibrary( const QString& pid, bool )
-        : m_currentIndex( 0 )
+        : m_currentIndex( 0 ),
+          m_xmlTrackCount( 0 )
 {
+    // the XML is only the library, it doesn't have what's on the iPods
+    if (pid.isEmpty() && openXml())
+        return;
+
     QString source;
     if (!pid.isEmpty())
         source = "tell first source whose persistent ID is \"" + pid + "\" to ";
@@ -67,9 +74,71 @@ ITunesLibrary::~ITunesLibrary()
 {}
 
 
+bool
+ITunesLibrary::openXml()
+{
+    QString const path = ITunesLibraryXml::defaultPath();
+    if (path.isEmpty())
+        return false;
+
+    // iTunes writes the XML some time after its database, so right after a
+    // sync it may not have the new play counts yet
+    QFileInfo const xml( path );
+    QStringList const databases = QStringList() << "iTunes Library.itl" << "iTunes Library";
+    foreach (const QString& name, databases)
+    {
+        QFileInfo const itl( xml.dir().filePath( name ) );
+        if (itl.isFile() && itl.lastModified() > xml.lastModified())
+        {
+            qDebug() << path << "is older than" << itl.fileName() << "asking iTunes instead";
+            return false;
+        }
+    }
+
+    m_xml = QSharedPointer<ITunesLibraryXml>( new ITunesLibraryXml( path ) );
+    if (!m_xml->isOpen())
+    {
+        qWarning() << "Couldn't read" << path;
+        m_xml.clear();
+        return false;
+    }
+
+    m_xmlTrackCount = m_xml->trackCount();
+    readXmlTrack();
+
+    qDebug() << "Found" << m_xmlTrackCount << "tracks in" << path;
+    return true;
+}
+
+
+void
+ITunesLibrary::readXmlTrack()
+{
+    ITunesLibraryXml::Track x;
+    while (m_xml->next( x ))
+    {
+        if (x.persistentId.isEmpty())
+            continue;
+
+        m_next = Track( x.persistentId, x.playCount );
+        m_next.m_xml = m_xml;
+        m_next.m_xmlOffset = x.offset;
+        return;
+    }
+
+    // we'll pick up whatever we missed next time
+    if (m_xml->hasError())
+        qWarning() << "Stopped reading the iTunes Library XML at an error";
+
+    m_next = Track();
+}
+
+
 bool
 ITunesLibrary::hasTracks() const
 {
+    if (m_xml)
+        return !m_next.isNull();
     return m_currentIndex < (uint)m_tracks.count();
 }
 
@@ -77,6 +146,13 @@ ITunesLibrary::hasTracks() const
 ITunesLibrary::Track
 ITunesLibrary::nextTrack()
 {
+    if (m_xml)
+    {
+        Track const t = m_next;
+        readXmlTrack();
+        ++m_currentIndex;
+        return t;
+    }
     return m_tracks.value( m_currentIndex++ );
 }
 
@@ -84,7 +160,7 @@ ITunesLibrary::nextTrack()
 int 
 ITunesLibrary::trackCount() const
 {
-    return m_tracks.count();
+    return m_xml ? m_xmlTrackCount : m_tracks.count();
 }
 
 
@@ -107,9 +183,36 @@ qDateTimeFromScriptString( const QString& s )
 }
 
 
+// the same as the AppleScript below gets us, without asking iTunes
+static ::Track
+lastfmTrack( const ITunesLibraryXml::Track& x )
+{
+    IPodScrobble t;
+    t.setSource( ::Track::MediaDevice );
+    t.setArtist( x.artist );
+    t.setAlbumArtist( x.albumArtist );
+    t.setTitle( x.name );
+    t.setDuration( x.duration );
+    t.setAlbum( x.album );
+    t.setPlayCount( x.playCount );
+    t.setTimeStamp( x.playDate );
+    t.setUrl( QUrl::fromLocalFile( QFileInfo( x.location ).absolutePath() ) );
+    t.setPodcast( x.isPodcast );
+    t.setVideo( x.isVideo );
+    return t;
+}
+
+
 ::Track
 ITunesLibrary::Track::lastfmTrack() const
 {
+    if (m_xml)
+    {
+        ITunesLibraryXml::Track x;
+        if (m_xml->trackAt( m_xmlOffset, x ))
+            return ::lastfmTrack( x );
+    }
+
     // NOTE we only what data we require for scrobbling, though we could fill in
     // more of the Track object
     IPodScrobble t;
@@ -22,7 +22,6 @@
 #include "TwiddlyApplication.h"
 #include "IPod.h"
 #include "ITunesLibrary.h"
-#include "common/qt/msleep.cpp"
 #include "common/c++/fileCreationTime.cpp"
 #include "lib/unicorn/UnicornSettings.h"
 #include "lib/unicorn/mac/AppleScript.h"
@@ -40,6 +39,12 @@
                "play_count      INTEGER"
 #define INDEX "persistent_id"
 
+// how long sqlite waits for the iTunes plugin to let go of the db
+#define BUSY_TIMEOUT_MS 5000
+
+// rows per execBatch while bootstrapping
+#define BOOTSTRAP_BATCH 1000
+
 
 /** @author Max Howell <max@last.fm>
   * @brief automatically log sql errors */
@@ -68,6 +73,11 @@ namespace QtOverrides
         {
             return arse( QSqlQuery::exec( sql ) );
         }
+
+        bool execBatch()
+        {
+            return arse( QSqlQuery::execBatch() );
+        }
     };
 }
 
@@ -81,11 +91,16 @@ PlayCountsDatabase::PlayCountsDatabase( const QString& path )
 
     m_db = QSqlDatabase::addDatabase( "QSQLITE", path /*connection-name*/ );
     m_db.setDatabaseName( path );
+    m_db.setConnectOptions( "QSQLITE_BUSY_TIMEOUT=" + QString::number( BUSY_TIMEOUT_MS ) );
     m_db.open();
 
     if ( !m_db.isValid() )
         throw "Could not open " + path;
 
+    // the iTunes plugin writes to this db while we're reading the library,
+    // in WAL mode neither of us blocks the other until we both want to write
+    QSqlQuery( m_db ).exec( "PRAGMA journal_mode=WAL" );
+
     // rename the old table name if it exists
     if ( m_db.tables().contains(TABLE_NAME_OLD) )
     {
@@ -105,20 +120,27 @@ PlayCountsDatabase::PlayCountsDatabase( const QString& path )
     m_query = new QSqlQuery( m_db );
     m_query->prepare( "SELECT play_count FROM " TABLE_NAME " WHERE persistent_id = :pid LIMIT 1" );
 
+    m_insertQuery = new QSqlQuery( m_db );
+    m_insertQuery->prepare( "INSERT OR ROLLBACK INTO " TABLE_NAME " ( persistent_id, play_count ) VALUES ( :pid, :count )" );
+
+    m_updateQuery = new QSqlQuery( m_db );
+    m_updateQuery->prepare( "UPDATE OR ROLLBACK " TABLE_NAME " SET play_count = :count WHERE persistent_id = :pid" );
+
+    // forward only, or Qt keeps every row of the table around as well
     QSqlQuery snapshotQuery( m_db );
+    snapshotQuery.setForwardOnly( true );
     snapshotQuery.exec( "SELECT persistent_id, play_count FROM " TABLE_NAME " ORDER BY persistent_id ASC" );
 
-    if ( snapshotQuery.first() )
+    while ( snapshotQuery.next() )
     {
-        do {
-            bool ok;
-            int count = snapshotQuery.value( 1 ).toInt( &ok );
-
-            if ( ok )
-                m_snapshot[snapshotQuery.value(0).toString()] = count;
+        bool ok;
+        int count = snapshotQuery.value( 1 ).toInt( &ok );
 
-        } while ( snapshotQuery.next() );
+        if ( ok )
+            m_snapshot.insert( snapshotQuery.value( 0 ).toString(), count );
     }
+
+    m_snapshot.squeeze();
 }
 
 
@@ -129,15 +151,17 @@ PlayCountsDatabase::~PlayCountsDatabase()
     //m_db.close();
 
     delete m_query;
-
+    delete m_insertQuery;
+    delete m_updateQuery;
 }
 
 
 PlayCountsDatabase::Track
 PlayCountsDatabase::operator[]( const QString& uid )
 {
-    if ( m_snapshot.contains( uid ) )
-        return Track( uid, m_snapshot[uid] );
+    int count;
+    if ( m_snapshot.find( uid, count ) )
+        return Track( uid, count );
 
     return Track();
 }
@@ -170,21 +194,10 @@ PlayCountsDatabase::beginTransaction()
 {
     qDebug() << "beginTransaction";
 
-    // we try until blue in the face to begin the transaction, as we really,
-    // really want db lock
-    
-    QSqlQuery q( m_db );
-    q.exec( "BEGIN TRANSACTION" );
-            
-    for (int i = 5; q.lastError().type() == QSqlError::ConnectionError && i; i--)
-    {
-        // we only try 5 times since SQLITE_BUSY is just one of the
-        // possible things that ConnectionError might mean
-        LOG( 3, "SQLite might be busy trying again in 25ms..." );
-        Qt::msleep( 25 );
-
-        q.exec();
-    }
+    // we really, really want db lock, so take it now. IMMEDIATE waits out the
+    // busy timeout if the plugin has it, where a deferred transaction could
+    // only fail at our first write
+    QSqlQuery( m_db ).exec( "BEGIN IMMEDIATE TRANSACTION" );
 }
 
 
@@ -200,20 +213,49 @@ PlayCountsDatabase::endTransaction()
 bool
 PlayCountsDatabase::insert( const ITunesLibrary::Track& track )
 {
-    QString playCount = QString::number( track.playCount() );  
-    QString sql = "INSERT OR ROLLBACK INTO " TABLE_NAME " ( persistent_id, play_count ) "
-                  "VALUES ( '" + track.persistentId() + "', '" + playCount + "' )";
-    return QSqlQuery( m_db ).exec( sql );
+    m_insertQuery->bindValue( ":pid", track.persistentId() );
+    m_insertQuery->bindValue( ":count", track.playCount() );
+    return m_insertQuery->exec();
 }
 
 bool
 PlayCountsDatabase::update( const ITunesLibrary::Track& track )
 {
-    QString playCount = QString::number( track.playCount() );  
-    QString sql = "UPDATE OR ROLLBACK " TABLE_NAME " "
-                  "SET play_count='" + playCount + "' "
-                  "WHERE persistent_id='" + track.persistentId() + "'";
-    return QSqlQuery( m_db ).exec( sql );
+    m_updateQuery->bindValue( ":pid", track.persistentId() );
+    m_updateQuery->bindValue( ":count", track.playCount() );
+    return m_updateQuery->exec();
+}
+
+
+static bool
+execBatch( QSqlQuery& query, const QList<ITunesLibrary::Track>& tracks )
+{
+    if ( tracks.isEmpty() )
+        return true;
+
+    QVariantList ids;
+    QVariantList counts;
+    foreach ( const ITunesLibrary::Track& track, tracks )
+    {
+        ids << track.persistentId();
+        counts << track.playCount(); // can throw
+    }
+
+    query.bindValue( ":pid", ids );
+    query.bindValue( ":count", counts );
+    return query.execBatch();
+}
+
+bool
+PlayCountsDatabase::insert( const QList<ITunesLibrary::Track>& tracks )
+{
+    return execBatch( *m_insertQuery, tracks );
+}
+
+bool
+PlayCountsDatabase::update( const QList<ITunesLibrary::Track>& tracks )
+{
+    return execBatch( *m_updateQuery, tracks );
 }
 
 AutomaticIPod::PlayCountsDatabase::PlayCountsDatabase() 
@@ -274,6 +316,11 @@ AutomaticIPod::PlayCountsDatabase::bootstrap()
     // for wizard progress screen
     std::cout << lib.trackCount() << std::endl;
     
+    QSqlQuery insertQuery( m_db );
+    insertQuery.prepare( "INSERT OR IGNORE INTO " TABLE_NAME " ( persistent_id, play_count ) VALUES ( :pid, :count )" );
+
+    QVariantList ids;
+    QVariantList counts;
     int i = 0;
 
     while (lib.hasTracks())
@@ -281,11 +328,10 @@ AutomaticIPod::PlayCountsDatabase::bootstrap()
         try
         {
             ITunesLibrary::Track const t = lib.nextTrack();
-            QString const plays = QString::number( t.playCount() );
-
-            query.exec( "INSERT OR IGNORE INTO " TABLE_NAME " ( persistent_id, play_count ) "
-                        "VALUES ( '" + t.uniqueId() + "', '" + plays + "' )" );
+            int const plays = t.playCount();
 
+            ids << t.uniqueId();
+            counts << plays;
         }
         catch ( ... )
         {
@@ -293,6 +339,22 @@ AutomaticIPod::PlayCountsDatabase::bootstrap()
         }
 
         std::cout << ++i << std::endl;
+
+        if (ids.count() >= BOOTSTRAP_BATCH)
+        {
+            insertQuery.bindValue( ":pid", ids );
+            insertQuery.bindValue( ":count", counts );
+            insertQuery.execBatch();
+            ids.clear();
+            counts.clear();
+        }
+    }
+
+    if (ids.count())
+    {
+        insertQuery.bindValue( ":pid", ids );
+        insertQuery.bindValue( ":count", counts );
+        insertQuery.execBatch();
     }
 
     // if either INSERTS fail we'll rebootstrap next time
@@ -21,11 +21,13 @@
 #ifndef PLAY_COUNT_DATABASE_H
 #define PLAY_COUNT_DATABASE_H
 
+#include "PlayCountsSnapshot.h"
 #include <QString>
 #include <QSqlDatabase>
-#include <QHash>
+#include <QList>
 
 class QSqlQuery;
+namespace QtOverrides { class SqlQuery; }
 
 class ITunesLibraryTrack;
 
@@ -82,6 +84,11 @@ public:
     bool remove( const ITunesLibraryTrack& track );
     bool update( const ITunesLibraryTrack& track );
 
+    /** the same, but for a whole list of tracks as one batch of a prepared
+      * statement, do these inside a transaction */
+    bool insert( const QList<ITunesLibraryTrack>& tracks );
+    bool update( const QList<ITunesLibraryTrack>& tracks );
+
     QString path() const { return m_path; }
 
 protected:
@@ -92,7 +99,9 @@ protected:
 protected:
     QSqlDatabase m_db;
     QSqlQuery* m_query;
-    QHash<QString,int> m_snapshot;
+    QtOverrides::SqlQuery* m_insertQuery;
+    QtOverrides::SqlQuery* m_updateQuery;
+    PlayCountsSnapshot m_snapshot;
 
 private:
     Q_DISABLE_COPY( PlayCountsDatabase )
@@ -0,0 +1,140 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "PlayCountsSnapshot.h"
+#include <algorithm>
+
+
+namespace
+{
+    struct IdLessThan
+    {
+        IdLessThan( const QVector<quint64>& ids ) : ids( ids )
+        {}
+
+        bool operator()( int a, int b ) const { return ids[a] < ids[b]; }
+
+        const QVector<quint64>& ids;
+    };
+}
+
+
+bool //static
+PlayCountsSnapshot::toId( const QString& uid, quint64& id )
+{
+    // only upper case, so that every id has just the one spelling and we
+    // match exactly what a QString compare would
+    if ( uid.length() != 16 )
+        return false;
+
+    const QChar* c = uid.constData();
+    quint64 n = 0;
+    for ( int i = 0; i < 16; ++i )
+    {
+        const ushort u = c[i].unicode();
+        if ( u >= '0' && u <= '9' )
+            n = ( n << 4 ) | ( u - '0' );
+        else if ( u >= 'A' && u <= 'F' )
+            n = ( n << 4 ) | ( u - 'A' + 10 );
+        else
+            return false;
+    }
+    id = n;
+    return true;
+}
+
+
+void
+PlayCountsSnapshot::insert( const QString& uid, int playCount )
+{
+    quint64 id;
+    if ( !toId( uid, id ) )
+    {
+        m_others[uid] = playCount;
+        return;
+    }
+
+    if ( !m_ids.isEmpty() && id <= m_ids.last() )
+        m_sorted = false;
+
+    m_ids.append( id );
+    m_playCounts.append( playCount );
+}
+
+
+void
+PlayCountsSnapshot::squeeze()
+{
+    if ( !m_sorted )
+    {
+        QVector<int> order( m_ids.count() );
+        for ( int i = 0; i < order.count(); ++i )
+            order[i] = i;
+        std::stable_sort( order.begin(), order.end(), IdLessThan( m_ids ) );
+
+        QVector<quint64> ids;
+        QVector<int> playCounts;
+        ids.reserve( order.count() );
+        playCounts.reserve( order.count() );
+        foreach ( int i, order )
+        {
+            // the last insert wins, as it would in a hash
+            if ( !ids.isEmpty() && ids.last() == m_ids[i] )
+            {
+                playCounts.last() = m_playCounts[i];
+                continue;
+            }
+            ids.append( m_ids[i] );
+            playCounts.append( m_playCounts[i] );
+        }
+
+        m_ids = ids;
+        m_playCounts = playCounts;
+        m_sorted = true;
+    }
+
+    m_ids.squeeze();
+    m_playCounts.squeeze();
+    m_others.squeeze();
+}
+
+
+bool
+PlayCountsSnapshot::find( const QString& uid, int& playCount ) const
+{
+    Q_ASSERT( m_sorted );
+
+    quint64 id;
+    if ( !toId( uid, id ) )
+    {
+        QHash<QString, int>::const_iterator i = m_others.find( uid );
+        if ( i == m_others.end() )
+            return false;
+        playCount = i.value();
+        return true;
+    }
+
+    const quint64* begin = m_ids.constData();
+    const quint64* end = begin + m_ids.count();
+    const quint64* i = std::lower_bound( begin, end, id );
+    if ( i == end || *i != id )
+        return false;
+
+    playCount = m_playCounts[i - begin];
+    return true;
+}
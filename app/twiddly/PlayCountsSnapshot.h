@@ -0,0 +1,61 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef PLAY_COUNTS_SNAPSHOT_H
+#define PLAY_COUNTS_SNAPSHOT_H
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+
+/** The play counts table as it was when twiddly started, which is what we
+  * diff the iTunes Library against.
+  *
+  * Persistent IDs are 16 hex digits, so they're kept as 64 bit numbers in a
+  * sorted array with the play counts alongside, and found by binary search.
+  * Anything else, like the artist/track/album keys of manual iPods on
+  * Windows, goes in a QHash.
+  */
+class PlayCountsSnapshot
+{
+public:
+    PlayCountsSnapshot() : m_sorted( true )
+    {}
+
+    /** fastest if you add them in ascending order, as ORDER BY gives them */
+    void insert( const QString& uid, int playCount );
+
+    /** call once you've inserted everything, before any lookups */
+    void squeeze();
+
+    /** @returns false if uid isn't in the snapshot */
+    bool find( const QString& uid, int& playCount ) const;
+
+    int count() const { return m_ids.count() + m_others.count(); }
+
+private:
+    static bool toId( const QString& uid, quint64& id );
+
+    QVector<quint64> m_ids;
+    QVector<int> m_playCounts;
+    QHash<QString, int> m_others;
+    bool m_sorted;
+};
+
+#endif
@@ -0,0 +1,339 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Syncs a made up iTunes library against the playcounts db the way
+// IPod::twiddle does, with the per track SQL twiddly used to build and with
+// PlayCountsDatabase's prepared statements.
+//
+// ./bench_playcounts [--iterations <n>] [--tracks <n>] [--played <percent>] [--seed <n>]
+//
+// "import" is the first sync after the whole library was added to iTunes,
+// so every track is an insert. "resync" starts from a db with the library
+// in it and --played percent of the tracks played since (scrobbles) and as
+// many again with lower play counts (updates). Each sync gets a fresh db in
+// the temp dir and is checked against the library before it counts.
+// Results are written to stdout as one JSON object per line:
+//
+// {"sql":"prepared","scenario":"import","tracks":150000,"iterations":3,
+//  "seconds":0.91,"mean_seconds":0.94,"tracks_per_sec":164835}
+//
+// seconds is the best of the iterations, and includes loading the snapshot
+// but not checking the db afterwards.
+
+#include <limits>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSet>
+#include <QSqlQuery>
+#include <QStringList>
+#include <QTextStream>
+
+#include "PlayCountsDatabase.h"
+#include "ITunesLibraryTrack.h"
+
+
+namespace
+{
+    enum Sql { Legacy, Prepared };
+    const char* const sqlNames[] = { "legacy", "prepared" };
+
+    quint32 s_seed = 1;
+
+    int
+    randomInt( int n )
+    {
+        s_seed = s_seed * 1103515245 + 12345;
+        return int( ( s_seed >> 8 ) % quint32( n ) );
+    }
+
+    typedef QList<ITunesLibraryTrack> Library;
+
+    class Database : public PlayCountsDatabase
+    {
+    public:
+        Database( const QString& path ) : PlayCountsDatabase( path )
+        {}
+
+        // what insert() and update() did before they were prepared
+        bool legacyInsert( const ITunesLibraryTrack& track )
+        {
+            QString playCount = QString::number( track.playCount() );
+            QString sql = "INSERT OR ROLLBACK INTO playcounts ( persistent_id, play_count ) "
+                          "VALUES ( '" + track.persistentId() + "', '" + playCount + "' )";
+            return QSqlQuery( m_db ).exec( sql );
+        }
+
+        bool legacyUpdate( const ITunesLibraryTrack& track )
+        {
+            QString playCount = QString::number( track.playCount() );
+            QString sql = "UPDATE OR ROLLBACK playcounts "
+                          "SET play_count='" + playCount + "' "
+                          "WHERE persistent_id='" + track.persistentId() + "'";
+            return QSqlQuery( m_db ).exec( sql );
+        }
+
+        /** returns the number of rows that don't match library */
+        int check( const Library& library )
+        {
+            QHash<QString, int> expected;
+            foreach ( const ITunesLibraryTrack& t, library )
+                expected[t.uniqueId()] = t.playCount();
+
+            int wrong = 0;
+            int rows = 0;
+            QSqlQuery q( m_db );
+            q.exec( "SELECT persistent_id, play_count FROM playcounts" );
+            while ( q.next() )
+            {
+                ++rows;
+                QHash<QString, int>::const_iterator i = expected.find( q.value( 0 ).toString() );
+                if ( i == expected.end() || i.value() != q.value( 1 ).toInt() )
+                    ++wrong;
+            }
+            return wrong + qAbs( library.count() - rows );
+        }
+    };
+}
+
+
+static QString
+persistentId()
+{
+    // iTunes' are 64 bits of hex
+    QString id;
+    for ( int n = 0; n < 4; ++n )
+        id += QString( "%1" ).arg( randomInt( 0x10000 ), 4, 16, QChar( '0' ) );
+    return id.toUpper();
+}
+
+
+static Library
+library( int count )
+{
+    QSet<QString> ids;
+    Library v;
+    v.reserve( count );
+
+    while ( v.count() < count )
+    {
+        const QString id = persistentId();
+        if ( ids.contains( id ) )
+            continue;
+        ids << id;
+        v << ITunesLibraryTrack( id, randomInt( 50 ) );
+    }
+    return v;
+}
+
+
+// played percent of the tracks go up, as many again go down
+static Library
+played( const Library& library, int percent )
+{
+    Library v;
+    v.reserve( library.count() );
+
+    foreach ( const ITunesLibraryTrack& t, library )
+    {
+        const int r = randomInt( 100 );
+        int count = t.playCount();
+        if ( r < percent )
+            count += 1 + randomInt( 5 );
+        else if ( r < 2 * percent && count > 0 )
+            count -= 1 + randomInt( count );
+        v << ITunesLibraryTrack( t.uniqueId(), count );
+    }
+    return v;
+}
+
+
+static void
+fill( const QString& path, const Library& library )
+{
+    Database* db = new Database( path );
+    db->beginTransaction();
+    db->insert( library );
+    db->endTransaction();
+    delete db;
+    QSqlDatabase::removeDatabase( path );
+}
+
+
+// IPod::twiddle without iTunes and the scrobbling, seconds is how long it took
+static int
+sync( Sql sql, const QString& path, const Library& library, double& seconds )
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    Database db( path );
+
+    Library tracksToUpdate;
+    Library tracksToInsert;
+    Library tracksToScrobble;
+
+    foreach ( const ITunesLibraryTrack& track, library )
+    {
+        PlayCountsDatabase::Track dbTrack = db[track.uniqueId()];
+
+        if ( dbTrack.isNull() )
+        {
+            tracksToInsert << track;
+            continue;
+        }
+
+        const int diff = track.playCount() - dbTrack.playCount();
+        if ( diff > 0 )
+            tracksToScrobble << track;
+        if ( diff < 0 )
+            tracksToUpdate << track;
+    }
+
+    int scrobbles = 0;
+
+    db.beginTransaction();
+
+    foreach ( const ITunesLibraryTrack& track, tracksToScrobble )
+    {
+        scrobbles += track.playCount() - db.track( track.uniqueId() ).playCount();
+        if ( sql == Legacy )
+            db.legacyUpdate( track );
+        else
+            db.update( track );
+    }
+
+    if ( sql == Legacy )
+    {
+        foreach ( const ITunesLibraryTrack& track, tracksToUpdate )
+            db.legacyUpdate( track );
+        foreach ( const ITunesLibraryTrack& track, tracksToInsert )
+            db.legacyInsert( track );
+    }
+    else
+    {
+        db.update( tracksToUpdate );
+        db.insert( tracksToInsert );
+    }
+
+    db.endTransaction();
+
+    // check() isn't timed, it costs both the same and would only hide the
+    // difference between them
+    seconds = timer.nsecsElapsed() / 1e9;
+
+    return db.check( library ) ? -1 : scrobbles;
+}
+
+
+static void
+removeDb( const QString& path )
+{
+    QSqlDatabase::removeDatabase( path );
+    QFile::remove( path );
+    QFile::remove( path + "-wal" );
+    QFile::remove( path + "-shm" );
+}
+
+
+int main( int argc, char** argv )
+{
+    QCoreApplication app( argc, argv );
+    QStringList args = app.arguments();
+
+    int iterations = 3;
+    int count = 150000;
+    int percent = 1;
+
+    int i;
+    if ( ( i = args.indexOf( "--iterations" ) ) != -1 && i + 1 < args.size() ) iterations = qMax( 1, args.at( i + 1 ).toInt() );
+    if ( ( i = args.indexOf( "--tracks" ) ) != -1 && i + 1 < args.size() ) count = qMax( 1, args.at( i + 1 ).toInt() );
+    if ( ( i = args.indexOf( "--played" ) ) != -1 && i + 1 < args.size() ) percent = qBound( 0, args.at( i + 1 ).toInt(), 50 );
+    if ( ( i = args.indexOf( "--seed" ) ) != -1 && i + 1 < args.size() ) s_seed = args.at( i + 1 ).toUInt();
+
+    QTextStream out( stdout );
+    QTextStream err( stderr );
+
+    const Library before = library( count );
+    const Library after = played( before, percent );
+
+    struct Scenario { const char* name; bool filled; };
+    const Scenario scenarios[] =
+    {
+        { "import", false },
+        { "resync", true }
+    };
+
+    int failures = 0;
+    int run = 0;
+
+    for ( size_t s = 0 ; s < sizeof( scenarios ) / sizeof( scenarios[0] ) ; ++s )
+    {
+        for ( int k = Legacy ; k <= Prepared ; ++k )
+        {
+            const Sql sql = Sql( k );
+
+            double best = std::numeric_limits<double>::max();
+            double total = 0;
+            bool ok = true;
+
+            for ( int n = 0 ; n < iterations && ok ; ++n )
+            {
+                const QString path = QDir::temp().filePath( QString( "bench_playcounts_%1_%2.db" )
+                        .arg( QCoreApplication::applicationPid() ).arg( run++ ) );
+                removeDb( path );
+
+                if ( scenarios[s].filled )
+                    fill( path, before );
+
+                double seconds;
+                ok = sync( sql, path, after, seconds ) >= 0;
+
+                best = qMin( best, seconds );
+                total += seconds;
+
+                removeDb( path );
+            }
+
+            if ( !ok )
+            {
+                err << sqlNames[sql] << ": " << scenarios[s].name << " left the db out of step with the library\n";
+                err.flush();
+                ++failures;
+                continue;
+            }
+
+            best = qMax( best, 1e-9 );
+
+            out << "{\"sql\":\"" << sqlNames[sql] << "\""
+                << ",\"scenario\":\"" << scenarios[s].name << "\""
+                << ",\"tracks\":" << after.count()
+                << ",\"iterations\":" << iterations
+                << ",\"seconds\":" << best
+                << ",\"mean_seconds\":" << total / iterations
+                << ",\"tracks_per_sec\":" << qint64( after.count() / best )
+                << "}\n";
+            out.flush();
+        }
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,282 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <QtTest>
+#include <QTemporaryFile>
+
+#include "ITunesLibraryXml.h"
+
+
+class TestITunesLibraryXml : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void cleanup();
+
+    void testTracks();
+    void testTrackAt();
+    void testTrackCount();
+    void testEmptyTracks();
+    void testNoTracks();
+    void testMissingFile();
+    void testTruncated();
+    void testLarge();
+
+private:
+    /** @returns the path of a temporary file with xml in it */
+    QString write( const QByteArray& xml );
+
+    QList<QTemporaryFile*> m_files;
+};
+
+
+static const char* const k_header =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<!DOCTYPE plist PUBLIC \"-//Apple Computer//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">\n"
+        "<plist version=\"1.0\">\n"
+        "<dict>\n"
+        "\t<key>Major Version</key><integer>1</integer>\n"
+        "\t<key>Application Version</key><string>11.0.2</string>\n"
+        "\t<key>Features</key><array><dict/><string>x</string></array>\n"
+        "\t<!-- not that iTunes writes comments -->\n";
+
+static const char* const k_playlists =
+        "\t<key>Playlists</key>\n"
+        "\t<array>\n"
+        "\t\t<dict>\n"
+        "\t\t\t<key>Name</key><string>Library</string>\n"
+        "\t\t\t<key>Playlist Persistent ID</key><string>AAAAAAAAAAAAAAAA</string>\n"
+        "\t\t\t<key>Playlist Items</key>\n"
+        "\t\t\t<array><dict><key>Track ID</key><integer>101</integer></dict></array>\n"
+        "\t\t</dict>\n"
+        "\t</array>\n"
+        "</dict>\n"
+        "</plist>\n";
+
+static const char* const k_track101 =
+        "\t\t<key>101</key>\n"
+        "\t\t<dict>\n"
+        "\t\t\t<key>Track ID</key><integer>101</integer>\n"
+        "\t\t\t<key>Name</key><string>Fish &amp; Chips &#233;</string>\n"
+        "\t\t\t<key>Artist</key><string>Blur</string>\n"
+        "\t\t\t<key>Album Artist</key><string/>\n"
+        "\t\t\t<key>Album</key><string>Parklife</string>\n"
+        "\t\t\t<key>Total Time</key><integer>245093</integer>\n"
+        "\t\t\t<key>Play Count</key><integer>12</integer>\n"
+        "\t\t\t<key>Play Date UTC</key><date>2013-02-01T10:20:30Z</date>\n"
+        "\t\t\t<key>Equalizer</key><dict><key>Preset</key><array><real>1.5</real></array></dict>\n"
+        "\t\t\t<key>Artwork</key><data>AAAA</data>\n"
+        "\t\t\t<key>Persistent ID</key><string>0123456789ABCDEF</string>\n"
+        "\t\t\t<key>Has Video</key><true/>\n"
+        "\t\t\t<key>Podcast</key><false/>\n"
+        "\t\t\t<key>Location</key><string>file://localhost/Users/max/Music/Blur/Parklife/01%20Girls%20&amp;%20Boys.mp3</string>\n"
+        "\t\t</dict>\n";
+
+static const char* const k_track102 =
+        "\t\t<key>102</key>\n"
+        "\t\t<dict>\n"
+        "\t\t\t<key>Track ID</key><integer>102</integer>\n"
+        "\t\t\t<key>Name</key><string>Song 2</string>\n"
+        "\t\t\t<key>Persistent ID</key><string>00000000000000FF</string>\n"
+        "\t\t\t<key>Has Video</key><true/>\n"
+        "\t\t\t<key>Music Video</key><true/>\n"
+        "\t\t\t<key>Podcast</key><true/>\n"
+        "\t\t</dict>\n";
+
+
+static QByteArray
+library( const QByteArray& tracks )
+{
+    return QByteArray( k_header ) + "\t<key>Tracks</key>\n\t<dict>\n" + tracks + "\t</dict>\n" + k_playlists;
+}
+
+
+QString
+TestITunesLibraryXml::write( const QByteArray& xml )
+{
+    QTemporaryFile* file = new QTemporaryFile;
+    file->open();
+    file->write( xml );
+    file->flush();
+    m_files << file;
+    return file->fileName();
+}
+
+
+void
+TestITunesLibraryXml::cleanup()
+{
+    qDeleteAll( m_files );
+    m_files.clear();
+}
+
+void
+TestITunesLibraryXml::testTracks()
+{
+    ITunesLibraryXml xml( write( library( QByteArray( k_track101 ) + k_track102 ) ) );
+    QVERIFY( xml.isOpen() );
+
+    ITunesLibraryXml::Track t;
+    QVERIFY( xml.next( t ) );
+    QCOMPARE( t.persistentId, QString( "0123456789ABCDEF" ) );
+    QCOMPARE( t.playCount, 12 );
+    QCOMPARE( t.playDate, QDateTime( QDate( 2013, 2, 1 ), QTime( 10, 20, 30 ), Qt::UTC ).toLocalTime() );
+    QCOMPARE( t.name, QString::fromUtf8( "Fish & Chips \xc3\xa9" ) );
+    QCOMPARE( t.artist, QString( "Blur" ) );
+    QCOMPARE( t.albumArtist, QString() );
+    QCOMPARE( t.album, QString( "Parklife" ) );
+    QCOMPARE( t.duration, 245u );
+    QCOMPARE( t.location, QString( "/Users/max/Music/Blur/Parklife/01 Girls & Boys.mp3" ) );
+    QVERIFY( t.isVideo );
+    QVERIFY( !t.isPodcast );
+
+    QVERIFY( xml.next( t ) );
+    QCOMPARE( t.persistentId, QString( "00000000000000FF" ) );
+    QCOMPARE( t.playCount, 0 );
+    QVERIFY( t.playDate.isNull() );
+    QVERIFY( !t.isVideo );
+    QVERIFY( t.isPodcast );
+
+    QVERIFY( !xml.next( t ) );
+    QVERIFY( !xml.next( t ) );
+    QVERIFY( !xml.hasError() );
+}
+
+void
+TestITunesLibraryXml::testTrackAt()
+{
+    ITunesLibraryXml xml( write( library( QByteArray( k_track101 ) + k_track102 ) ) );
+
+    ITunesLibraryXml::Track first;
+    ITunesLibraryXml::Track second;
+    QVERIFY( xml.next( first ) );
+    QVERIFY( xml.next( second ) );
+
+    // and it doesn't upset next()
+    ITunesLibraryXml::Track t;
+    QVERIFY( xml.trackAt( first.offset, t ) );
+    QCOMPARE( t.persistentId, first.persistentId );
+    QCOMPARE( t.name, first.name );
+    QCOMPARE( t.playCount, first.playCount );
+    QVERIFY( !xml.next( t ) );
+
+    QVERIFY( xml.trackAt( second.offset, t ) );
+    QCOMPARE( t.persistentId, second.persistentId );
+
+    QVERIFY( !xml.trackAt( 0, t ) );
+    QVERIFY( !xml.trackAt( -1, t ) );
+}
+
+void
+TestITunesLibraryXml::testTrackCount()
+{
+    ITunesLibraryXml xml( write( library( QByteArray( k_track101 ) + k_track102 ) ) );
+    QCOMPARE( xml.trackCount(), 2 );
+}
+
+void
+TestITunesLibraryXml::testEmptyTracks()
+{
+    ITunesLibraryXml xml( write( QByteArray( k_header ) + "\t<key>Tracks</key><dict/>\n" + k_playlists ) );
+    QVERIFY( xml.isOpen() );
+    QCOMPARE( xml.trackCount(), 0 );
+
+    ITunesLibraryXml::Track t;
+    QVERIFY( !xml.next( t ) );
+    QVERIFY( !xml.hasError() );
+}
+
+void
+TestITunesLibraryXml::testNoTracks()
+{
+    ITunesLibraryXml xml( write( QByteArray( k_header ) + k_playlists ) );
+    QVERIFY( !xml.isOpen() );
+    QVERIFY( !xml.hasError() );
+
+    ITunesLibraryXml::Track t;
+    QVERIFY( !xml.next( t ) );
+}
+
+void
+TestITunesLibraryXml::testMissingFile()
+{
+    ITunesLibraryXml xml( QDir::temp().filePath( "there is no iTunes Library.xml" ) );
+    QVERIFY( !xml.isOpen() );
+    QCOMPARE( xml.trackCount(), 0 );
+}
+
+void
+TestITunesLibraryXml::testTruncated()
+{
+    const QByteArray whole = library( QByteArray( k_track101 ) + k_track102 );
+    const int firstTrackEnd = whole.indexOf( "</dict>\n\t\t<key>102</key>" ) + 7;
+
+    for (int n = 0; n < whole.size(); n += 5)
+    {
+        ITunesLibraryXml xml( write( whole.left( n ) ) );
+
+        int count = 0;
+        ITunesLibraryXml::Track t;
+        while (xml.next( t ))
+            ++count;
+
+        QVERIFY( count <= 2 );
+        QVERIFY( xml.trackCount() <= 2 );
+        // only a whole track counts, even if the file stops after it
+        if (count)
+            QVERIFY( n >= firstTrackEnd );
+
+        cleanup();
+    }
+}
+
+void
+TestITunesLibraryXml::testLarge()
+{
+    const int N = 20000;
+
+    QByteArray tracks;
+    for (int i = 0; i < N; ++i)
+    {
+        const QByteArray id = QByteArray::number( i );
+        tracks += "\t\t<key>" + id + "</key>\n\t\t<dict>\n"
+                  "\t\t\t<key>Name</key><string>Track " + id + "</string>\n"
+                  "\t\t\t<key>Play Count</key><integer>" + QByteArray::number( i % 50 ) + "</integer>\n"
+                  "\t\t\t<key>Persistent ID</key><string>" + QByteArray::number( i, 16 ).rightJustified( 16, '0' ).toUpper() + "</string>\n"
+                  "\t\t</dict>\n";
+    }
+
+    ITunesLibraryXml xml( write( library( tracks ) ) );
+    QCOMPARE( xml.trackCount(), N );
+
+    int i = 0;
+    ITunesLibraryXml::Track t;
+    while (xml.next( t ))
+    {
+        QCOMPARE( t.playCount, i % 50 );
+        QCOMPARE( t.persistentId, QString::number( i, 16 ).rightJustified( 16, '0' ).toUpper() );
+        ++i;
+    }
+    QCOMPARE( i, N );
+    QVERIFY( !xml.hasError() );
+}
+
+
+QTEST_MAIN( TestITunesLibraryXml )
+#include "TestITunesLibraryXml.moc"
@@ -0,0 +1,197 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <QtTest>
+
+#include "PlayCountsSnapshot.h"
+
+
+class TestPlayCountsSnapshot : public QObject
+{
+    Q_OBJECT
+
+    typedef QPair<QString, int> Row;
+
+    /** 16 upper case hex digits, as iTunes writes persistent ids */
+    static QString persistentId( quint64 id )
+    {
+        return QString( "%1" ).arg( id, 16, 16, QChar( '0' ) ).toUpper();
+    }
+
+    static quint64 randomId()
+    {
+        quint64 id = 0;
+        for ( int i = 0; i < 4; ++i )
+            id = ( id << 16 ) | quint64( qrand() & 0xffff );
+        return id;
+    }
+
+    /** Inserts rows into a snapshot and into the QHash the snapshot used to
+      * be, then asks both about every row and every query. A uid is found
+      * only if the hash contains it, with what the hash's operator[] gave. */
+    static void check( const QList<Row>& rows, const QStringList& queries )
+    {
+        PlayCountsSnapshot snapshot;
+        QHash<QString, int> reference;
+        foreach ( const Row& row, rows )
+        {
+            snapshot.insert( row.first, row.second );
+            reference[row.first] = row.second;
+        }
+        snapshot.squeeze();
+
+        QCOMPARE( snapshot.count(), reference.count() );
+
+        QStringList uids = queries;
+        foreach ( const Row& row, rows )
+            uids << row.first;
+
+        foreach ( const QString& uid, uids )
+        {
+            int count = -1;
+            const bool found = snapshot.find( uid, count );
+            if ( found != reference.contains( uid ) )
+                QFAIL( qPrintable( uid + ( found ? " was found" : " wasn't found" ) ) );
+            if ( found )
+                QCOMPARE( count, reference[uid] );
+        }
+    }
+
+private slots:
+    void initTestCase()
+    {
+        qsrand( 1 );
+    }
+
+    void empty()
+    {
+        PlayCountsSnapshot snapshot;
+        snapshot.squeeze();
+        QCOMPARE( snapshot.count(), 0 );
+
+        int count = -1;
+        QVERIFY( !snapshot.find( "0123456789ABCDEF", count ) );
+        QVERIFY( !snapshot.find( "Artist\tTrack\tAlbum", count ) );
+        QVERIFY( !snapshot.find( "", count ) );
+        QCOMPARE( count, -1 );
+    }
+
+    void orderedInserts()
+    {
+        // as ORDER BY gives them, the ends of the range included
+        QList<Row> rows;
+        rows << Row( "0000000000000000", 1 )
+             << Row( "0000000000000001", 2 )
+             << Row( "00000000FFFFFFFF", 3 )
+             << Row( "0123456789ABCDEF", 4 )
+             << Row( "7FFFFFFFFFFFFFFF", 5 )
+             << Row( "8000000000000000", 6 )
+             << Row( "FFFFFFFFFFFFFFFE", 7 )
+             << Row( "FFFFFFFFFFFFFFFF", 0 );
+
+        check( rows, QStringList() << "0000000000000002" << "8000000000000001" << "FFFFFFFFFFFFFFFD" );
+    }
+
+    void unorderedInserts()
+    {
+        QList<Row> rows;
+        QStringList misses;
+        for ( int i = 0; i < 2000; ++i )
+            rows << Row( persistentId( randomId() ), qrand() % 1000 );
+        for ( int i = 0; i < 500; ++i )
+            misses << persistentId( randomId() );
+
+        check( rows, misses );
+
+        // and backwards
+        QList<Row> reversed;
+        foreach ( const Row& row, rows )
+            reversed.prepend( row );
+        check( reversed, misses );
+    }
+
+    void duplicates()
+    {
+        // the last insert wins, in order or not
+        QList<Row> rows;
+        rows << Row( "0000000000000001", 1 )
+             << Row( "0000000000000002", 2 )
+             << Row( "0000000000000002", 3 )
+             << Row( "0000000000000003", 4 );
+        check( rows, QStringList() );
+
+        rows << Row( "0000000000000001", 5 )
+             << Row( "0000000000000002", 6 )
+             << Row( "0000000000000001", 7 );
+        check( rows, QStringList() );
+
+        QList<Row> many;
+        for ( int i = 0; i < 2000; ++i )
+            many << Row( persistentId( qrand() % 100 ), i );
+        check( many, QStringList() << persistentId( 100 ) );
+    }
+
+    void fallback()
+    {
+        // anything that isn't 16 upper case hex digits is kept as it is,
+        // so different spellings of the same number are different uids
+        QList<Row> rows;
+        rows << Row( "00000000000000AB", 1 )
+             << Row( "00000000000000ab", 2 )
+             << Row( "00000000000000aB", 3 )
+             << Row( "0000000000000AB", 4 )
+             << Row( "000000000000000AB", 5 )
+             << Row( "000000000000000G", 6 )
+             << Row( "000000000000000 ", 7 )
+             << Row( "0x000000000000AB", 8 )
+             << Row( "", 9 )
+             << Row( "Artist\tTrack\tAlbum", 10 )
+             << Row( "Artist\tTrack\tAlbum", 11 )
+             << Row( QString::fromUtf8( "Bj\xc3\xb6rk\tJ\xc3\xb3ga\tHomogenic" ), 12 );
+
+        check( rows, QStringList() << "00000000000000Ab" << "000000000000AB"
+                                   << "artist\ttrack\talbum" << "Artist\tTrack" );
+    }
+
+    void misses()
+    {
+        QList<Row> rows;
+        rows << Row( "0000000000000010", 1 )
+             << Row( "0000000000000020", 2 )
+             << Row( "0000000000000030", 3 );
+
+        // below, between and above the ids, and spellings of them that
+        // aren't theirs
+        check( rows, QStringList() << "000000000000000F" << "0000000000000011"
+                                   << "000000000000002F" << "0000000000000031"
+                                   << "FFFFFFFFFFFFFFFF" << "0000000000000010 "
+                                   << " 000000000000010" << "000000000000001o" );
+
+        // a miss leaves the play count alone, the caller's default stands
+        PlayCountsSnapshot snapshot;
+        snapshot.insert( "0000000000000010", 1 );
+        snapshot.squeeze();
+        int count = -1;
+        QVERIFY( !snapshot.find( "0000000000000011", count ) );
+        QCOMPARE( count, -1 );
+    }
+};
+
+
+QTEST_MAIN( TestPlayCountsSnapshot )
+#include "TestPlayCountsSnapshot.moc"
@@ -0,0 +1,25 @@
+TEMPLATE = app
+TARGET = bench_playcounts
+LIBS += -lunicorn -llastfm
+QT = core xml sql
+CONFIG += lastfm logger
+CONFIG -= app_bundle
+include( ../../../admin/include.qmake )
+INCLUDEPATH += ..
+
+DEFINES += LASTFM_COLLAPSE_NAMESPACE
+
+# ITunesLibraryTrack is a COM wrapper on Windows, we can only make up
+# libraries of our own on the mac
+mac {
+    SOURCES = BenchPlayCounts.cpp \
+              ../PlayCountsDatabase.cpp \
+              ../PlayCountsSnapshot.cpp \
+              ../TwiddlyApplication.cpp \
+              ../ITunesLibrary_mac.cpp \
+              ../ITunesLibraryXml.cpp
+
+    HEADERS = ../PlayCountsDatabase.h \
+              ../PlayCountsSnapshot.h \
+              ../TwiddlyApplication.h
+}
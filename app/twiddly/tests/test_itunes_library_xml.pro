@@ -0,0 +1,11 @@
+TEMPLATE = app
+TARGET = test_itunes_library_xml
+QT = core testlib
+CONFIG -= app_bundle
+include( ../../../admin/include.qmake )
+INCLUDEPATH += ..
+
+SOURCES = TestITunesLibraryXml.cpp \
+          ../ITunesLibraryXml.cpp
+
+HEADERS = ../ITunesLibraryXml.h
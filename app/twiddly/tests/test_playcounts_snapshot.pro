@@ -0,0 +1,11 @@
+TEMPLATE = app
+TARGET = test_playcounts_snapshot
+QT = core testlib
+CONFIG -= app_bundle
+include( ../../../admin/include.qmake )
+INCLUDEPATH += ..
+
+SOURCES = TestPlayCountsSnapshot.cpp \
+          ../PlayCountsSnapshot.cpp
+
+HEADERS = ../PlayCountsSnapshot.h
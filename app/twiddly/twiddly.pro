@@ -17,16 +17,19 @@ DEFINES += LASTFM_COLLAPSE_NAMESPACE
 SOURCES = main.cpp \
           TwiddlyApplication.cpp \
           PlayCountsDatabase.cpp \
+          PlayCountsSnapshot.cpp \
           IPod.cpp \
           Utils.cpp
 
 HEADERS = TwiddlyApplication.h \
           PlayCountsDatabase.h \
+          PlayCountsSnapshot.h \
           IPod.h \
           Utils.h
 
 mac {
-    SOURCES += ITunesLibrary_mac.cpp
+    SOURCES += ITunesLibrary_mac.cpp \
+               ITunesLibraryXml.cpp
     OBJECTIVE_SOURCES += Utils_mac.mm
 }
 
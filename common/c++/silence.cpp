@@ -0,0 +1,356 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "silence.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define SILENCE_SSE2
+    #include <emmintrin.h>
+#endif
+
+#if defined(SILENCE_SSE2) && ( defined(__clang__) || ( defined(__GNUC__) && ( __GNUC__ > 4 || ( __GNUC__ == 4 && __GNUC_MINOR__ >= 9 ) ) ) )
+    #define SILENCE_AVX2
+    #define SILENCE_AVX2_TARGET __attribute__((target("avx2")))
+    #include <immintrin.h>
+#elif defined(SILENCE_SSE2) && defined(_MSC_VER) && _MSC_VER >= 1700
+    #define SILENCE_AVX2
+    #define SILENCE_AVX2_TARGET
+    #include <immintrin.h>
+    #include <intrin.h>
+#endif
+
+
+namespace
+{
+    // The vector versions add into 32 bit lanes, each lane gains at most
+    // 65536 per iteration, so move the lanes into a 64 bit total before
+    // they can overflow.
+    const size_t kFlushIterations = 16384;
+
+    inline int fixedToShort( int32_t f, int fracBits )
+    {
+        // see f2s() in MadSource.cpp
+        const int32_t one = int32_t( 1 ) << fracBits;
+        if ( f >= one ) return 32767;
+        if ( f <= -one ) return -32767;
+        return int16_t( f >> ( fracBits - 15 ) );
+    }
+
+    inline int absInt( int v ) { return v < 0 ? -v : v; }
+
+
+    int64_t sumScalar( const int16_t* samples, size_t frames, int channels )
+    {
+        int64_t sum = 0;
+
+        if ( channels == 1 )
+        {
+            for ( size_t j = 0 ; j < frames ; ++j )
+                sum += absInt( samples[j] );
+        }
+        else if ( channels == 2 )
+        {
+            for ( size_t j = 0 ; j < frames ; ++j )
+                sum += absInt( ( samples[2*j] >> 1 ) + ( samples[2*j+1] >> 1 ) );
+        }
+
+        return sum;
+    }
+
+    int64_t sumFixedScalar( const int32_t* left, const int32_t* right, size_t frames, int fracBits )
+    {
+        int64_t sum = 0;
+
+        if ( right )
+        {
+            for ( size_t j = 0 ; j < frames ; ++j )
+                sum += absInt( fixedToShort( ( left[j] >> 1 ) + ( right[j] >> 1 ), fracBits ) );
+        }
+        else
+        {
+            for ( size_t j = 0 ; j < frames ; ++j )
+                sum += absInt( fixedToShort( left[j], fracBits ) );
+        }
+
+        return sum;
+    }
+
+
+#ifdef SILENCE_SSE2
+    inline __m128i abs32( __m128i v )
+    {
+        __m128i sign = _mm_srai_epi32( v, 31 );
+        return _mm_sub_epi32( _mm_xor_si128( v, sign ), sign );
+    }
+
+    inline int64_t horizontal( __m128i v )
+    {
+        int32_t lanes[4];
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( lanes ), v );
+        return int64_t( lanes[0] ) + lanes[1] + lanes[2] + lanes[3];
+    }
+
+    int64_t sumSse2( const int16_t* samples, size_t frames, int channels )
+    {
+        if ( channels != 1 && channels != 2 )
+            return 0;
+
+        const size_t count = frames * channels;
+        const __m128i ones = _mm_set1_epi16( 1 );
+
+        int64_t sum = 0;
+        __m128i acc = _mm_setzero_si128();
+        size_t i = 0;
+        size_t iterations = 0;
+
+        for ( ; i + 8 <= count ; i += 8 )
+        {
+            __m128i x = _mm_loadu_si128( reinterpret_cast<const __m128i*>( samples + i ) );
+
+            if ( channels == 2 )
+            {
+                // (l >> 1) + (r >> 1) for four frames
+                acc = _mm_add_epi32( acc, abs32( _mm_madd_epi16( _mm_srai_epi16( x, 1 ), ones ) ) );
+            }
+            else
+            {
+                __m128i lo = _mm_srai_epi32( _mm_unpacklo_epi16( x, x ), 16 );
+                __m128i hi = _mm_srai_epi32( _mm_unpackhi_epi16( x, x ), 16 );
+                acc = _mm_add_epi32( acc, _mm_add_epi32( abs32( lo ), abs32( hi ) ) );
+            }
+
+            if ( ++iterations == kFlushIterations )
+            {
+                sum += horizontal( acc );
+                acc = _mm_setzero_si128();
+                iterations = 0;
+            }
+        }
+
+        return sum + horizontal( acc ) + sumScalar( samples + i, ( count - i ) / channels, channels );
+    }
+
+    inline __m128i fixedToShortSse2( __m128i v, __m128i shift, __m128i one, __m128i minusOne )
+    {
+        const __m128i max = _mm_set1_epi32( 32767 );
+        const __m128i min = _mm_set1_epi32( -32767 );
+
+        __m128i s = _mm_sra_epi32( v, shift );
+        __m128i high = _mm_cmpgt_epi32( v, _mm_sub_epi32( one, _mm_set1_epi32( 1 ) ) );    // v >= one
+        __m128i low = _mm_cmplt_epi32( v, _mm_add_epi32( minusOne, _mm_set1_epi32( 1 ) ) ); // v <= -one
+
+        s = _mm_or_si128( _mm_andnot_si128( high, s ), _mm_and_si128( high, max ) );
+        return _mm_or_si128( _mm_andnot_si128( low, s ), _mm_and_si128( low, min ) );
+    }
+
+    int64_t sumFixedSse2( const int32_t* left, const int32_t* right, size_t frames, int fracBits )
+    {
+        const __m128i shift = _mm_cvtsi32_si128( fracBits - 15 );
+        const __m128i one = _mm_set1_epi32( int32_t( 1 ) << fracBits );
+        const __m128i minusOne = _mm_sub_epi32( _mm_setzero_si128(), one );
+
+        int64_t sum = 0;
+        __m128i acc = _mm_setzero_si128();
+        size_t j = 0;
+        size_t iterations = 0;
+
+        for ( ; j + 4 <= frames ; j += 4 )
+        {
+            __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( left + j ) );
+
+            if ( right )
+            {
+                __m128i r = _mm_loadu_si128( reinterpret_cast<const __m128i*>( right + j ) );
+                v = _mm_add_epi32( _mm_srai_epi32( v, 1 ), _mm_srai_epi32( r, 1 ) );
+            }
+
+            acc = _mm_add_epi32( acc, abs32( fixedToShortSse2( v, shift, one, minusOne ) ) );
+
+            if ( ++iterations == kFlushIterations )
+            {
+                sum += horizontal( acc );
+                acc = _mm_setzero_si128();
+                iterations = 0;
+            }
+        }
+
+        return sum + horizontal( acc ) + sumFixedScalar( left + j, right ? right + j : 0, frames - j, fracBits );
+    }
+#endif // SILENCE_SSE2
+
+
+#ifdef SILENCE_AVX2
+    SILENCE_AVX2_TARGET
+    inline int64_t horizontal256( __m256i v )
+    {
+        int32_t lanes[8];
+        _mm256_storeu_si256( reinterpret_cast<__m256i*>( lanes ), v );
+        return int64_t( lanes[0] ) + lanes[1] + lanes[2] + lanes[3]
+             + lanes[4] + lanes[5] + lanes[6] + lanes[7];
+    }
+
+    SILENCE_AVX2_TARGET
+    int64_t sumAvx2( const int16_t* samples, size_t frames, int channels )
+    {
+        if ( channels != 1 && channels != 2 )
+            return 0;
+
+        const size_t count = frames * channels;
+        const __m256i ones = _mm256_set1_epi16( 1 );
+
+        int64_t sum = 0;
+        __m256i acc = _mm256_setzero_si256();
+        size_t i = 0;
+        size_t iterations = 0;
+
+        for ( ; i + 16 <= count ; i += 16 )
+        {
+            __m256i x = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( samples + i ) );
+
+            if ( channels == 2 )
+            {
+                acc = _mm256_add_epi32( acc, _mm256_abs_epi32( _mm256_madd_epi16( _mm256_srai_epi16( x, 1 ), ones ) ) );
+            }
+            else
+            {
+                __m256i lo = _mm256_cvtepi16_epi32( _mm256_castsi256_si128( x ) );
+                __m256i hi = _mm256_cvtepi16_epi32( _mm256_extracti128_si256( x, 1 ) );
+                acc = _mm256_add_epi32( acc, _mm256_add_epi32( _mm256_abs_epi32( lo ), _mm256_abs_epi32( hi ) ) );
+            }
+
+            if ( ++iterations == kFlushIterations )
+            {
+                sum += horizontal256( acc );
+                acc = _mm256_setzero_si256();
+                iterations = 0;
+            }
+        }
+
+        return sum + horizontal256( acc ) + sumScalar( samples + i, ( count - i ) / channels, channels );
+    }
+
+    SILENCE_AVX2_TARGET
+    int64_t sumFixedAvx2( const int32_t* left, const int32_t* right, size_t frames, int fracBits )
+    {
+        const __m128i shift = _mm_cvtsi32_si128( fracBits - 15 );
+        const __m256i max = _mm256_set1_epi32( 32767 );
+        const __m256i min = _mm256_set1_epi32( -32767 );
+        const __m256i high = _mm256_set1_epi32( ( int32_t( 1 ) << fracBits ) - 1 );
+        const __m256i low = _mm256_set1_epi32( -( int32_t( 1 ) << fracBits ) + 1 );
+
+        int64_t sum = 0;
+        __m256i acc = _mm256_setzero_si256();
+        size_t j = 0;
+        size_t iterations = 0;
+
+        for ( ; j + 8 <= frames ; j += 8 )
+        {
+            __m256i v = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( left + j ) );
+
+            if ( right )
+            {
+                __m256i r = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( right + j ) );
+                v = _mm256_add_epi32( _mm256_srai_epi32( v, 1 ), _mm256_srai_epi32( r, 1 ) );
+            }
+
+            __m256i s = _mm256_sra_epi32( v, shift );
+            s = _mm256_blendv_epi8( s, max, _mm256_cmpgt_epi32( v, high ) );
+            s = _mm256_blendv_epi8( s, min, _mm256_cmpgt_epi32( low, v ) );
+            acc = _mm256_add_epi32( acc, _mm256_abs_epi32( s ) );
+
+            if ( ++iterations == kFlushIterations )
+            {
+                sum += horizontal256( acc );
+                acc = _mm256_setzero_si256();
+                iterations = 0;
+            }
+        }
+
+        return sum + horizontal256( acc ) + sumFixedScalar( left + j, right ? right + j : 0, frames - j, fracBits );
+    }
+
+    bool cpuHasAvx2()
+    {
+    #ifdef _MSC_VER
+        int info[4];
+        __cpuid( info, 0 );
+        if ( info[0] < 7 )
+            return false;
+
+        __cpuid( info, 1 );
+        const bool osxsave = ( info[2] & ( 1 << 27 ) ) != 0;
+        const bool avx = ( info[2] & ( 1 << 28 ) ) != 0;
+        if ( !osxsave || !avx || ( _xgetbv( 0 ) & 6 ) != 6 )
+            return false;
+
+        __cpuidex( info, 7, 0 );
+        return ( info[1] & ( 1 << 5 ) ) != 0;
+    #else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports( "avx2" );
+    #endif
+    }
+#endif // SILENCE_AVX2
+
+
+    typedef int64_t (*SumFunction)( const int16_t*, size_t, int );
+    typedef int64_t (*SumFixedFunction)( const int32_t*, const int32_t*, size_t, int );
+
+    struct Kernels
+    {
+        SumFunction sum;
+        SumFixedFunction sumFixed;
+
+        Kernels()
+            :sum( sumScalar ), sumFixed( sumFixedScalar )
+        {
+        #ifdef SILENCE_SSE2
+            sum = sumSse2;
+            sumFixed = sumFixedSse2;
+        #endif
+        #ifdef SILENCE_AVX2
+            if ( cpuHasAvx2() )
+            {
+                sum = sumAvx2;
+                sumFixed = sumFixedAvx2;
+            }
+        #endif
+        }
+    };
+
+    const Kernels& kernels()
+    {
+        static const Kernels k;
+        return k;
+    }
+}
+
+
+double
+silence::sum( const int16_t* samples, size_t frames, int channels )
+{
+    return static_cast<double>( kernels().sum( samples, frames, channels ) );
+}
+
+
+double
+silence::sumFixed( const int32_t* left, const int32_t* right, size_t frames, int fracBits )
+{
+    return static_cast<double>( kernels().sumFixed( left, right, frames, fracBits ) );
+}
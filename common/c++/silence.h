@@ -0,0 +1,45 @@
+/*
+   Copyright 2013 Last.fm Ltd.
+
+   This file is part of the Last.fm Desktop Application Suite.
+
+   lastfm-desktop is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   lastfm-desktop is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with lastfm-desktop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COMMON_SILENCE_H
+#define COMMON_SILENCE_H
+
+#include <cstddef>
+#include <stdint.h>
+
+/** The level measurement behind every FingerprintableSource::skipSilence.
+  *
+  * A frame is a single sample for mono and a left/right pair for stereo,
+  * where the pair is measured as abs( (l >> 1) + (r >> 1) ). A block of
+  * audio is silent if sum() < threshold * frames.
+  *
+  * SSE2 and AVX2 versions are picked at runtime when the CPU has them.
+  */
+namespace silence
+{
+    /** interleaved signed 16 bit samples, 1 or 2 channels */
+    double sum( const int16_t* samples, size_t frames, int channels );
+
+    /** libmad style planar fixed point samples with fracBits fractional
+      * bits, each clipped and converted to 16 bits first. Pass a null
+      * right for mono. */
+    double sumFixed( const int32_t* left, const int32_t* right, size_t frames, int fracBits );
+}
+
+#endif // COMMON_SILENCE_H